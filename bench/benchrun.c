@@ -0,0 +1,303 @@
+/*
+    benchmark runner, times each script's compile & run over a number of fresh states and reports the results as JSON so runs can
+    be compared across commits.
+
+    usage: benchrun [-w warmups] [-n runs] [-o out.json] script ...
+        every script is compiled & ran warmups + runs times (each time on a new state with the base libraries loaded), only the
+        last runs are measured. a synthetic "compile" benchmark that only compiles a large generated source is always included.
+        the JSON goes to stdout (or -o), a human readable summary goes to stderr. exits with 1 if any benchmark failed
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cosmo.h"
+#include "cstate.h"
+#include "cvm.h"
+#include "cbaselib.h"
+
+#define DEFAULT_WARMUPS     2
+#define DEFAULT_RUNS        10
+#define COMPILE_CORPUS_SIZE (1024 * 1024)
+
+typedef struct {
+    double min;
+    double median;
+    double p90;
+    double p99;
+    double max;
+    double mean;
+} Summary;
+
+typedef struct {
+    const char *name;
+    const char *src;
+    bool runScript; // false for compile-only benchmarks
+    bool failed;
+    double *compileTimes;
+    double *runTimes;
+} Benchmark;
+
+static const char *compileSnippet =
+    "proto Shape%d\n"
+    "    function __init(self, w, h)\n"
+    "        self.w = w\n"
+    "        self.h = h\n"
+    "    end\n"
+    "\n"
+    "    function area(self)\n"
+    "        return self.w * self.h\n"
+    "    end\n"
+    "end\n"
+    "\n"
+    "function work%d(n, ...rest)\n"
+    "    local total = 0\n"
+    "    local names = [\"a\" = 1, \"b\" = \"two\", \"c\" = [1, 2, 3]]\n"
+    "    for (var i = 0; i < n; i++) do\n"
+    "        if i %% 3 == 0 and !names.skip then\n"
+    "            total = total + Shape%d(i, n):area()\n"
+    "        elseif i > 100 then\n"
+    "            break\n"
+    "        else\n"
+    "            total = total - #names - #rest\n"
+    "        end\n"
+    "    end\n"
+    "    return function(x) return total + x end\n"
+    "end\n";
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *readFile(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        exit(74);
+    }
+
+    fseek(file, 0L, SEEK_END);
+    size_t size = ftell(file);
+    rewind(file);
+
+    char *buf = malloc(size + 1);
+    size = fread(buf, sizeof(char), size, file);
+    buf[size] = '\0';
+
+    fclose(file);
+    return buf;
+}
+
+static char *makeCompileCorpus() {
+    char *buf = malloc(COMPILE_CORPUS_SIZE + 2048);
+    size_t len = 0;
+
+    for (int i = 0; len < COMPILE_CORPUS_SIZE; i++)
+        len += sprintf(buf + len, compileSnippet, i, i, i);
+
+    return buf;
+}
+
+// "bench/scripts/recursion.cosmo" -> "recursion"
+static char *benchName(const char *path) {
+    const char *start = strrchr(path, '/');
+    start = start == NULL ? path : start + 1;
+
+    const char *end = strrchr(start, '.');
+    size_t len = end == NULL ? strlen(start) : (size_t)(end - start);
+
+    char *name = malloc(len + 1);
+    memcpy(name, start, len);
+    name[len] = '\0';
+    return name;
+}
+
+// does a single compile (& run), returns false if either failed
+static bool runOnce(Benchmark *bench, double *compileTime, double *runTime) {
+    CState *state = cosmoV_newState();
+    cosmoB_loadLibrary(state);
+    cosmoB_loadOSLib(state);
+    bool ok = true;
+
+    double start = now();
+    bool compiled = cosmoV_compileString(state, bench->src, bench->name);
+    *compileTime = now() - start;
+    *runTime = 0;
+
+    if (!compiled) {
+        cosmoV_pop(state); // pop the error
+        cosmoV_printError(state, state->error);
+        ok = false;
+    } else if (bench->runScript) {
+        start = now();
+        COSMOVMRESULT res = cosmoV_call(state, 0, 0);
+        *runTime = now() - start;
+
+        if (res != COSMOVM_OK) {
+            cosmoV_printError(state, state->error);
+            ok = false;
+        }
+    }
+
+    cosmoV_freeState(state);
+    return ok;
+}
+
+static void runBenchmark(Benchmark *bench, int warmups, int runs) {
+    double compileTime, runTime;
+
+    for (int i = 0; i < warmups + runs; i++) {
+        if (!runOnce(bench, &compileTime, &runTime)) {
+            bench->failed = true;
+            return;
+        }
+
+        if (i >= warmups) {
+            bench->compileTimes[i - warmups] = compileTime;
+            bench->runTimes[i - warmups] = runTime;
+        }
+    }
+}
+
+static int compareTimes(const void *a, const void *b) {
+    double timeA = *(const double*)a, timeB = *(const double*)b;
+    return timeA < timeB ? -1 : (timeA > timeB ? 1 : 0);
+}
+
+// nearest-rank percentile of the sorted times
+static double percentile(double *sorted, int count, double pct) {
+    int rank = (int)(pct / 100.0 * count + 0.999999);
+    if (rank < 1)
+        rank = 1;
+
+    return sorted[(rank > count ? count : rank) - 1];
+}
+
+static Summary summarize(double *times, int count) {
+    Summary sum;
+    double total = 0;
+
+    qsort(times, count, sizeof(double), compareTimes);
+    for (int i = 0; i < count; i++)
+        total += times[i];
+
+    sum.min = times[0];
+    sum.median = count % 2 == 1 ? times[count / 2] : (times[count / 2 - 1] + times[count / 2]) / 2;
+    sum.p90 = percentile(times, count, 90);
+    sum.p99 = percentile(times, count, 99);
+    sum.max = times[count - 1];
+    sum.mean = total / count;
+    return sum;
+}
+
+// times are reported in milliseconds
+static void writeSummary(FILE *out, const char *key, Summary sum) {
+    fprintf(out, "\"%s\": {\"min\": %.4f, \"median\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f, \"mean\": %.4f}", key,
+        sum.min * 1000, sum.median * 1000, sum.p90 * 1000, sum.p99 * 1000, sum.max * 1000, sum.mean * 1000);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-w warmups] [-n runs] [-o out.json] script ...\n", name);
+    exit(64);
+}
+
+int main(int argc, const char *argv[]) {
+    int warmups = DEFAULT_WARMUPS, runs = DEFAULT_RUNS;
+    const char *outPath = NULL;
+    Benchmark *benches = malloc(sizeof(Benchmark) * argc);
+    int count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "-o") == 0) {
+            if (i + 1 >= argc)
+                usage(argv[0]);
+
+            if (argv[i][1] == 'w')
+                warmups = atoi(argv[++i]);
+            else if (argv[i][1] == 'n')
+                runs = atoi(argv[++i]);
+            else
+                outPath = argv[++i];
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+        } else {
+            benches[count].name = benchName(argv[i]);
+            benches[count].src = readFile(argv[i]);
+            benches[count].runScript = true;
+            count++;
+        }
+    }
+
+    if (runs < 1 || warmups < 0)
+        usage(argv[0]);
+
+    benches[count].name = "compile";
+    benches[count].src = makeCompileCorpus();
+    benches[count].runScript = false;
+    count++;
+
+    for (int i = 0; i < count; i++) {
+        Benchmark *bench = &benches[i];
+        bench->failed = false;
+        bench->compileTimes = malloc(sizeof(double) * runs);
+        bench->runTimes = malloc(sizeof(double) * runs);
+
+        fprintf(stderr, "%-12s ", bench->name);
+        fflush(stderr);
+        runBenchmark(bench, warmups, runs);
+
+        if (bench->failed) {
+            fprintf(stderr, "FAILED\n");
+        } else {
+            // summarize sorts the times, so the printed summary is made from copies
+            double *times = bench->runScript ? bench->runTimes : bench->compileTimes;
+            double *sorted = malloc(sizeof(double) * runs);
+            memcpy(sorted, times, sizeof(double) * runs);
+
+            Summary sum = summarize(sorted, runs);
+            fprintf(stderr, "%s median %9.3f ms  p90 %9.3f ms  min %9.3f ms\n", bench->runScript ? "run    " : "compile",
+                sum.median * 1000, sum.p90 * 1000, sum.min * 1000);
+            free(sorted);
+        }
+    }
+
+    FILE *out = stdout;
+    if (outPath != NULL && (out = fopen(outPath, "w")) == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", outPath);
+        exit(74);
+    }
+
+    bool failed = false;
+    fprintf(out, "{\n  \"warmups\": %d,\n  \"runs\": %d,\n  \"unit\": \"ms\",\n  \"benchmarks\": [\n", warmups, runs);
+    for (int i = 0; i < count; i++) {
+        Benchmark *bench = &benches[i];
+        fprintf(out, "    {\"name\": \"%s\", ", bench->name);
+
+        if (bench->failed) {
+            fprintf(out, "\"failed\": true}");
+            failed = true;
+        } else {
+            writeSummary(out, "compile", summarize(bench->compileTimes, runs));
+            if (bench->runScript) {
+                fprintf(out, ", ");
+                writeSummary(out, "run", summarize(bench->runTimes, runs));
+            }
+            fprintf(out, "}");
+        }
+
+        fprintf(out, i < count - 1 ? ",\n" : "\n");
+    }
+    fprintf(out, "  ]\n}\n");
+
+    if (out != stdout)
+        fclose(out);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,461 @@
+/*
+    microbenchmarks for the data structures under the VM, drives CTable, string interning, hashString, cosmoM_reallocate &
+    cosmoM_collectGarbage directly so changes to them can be measured without the parser & VM in the way.
+
+    usage: cbench [-n ops] [filter ...]
+        runs every benchmark whose name contains one of the filters (or all of them). each benchmark gets a fresh state & is ran
+        RUNS times, the best time is reported
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cosmo.h"
+#include "cstate.h"
+#include "ctable.h"
+#include "cobj.h"
+#include "cmem.h"
+#include "carena.h"
+
+#define DEFAULT_OPS (1 << 18)
+#define RUNS        5
+#define LONG_STRING 4096
+
+// returns the seconds spent on the n operations being measured, setup isn't counted
+typedef double (*BenchFunc)(long n);
+
+typedef struct {
+    const char *name;
+    BenchFunc func;
+} Benchmark;
+
+// keeps the compiler from throwing away lookups we never look at
+static volatile long sink;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// the GC is kept frozen while we're poking at the heap, the GC benchmarks call cosmoM_collectGarbage themselves
+static CState *newState() {
+    CState *state = cosmoV_newState();
+    cosmoM_freezeGC(state);
+    return state;
+}
+
+static void freeState(CState *state) {
+    state->freezeGC = 0;
+    cosmoV_freeState(state);
+}
+
+// distinct, non-sequential number keys
+static CValue numberKey(long i) {
+    return cosmoV_newNumber((uint32_t)(i * 2654435761u));
+}
+
+static CValue *makeStringKeys(CState *state, long n) {
+    CValue *keys = malloc(sizeof(CValue) * n);
+    char buf[32];
+
+    for (long i = 0; i < n; i++)
+        keys[i] = cosmoV_newRef(cosmoO_copyString(state, buf, sprintf(buf, "key_%ld", i)));
+
+    return keys;
+}
+
+// every third key is a number, a string or a table
+static CValue *makeMixedKeys(CState *state, long n) {
+    CValue *keys = makeStringKeys(state, n);
+
+    for (long i = 0; i < n; i++) {
+        if (i % 3 == 0)
+            keys[i] = numberKey(i);
+        else if (i % 3 == 1)
+            keys[i] = cosmoV_newRef(cosmoO_newTable(state));
+    }
+
+    return keys;
+}
+
+static void fillTable(CState *state, CTable *tbl, CValue *keys, long n) {
+    for (long i = 0; i < n; i++)
+        *cosmoT_insert(state, tbl, keys[i]) = cosmoV_newNumber(i);
+}
+
+static double timeGets(CState *state, CTable *tbl, CValue *keys, long n) {
+    CValue val;
+    long found = 0;
+
+    double start = now();
+    for (long i = 0; i < n; i++)
+        found += cosmoT_get(state, tbl, keys[i], &val);
+    double elapsed = now() - start;
+
+    sink = found;
+    return elapsed;
+}
+
+// ================================================================ [TABLES] ================================================================
+
+static double tableInsert(long n, CValue *(*makeKeys)(CState*, long)) {
+    CState *state = newState();
+    CValue *keys = makeKeys(state, n);
+    CTable tbl;
+
+    cosmoT_initTable(state, &tbl, ARRAY_START);
+    double start = now();
+    fillTable(state, &tbl, keys, n);
+    double elapsed = now() - start;
+
+    cosmoT_clearTable(state, &tbl);
+    free(keys);
+    freeState(state);
+    return elapsed;
+}
+
+// if miss is true, the looked up keys aren't in the table
+static double tableGet(long n, CValue *(*makeKeys)(CState*, long), bool miss) {
+    CState *state = newState();
+    CValue *keys = makeKeys(state, n * 2);
+    CTable tbl;
+
+    cosmoT_initTable(state, &tbl, ARRAY_START);
+    fillTable(state, &tbl, keys, n);
+    double elapsed = timeGets(state, &tbl, miss ? keys + n : keys, n);
+
+    cosmoT_clearTable(state, &tbl);
+    free(keys);
+    freeState(state);
+    return elapsed;
+}
+
+static CValue *makeNumberKeys(CState *state, long n) {
+    CValue *keys = malloc(sizeof(CValue) * n);
+
+    for (long i = 0; i < n; i++)
+        keys[i] = numberKey(i);
+
+    return keys;
+}
+
+static double tableInsertNumbers(long n) { return tableInsert(n, makeNumberKeys); }
+static double tableInsertStrings(long n) { return tableInsert(n, makeStringKeys); }
+static double tableInsertMixed(long n) { return tableInsert(n, makeMixedKeys); }
+static double tableGetNumbers(long n) { return tableGet(n, makeNumberKeys, false); }
+static double tableGetStrings(long n) { return tableGet(n, makeStringKeys, false); }
+static double tableGetMixed(long n) { return tableGet(n, makeMixedKeys, false); }
+static double tableMissNumbers(long n) { return tableGet(n, makeNumberKeys, true); }
+static double tableMissStrings(long n) { return tableGet(n, makeStringKeys, true); }
+
+static double tableRemove(long n) {
+    CState *state = newState();
+    CValue *keys = makeMixedKeys(state, n);
+    CTable tbl;
+    long removed = 0;
+
+    cosmoT_initTable(state, &tbl, ARRAY_START);
+    fillTable(state, &tbl, keys, n);
+
+    double start = now();
+    for (long i = 0; i < n; i++)
+        removed += cosmoT_remove(state, &tbl, keys[i]);
+    double elapsed = now() - start;
+
+    sink = removed;
+    cosmoT_clearTable(state, &tbl);
+    free(keys);
+    freeState(state);
+    return elapsed;
+}
+
+// a sliding window of 1024 keys, every insert also removes the oldest key. stresses tombstone handling
+static double tableChurn(long n) {
+    CState *state = newState();
+    CValue *keys = makeNumberKeys(state, n + 1024);
+    CTable tbl;
+
+    cosmoT_initTable(state, &tbl, ARRAY_START);
+    fillTable(state, &tbl, keys, 1024);
+
+    double start = now();
+    for (long i = 0; i < n; i++) {
+        *cosmoT_insert(state, &tbl, keys[i + 1024]) = cosmoV_newNumber(i);
+        cosmoT_remove(state, &tbl, keys[i]);
+    }
+    double elapsed = now() - start;
+
+    cosmoT_clearTable(state, &tbl);
+    free(keys);
+    freeState(state);
+    return elapsed;
+}
+
+// ================================================================ [STRINGS] ================================================================
+
+// n null terminated strings packed into one buffer, each is 32 bytes apart
+static char *makeRawStrings(long n, size_t *lengths) {
+    char *buf = malloc(32 * n);
+
+    for (long i = 0; i < n; i++)
+        lengths[i] = sprintf(buf + 32 * i, "string_%ld", i);
+
+    return buf;
+}
+
+// if hit is true, every string is already interned
+static double internStrings(long n, bool hit) {
+    CState *state = newState();
+    size_t *lengths = malloc(sizeof(size_t) * n);
+    char *strs = makeRawStrings(n, lengths);
+    long total = 0;
+
+    if (hit) {
+        for (long i = 0; i < n; i++)
+            cosmoO_copyString(state, strs + 32 * i, lengths[i]);
+    }
+
+    double start = now();
+    for (long i = 0; i < n; i++)
+        total += cosmoO_copyString(state, strs + 32 * i, lengths[i])->length;
+    double elapsed = now() - start;
+
+    sink = total;
+    free(strs);
+    free(lengths);
+    freeState(state);
+    return elapsed;
+}
+
+static double internNew(long n) { return internStrings(n, false); }
+static double internHit(long n) { return internStrings(n, true); }
+
+static double hashStrings(long n, size_t length) {
+    char *str = malloc(length);
+    uint32_t total = 0;
+
+    for (size_t i = 0; i < length; i++)
+        str[i] = 'a' + i % 26;
+
+    double start = now();
+    for (long i = 0; i < n; i++) {
+        str[i % length] ^= 1; // so the hash can't be hoisted out of the loop
+        total += hashString(str, length);
+    }
+    double elapsed = now() - start;
+
+    sink = total;
+    free(str);
+    return elapsed;
+}
+
+static double hashShort(long n) { return hashStrings(n, 16); }
+static double hashLong(long n) { return hashStrings(n, LONG_STRING); }
+
+// ================================================================ [ALLOCATOR] ================================================================
+
+// n alloc/free pairs of mixed small sizes, like short lived objects
+static double reallocSmall(long n) {
+    CState *state = newState();
+
+    double start = now();
+    for (long i = 0; i < n; i++) {
+        size_t size = 16 + (i % 8) * 8;
+        void *buf = cosmoM_xmalloc(state, size);
+        cosmoM_reallocate(state, buf, size, 0);
+    }
+    double elapsed = now() - start;
+
+    freeState(state);
+    return elapsed;
+}
+
+// appends n values to arrays grown the same way the chunks & stacks are, an op is one append
+static double reallocGrow(long n) {
+    CState *state = newState();
+    long done = 0;
+
+    double start = now();
+    while (done < n) {
+        int capacity = ARRAY_START, count = 0;
+        CValue *buf = cosmoM_xmalloc(state, sizeof(CValue) * capacity);
+
+        for (; count < 4096 && done < n; count++, done++) {
+            cosmoM_growarray(state, CValue, buf, count, capacity);
+            buf[count] = cosmoV_newNumber(count);
+        }
+
+        cosmoM_freearray(state, CValue, buf, capacity);
+    }
+    double elapsed = now() - start;
+
+    freeState(state);
+    return elapsed;
+}
+
+// ================================================================ [STATES] ================================================================
+
+#define STATE_OBJECTS 512
+
+// short lived states, like one per request. each state gets STATE_OBJECTS tables & strings before it's thrown away, an op is
+// one of those objects (the state being made & freed included)
+static double stateLifecycle(long n, bool arena) {
+    char buf[32];
+    long done = 0;
+
+    double start = now();
+    while (done < n) {
+        CState *state = arena ? cosmoV_newArenaState(0, 0) : cosmoV_newState();
+        CObjTable *root = cosmoO_newTable(state);
+        cosmoM_addRoot(state, (CObj*)root);
+
+        for (int i = 0; i < STATE_OBJECTS && done < n; i++, done++) {
+            CValue val = i % 2 == 0
+                ? cosmoV_newRef(cosmoO_newTable(state))
+                : cosmoV_newRef(cosmoO_copyString(state, buf, sprintf(buf, "request_%d", i)));
+            *cosmoT_insert(state, &root->tbl, numberKey(i)) = val;
+        }
+
+        cosmoV_freeState(state);
+    }
+    double elapsed = now() - start;
+
+    return elapsed;
+}
+
+static double stateLibc(long n) { return stateLifecycle(n, false); }
+static double stateArena(long n) { return stateLifecycle(n, true); }
+
+// ================================================================ [GC] ================================================================
+
+// n/2 rooted tables, each holding a string & a few numbers, an op is one live object being marked
+static double gcMark(long n) {
+    CState *state = newState();
+    CObjTable *root = cosmoO_newTable(state);
+    char buf[32];
+
+    cosmoM_addRoot(state, (CObj*)root);
+    for (long i = 0; i < n / 2; i++) {
+        CObjTable *tbl = cosmoO_newTable(state);
+        *cosmoT_insert(state, &root->tbl, cosmoV_newNumber(i)) = cosmoV_newRef(tbl);
+
+        for (int j = 0; j < 3; j++)
+            *cosmoT_insert(state, &tbl->tbl, cosmoV_newNumber(j)) = cosmoV_newNumber(i + j);
+        *cosmoT_insert(state, &tbl->tbl, cosmoV_newNumber(3)) = cosmoV_newRef(cosmoO_copyString(state, buf, sprintf(buf, "live_%ld", i)));
+    }
+
+    // the first cycle also frees whatever cosmoV_newState left behind, so it isn't timed
+    cosmoM_collectGarbage(state);
+
+    double start = now();
+    cosmoM_collectGarbage(state);
+    double elapsed = now() - start;
+
+    cosmoM_removeRoot(state, (CObj*)root);
+    freeState(state);
+    return elapsed;
+}
+
+// n unreachable tables & strings, an op is one object being swept
+static double gcSweep(long n) {
+    CState *state = newState();
+    char buf[32];
+
+    for (long i = 0; i < n; i++) {
+        if (i % 2 == 0)
+            cosmoO_newTable(state);
+        else
+            cosmoO_copyString(state, buf, sprintf(buf, "garbage_%ld", i));
+    }
+
+    double start = now();
+    cosmoM_collectGarbage(state);
+    double elapsed = now() - start;
+
+    freeState(state);
+    return elapsed;
+}
+
+// ================================================================ [RUNNER] ================================================================
+
+static Benchmark benchmarks[] = {
+    {"table.insert.numbers", tableInsertNumbers},
+    {"table.insert.strings", tableInsertStrings},
+    {"table.insert.mixed", tableInsertMixed},
+    {"table.get.numbers", tableGetNumbers},
+    {"table.get.strings", tableGetStrings},
+    {"table.get.mixed", tableGetMixed},
+    {"table.miss.numbers", tableMissNumbers},
+    {"table.miss.strings", tableMissStrings},
+    {"table.remove.mixed", tableRemove},
+    {"table.churn", tableChurn},
+    {"string.intern.new", internNew},
+    {"string.intern.hit", internHit},
+    {"string.hash.short", hashShort},
+    {"string.hash.long", hashLong},
+    {"mem.realloc.small", reallocSmall},
+    {"mem.realloc.grow", reallocGrow},
+    {"state.libc", stateLibc},
+    {"state.arena", stateArena},
+    {"gc.mark", gcMark},
+    {"gc.sweep", gcSweep},
+    {NULL, NULL}
+};
+
+static bool matches(const char *name, int filterCount, const char **filters) {
+    if (filterCount == 0)
+        return true;
+
+    for (int i = 0; i < filterCount; i++) {
+        if (strstr(name, filters[i]) != NULL)
+            return true;
+    }
+
+    return false;
+}
+
+int main(int argc, const char *argv[]) {
+    const char **filters = malloc(sizeof(char*) * argc);
+    int filterCount = 0;
+    long ops = DEFAULT_OPS;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            ops = atol(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [-n ops] [filter ...]\n", argv[0]);
+            return 64;
+        } else {
+            filters[filterCount++] = argv[i];
+        }
+    }
+
+    if (ops < 2) {
+        fprintf(stderr, "need at least 2 ops per benchmark\n");
+        return 64;
+    }
+
+    for (Benchmark *bench = benchmarks; bench->name != NULL; bench++) {
+        if (!matches(bench->name, filterCount, filters))
+            continue;
+
+        double best = 0;
+        for (int i = 0; i < RUNS; i++) {
+            double elapsed = bench->func(ops);
+
+            if (i == 0 || elapsed < best)
+                best = elapsed;
+        }
+
+        printf("%-24s %10ld ops  %10.2f ns/op  %10.2f Mops/s\n", bench->name, ops, best * 1e9 / ops, ops / best / 1e6);
+    }
+
+    free(filters);
+    return 0;
+}
@@ -0,0 +1,163 @@
+/*
+    lexer throughput benchmark, reports how many MB/s cosmoL_scanToken gets through.
+
+    usage: lexbench [file ...]
+        with no files a synthetic corpus is generated, otherwise the passed scripts are lexed. each source is lexed both from
+        memory & streamed through a CosmoReader
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cosmo.h"
+#include "cstate.h"
+#include "clex.h"
+#include "cmem.h"
+
+#define CORPUS_SIZE (8 * 1024 * 1024)
+#define RUNS        20
+#define BLOCK_SIZE  4096
+
+static const char *snippet =
+    "// generated chunk %d\n"
+    "proto Vector%d\n"
+    "    function __init(self, x, y)\n"
+    "        self.x = x\n"
+    "        self.y = y\n"
+    "    end\n"
+    "\n"
+    "    function length(self)\n"
+    "        return math.sqrt(self.x * self.x + self.y * self.y)\n"
+    "    end\n"
+    "end\n"
+    "\n"
+    "local config_%d = [\"name\" = \"entry \\x41 %d\", \"weight\" = %d.25, \"mask\" = 0xFF, \"flags\" = 0b1011]\n"
+    "for (var i = 0; i < %d; i++) do\n"
+    "    if i %% 2 == 0 and not config_%d.disabled then\n"
+    "        total = total + i\n"
+    "    elseif i > 10 or false then\n"
+    "        break\n"
+    "    else\n"
+    "        continue\n"
+    "    end\n"
+    "end\n"
+    "/* a multiline\n   comment */\n";
+
+static char *makeCorpus(size_t *size) {
+    char *buf = malloc(CORPUS_SIZE + 1024);
+    size_t len = 0;
+
+    for (int i = 0; len < CORPUS_SIZE; i++)
+        len += sprintf(buf + len, snippet, i, i, i, i, i, i, i);
+
+    *size = len;
+    return buf;
+}
+
+static char *readFile(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        exit(74);
+    }
+
+    fseek(file, 0L, SEEK_END);
+    *size = ftell(file);
+    rewind(file);
+
+    char *buf = malloc(*size + 1);
+    *size = fread(buf, sizeof(char), *size, file);
+    buf[*size] = '\0';
+
+    fclose(file);
+    return buf;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    const char *src;
+    size_t size;
+} BlockReader;
+
+// hands out the source in BLOCK_SIZE chunks, like a file would
+static const char *readBlock(CState *state, void *ud, size_t *size) {
+    BlockReader *reader = (BlockReader*)ud;
+
+    *size = reader->size < BLOCK_SIZE ? reader->size : BLOCK_SIZE;
+    const char *block = reader->src;
+
+    reader->src += *size;
+    reader->size -= *size;
+    return block;
+}
+
+// lexes the whole source, returns the # of tokens
+static long lexAll(CState *state, const char *src, size_t size, bool streamed) {
+    BlockReader reader = {src, size};
+    CLexState *lex = streamed ? cosmoL_newStreamLexState(state, readBlock, &reader) : cosmoL_newLexState(state, src);
+    long tokens = 0;
+    CToken tok;
+
+    do {
+        tok = cosmoL_scanToken(lex);
+        tokens++;
+    } while (tok.type != TOKEN_EOF && tok.type != TOKEN_ERROR);
+
+    if (tok.type == TOKEN_ERROR)
+        fprintf(stderr, "lex error on line %d: %.*s\n", tok.line, tok.length, tok.start);
+
+    cosmoL_freeLexState(state, lex);
+    return tokens;
+}
+
+static void bench(CState *state, const char *name, const char *src, size_t size, bool streamed) {
+    double best = 0;
+    long tokens = 0;
+
+    for (int i = 0; i < RUNS; i++) {
+        double start = now();
+        tokens = lexAll(state, src, size, streamed);
+        double elapsed = now() - start;
+
+        if (i == 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    printf("%-32s %-9s %8.2f MB  %10ld tokens  %8.2f MB/s\n", name, streamed ? "streamed" : "string", size / (1024.0 * 1024.0), tokens, size / (1024.0 * 1024.0) / best);
+}
+
+int main(int argc, const char *argv[]) {
+    CState *state = cosmoV_newState();
+    size_t size;
+
+    // streamed identifiers are interned, the compiler normally keeps the GC frozen while they're in use
+    cosmoM_freezeGC(state);
+
+    if (argc == 1) {
+        char *corpus = makeCorpus(&size);
+        bench(state, "<synthetic>", corpus, size, false);
+        bench(state, "<synthetic>", corpus, size, true);
+        free(corpus);
+    } else {
+        for (int i = 1; i < argc; i++) {
+            char *src = readFile(argv[i], &size);
+            bench(state, argv[i], src, size, false);
+            bench(state, argv[i], src, size, true);
+            free(src);
+        }
+    }
+
+    cosmoM_unfreezeGC(state);
+    cosmoV_freeState(state);
+    return 0;
+}
@@ -1,13 +1,29 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "cosmo.h"
 #include "cchunk.h"
 #include "cdebug.h"
 #include "cvm.h"
 #include "cparse.h"
 #include "cbaselib.h"
+#include "cproto.h"
+#include "cprofile.h"
+#include "cloop.h"
+#include "cworker.h"
 
 #include "cmem.h"
 
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_COMPILE_WORKERS 64
+#define PROFILE_INTERVAL    1000 // microseconds between profiler samples
+
 static bool _ACTIVE = false;
+static char *cacheDir = NULL; // where compiled scripts are cached, NULL if the cache is disabled
+static FILE *profileOut = NULL; // where the folded stacks go, NULL unless --profile was passed
 
 int cosmoB_quitRepl(CState *state, int nargs, CValue *args) {
     _ACTIVE = false;
@@ -31,12 +47,13 @@ int cosmoB_input(CState *state, int nargs, CValue *args) {
     return 1; // 1 return value
 }
 
-static void interpret(CState *state, const char *script, const char *mod) {
-    // cosmoV_compileString pushes the result onto the stack (COBJ_ERROR or COBJ_CLOSURE)
-    if (cosmoV_compileString(state, script, mod)) {        
+// runs the <closure> compiled by cosmoV_compileString or cosmoV_load, or prints the <error> if it failed
+static void run(CState *state, bool compiled) {
+    if (compiled) {
         COSMOVMRESULT res = cosmoV_call(state, 0, 0); // 0 args being passed, 0 results expected
 
-        if (res == COSMOVM_RUNTIME_ERR)
+        // then whatever the script spawned on the event loop runs until it's done
+        if (res == COSMOVM_RUNTIME_ERR || !cosmoE_run(state))
             cosmoV_printError(state, state->error);
     } else {
         cosmoV_pop(state); // pop the error off the stack
@@ -46,11 +63,41 @@ static void interpret(CState *state, const char *script, const char *mod) {
     state->panic = false; // so our repl isn't broken
 }
 
+// same as run, but scripts are profiled if --profile was passed
+static void runScript(CState *state, bool compiled) {
+    if (profileOut == NULL) {
+        run(state, compiled);
+        return;
+    }
+
+    cosmoV_startProfiler(state, PROFILE_INTERVAL);
+    run(state, compiled);
+    cosmoV_stopProfiler(state);
+    cosmoV_writeProfile(state, profileOut);
+}
+
+static void interpret(CState *state, const char *script, const char *mod) {
+    // cosmoV_compileString pushes the result onto the stack (COBJ_ERROR or COBJ_CLOSURE)
+    run(state, cosmoV_compileString(state, script, mod));
+}
+
+// cosmoV_newState only fails if we're out of memory, there's not much else we can do
+static CState *newState() {
+    CState *state = cosmoV_newState();
+
+    if (state == NULL) {
+        CERROR("failed to allocate memory!");
+        exit(1);
+    }
+
+    return state;
+}
+
 static void repl() {
     char line[1024];
     _ACTIVE = true;
 
-    CState *state = cosmoV_newState();
+    CState *state = newState();
     cosmoB_loadLibrary(state);
     cosmoB_loadOSLib(state);
     cosmoB_loadVM(state);
@@ -78,64 +125,458 @@ static void repl() {
     cosmoV_freeState(state);
 }
 
-static char *readFile(const char* path) {
-    FILE* file = fopen(path, "rb");
-    if (file == NULL) {
-        fprintf(stderr, "Could not open file \"%s\".\n", path);
-        exit(74);
+typedef struct {
+    FILE *file;
+    char buf[BUFSIZ];
+} FileReader;
+
+// CosmoReader for scripts, so they're compiled as they're read instead of being loaded all at once
+static const char *readFileBlock(CState *state, void *ud, size_t *size) {
+    FileReader *reader = (FileReader*)ud;
+
+    *size = fread(reader->buf, sizeof(char), sizeof(reader->buf), reader->file);
+    return *size > 0 ? reader->buf : NULL;
+}
+
+// makes a state for running a script file
+static CState *newFileState() {
+    CState *state = newState();
+    cosmoB_loadLibrary(state);
+    cosmoB_loadOSLib(state);
+    cosmoB_loadIOLib(state);
+    cosmoB_loadWorkerLib(state);
+
+    // add our input() function to the global table
+    cosmoV_pushString(state, "input");
+    cosmoV_pushCFunction(state, cosmoB_input);
+
+    cosmoV_register(state, 1);
+    return state;
+}
+
+// ================================================================ [COMPILE CACHE] ================================================================
+
+// mkdir -p, returns false if path couldn't be made
+static bool makeDirs(char *path) {
+    for (char *c = path + 1; *c != '\0'; c++) {
+        if (*c != '/')
+            continue;
+
+        *c = '\0';
+        bool made = mkdir(path, 0755) == 0 || errno == EEXIST;
+        *c = '/';
+
+        if (!made)
+            return false;
     }
 
-    // first, we need to know how big our file is
-    fseek(file, 0L, SEEK_END);
-    size_t fileSize = ftell(file);
-    rewind(file);
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
 
-    char *buffer = (char*)malloc(fileSize + 1); // make room for the null byte
-    if (buffer == NULL) {
-        fprintf(stderr, "failed to allocate!");
-        exit(1);
+// picks COSMO_CACHE_DIR, $XDG_CACHE_HOME/cosmo or ~/.cache/cosmo (in that order). an empty COSMO_CACHE_DIR disables the cache
+static char *findCacheDir() {
+    const char *env = getenv("COSMO_CACHE_DIR");
+    char *dir;
+
+    if (env != NULL) {
+        if (*env == '\0')
+            return NULL;
+
+        dir = strdup(env);
+    } else if ((env = getenv("XDG_CACHE_HOME")) != NULL && *env != '\0') {
+        if ((dir = malloc(strlen(env) + sizeof("/cosmo"))) != NULL)
+            sprintf(dir, "%s/cosmo", env);
+    } else if ((env = getenv("HOME")) != NULL && *env != '\0') {
+        if ((dir = malloc(strlen(env) + sizeof("/.cache/cosmo"))) != NULL)
+            sprintf(dir, "%s/.cache/cosmo", env);
+    } else {
+        return NULL;
     }
 
-    size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
+    // no memory for the path just runs without the cache
+    if (dir == NULL)
+        return NULL;
 
-    if (bytesRead < fileSize) {
-        printf("failed to read file \"%s\"!\n", path);
-        exit(74);
+    if (!makeDirs(dir)) {
+        free(dir);
+        return NULL;
+    }
+
+    return dir;
+}
+
+// reads the whole file into a malloc'd buffer, returns NULL if it couldn't be opened or we ran out of memory
+static char *readFile(const char *fileName, size_t *size) {
+    FILE *file = fopen(fileName, "rb");
+    if (file == NULL)
+        return NULL;
+
+    size_t capacity = BUFSIZ;
+    char *buf = malloc(capacity + 1);
+    *size = 0;
+
+    if (buf == NULL) {
+        fclose(file);
+        return NULL;
+    }
+
+    size_t read;
+    while ((read = fread(buf + *size, sizeof(char), capacity - *size, file)) > 0) {
+        *size += read;
+
+        if (*size == capacity) {
+            char *newBuf = realloc(buf, capacity * 2 + 1);
+            if (newBuf == NULL) {
+                free(buf);
+                fclose(file);
+                return NULL;
+            }
+
+            buf = newBuf;
+            capacity *= 2;
+        }
     }
-    
-    buffer[bytesRead] = '\0'; // place our null terminator
 
-    // close the file handler and return the script buffer
+    buf[*size] = '\0';
     fclose(file);
-    return buffer;
+    return buf;
+}
+
+// returns NULL if we ran out of memory, the cache is skipped (a miss, or the entry just isn't written)
+static char *cachePath(uint64_t key) {
+    char *path = malloc(strlen(cacheDir) + sizeof("/0123456789abcdef.cbc"));
+    if (path != NULL)
+        sprintf(path, "%s/%016llx.cbc", cacheDir, (unsigned long long)key);
+
+    return path;
+}
+
+static CProto *readCache(uint64_t key) {
+    char *path = cachePath(key);
+    if (path == NULL)
+        return NULL;
+
+    size_t size;
+    char *buf = readFile(path, &size);
+    free(path);
+
+    if (buf == NULL)
+        return NULL;
+
+    // a stale or corrupt entry is just a miss, it'll be overwritten
+    CProto *proto = cosmoP_undumpProto(buf, size, key);
+    free(buf);
+    return proto;
+}
+
+// the dump is written to a temp file & renamed into place, so other cosmo processes never see half an entry
+static void writeCache(uint64_t key, CProto *proto) {
+    char *tmpPath = malloc(strlen(cacheDir) + sizeof("/.tmp-XXXXXX"));
+    if (tmpPath == NULL)
+        return;
+
+    sprintf(tmpPath, "%s/.tmp-XXXXXX", cacheDir);
+
+    int fd = mkstemp(tmpPath);
+    if (fd == -1) {
+        free(tmpPath);
+        return;
+    }
+
+    size_t size;
+    char *buf = cosmoP_dumpProto(proto, key, &size);
+    if (buf == NULL) {
+        close(fd);
+        remove(tmpPath);
+        free(tmpPath);
+        return;
+    }
+
+    FILE *file = fdopen(fd, "wb");
+    bool wrote = file != NULL && fwrite(buf, sizeof(char), size, file) == size;
+    wrote = (file != NULL ? fclose(file) == 0 : close(fd) == 0) && wrote;
+    free(buf);
+
+    char *path = wrote ? cachePath(key) : NULL;
+    if (path == NULL || rename(tmpPath, path) != 0)
+        remove(tmpPath);
+
+    free(path);
+    free(tmpPath);
+}
+
+// compiles src (read from fileName) into a proto, going through the cache if it's enabled. key is src's cosmoP_hashSource.
+// returns NULL if we ran out of memory
+static CProto *compileSource(const char *src, uint64_t key, const char *fileName) {
+    CProto *proto = cacheDir != NULL ? readCache(key) : NULL;
+
+    if (proto == NULL) {
+        proto = cosmoP_compileProto(src, fileName);
+
+        // errors aren't cached, so they're always reported against the current source
+        if (cacheDir != NULL && proto != NULL && proto->error == NULL)
+            writeCache(key, proto);
+    }
+
+    return proto;
+}
+
+// same as newState, if we couldn't compile the script for lack of memory there's not much else we can do
+static CProto *checkProto(CProto *proto) {
+    if (proto == NULL) {
+        CERROR("failed to allocate memory!");
+        exit(1);
+    }
+
+    return proto;
+}
+
+// compiles fileName into a proto, going through the cache if it's enabled. returns NULL if the file couldn't be opened
+static CProto *compileFile(const char *fileName) {
+    if (cacheDir == NULL) {
+        FileReader reader;
+        reader.file = fopen(fileName, "rb");
+        if (reader.file == NULL)
+            return NULL;
+
+        CProto *proto = checkProto(cosmoP_compileProtoReader(readFileBlock, &reader, fileName));
+        fclose(reader.file);
+        return proto;
+    }
+
+    // the source has to be hashed before we know if it needs to be parsed, so it's read all at once
+    size_t size;
+    char *src = readFile(fileName, &size);
+    if (src == NULL)
+        return NULL;
+
+    CProto *proto = checkProto(compileSource(src, cosmoP_hashSource(src, size, fileName), fileName));
+    free(src);
+    return proto;
+}
+
+// ================================================================ [RUNNING] ================================================================
+
+// runs a proto made by compileFile on a fresh state
+static void runProto(CProto *proto) {
+    CState *state = newFileState();
+
+    // cosmoV_loadProto pushes the result onto the stack (COBJ_ERROR or COBJ_CLOSURE)
+    runScript(state, cosmoV_loadProto(state, proto));
+
+    cosmoV_freeState(state);
 }
 
 static void runFile(const char* fileName) {
-    char* script = readFile(fileName);
-    CState *state = cosmoV_newState();
-    cosmoB_loadLibrary(state);
-    cosmoB_loadOSLib(state);
+    if (cacheDir != NULL) {
+        CProto *proto = compileFile(fileName);
+        if (proto == NULL) {
+            fprintf(stderr, "Could not open file \"%s\".\n", fileName);
+            exit(74);
+        }
 
-    // add our input() function to the global table
-    cosmoV_pushString(state, "input");
-    cosmoV_pushCFunction(state, cosmoB_input);
+        runProto(proto);
+        cosmoP_freeProto(proto);
+        return;
+    }
 
-    cosmoV_register(state, 1);
+    FileReader reader;
+    reader.file = fopen(fileName, "rb");
+    if (reader.file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", fileName);
+        exit(74);
+    }
+
+    CState *state = newFileState();
 
-    interpret(state, script, fileName);
+    // cosmoV_load pushes the result onto the stack (COBJ_ERROR or COBJ_CLOSURE)
+    bool compiled = cosmoV_load(state, readFileBlock, &reader, fileName);
+    fclose(reader.file);
+    runScript(state, compiled);
 
     cosmoV_freeState(state);
-    free(script);
+}
+
+typedef struct {
+    const char **files;
+    CProto **protos; // NULL if the file couldn't be opened (or we ran out of memory), it's tried again when it's ran
+    uint64_t *keys; // cosmoP_hashSource of the source each proto was compiled from
+    bool *ready; // set once the file has been compiled (or couldn't be opened)
+    int count;
+    int next; // next file to compile
+    pthread_mutex_t lock;
+    pthread_cond_t compiled; // broadcast every time a file is ready
+    pthread_t threads[MAX_COMPILE_WORKERS];
+    int started;
+} CompileQueue;
+
+static void *compileWorker(void *ud) {
+    CompileQueue *queue = (CompileQueue*)ud;
+
+    while (true) {
+        pthread_mutex_lock(&queue->lock);
+        int i = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (i >= queue->count)
+            return NULL;
+
+        // protos don't belong to a state, so each file can be compiled on whichever thread gets to it. if the file couldn't be
+        // opened it's reported when it's ran
+        size_t size;
+        char *src = readFile(queue->files[i], &size);
+        CProto *proto = NULL;
+        uint64_t key = 0;
+
+        if (src != NULL) {
+            key = cosmoP_hashSource(src, size, queue->files[i]);
+            proto = compileSource(src, key, queue->files[i]);
+            free(src);
+        }
+
+        pthread_mutex_lock(&queue->lock);
+        queue->protos[i] = proto;
+        queue->keys[i] = key;
+        queue->ready[i] = true;
+        pthread_cond_broadcast(&queue->compiled);
+        pthread_mutex_unlock(&queue->lock);
+    }
+}
+
+// drops the files that haven't started compiling yet, waits for the rest & frees every proto that wasn't ran
+static void closeQueue(CompileQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->next = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+
+    for (int i = 0; i < queue->started; i++)
+        pthread_join(queue->threads[i], NULL);
+
+    for (int i = 0; i < queue->count; i++) {
+        if (queue->protos[i] != NULL)
+            cosmoP_freeProto(queue->protos[i]);
+    }
+
+    pthread_cond_destroy(&queue->compiled);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->protos);
+    free(queue->keys);
+    free(queue->ready);
+}
+
+/*
+    compiles the files in the background & runs them in order (each on their own state), each one as soon as it's compiled.
+    this has to behave exactly like running them one after another: a script can write (or delete) a file that's ran after
+    it, so every file is read again when its turn comes & recompiled if it changed since it was compiled ahead of time
+*/
+static void runFiles(const char **files, int count) {
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers > count - 1)
+        workers = count - 1; // we compile whichever file the workers haven't gotten to yet, starting with the first
+    if (workers > MAX_COMPILE_WORKERS)
+        workers = MAX_COMPILE_WORKERS;
+
+    CompileQueue queue;
+    queue.files = files;
+    queue.protos = calloc(count, sizeof(CProto*));
+    queue.keys = calloc(count, sizeof(uint64_t));
+    queue.ready = calloc(count, sizeof(bool));
+    queue.count = count;
+    queue.next = 0;
+    queue.started = 0;
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.compiled, NULL);
+
+    while (queue.started < workers && pthread_create(&queue.threads[queue.started], NULL, compileWorker, &queue) == 0)
+        queue.started++;
+
+    // going through protos costs an extra copy, so it's only worth it if something can compile alongside us
+    if (queue.started == 0) {
+        closeQueue(&queue);
+
+        for (int i = 0; i < count; i++)
+            runFile(files[i]);
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        pthread_mutex_lock(&queue.lock);
+
+        // nobody's gotten to it yet, so compiling it ourselves beats waiting
+        bool claimed = queue.next <= i;
+        if (claimed)
+            queue.next = i + 1;
+
+        while (!claimed && !queue.ready[i])
+            pthread_cond_wait(&queue.compiled, &queue.lock);
+
+        CProto *proto = queue.protos[i];
+        uint64_t compiledKey = queue.keys[i];
+        queue.protos[i] = NULL;
+        pthread_mutex_unlock(&queue.lock);
+
+        size_t size;
+        char *src = readFile(files[i], &size);
+        if (src == NULL) {
+            if (proto != NULL)
+                cosmoP_freeProto(proto);
+
+            closeQueue(&queue);
+            fprintf(stderr, "Could not open file \"%s\".\n", files[i]);
+            exit(74);
+        }
+
+        uint64_t key = cosmoP_hashSource(src, size, files[i]);
+        if (proto == NULL || key != compiledKey) {
+            if (proto != NULL)
+                cosmoP_freeProto(proto);
+
+            proto = checkProto(compileSource(src, key, files[i]));
+        }
+
+        free(src);
+        runProto(proto);
+        cosmoP_freeProto(proto);
+    }
+
+    closeQueue(&queue);
 }
 
 int main(int argc, const char *argv[]) {
-    if (argc == 1) {
+    bool useCache = true;
+    int fileCount = 0;
+
+    // pull the flags out, leaving just the files in argv
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--no-cache") == 0) {
+            useCache = false;
+        } else if (strncmp(argv[i], "--profile=", 10) == 0) {
+            if (profileOut != NULL)
+                fclose(profileOut);
+
+            profileOut = fopen(argv[i] + 10, "w");
+            if (profileOut == NULL) {
+                fprintf(stderr, "Could not open file \"%s\".\n", argv[i] + 10);
+                exit(74);
+            }
+        } else
+            argv[++fileCount] = argv[i];
+    }
+
+    if (useCache && fileCount > 0)
+        cacheDir = findCacheDir();
+
+    if (fileCount == 0) {
         repl();
-    } else if (argc >= 2) { // they passed a file (or more lol)
-        for (int i = 1; i < argc; i++) {
-            runFile(argv[i]);
-        }
+    } else if (fileCount == 1) {
+        runFile(argv[1]);
+    } else { // they passed more than one file, so compile them all at once
+        runFiles(argv + 1, fileCount);
     }
 
+    free(cacheDir);
+    if (profileOut != NULL)
+        fclose(profileOut);
+
     return 0;
 }
@@ -0,0 +1,143 @@
+#include "carena.h"
+
+#include <string.h>
+
+// buffers are aligned the same as malloc'd ones would be on anything we care about
+#define ARENA_ALIGN 16
+
+typedef struct CArenaBlock {
+    struct CArenaBlock *next;
+    size_t size; // usable bytes
+    size_t used;
+} CArenaBlock;
+
+struct CArena {
+    CArenaBlock *head; // the block being bumped, blocks holding a single big allocation are kept behind it
+    char *last; // the last allocation made from head, it's the only one that can be resized in place
+    size_t blockSize;
+    size_t limit;
+    size_t reserved;
+};
+
+static inline size_t alignUp(size_t sz) {
+    return (sz + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static inline char *blockData(CArenaBlock *block) {
+    return (char*)block + alignUp(sizeof(CArenaBlock));
+}
+
+static CArenaBlock *newBlock(CArena *arena, size_t size) {
+    size_t total = alignUp(sizeof(CArenaBlock)) + size;
+
+    if (arena->limit != 0 && arena->reserved + total > arena->limit)
+        return NULL;
+
+    CArenaBlock *block = malloc(total);
+    if (block == NULL)
+        return NULL;
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    arena->reserved += total;
+    return block;
+}
+
+// size should already be aligned
+static void *bump(CArena *arena, size_t size) {
+    CArenaBlock *head = arena->head;
+
+    if (head != NULL && head->size - head->used >= size) {
+        arena->last = blockData(head) + head->used;
+        head->used += size;
+        return arena->last;
+    }
+
+    // big allocations get a block of their own, so what's left of head isn't thrown away
+    if (head != NULL && size > arena->blockSize / 4) {
+        CArenaBlock *block = newBlock(arena, size);
+        if (block == NULL)
+            return NULL;
+
+        block->used = size;
+        block->next = head->next;
+        head->next = block;
+        return blockData(block);
+    }
+
+    CArenaBlock *block = newBlock(arena, size > arena->blockSize ? size : arena->blockSize);
+    if (block == NULL)
+        return NULL;
+
+    block->next = head;
+    block->used = size;
+    arena->head = block;
+    arena->last = blockData(block);
+    return arena->last;
+}
+
+COSMO_API CArena *cosmoM_newArena(size_t blockSize, size_t limit) {
+    CArena *arena = malloc(sizeof(CArena));
+    if (arena == NULL)
+        return NULL;
+
+    arena->head = NULL;
+    arena->last = NULL;
+    arena->blockSize = alignUp(blockSize != 0 ? blockSize : ARENA_BLOCK_SIZE);
+    arena->limit = limit;
+    arena->reserved = 0;
+    return arena;
+}
+
+COSMO_API void cosmoM_freeArena(CArena *arena) {
+    CArenaBlock *block = arena->head;
+
+    while (block != NULL) {
+        CArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    free(arena);
+}
+
+COSMO_API size_t cosmoM_arenaSize(CArena *arena) {
+    return arena->reserved;
+}
+
+COSMO_API void *cosmoM_arenaAlloc(void *ud, void *buf, size_t oldSize, size_t newSize) {
+    CArena *arena = (CArena*)ud;
+
+    // the last allocation can be shrunk, grown or given back in place
+    if (buf != NULL && buf == arena->last) {
+        CArenaBlock *head = arena->head;
+        size_t offset = arena->last - blockData(head);
+
+        if (newSize <= head->size - offset) {
+            head->used = offset + alignUp(newSize);
+
+            if (newSize == 0) {
+                arena->last = NULL;
+                return NULL;
+            }
+
+            return buf;
+        }
+    }
+
+    if (newSize == 0) // it's given back when the arena is freed
+        return NULL;
+
+    if (newSize <= oldSize)
+        return buf;
+
+    if (newSize > SIZE_MAX / 2) // alignUp would overflow
+        return NULL;
+
+    void *newBuf = bump(arena, alignUp(newSize));
+    if (newBuf != NULL && buf != NULL)
+        memcpy(newBuf, buf, oldSize);
+
+    return newBuf;
+}
@@ -0,0 +1,32 @@
+#ifndef CARENA_H
+#define CARENA_H
+
+#include "cosmo.h"
+
+/*
+    bump allocator for short lived states, eg. one state per request that's thrown away once the request is done. memory is
+    handed out from big blocks & only goes back to the system when the whole arena is freed. freeing (or growing) a buffer is
+    only done in place if it was the last thing allocated, anything else that's freed stays used until the arena goes away.
+
+    cosmoV_newArenaState makes a state that owns its arena: the state itself lives in it, cosmoV_freeState frees the arena in
+    one shot instead of freeing every object & the GC is kept frozen since collecting wouldn't give anything back. an arena can
+    also be passed to cosmoV_newStateEx with cosmoM_arenaAlloc, it has to outlive the state then.
+
+    limit caps the bytes the arena reserves from the system (the state alone takes ~sizeof(CState), a little over 256kb). going
+    over it fails the allocation, which throws the state's out of memory error (see cosmoM_reallocate). unlike
+    cosmoM_setMemoryLimit this cap is hard
+*/
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+// blockSize of 0 uses ARENA_BLOCK_SIZE, limit of 0 means there isn't one. returns NULL if the arena couldn't be allocated
+COSMO_API CArena *cosmoM_newArena(size_t blockSize, size_t limit);
+COSMO_API void cosmoM_freeArena(CArena *arena);
+
+// bytes the arena has reserved from the system
+COSMO_API size_t cosmoM_arenaSize(CArena *arena);
+
+// CosmoAlloc for an arena, ud is the CArena
+COSMO_API void *cosmoM_arenaAlloc(void *ud, void *buf, size_t oldSize, size_t newSize);
+
+#endif
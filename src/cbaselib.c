@@ -3,6 +3,7 @@
 #include "cvalue.h"
 #include "cobj.h"
 #include "cmem.h"
+#include "cheap.h"
 
 #include <math.h>
 #include <sys/time.h>
@@ -133,7 +134,6 @@ void cosmoB_loadLibrary(CState *state) {
     const char *identifiers[] = {
         "print",
         "assert",
-        "type",
         "pcall",
         "tonumber",
         "tostring",
@@ -144,7 +144,6 @@ void cosmoB_loadLibrary(CState *state) {
     CosmoCFunction baseLib[] = {
         cosmoB_print,
         cosmoB_assert,
-        cosmoB_type,
         cosmoB_pcall,
         cosmoB_tonumber,
         cosmoB_tostring,
@@ -158,6 +157,11 @@ void cosmoB_loadLibrary(CState *state) {
         cosmoV_pushCFunction(state, baseLib[i]);
     }
 
+    // type() is a leaf function, so the VM can call it without any GC bookkeeping
+    cosmoV_pushString(state, "type");
+    cosmoV_pushLeafCFunction(state, cosmoB_type, 1);
+    i++;
+
     // register all the pushed c functions and the strings as globals
     cosmoV_register(state, i);
 
@@ -165,6 +169,7 @@ void cosmoB_loadLibrary(CState *state) {
     cosmoB_loadObjLib(state);
     cosmoB_loadStrLib(state);
     cosmoB_loadMathLib(state);
+    cosmoB_loadCoroutineLib(state);
 }
 
 // ================================================================ [OBJECT.*] ================================================================
@@ -315,6 +320,15 @@ int cosmoB_osTime(CState *state, int nargs, CValue *args) {
     return 1;
 }
 
+CObjObject *cosmoB_makeLib(CState *state, const char **identifiers, CosmoCFunction *funcs, int count) {
+    for (int i = 0; i < count; i++) {
+        cosmoV_pushString(state, identifiers[i]);
+        cosmoV_pushCFunction(state, funcs[i]);
+    }
+
+    return cosmoV_makeObject(state, count);
+}
+
 COSMO_API void cosmoB_loadOSLib(CState *state) {
     const char *identifiers[] = {
         "read",
@@ -327,14 +341,7 @@ COSMO_API void cosmoB_loadOSLib(CState *state) {
     };
 
     cosmoV_pushString(state, "os");
-
-    int i;
-    for (i = 0; i < sizeof(identifiers)/sizeof(identifiers[0]); i++) {
-        cosmoV_pushString(state, identifiers[i]);
-        cosmoV_pushCFunction(state, osLib[i]);
-    }
-
-    cosmoV_makeObject(state, i);
+    cosmoB_makeLib(state, identifiers, osLib, sizeof(identifiers)/sizeof(identifiers[0]));
     cosmoV_register(state, 1); // register the os.* object to the global table
 }
 
@@ -554,7 +561,10 @@ int cosmoB_sRep(CState *state, int nargs, CValue *args) {
     }
 
     // allocated the new buffer for the string
-    size_t length = str->length * times;
+    size_t length = (size_t)str->length * times;
+    if (!cosmoM_checkLimit(state, length + 1))
+        return 0;
+
     char *newStr = cosmoM_xmalloc(state, length + 1); // + 1 for the NULL terminator
 
     // copy the string over the new buffer
@@ -574,8 +584,6 @@ void cosmoB_loadStrLib(CState *state) {
         "sub",
         "find",
         "split",
-        "byte",
-        "char",
         "len",
         "rep"
     };
@@ -584,8 +592,6 @@ void cosmoB_loadStrLib(CState *state) {
         cosmoB_sSub,
         cosmoB_sFind,
         cosmoB_sSplit,
-        cosmoB_sByte,
-        cosmoB_sChar,
         cosmoB_sLen,
         cosmoB_sRep
     };
@@ -598,6 +604,13 @@ void cosmoB_loadStrLib(CState *state) {
         cosmoV_pushCFunction(state, strLib[i]);
     }
 
+    // byte & char are leaf functions
+    cosmoV_pushString(state, "byte");
+    cosmoV_pushLeafCFunction(state, cosmoB_sByte, 1);
+    cosmoV_pushString(state, "char");
+    cosmoV_pushLeafCFunction(state, cosmoB_sChar, 1);
+    i += 2;
+
     // make the object and set the protoobject for all strings
     CObjObject *obj = cosmoV_makeObject(state, i);
     cosmoO_lock(obj); // lock so pesky people don't mess with it (feel free to remove if debugging)
@@ -821,7 +834,7 @@ void cosmoB_loadMathLib(CState *state) {
     int i;
     for (i = 0; i < sizeof(identifiers)/sizeof(identifiers[0]); i++) {
         cosmoV_pushString(state, identifiers[i]);
-        cosmoV_pushCFunction(state, mathLib[i]);
+        cosmoV_pushLeafCFunction(state, mathLib[i], 1); // every math function is a leaf function
     }
 
     cosmoV_pushString(state, "pi");
@@ -833,12 +846,225 @@ void cosmoB_loadMathLib(CState *state) {
     cosmoV_register(state, 1);
 }
 
+// ================================================================ [COROUTINE.*] ================================================================
+
+// coroutine.create(<closure>)
+int cosmoB_coCreate(CState *state, int nargs, CValue *args) {
+    if (nargs != 1) {
+        cosmoV_error(state, "coroutine.create() expected 1 argument, got %d!", nargs);
+        return 0;
+    }
+
+    if (!IS_CLOSURE(args[0])) {
+        cosmoV_typeError(state, "coroutine.create()", "<closure>", "%s", cosmoV_typeStr(args[0]));
+        return 0;
+    }
+
+    cosmoV_pushRef(state, (CObj*)cosmoO_newCoroutine(state, cosmoV_readClosure(args[0])));
+    return 1;
+}
+
+// coroutine.resume(<coroutine>, ...), returns true & whatever was yielded or returned, or false & the error
+int cosmoB_coResume(CState *state, int nargs, CValue *args) {
+    if (nargs < 1) {
+        cosmoV_error(state, "coroutine.resume() expected at least 1 argument!");
+        return 0;
+    }
+
+    if (!IS_COROUTINE(args[0])) {
+        cosmoV_typeError(state, "coroutine.resume()", "<coroutine>", "%s", cosmoV_typeStr(args[0]));
+        return 0;
+    }
+
+    // the coroutine runs with the GC unfrozen, same as pcall()
+    cosmoM_unfreezeGC(state);
+
+    int nres = cosmoV_resume(state, cosmoV_readCoroutine(args[0]), nargs - 1);
+    if (nres == -1) {
+        // restore panic state
+        state->panic = false;
+        cosmoV_pushBoolean(state, false);
+        cosmoV_pushRef(state, (CObj*)state->error);
+        nres = 1;
+    } else {
+        // insert true before the results
+        cosmo_insert(state, nres - 1, cosmoV_newBoolean(true));
+    }
+
+    cosmoM_freezeGC(state);
+    return nres + 1;
+}
+
+// coroutine.yield(...), returns whatever the coroutine is resumed with next
+int cosmoB_coYield(CState *state, int nargs, CValue *args) {
+    return cosmoV_yield(state, nargs);
+}
+
+// coroutine.status(<coroutine>)
+int cosmoB_coStatus(CState *state, int nargs, CValue *args) {
+    if (nargs != 1) {
+        cosmoV_error(state, "coroutine.status() expected 1 argument, got %d!", nargs);
+        return 0;
+    }
+
+    if (!IS_COROUTINE(args[0])) {
+        cosmoV_typeError(state, "coroutine.status()", "<coroutine>", "%s", cosmoV_typeStr(args[0]));
+        return 0;
+    }
+
+    cosmoV_pushString(state, cosmoO_coroutineStatus(cosmoV_readCoroutine(args[0])));
+    return 1;
+}
+
+// coroutine.running(), returns nil if it isn't called from a coroutine
+int cosmoB_coRunning(CState *state, int nargs, CValue *args) {
+    if (state->coroutine != NULL)
+        cosmoV_pushRef(state, (CObj*)state->coroutine);
+    else
+        cosmoV_pushNil(state);
+
+    return 1;
+}
+
+// what coroutine.wrap() returns is this, bound to the coroutine. errors are passed through instead of returned
+int cosmoB_coWrapped(CState *state, int nargs, CValue *args) {
+    cosmoM_unfreezeGC(state);
+    int nres = cosmoV_resume(state, cosmoV_readCoroutine(args[0]), nargs - 1);
+    cosmoM_freezeGC(state);
+
+    return nres == -1 ? 0 : nres;
+}
+
+// coroutine.wrap(<closure>), makes a coroutine & returns a function that resumes it every time it's called
+int cosmoB_coWrap(CState *state, int nargs, CValue *args) {
+    if (cosmoB_coCreate(state, nargs, args) == 0)
+        return 0;
+
+    CObj *co = cosmoV_readRef(*cosmoV_getTop(state, 0));
+    cosmoV_pushCFunction(state, cosmoB_coWrapped);
+    CObjMethod *method = cosmoO_newMethod(state, *cosmoV_getTop(state, 0), co);
+
+    cosmoV_setTop(state, 2); // pop the coroutine & the cfunction
+    cosmoV_pushRef(state, (CObj*)method);
+    return 1;
+}
+
+void cosmoB_loadCoroutineLib(CState *state) {
+    const char *identifiers[] = {
+        "create",
+        "resume",
+        "yield",
+        "status",
+        "running",
+        "wrap"
+    };
+
+    CosmoCFunction coLib[] = {
+        cosmoB_coCreate,
+        cosmoB_coResume,
+        cosmoB_coYield,
+        cosmoB_coStatus,
+        cosmoB_coRunning,
+        cosmoB_coWrap
+    };
+
+    // make coroutine library object
+    cosmoV_pushString(state, "coroutine");
+    int i;
+    for (i = 0; i < sizeof(identifiers)/sizeof(identifiers[0]); i++) {
+        cosmoV_pushString(state, identifiers[i]);
+        cosmoV_pushCFunction(state, coLib[i]);
+    }
+
+    // make the object and set the protoobject for all coroutines
+    CObjObject *obj = cosmoV_makeObject(state, i);
+    cosmoO_lock(obj); // lock so pesky people don't mess with it (feel free to remove if debugging)
+    cosmoV_registerProtoObject(state, COBJ_COROUTINE, obj);
+
+    // register "coroutine" to the global table
+    cosmoV_register(state, 1);
+}
+
 // ================================================================ [VM.*] ================================================================
 
+// vm.globals.__index
+int cosmoB_vindexGlobals(CState *state, int nargs, CValue *args) {
+    if (nargs != 2) {
+        cosmoV_error(state, "Expected 2 arguments, got %d!", nargs);
+        return 0;
+    }
+
+    // reads the cell directly, so the proxy always sees the live value (an undefined global reads as nil)
+    cosmoV_pushValue(state, *cosmoV_getGlobalCell(state, args[1]));
+    return 1;
+}
+
+// vm.globals.__newindex
+int cosmoB_vnewindexGlobals(CState *state, int nargs, CValue *args) {
+    if (nargs != 3) {
+        cosmoV_error(state, "Expected 3 arguments, got %d!", nargs);
+        return 0;
+    }
+
+    *cosmoV_getGlobalCell(state, args[1]) = args[2];
+    return 0;
+}
+
+// __next for the iterator vm.globals.__iter returns, the userdata is our position in state->globalIndex
+int cosmoB_vnextGlobals(CState *state, int nargs, CValue *args) {
+    if (nargs != 1 || !IS_OBJECT(args[0])) {
+        cosmoV_error(state, "Expected iterator object!");
+        return 0;
+    }
+
+    CObjObject *obj = cosmoV_readObject(args[0]);
+    int cap = state->globalIndex.capacityMask + 1;
+
+    // skip empty entries & globals that were cleared (their cells stay around, since compiled chunks cache them)
+    for (int i = cosmoO_getUserI(obj); i < cap; i++) {
+        CTableEntry *entry = &state->globalIndex.table[i];
+        if (IS_NIL(entry->key))
+            continue;
+
+        CValue *cell = cosmoV_getGlobalSlot(state, (int)cosmoV_readNumber(entry->val));
+        if (IS_NIL(*cell))
+            continue;
+
+        cosmoO_setUserI(obj, i + 1);
+        cosmoV_pushValue(state, entry->key);
+        cosmoV_pushValue(state, *cell);
+        return 2;
+    }
+
+    cosmoO_setUserI(obj, cap);
+    return 0; // no more globals, exits the loop
+}
+
+// vm.globals.__iter
+int cosmoB_viterGlobals(CState *state, int nargs, CValue *args) {
+    cosmoV_pushString(state, "__next");
+    cosmoV_pushCFunction(state, cosmoB_vnextGlobals);
+
+    CObjObject *obj = cosmoV_makeObject(state, 1);
+    cosmoO_setUserI(obj, 0);
+    return 1;
+}
+
 // vm.__getter["globals"]
 int cosmoB_vgetGlobal(CState *state, int nargs, CValue *args) {
-    // this function doesn't need to check anything, just return the global table
-    cosmoV_pushRef(state, (CObj*)state->globals);
+    // globals live in cells now, so hand back a proxy that reads & writes them (vm.globals["x"]) instead of a table
+    cosmoV_pushString(state, "__index");
+    cosmoV_pushCFunction(state, cosmoB_vindexGlobals);
+
+    cosmoV_pushString(state, "__newindex");
+    cosmoV_pushCFunction(state, cosmoB_vnewindexGlobals);
+
+    cosmoV_pushString(state, "__iter");
+    cosmoV_pushCFunction(state, cosmoB_viterGlobals);
+
+    // fields are the proxy's own, so lock it. vm.globals.x = 1 would otherwise quietly set a field instead of the global
+    CObjObject *obj = cosmoV_makeObject(state, 3);
+    cosmoO_lock(obj);
     return 1;
 }
 
@@ -856,7 +1082,18 @@ int cosmoB_vsetGlobal(CState *state, int nargs, CValue *args) {
 
     // this makes me very nervous ngl
     CObjTable *tbl = (CObjTable*)cosmoV_readRef(args[1]);
-    state->globals = tbl;
+
+    // clear every cell (the slots stay, since compiled chunks cache them) and load the new globals into them
+    for (int i = 0; i < state->globals.count; i++)
+        *cosmoV_getGlobalSlot(state, i) = cosmoV_newNil();
+
+    int cap = tbl->tbl.capacityMask + 1;
+    for (int i = 0; i < cap; i++) {
+        CTableEntry *entry = &tbl->tbl.table[i];
+        if (!IS_NIL(entry->key))
+            *cosmoV_getGlobalCell(state, entry->key) = entry->val;
+    }
+
     return 0;
 }
 
@@ -924,6 +1161,122 @@ int cosmoB_vcollect(CState *state, int nargs, CValue *args) {
     return 0;
 }
 
+// vm.stats()
+int cosmoB_vstats(CState *state, int nargs, CValue *args) {
+    // pushes the stats table (or errors if the VM was built without VM_STATS)
+    return cosmoV_pushStats(state) ? 1 : 0;
+}
+
+// table[key] = num
+static void setField(CState *state, CObjTable *tbl, const char *key, cosmo_Number num) {
+    CValue keyVal = cosmoV_newRef(cosmoO_copyString(state, key, strlen(key)));
+    *cosmoT_insert(state, &tbl->tbl, keyVal) = cosmoV_newNumber(num);
+}
+
+// vm.gcstats()
+int cosmoB_vgcstats(CState *state, int nargs, CValue *args) {
+    CGCStats stats;
+    cosmoM_getGCStats(state, &stats);
+
+    CObjTable *tbl = cosmoO_newTable(state);
+    cosmoV_pushRef(state, (CObj*)tbl);
+
+    setField(state, tbl, "cycles", stats.cycles);
+    setField(state, tbl, "totalPause", stats.totalPause);
+    setField(state, tbl, "maxPause", stats.maxPause);
+    setField(state, tbl, "lastPause", stats.lastPause);
+    setField(state, tbl, "lastReclaimed", stats.lastReclaimed);
+    setField(state, tbl, "totalReclaimed", stats.totalReclaimed);
+    setField(state, tbl, "heapBytes", stats.heapBytes);
+    setField(state, tbl, "nextGC", stats.nextGC);
+    setField(state, tbl, "strings", stats.strings);
+    setField(state, tbl, "stringCapacity", stats.stringCapacity);
+
+    // ["<type>" = ["count" = <live objects>, "bytes" = <live bytes>], ...]
+    CObjTable *types = cosmoO_newTable(state);
+    *cosmoT_insert(state, &tbl->tbl, cosmoV_newRef(cosmoO_copyString(state, "objects", 7))) = cosmoV_newRef(types);
+
+    for (int i = 0; i < COBJ_MAX; i++) {
+        if (stats.liveObjects[i] == 0)
+            continue;
+
+        CObjTable *type = cosmoO_newTable(state);
+        const char *name = cosmoO_typeName(i);
+        *cosmoT_insert(state, &types->tbl, cosmoV_newRef(cosmoO_copyString(state, name, strlen(name)))) = cosmoV_newRef(type);
+
+        setField(state, type, "count", stats.liveObjects[i]);
+        setField(state, type, "bytes", stats.liveBytes[i]);
+    }
+
+    return 1;
+}
+
+// vm.track(<boolean>), starts or stops the allocation tracker
+int cosmoB_vtrack(CState *state, int nargs, CValue *args) {
+    if (nargs != 1) {
+        cosmoV_error(state, "vm.track() expected 1 argument, got %d!", nargs);
+        return 0;
+    }
+
+    if (!IS_BOOLEAN(args[0])) {
+        cosmoV_typeError(state, "vm.track()", "<boolean>", "%s", cosmoV_typeStr(args[0]));
+        return 0;
+    }
+
+    if (cosmoV_readBoolean(args[0])) {
+        if (!cosmoM_startTracking(state))
+            cosmoV_error(state, "vm.track() couldn't allocate the tracker!");
+    } else
+        cosmoM_stopTracking(state);
+
+    return 0;
+}
+
+// opens the file at args[0] for writing, returns NULL (after throwing an error) if it couldn't be opened
+static FILE *openReport(CState *state, const char *name, int nargs, CValue *args) {
+    if (nargs != 1) {
+        cosmoV_error(state, "%s expected 1 argument, got %d!", name, nargs);
+        return NULL;
+    }
+
+    if (!IS_STRING(args[0])) {
+        cosmoV_error(state, "%s expected (<string>), got (%s)!", name, cosmoV_typeStr(args[0]));
+        return NULL;
+    }
+
+    FILE *out = fopen(cosmoV_readCString(args[0]), "w");
+    if (out == NULL)
+        cosmoV_error(state, "%s couldn't open '%s'!", name, cosmoV_readCString(args[0]));
+
+    return out;
+}
+
+// vm.allocations(<path>), writes the allocation tracker's report (see cheap.h)
+int cosmoB_vallocations(CState *state, int nargs, CValue *args) {
+    FILE *out = openReport(state, "vm.allocations()", nargs, args);
+    if (out == NULL)
+        return 0;
+
+    bool ok = cosmoM_writeAllocations(state, out);
+    fclose(out);
+
+    if (!ok)
+        cosmoV_error(state, "vm.allocations() failed, the allocation tracker ran out of memory!");
+
+    return 0;
+}
+
+// vm.snapshot(<path>), writes a heap snapshot (see cheap.h)
+int cosmoB_vsnapshot(CState *state, int nargs, CValue *args) {
+    FILE *out = openReport(state, "vm.snapshot()", nargs, args);
+    if (out == NULL)
+        return 0;
+
+    cosmoM_writeHeapSnapshot(state, out);
+    fclose(out);
+    return 0;
+}
+
 void cosmoB_loadVM(CState *state) {
     // make vm.* object
     cosmoV_pushString(state, "vm");
@@ -958,7 +1311,22 @@ void cosmoB_loadVM(CState *state) {
     cosmoV_pushString(state, "collect");
     cosmoV_pushCFunction(state, cosmoB_vcollect);
 
-    cosmoV_makeObject(state, 4); // makes the vm object
+    cosmoV_pushString(state, "stats");
+    cosmoV_pushCFunction(state, cosmoB_vstats);
+
+    cosmoV_pushString(state, "gcstats");
+    cosmoV_pushCFunction(state, cosmoB_vgcstats);
+
+    cosmoV_pushString(state, "track");
+    cosmoV_pushCFunction(state, cosmoB_vtrack);
+
+    cosmoV_pushString(state, "allocations");
+    cosmoV_pushCFunction(state, cosmoB_vallocations);
+
+    cosmoV_pushString(state, "snapshot");
+    cosmoV_pushCFunction(state, cosmoB_vsnapshot);
+
+    cosmoV_makeObject(state, 9); // makes the vm object
 
     // register "vm" to the global table
     cosmoV_register(state, 1);
@@ -8,6 +8,7 @@
     - object library
     - string library
     - math library
+    - coroutine library
 */
 COSMO_API void cosmoB_loadLibrary(CState *state);
 
@@ -44,15 +45,32 @@ COSMO_API void cosmoB_loadStrLib(CState *state);
 */
 COSMO_API void cosmoB_loadMathLib(CState *state);
 
+/* loads the coroutine library, including:
+    - coroutine.create & coroutine.wrap
+    - coroutine.resume & <coroutine>:resume()
+    - coroutine.yield
+    - coroutine.status & <coroutine>:status()
+    - coroutine.running
+
+    The base proto object for coroutines is also set, and coroutines can be iterated over, eg.
+        `for x in coroutine.create(gen) do ... end` resumes gen until it's dead, x being whatever it yielded
+*/
+COSMO_API void cosmoB_loadCoroutineLib(CState *state);
+
 /* loads the vm library, including:
     - manually setting/grabbing base protos of any object (vm.baseProtos)
-    - manually setting/grabbing the global table (vm.globals)
+    - manually setting/grabbing the globals (vm.globals, grabbing returns a live view of the globals, setting replaces them with a table's contents)
     - manually invoking a garbage collection event (vm.collect())
+    - grabbing the per-opcode/per-function execution counts (vm.stats(), only if the VM was built with VM_STATS)
+    - grabbing the GC telemetry: cycles, pause times, bytes reclaimed & the live heap by type (vm.gcstats())
 
     for this reason, it is recommended to NOT load this library in production
 */
 COSMO_API void cosmoB_loadVM(CState *state);
 
+// pushes an object made out of the functions, for the libraries to build themselves with
+CObjObject *cosmoB_makeLib(CState *state, const char **identifiers, CosmoCFunction *funcs, int count);
+
 #define cosmoV_typeError(state, name, expectedTypes, formatStr, ...) \
         cosmoV_error(state, name " expected (" expectedTypes "), got (" formatStr ")!", __VA_ARGS__);
 
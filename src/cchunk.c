@@ -12,10 +12,13 @@ CChunk *newChunk(CState* state, size_t startCapacity) {
 
 void initChunk(CState* state, CChunk *chunk, size_t startCapacity) {
     chunk->capacity = startCapacity;
-    chunk->lineCapacity = startCapacity;
+    chunk->lineCapacity = ARRAY_START;
+    chunk->lineCount = 0;
     chunk->count = 0;
     chunk->buf = NULL; // when writeByteChunk is called, it'll allocate the array for us
     chunk->lineInfo = NULL;
+    chunk->globalCache = NULL;
+    chunk->globalCacheCount = 0;
     
     // constants
     initValArray(state, &chunk->constants, ARRAY_START);
@@ -25,9 +28,11 @@ void cleanChunk(CState* state, CChunk *chunk) {
     // first, free the chunk buffer
     cosmoM_freearray(state, INSTRUCTION, chunk->buf, chunk->capacity);
     // then the line info
-    cosmoM_freearray(state, int, chunk->lineInfo, chunk->capacity);
+    cosmoM_freearray(state, CLineRun, chunk->lineInfo, chunk->lineCapacity);
     // free the constants
     cleanValArray(state, &chunk->constants);
+    // and the global cache
+    cosmoM_freearray(state, CValue*, chunk->globalCache, chunk->globalCacheCount);
 }
 
 void freeChunk(CState* state, CChunk *chunk) {
@@ -37,12 +42,6 @@ void freeChunk(CState* state, CChunk *chunk) {
 }
 
 int addConstant(CState* state, CChunk *chunk, CValue value) {
-    // before adding the constant, check if we already have it
-    for (size_t i = 0; i < chunk->constants.count; i++) {
-        if (cosmoV_equal(state, value, chunk->constants.values[i]))
-            return i; // we already have a matching constant!
-    }
-
     cosmoM_freezeGC(state); // so our GC doesn't free it
     appendValArray(state, &chunk->constants, value);
     cosmoM_unfreezeGC(state);
@@ -54,10 +53,15 @@ int addConstant(CState* state, CChunk *chunk, CValue value) {
 void writeu8Chunk(CState* state, CChunk *chunk, INSTRUCTION i, int line) {
     // does the buffer need to be reallocated?
     cosmoM_growarray(state, INSTRUCTION, chunk->buf, chunk->count, chunk->capacity);
-    cosmoM_growarray(state, int, chunk->lineInfo, chunk->count, chunk->lineCapacity);
+
+    // only start a new run if the line changed
+    if (chunk->lineCount == 0 || chunk->lineInfo[chunk->lineCount - 1].line != line) {
+        cosmoM_growarray(state, CLineRun, chunk->lineInfo, chunk->lineCount, chunk->lineCapacity);
+        chunk->lineInfo[chunk->lineCount].pc = chunk->count;
+        chunk->lineInfo[chunk->lineCount++].line = line;
+    }
 
     // write data to the chunk :)
-    chunk->lineInfo[chunk->count] = line;
     chunk->buf[chunk->count++] = i;
 }
 
@@ -69,3 +73,21 @@ void writeu16Chunk(CState* state, CChunk *chunk, uint16_t i, int line) {
         writeu8Chunk(state, chunk, buffer[i], line);
     }
 }
+
+// ================================================================ [READ FROM CHUNK] ================================================================
+
+int getLineChunk(CChunk *chunk, int offset) {
+    // binary search for the last run that starts at or before offset
+    int low = 0, high = (int)chunk->lineCount - 1;
+
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+
+        if (chunk->lineInfo[mid].pc <= offset)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+
+    return chunk->lineCount > 0 ? chunk->lineInfo[low].line : 0;
+}
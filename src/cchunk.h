@@ -6,25 +6,37 @@
 #include "coperators.h"
 #include "cvalue.h"
 
+// a run of instructions that share the same line, starting at pc
+typedef struct CLineRun {
+    int pc;
+    int line;
+} CLineRun;
+
 struct CChunk {
     size_t capacity; // the amount of space we've allocated for
     size_t count; // the space we're currently using
     INSTRUCTION *buf; // whole chunk
     CValueArray constants; // holds constants
+    CLineRun *lineInfo; // a new run is only started when the line changes
+    size_t lineCount;
     size_t lineCapacity;
-    int *lineInfo;
+    CValue **globalCache; // global cells indexed by constant, filled lazily by the VM (NULL until the first global is touched)
+    size_t globalCacheCount;
 };
 
 CChunk *newChunk(CState* state, size_t startCapacity);
 void initChunk(CState* state, CChunk *chunk, size_t startCapacity);
 void cleanChunk(CState* state, CChunk *chunk); // frees everything but the struct
 void freeChunk(CState* state, CChunk *chunk); // frees everything including the struct
-int addConstant(CState* state, CChunk *chunk, CValue value);
+int addConstant(CState* state, CChunk *chunk, CValue value); // appends to the constant pool, the parser already dedups constants (see makeConstant)
 
 // write to chunk
 void writeu8Chunk(CState* state, CChunk *chunk, INSTRUCTION i, int line);
 void writeu16Chunk(CState* state, CChunk *chunk, uint16_t i, int line);
 
+// grabs the line of the instruction at offset
+int getLineChunk(CChunk *chunk, int offset);
+
 // read from chunk
 static inline INSTRUCTION readu8Chunk(CChunk *chunk, int offset) {
     return chunk->buf[offset];
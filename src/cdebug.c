@@ -2,6 +2,73 @@
 #include "cvalue.h"
 #include "cobj.h"
 
+static const char *opNames[OP_MAX] = {
+    [OP_LOADCONST] = "OP_LOADCONST",
+    [OP_SETGLOBAL] = "OP_SETGLOBAL",
+    [OP_GETGLOBAL] = "OP_GETGLOBAL",
+    [OP_SETLOCAL] = "OP_SETLOCAL",
+    [OP_GETLOCAL] = "OP_GETLOCAL",
+    [OP_GETUPVAL] = "OP_GETUPVAL",
+    [OP_SETUPVAL] = "OP_SETUPVAL",
+    [OP_PEJMP] = "OP_PEJMP",
+    [OP_EJMP] = "OP_EJMP",
+    [OP_JMP] = "OP_JMP",
+    [OP_JMPBACK] = "OP_JMPBACK",
+    [OP_POP] = "OP_POP",
+    [OP_CALL] = "OP_CALL",
+    [OP_TAILCALL] = "OP_TAILCALL",
+    [OP_CLOSURE] = "OP_CLOSURE",
+    [OP_CLOSE] = "OP_CLOSE",
+    [OP_NEWTABLE] = "OP_NEWTABLE",
+    [OP_NEWARRAY] = "OP_NEWARRAY",
+    [OP_INDEX] = "OP_INDEX",
+    [OP_NEWINDEX] = "OP_NEWINDEX",
+    [OP_NEWOBJECT] = "OP_NEWOBJECT",
+    [OP_SETOBJECT] = "OP_SETOBJECT",
+    [OP_GETOBJECT] = "OP_GETOBJECT",
+    [OP_GETMETHOD] = "OP_GETMETHOD",
+    [OP_INVOKE] = "OP_INVOKE",
+    [OP_TAILINVOKE] = "OP_TAILINVOKE",
+    [OP_ITER] = "OP_ITER",
+    [OP_NEXT] = "OP_NEXT",
+    [OP_VARARGS] = "OP_VARARGS",
+    [OP_VARINDEX] = "OP_VARINDEX",
+    [OP_VARNEWINDEX] = "OP_VARNEWINDEX",
+    [OP_VARINCINDEX] = "OP_VARINCINDEX",
+    [OP_VARCOUNT] = "OP_VARCOUNT",
+    [OP_VARITER] = "OP_VARITER",
+    [OP_VARCALL] = "OP_VARCALL",
+    [OP_TAILVARCALL] = "OP_TAILVARCALL",
+    [OP_ADD] = "OP_ADD",
+    [OP_SUB] = "OP_SUB",
+    [OP_MULT] = "OP_MULT",
+    [OP_DIV] = "OP_DIV",
+    [OP_MOD] = "OP_MOD",
+    [OP_POW] = "OP_POW",
+    [OP_NOT] = "OP_NOT",
+    [OP_NEGATE] = "OP_NEGATE",
+    [OP_COUNT] = "OP_COUNT",
+    [OP_CONCAT] = "OP_CONCAT",
+    [OP_INCLOCAL] = "OP_INCLOCAL",
+    [OP_INCGLOBAL] = "OP_INCGLOBAL",
+    [OP_INCUPVAL] = "OP_INCUPVAL",
+    [OP_INCINDEX] = "OP_INCINDEX",
+    [OP_INCOBJECT] = "OP_INCOBJECT",
+    [OP_EQUAL] = "OP_EQUAL",
+    [OP_LESS] = "OP_LESS",
+    [OP_GREATER] = "OP_GREATER",
+    [OP_LESS_EQUAL] = "OP_LESS_EQUAL",
+    [OP_GREATER_EQUAL] = "OP_GREATER_EQUAL",
+    [OP_TRUE] = "OP_TRUE",
+    [OP_FALSE] = "OP_FALSE",
+    [OP_NIL] = "OP_NIL",
+    [OP_RETURN] = "OP_RETURN",
+};
+
+const char *opcodeName(int op) {
+    return op >= 0 && op < OP_MAX ? opNames[op] : "OP_UNKNOWN";
+}
+
 void printIndent(int indent) {
     for (int i = 0; i < indent; i++)
         printf("\t");
@@ -70,9 +137,9 @@ int disasmInstr(CChunk *chunk, int offset, int indent) {
     printf("%04d ", offset);
 
     INSTRUCTION i = chunk->buf[offset];
-    int line = chunk->lineInfo[offset];
+    int line = getLineChunk(chunk, offset);
 
-    if (offset > 0 && line == chunk->lineInfo[offset - 1]) {
+    if (offset > 0 && line == getLineChunk(chunk, offset - 1)) {
         printf("   | ");
     } else {
         printf("%4d ", line);
@@ -105,6 +172,8 @@ int disasmInstr(CChunk *chunk, int offset, int indent) {
             return u8OperandInstruction("OP_POP", chunk, offset);
         case OP_CALL:
             return u8u8OperandInstruction("OP_CALL", chunk, offset);
+        case OP_TAILCALL:
+            return u8u8OperandInstruction("OP_TAILCALL", chunk, offset);
         case OP_CLOSURE: {
             int index = readu16Chunk(chunk, offset + 1);
             printf("%-16s [%05d] - ", "OP_CLOSURE", index);
@@ -147,10 +216,28 @@ int disasmInstr(CChunk *chunk, int offset, int indent) {
             return constInstruction("OP_GETMETHOD", chunk, offset);
         case OP_INVOKE:
             return u8u8u16OperandInstruction("OP_INVOKE", chunk, offset);
+        case OP_TAILINVOKE:
+            return u8u8u16OperandInstruction("OP_TAILINVOKE", chunk, offset);
         case OP_ITER:
             return simpleInstruction("OP_ITER", offset);
         case OP_NEXT:
             return u8u16OperandInstruction("OP_NEXT", chunk, offset);
+        case OP_VARARGS:
+            return simpleInstruction("OP_VARARGS", offset);
+        case OP_VARINDEX:
+            return simpleInstruction("OP_VARINDEX", offset);
+        case OP_VARNEWINDEX:
+            return simpleInstruction("OP_VARNEWINDEX", offset);
+        case OP_VARINCINDEX:
+            return u8OperandInstruction("OP_VARINCINDEX", chunk, offset);
+        case OP_VARCOUNT:
+            return simpleInstruction("OP_VARCOUNT", offset);
+        case OP_VARITER:
+            return simpleInstruction("OP_VARITER", offset);
+        case OP_VARCALL:
+            return u8u8OperandInstruction("OP_VARCALL", chunk, offset);
+        case OP_TAILVARCALL:
+            return u8u8OperandInstruction("OP_TAILVARCALL", chunk, offset);
         case OP_ADD:
             return simpleInstruction("OP_ADD", offset);
         case OP_SUB:
@@ -7,5 +7,6 @@ COSMO_API void disasmChunk(CChunk *chunk, const char *name, int indent);
 COSMO_API int disasmInstr(CChunk *chunk, int offset, int indent);
 
 void printIndent(int indent);
+const char *opcodeName(int op); // eg. "OP_ADD"
 
 #endif
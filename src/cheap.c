@@ -0,0 +1,527 @@
+#include "cheap.h"
+#include "cstate.h"
+#include "cchunk.h"
+#include "cobj.h"
+#include "cvalue.h"
+#include "ctable.h"
+#include "cloop.h"
+#include "csite.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#define TOMBSTONE ((CObj*)1)
+#define LABEL_MAX 64
+
+typedef struct CAllocSite {
+    uint64_t bytes; // every byte allocated here, buffers included
+    uint64_t objects;
+    uint64_t types[COBJ_MAX];
+} CAllocSite;
+
+typedef struct CTrackedObject {
+    CObj *obj; // NULL if the slot is empty, TOMBSTONE if it was removed
+    int site;
+} CTrackedObject;
+
+// the tracker runs in the middle of allocations, so it stays away from the GC & uses C's allocator
+struct CHeapTracker {
+    CSiteTable sites; // named "module:function:line", each site's data is a CAllocSite
+    CTrackedObject *objects; // open addressed, maps every object allocated while tracking to its site
+    int objectCount; // includes tombstones
+    int objectCapacity;
+    bool failed; // ran out of memory & threw everything away, nothing is tracked until cosmoM_startTracking is called again
+};
+
+#define allocSite(tracker, site) ((CAllocSite*)cosmoS_siteData(&(tracker)->sites, site))
+
+static void freeTables(CHeapTracker *tracker) {
+    cosmoS_freeSites(&tracker->sites);
+    free(tracker->objects);
+    tracker->objects = NULL;
+    tracker->objectCount = 0;
+    tracker->objectCapacity = 0;
+}
+
+// we can't throw from inside an allocation, so running out of memory just stops the tracker. the error is reported by
+// cosmoM_writeAllocations
+static void giveUp(CHeapTracker *tracker) {
+    freeTables(tracker);
+    tracker->failed = true;
+}
+
+COSMO_API bool cosmoM_startTracking(CState *state) {
+    CHeapTracker *tracker = state->heapTracker;
+
+    if (tracker != NULL) {
+        // if it ran out of memory everything was already thrown away, so it just starts over
+        tracker->failed = false;
+        return true;
+    }
+
+    tracker = malloc(sizeof(CHeapTracker));
+    if (tracker == NULL)
+        return false;
+
+    cosmoS_initSites(&tracker->sites, sizeof(CAllocSite));
+    tracker->objects = NULL;
+    tracker->objectCount = 0;
+    tracker->objectCapacity = 0;
+    tracker->failed = false;
+    state->heapTracker = tracker;
+    return true;
+}
+
+COSMO_API void cosmoM_stopTracking(CState *state) {
+    CHeapTracker *tracker = state->heapTracker;
+    if (tracker == NULL)
+        return;
+
+    freeTables(tracker);
+    free(tracker);
+    state->heapTracker = NULL;
+}
+
+COSMO_API bool cosmoM_isTracking(CState *state) {
+    return state->heapTracker != NULL && !state->heapTracker->failed;
+}
+
+// ================================================================ [SITES] ================================================================
+
+// finds (or makes) the site for whatever the VM is executing right now, -1 if we're out of memory
+static int currentSite(CState *state, CHeapTracker *tracker) {
+    CSiteTable *sites = &tracker->sites;
+    cosmoS_resetName(sites);
+
+    if (state->frameCount == 0) {
+        if (!cosmoS_append(sites, "<C>", 3))
+            return -1;
+    } else if (!cosmoS_appendFrame(sites, &state->callFrame[state->frameCount - 1])) {
+        return -1;
+    }
+
+    return cosmoS_findSite(sites);
+}
+
+// ================================================================ [OBJECTS] ================================================================
+
+static uint32_t hashPointer(CObj *obj) {
+    uint64_t x = (uintptr_t)obj;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return (uint32_t)x;
+}
+
+// returns obj's slot, or the first free slot if obj isn't being tracked. tombstones are only reused when insert is set
+static CTrackedObject *findObject(CTrackedObject *objects, int capacity, CObj *obj, bool insert) {
+    int indx = hashPointer(obj) & (capacity - 1);
+    CTrackedObject *tombstone = NULL;
+
+    while (true) {
+        CTrackedObject *entry = &objects[indx];
+
+        if (entry->obj == obj)
+            return entry;
+
+        if (entry->obj == NULL)
+            return insert && tombstone != NULL ? tombstone : entry;
+
+        if (entry->obj == TOMBSTONE && tombstone == NULL)
+            tombstone = entry;
+
+        indx = (indx + 1) & (capacity - 1);
+    }
+}
+
+static bool growObjects(CHeapTracker *tracker) {
+    // tombstones are dropped when we rehash, so count the live entries first
+    int live = 0;
+    for (int i = 0; i < tracker->objectCapacity; i++) {
+        if (tracker->objects[i].obj != NULL && tracker->objects[i].obj != TOMBSTONE)
+            live++;
+    }
+
+    int capacity = tracker->objectCapacity == 0 ? 256 : tracker->objectCapacity;
+    while ((live + 1) * 2 > capacity)
+        capacity *= 2;
+
+    CTrackedObject *objects = malloc(sizeof(CTrackedObject) * capacity);
+    if (objects == NULL)
+        return false;
+
+    memset(objects, 0, sizeof(CTrackedObject) * capacity);
+
+    for (int i = 0; i < tracker->objectCapacity; i++) {
+        CTrackedObject *entry = &tracker->objects[i];
+
+        if (entry->obj != NULL && entry->obj != TOMBSTONE)
+            *findObject(objects, capacity, entry->obj, true) = *entry;
+    }
+
+    free(tracker->objects);
+    tracker->objects = objects;
+    tracker->objectCount = live;
+    tracker->objectCapacity = capacity;
+    return true;
+}
+
+// returns the site obj was allocated at, or -1 if it was allocated before tracking started
+static int objectSite(CHeapTracker *tracker, CObj *obj) {
+    if (tracker == NULL || tracker->objectCapacity == 0)
+        return -1;
+
+    CTrackedObject *entry = findObject(tracker->objects, tracker->objectCapacity, obj, false);
+    return entry->obj == obj ? entry->site : -1;
+}
+
+void cosmoM_trackBytes(CState *state, size_t bytes) {
+    CHeapTracker *tracker = state->heapTracker;
+    if (tracker->failed)
+        return;
+
+    int site = currentSite(state, tracker); // can grow sites, so it has to be called before we index it
+    if (site == -1) {
+        giveUp(tracker);
+        return;
+    }
+
+    allocSite(tracker, site)->bytes += bytes;
+}
+
+void cosmoM_trackObject(CState *state, CObj *obj) {
+    CHeapTracker *tracker = state->heapTracker;
+    if (tracker->failed)
+        return;
+
+    int site = currentSite(state, tracker);
+
+    // keep the load factor (tombstones included) under 3/4
+    if (site == -1 || ((tracker->objectCount + 1) * 4 > tracker->objectCapacity * 3 && !growObjects(tracker))) {
+        giveUp(tracker);
+        return;
+    }
+
+    allocSite(tracker, site)->objects++;
+    allocSite(tracker, site)->types[obj->type]++;
+
+    CTrackedObject *entry = findObject(tracker->objects, tracker->objectCapacity, obj, true);
+    if (entry->obj == NULL)
+        tracker->objectCount++;
+
+    entry->obj = obj;
+    entry->site = site;
+}
+
+void cosmoM_untrackObject(CState *state, CObj *obj) {
+    CHeapTracker *tracker = state->heapTracker;
+    if (tracker->objectCapacity == 0)
+        return;
+
+    CTrackedObject *entry = findObject(tracker->objects, tracker->objectCapacity, obj, false);
+    if (entry->obj == obj)
+        entry->obj = TOMBSTONE;
+}
+
+// ================================================================ [REPORTS] ================================================================
+
+static void writeEscaped(FILE *out, const char *str, size_t length) {
+    fputc('"', out);
+
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = str[i];
+
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 0x20 || c > 0x7E)
+            fprintf(out, "\\x%02X", c);
+        else
+            fputc(c, out);
+    }
+
+    fputc('"', out);
+}
+
+// qsort doesn't pass any userdata, so the live bytes being sorted by are stashed here
+static const uint64_t *sortBytes;
+
+static int compareSites(const void *a, const void *b) {
+    uint64_t bytesA = sortBytes[*(const int*)a], bytesB = sortBytes[*(const int*)b];
+    return bytesA < bytesB ? 1 : (bytesA > bytesB ? -1 : 0);
+}
+
+COSMO_API bool cosmoM_writeAllocations(CState *state, FILE *out) {
+    CHeapTracker *tracker = state->heapTracker;
+    if (tracker == NULL)
+        return true;
+    else if (tracker->failed)
+        return false;
+
+    int count = tracker->sites.count;
+    if (count == 0)
+        return true;
+
+    uint64_t *liveBytes = malloc(sizeof(uint64_t) * count);
+    uint64_t *liveObjects = malloc(sizeof(uint64_t) * count);
+    int *order = malloc(sizeof(int) * count);
+
+    if (liveBytes == NULL || liveObjects == NULL || order == NULL) {
+        free(liveBytes);
+        free(liveObjects);
+        free(order);
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        liveBytes[i] = 0;
+        liveObjects[i] = 0;
+        order[i] = i;
+    }
+
+    for (CObj *obj = state->objects; obj != NULL; obj = obj->next) {
+        int site = objectSite(tracker, obj);
+
+        if (site != -1) {
+            liveBytes[site] += cosmoO_sizeOf(obj);
+            liveObjects[site]++;
+        }
+    }
+
+    sortBytes = liveBytes;
+    qsort(order, count, sizeof(int), compareSites);
+
+    for (int i = 0; i < count; i++) {
+        CSite *name = &tracker->sites.sites[order[i]];
+        CAllocSite *site = allocSite(tracker, order[i]);
+
+        fprintf(out, "%" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " ", liveBytes[order[i]], liveObjects[order[i]], site->bytes,
+            site->objects);
+        writeEscaped(out, name->name, name->length);
+
+        for (int type = 0; type < COBJ_MAX; type++) {
+            if (site->types[type] > 0)
+                fprintf(out, " %s=%" PRIu64, cosmoO_typeName(type), site->types[type]);
+        }
+
+        fprintf(out, "\n");
+    }
+
+    free(liveBytes);
+    free(liveObjects);
+    free(order);
+    return true;
+}
+
+static void writeRoot(FILE *out, CObj *obj, const char *kind) {
+    if (obj != NULL)
+        fprintf(out, "R %" PRIxPTR " %s \"\"\n", (uintptr_t)obj, kind);
+}
+
+static void writeRootValue(FILE *out, CValue val, const char *kind) {
+    if (IS_REF(val))
+        writeRoot(out, cosmoV_readRef(val), kind);
+}
+
+static void writeContextRoots(FILE *out, CContext *ctx) {
+    for (StkPtr value = ctx->stack; value < ctx->top; value++)
+        writeRootValue(out, *value, "stack");
+
+    for (int i = 0; i < ctx->frameCount; i++)
+        writeRoot(out, (CObj*)ctx->callFrame[i].closure, "frame");
+
+    for (CObjUpval *upvalue = ctx->openUpvalues; upvalue != NULL; upvalue = upvalue->next)
+        writeRoot(out, (CObj*)upvalue, "upvalue");
+}
+
+static void writeLoopRoot(CState *state, CValue val, void *ud) {
+    writeRootValue((FILE*)ud, val, "loop");
+}
+
+static void writeRoots(CState *state, FILE *out) {
+    CContext current;
+    cosmoV_saveContext(state, &current);
+    writeContextRoots(out, &current);
+
+    // same as markRoots, the running coroutine is the root of whoever resumed it
+    if (state->coroutine != NULL) {
+        writeContextRoots(out, &state->mainContext);
+        writeRoot(out, (CObj*)state->coroutine, "coroutine");
+    }
+
+    // globals are written with their names, so walk the index instead of the cells
+    CTable *index = &state->globalIndex;
+    for (int i = 0; i <= index->capacityMask; i++) {
+        CTableEntry *entry = &index->table[i];
+        if (!IS_STRING(entry->key) || !IS_NUMBER(entry->val))
+            continue;
+
+        CValue cell = *cosmoV_getGlobalSlot(state, (int)cosmoV_readNumber(entry->val));
+        if (!IS_REF(cell))
+            continue;
+
+        CObjString *name = cosmoV_readString(entry->key);
+        fprintf(out, "R %" PRIxPTR " global ", (uintptr_t)cosmoV_readRef(cell));
+        writeEscaped(out, name->str, name->length);
+        fprintf(out, "\n");
+    }
+
+    // the global names themselves are kept alive by the index
+    for (int i = 0; i <= index->capacityMask; i++)
+        writeRootValue(out, index->table[i].key, "global");
+
+    for (int i = 0; i < ISTRING_MAX; i++)
+        writeRoot(out, (CObj*)state->iStrings[i], "istring");
+
+    for (CObj *root = state->userRoots; root != NULL; root = root->nextRoot)
+        writeRoot(out, root, "user");
+
+    // coroutines waiting on I/O & timers, and what they're going to be resumed with
+    if (state->loop != NULL)
+        cosmoE_visitLoop(state, writeLoopRoot, out);
+
+    writeRoot(out, (CObj*)state->error, "error");
+
+    for (int i = 0; i < COBJ_MAX; i++)
+        writeRoot(out, (CObj*)state->protoObjects[i], "proto");
+}
+
+static void writeEdge(FILE *out, CObj *obj) {
+    if (obj != NULL)
+        fprintf(out, "E %" PRIxPTR "\n", (uintptr_t)obj);
+}
+
+static void writeValueEdge(FILE *out, CValue val) {
+    if (IS_REF(val))
+        writeEdge(out, cosmoV_readRef(val));
+}
+
+static void writeTableEdges(FILE *out, CTable *tbl) {
+    if (tbl->table == NULL)
+        return;
+
+    for (int i = 0; i <= tbl->capacityMask; i++) {
+        writeValueEdge(out, tbl->table[i].key);
+        writeValueEdge(out, tbl->table[i].val);
+    }
+}
+
+// these are the same references blackenObject in cmem.c traces, keep them in sync
+static void writeEdges(FILE *out, CObj *obj) {
+    writeEdge(out, (CObj*)obj->proto);
+
+    switch (obj->type) {
+        case COBJ_OBJECT:
+            writeTableEdges(out, &((CObjObject*)obj)->tbl);
+            break;
+        case COBJ_TABLE:
+            writeTableEdges(out, &((CObjTable*)obj)->tbl);
+            break;
+        case COBJ_UPVALUE: {
+            CObjUpval *upval = (CObjUpval*)obj;
+
+            // open upvalues point into a stack, the state's is already a root & a coroutine's is owned by the coroutine
+            if (upval->val == &upval->closed)
+                writeValueEdge(out, upval->closed);
+            else
+                writeEdge(out, (CObj*)upval->owner);
+            break;
+        }
+        case COBJ_FUNCTION: {
+            CObjFunction *func = (CObjFunction*)obj;
+            writeEdge(out, (CObj*)func->name);
+            writeEdge(out, (CObj*)func->module);
+
+            for (size_t i = 0; i < func->chunk.constants.count; i++)
+                writeValueEdge(out, func->chunk.constants.values[i]);
+            break;
+        }
+        case COBJ_METHOD: {
+            CObjMethod *method = (CObjMethod*)obj;
+            writeValueEdge(out, method->func);
+            writeEdge(out, method->obj);
+            break;
+        }
+        case COBJ_ERROR: {
+            CObjError *err = (CObjError*)obj;
+            writeValueEdge(out, err->err);
+
+            for (int i = 0; i < err->frameCount; i++)
+                writeEdge(out, (CObj*)err->frames[i].closure);
+            break;
+        }
+        case COBJ_CLOSURE: {
+            CObjClosure *closure = (CObjClosure*)obj;
+            writeEdge(out, (CObj*)closure->function);
+
+            for (int i = 0; i < closure->upvalueCount; i++)
+                writeEdge(out, (CObj*)closure->upvalues[i]);
+            break;
+        }
+        case COBJ_COROUTINE: {
+            CObjCoroutine *co = (CObjCoroutine*)obj;
+            CContext *ctx = &co->ctx;
+
+            // while it's running its stack is the state's, which was written with the roots
+            if (co->status != COROUTINE_RUNNING) {
+                for (StkPtr value = ctx->stack; value < ctx->top; value++)
+                    writeValueEdge(out, *value);
+
+                for (int i = 0; i < ctx->frameCount; i++)
+                    writeEdge(out, (CObj*)ctx->callFrame[i].closure);
+
+                for (CObjUpval *upvalue = ctx->openUpvalues; upvalue != NULL; upvalue = upvalue->next)
+                    writeEdge(out, (CObj*)upvalue);
+            }
+
+            writeEdge(out, (CObj*)co->resumer);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void writeLabel(FILE *out, CObj *obj) {
+    switch (obj->type) {
+        case COBJ_STRING: {
+            CObjString *str = (CObjString*)obj;
+            writeEscaped(out, str->str, str->length < LABEL_MAX ? str->length : LABEL_MAX);
+            break;
+        }
+        case COBJ_FUNCTION: {
+            CObjFunction *func = (CObjFunction*)obj;
+            char label[LABEL_MAX * 2 + 2];
+
+            int length = snprintf(label, sizeof(label), "%.*s:%.*s", func->module != NULL ? LABEL_MAX : 0,
+                func->module != NULL ? func->module->str : "", LABEL_MAX, func->name != NULL ? func->name->str : UNNAMEDCHUNK);
+            writeEscaped(out, label, length);
+            break;
+        }
+        default:
+            writeEscaped(out, "", 0);
+            break;
+    }
+}
+
+COSMO_API void cosmoM_writeHeapSnapshot(CState *state, FILE *out) {
+    CHeapTracker *tracker = state->heapTracker;
+
+    fprintf(out, "cosmo-heap %d\n", HEAP_SNAPSHOT_VERSION);
+    writeRoots(state, out);
+
+    for (CObj *obj = state->objects; obj != NULL; obj = obj->next) {
+        int site = objectSite(tracker, obj);
+
+        fprintf(out, "O %" PRIxPTR " %s %zu ", (uintptr_t)obj, cosmoO_typeName(obj->type), cosmoO_sizeOf(obj));
+        if (site != -1)
+            writeEscaped(out, tracker->sites.sites[site].name, tracker->sites.sites[site].length);
+        else
+            writeEscaped(out, "", 0);
+
+        fprintf(out, " ");
+        writeLabel(out, obj);
+        fprintf(out, "\n");
+
+        writeEdges(out, obj);
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef CHEAP_H
+#define CHEAP_H
+
+#include "cosmo.h"
+
+#include <stdio.h>
+
+/*
+    heap introspection. the allocation tracker attributes every allocation made while it's running to the "allocation site",
+    which is the function & line the VM was executing at the time (allocations made by C functions are charged to the line
+    that called them, allocations made outside of any call are charged to "<C>"). when the tracker is off the allocator only
+    pays for a NULL check.
+
+    ---- allocation report (cosmoM_writeAllocations) ----
+
+    one site per line, sorted by the bytes the site's objects are still holding onto:
+
+        <live bytes> <live objects> <allocated bytes> <allocated objects> "<site>" [<type>=<count> ...]
+
+    live counts are for objects still on the heap (garbage that hasn't been swept yet included), allocated counts are totals
+    since tracking started. allocated bytes include buffers (table storage, string contents, etc.) that aren't objects on
+    their own. the type counts are the allocated objects of each type.
+
+    ---- heap snapshot (cosmoM_writeHeapSnapshot) ----
+
+    line oriented text, meant to be fed to offline dominator/leak analysis tools. the first line is the header:
+
+        cosmo-heap <version>
+
+    followed by the roots, one per reference the GC treats as a root:
+
+        R <id> <kind> "<name>"
+
+    kind is one of stack, frame, upvalue, coroutine, global, istring, user, loop, error or proto. name is the global's name for
+    globals and empty for everything else. next, every object on the heap:
+
+        O <id> <type> <size> "<site>" "<label>"
+        E <id>
+        E <id>
+        ...
+
+    each O line is followed by one E line per outgoing reference (the same references the GC traces, including the proto).
+    ids are the object's address in hex & are only meaningful within a snapshot. type is the name cosmoO_typeName gives (eg.
+    <table>) & size is the bytes the object & the buffers it owns are using. site is "module:function:line" if the object was
+    allocated while tracking, otherwise it's empty. label is the contents of strings (cut off at 64 bytes) or "module:name"
+    for functions, empty for everything else. sites, labels & names are escaped: '"' & '\' are prefixed with '\', bytes
+    outside of printable ascii are written as \xHH.
+*/
+
+#define HEAP_SNAPSHOT_VERSION 1
+
+/*
+    starts attributing allocations to their sites, objects allocated before this don't have one. returns false if the tracker
+    couldn't be allocated. if the tracker runs out of memory later on it throws away everything it recorded & stops (the
+    allocation itself still goes through), cosmoM_writeAllocations reports it
+*/
+COSMO_API bool cosmoM_startTracking(CState *state);
+// stops tracking & throws away everything that was recorded
+COSMO_API void cosmoM_stopTracking(CState *state);
+COSMO_API bool cosmoM_isTracking(CState *state);
+
+// writes the allocation report described above, does nothing if the tracker isn't running. returns false (without writing
+// anything) if the tracker ran out of memory, or there isn't enough memory to sort the report
+COSMO_API bool cosmoM_writeAllocations(CState *state, FILE *out);
+
+// writes a snapshot of every object on the heap, works with or without the tracker
+COSMO_API void cosmoM_writeHeapSnapshot(CState *state, FILE *out);
+
+// hooks for the allocator, only called while the tracker is running
+void cosmoM_trackBytes(CState *state, size_t bytes);
+void cosmoM_trackObject(CState *state, CObj *obj);
+void cosmoM_untrackObject(CState *state, CObj *obj);
+
+#endif
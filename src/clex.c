@@ -1,43 +1,95 @@
 #include "clex.h"
 #include "cmem.h"
+#include "cobj.h"
 
 #include <string.h>
 
-CReservedWord reservedWords[] = {
-    {TOKEN_AND, "and", 3},
-    {TOKEN_BREAK, "break", 5},
-    {TOKEN_CONTINUE, "continue", 8},
-    {TOKEN_DO, "do", 2},
-    {TOKEN_ELSE, "else", 4},
-    {TOKEN_ELSEIF, "elseif", 6},
-    {TOKEN_END, "end", 3},
-    {TOKEN_FALSE, "false", 5},
-    {TOKEN_FOR, "for", 3},
-    {TOKEN_FUNCTION, "function", 8},
-    {TOKEN_IF, "if", 2},
-    {TOKEN_IN, "in", 2},
-    {TOKEN_LOCAL, "local", 5},
-    {TOKEN_NIL, "nil", 3},
-    {TOKEN_NOT, "not", 3},
-    {TOKEN_OR, "or", 2},
-    {TOKEN_PROTO, "proto", 5},
-    {TOKEN_RETURN, "return", 6},
-    {TOKEN_THEN, "then", 4},
-    {TOKEN_TRUE, "true", 4},
-    {TOKEN_VAR, "var", 3},
-    {TOKEN_WHILE, "while", 5}
+/*
+    reserved words, indexed by a perfect hash of the first character, last character & length of the word (see keywordHash).
+    the multipliers were found with a brute-force search, so if a reserved word is added, a new pair needs to be found!
+*/
+#define KEYWORD_MASK 31
+
+static const CReservedWord reservedWords[KEYWORD_MASK + 1] = {
+    [0] = {TOKEN_ELSE, "else", 4},
+    [1] = {TOKEN_IF, "if", 2},
+    [2] = {TOKEN_RETURN, "return", 6},
+    [3] = {TOKEN_OR, "or", 2},
+    [4] = {TOKEN_BREAK, "break", 5},
+    [5] = {TOKEN_NOT, "not", 3},
+    [8] = {TOKEN_FUNCTION, "function", 8},
+    [10] = {TOKEN_CONTINUE, "continue", 8},
+    [11] = {TOKEN_WHILE, "while", 5},
+    [13] = {TOKEN_NIL, "nil", 3},
+    [15] = {TOKEN_VAR, "var", 3},
+    [16] = {TOKEN_END, "end", 3},
+    [17] = {TOKEN_ELSEIF, "elseif", 6},
+    [19] = {TOKEN_TRUE, "true", 4},
+    [21] = {TOKEN_LOCAL, "local", 5},
+    [22] = {TOKEN_PROTO, "proto", 5},
+    [23] = {TOKEN_DO, "do", 2},
+    [25] = {TOKEN_IN, "in", 2},
+    [26] = {TOKEN_THEN, "then", 4},
+    [28] = {TOKEN_AND, "and", 3},
+    [30] = {TOKEN_FALSE, "false", 5},
+    [31] = {TOKEN_FOR, "for", 3},
 };
 
-// returns true if current token is a heap allocated buffer
+static inline int keywordHash(const char *word, int length) {
+    return ((unsigned char)word[0] * 29 + (unsigned char)word[length - 1] * 15 + length) & KEYWORD_MASK;
+}
+
+// character classes, indexed by the (unsigned) character
+#define CHAR_ALPHA  1 // identifiers can have '_'
+#define CHAR_DIGIT  2
+#define CHAR_HEX    4
+#define CHAR_SPACE  8 // '\n' isn't included since skipWhitespace has to count lines
+
+#define CA CHAR_ALPHA
+#define CD (CHAR_DIGIT | CHAR_HEX)
+#define CH (CHAR_ALPHA | CHAR_HEX)
+#define CS CHAR_SPACE
+
+static const uint8_t charClass[256] = {
+    /* 00 */ 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , CS, 0 , 0 , 0 , CS, 0 , 0,
+    /* 10 */ 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0,
+    /* 20 */ CS, 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0,
+    /* 30 */ CD, CD, CD, CD, CD, CD, CD, CD, CD, CD, 0 , 0 , 0 , 0 , 0 , 0,
+    /* 40 */ 0 , CH, CH, CH, CH, CH, CH, CA, CA, CA, CA, CA, CA, CA, CA, CA,
+    /* 50 */ CA, CA, CA, CA, CA, CA, CA, CA, CA, CA, CA, 0 , 0 , 0 , 0 , CA,
+    /* 60 */ 0 , CH, CH, CH, CH, CH, CH, CA, CA, CA, CA, CA, CA, CA, CA, CA,
+    /* 70 */ CA, CA, CA, CA, CA, CA, CA, CA, CA, CA, CA, 0 , 0 , 0 , 0 , 0,
+    // everything above 0x7f is 0
+};
+
+#undef CA
+#undef CD
+#undef CH
+#undef CS
+
+static inline bool isClass(char c, uint8_t class) {
+    return charClass[(unsigned char)c] & class;
+}
+
+// returns true if current token is being decoded into a scratch buffer
 static bool isBuffer(CLexState *state) {
     return state->buffer !=  NULL;
 }
 
-// marks the current token as heap allocated & allocates the buffer
+// grabs the next scratch buffer in the ring for the current token, it's only allocated the first time it's used
 static void makeBuffer(CLexState *state) {
-    state->buffer = cosmoM_xmalloc(state->cstate, sizeof(char) * 32); // start with a 32 character long buffer
+    int slot = state->nextScratch;
+    state->nextScratch = (slot + 1) % LEX_SCRATCH_COUNT;
+
+    if (state->scratch[slot] == NULL) {
+        state->scratch[slot] = cosmoM_xmalloc(state->cstate, sizeof(char) * 32); // start with a 32 character long buffer
+        state->scratchCap[slot] = 32;
+    }
+
+    state->buffer = state->scratch[slot];
     state->bufCount = 0;
-    state->bufCap = 32;
+    state->bufCap = state->scratchCap[slot];
+    state->bufSlot = slot;
 }
 
 static void resetBuffer(CLexState *state) {
@@ -46,9 +98,10 @@ static void resetBuffer(CLexState *state) {
     state->bufCap = 0;
 }
 
-// cancels the token heap buffer and frees it
-static void freeBuffer(CLexState *state) {
-    cosmoM_freearray(state->cstate, char, state->buffer, state->bufCap);
+// hands the (possibly grown) buffer back to its scratch slot so it can be reused
+static void releaseBuffer(CLexState *state) {
+    state->scratch[state->bufSlot] = state->buffer;
+    state->scratchCap[state->bufSlot] = state->bufCap;
 
     resetBuffer(state);
 }
@@ -60,28 +113,36 @@ static void appendBuffer(CLexState *state, char c) {
     state->buffer[state->bufCount++] = c;
 }
 
+// adds length characters to the buffer at once
+static void appendRange(CLexState *state, const char *str, size_t length) {
+    if (state->bufCount + length > state->bufCap) {
+        size_t cap = state->bufCap;
+        while (state->bufCount + length > cap)
+            cap *= GROW_FACTOR;
+
+        state->buffer = cosmoM_reallocate(state->cstate, state->buffer, state->bufCap, cap);
+        state->bufCap = cap;
+    }
+
+    memcpy(state->buffer + state->bufCount, str, length);
+    state->bufCount += length;
+}
+
 // saves the current character to the buffer, grows the buffer as needed
 static void saveBuffer(CLexState *state) {
     appendBuffer(state, *state->currentChar);
 }
 
-// resets the lex state buffer & returns the allocated buffer as a null terminated string
+// releases the lex state buffer & returns it as a null terminated string. it's only valid until the scratch slot is reused!
 static char *cutBuffer(CLexState *state, int *length) {
     // append the null terminator
     appendBuffer(state, '\0');
 
-    // cache buffer info
     char *buf = state->buffer;
-    size_t count = state->bufCount;
-    size_t cap = state->bufCap;
+    *length = state->bufCount - 1;
 
-    *length = count - 1;
-
-    // reset lex state buffer!
-    resetBuffer(state);
-
-    // shrink the buffer to only use what we need
-    return cosmoM_reallocate(state->cstate, buf, cap, count);
+    releaseBuffer(state);
+    return buf;
 }
 
 static CToken makeToken(CLexState *state, CTokenType type) {
@@ -101,6 +162,22 @@ static CToken makeToken(CLexState *state, CTokenType type) {
     return token;
 }
 
+// the window gets reused when streaming, so the token's text has to be moved somewhere that outlives it
+static void copyToken(CLexState *state, CToken *token) {
+    // errors point to a static message & escaped strings were already decoded into a scratch buffer
+    if (token->type == TOKEN_ERROR || (token->type == TOKEN_STRING && token->start == state->scratch[state->bufSlot]))
+        return;
+
+    if (token->type == TOKEN_IDENTIFIER) {
+        // identifiers end up in locals & constants, so they're interned (the GC is frozen while compiling)
+        token->start = cosmoO_copyString(state->cstate, token->start, token->length)->str;
+    } else {
+        makeBuffer(state);
+        appendRange(state, token->start, token->length);
+        token->start = cutBuffer(state, &token->length);
+    }
+}
+
 static CToken makeError(CLexState *state, const char *msg) {
     CToken token;
     token.type = TOKEN_ERROR;
@@ -109,21 +186,92 @@ static CToken makeError(CLexState *state, const char *msg) {
     token.line = state->line;
 
     if (isBuffer(state))
-        freeBuffer(state);
-        
+        releaseBuffer(state);
+
+
     return token;
 }
 
+/*
+    throws away the window & pulls in the next lines from the reader, returns false if there's nothing left. this is only called
+    once the lexer is between tokens at the end of the window, since the window always ends with a complete line (& strings
+    can't stretch across lines) only multiline comments can be cut off by it.
+*/
+static bool fillWindow(CLexState *state) {
+    if (state->reader == NULL || state->currentChar != state->windowEnd)
+        return false;
+
+    // slide the partial line to the front of the window
+    *state->windowEnd = state->hidden;
+    memmove(state->window, state->windowEnd, state->partial);
+    size_t size = state->partial;
+    size_t lineEnd = 0;
+
+    while (!state->readerDone) {
+        // grab the next block if we've used up the last one
+        if (state->pendingSize == 0) {
+            const char *block = state->reader(state->cstate, state->ud, &state->pendingSize);
+
+            if (block == NULL || state->pendingSize == 0) {
+                state->pendingSize = 0;
+                state->readerDone = true;
+                break;
+            }
+
+            state->pending = block;
+        }
+
+        // if the line is taking up more than half of the window, grow it
+        if (size + 1 > state->windowCap / 2) {
+            size_t cap = state->windowCap * GROW_FACTOR;
+            state->window = cosmoM_reallocate(state->cstate, state->window, state->windowCap, cap);
+            state->windowCap = cap;
+        }
+
+        size_t count = state->windowCap - size - 1; // room for the '\0'
+        if (count > state->pendingSize)
+            count = state->pendingSize;
+
+        memcpy(state->window + size, state->pending, count);
+        state->pending += count;
+        state->pendingSize -= count;
+
+        // only show up to the last complete line
+        for (size_t i = size + count; i > size; i--) {
+            if (state->window[i - 1] == '\n') {
+                lineEnd = i;
+                break;
+            }
+        }
+
+        size += count;
+        if (lineEnd > 0)
+            break;
+    }
+
+    // the last line doesn't need a '\n'
+    if (state->readerDone)
+        lineEnd = size;
+
+    state->startChar = state->window;
+    state->currentChar = state->window;
+    state->windowEnd = state->window + lineEnd;
+    state->partial = size - lineEnd;
+    state->hidden = *state->windowEnd;
+    *state->windowEnd = '\0';
+    return lineEnd > 0;
+}
+
 static inline bool isEnd(CLexState *state) {
     return *state->currentChar == '\0';
 }
 
 static inline bool isNumerical(char c) {
-    return c >= '0' && c <= '9';
+    return isClass(c, CHAR_DIGIT);
 }
 
-static bool isAlpha(char c) {
-    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; // identifiers can have '_'
+static inline bool isAlpha(char c) {
+    return isClass(c, CHAR_ALPHA);
 }
 
 static bool match(CLexState *state, char expected) {
@@ -154,18 +302,16 @@ char next(CLexState *state) {
 }
 
 bool isHex(char c) {
-    return isNumerical(c) || ('A' <= c && 'F' >= c) || ('a' <= c && 'f' >= c);
+    return isClass(c, CHAR_HEX);
 }
 
 CTokenType identifierType(CLexState *state) {
     int length = state->currentChar - state->startChar;
+    const CReservedWord *word = &reservedWords[keywordHash(state->startChar, length)];
 
-    // check against reserved word list
-    for (size_t i = 0; i < sizeof(reservedWords) / sizeof(CReservedWord); i++) {
-        // it matches the reserved word
-        if (reservedWords[i].len == length && memcmp(state->startChar, reservedWords[i].word, length) == 0) 
-            return reservedWords[i].type;
-    }
+    // there's only 1 reserved word it could be, check if it matches (empty slots have a len of 0)
+    if (word->len == length && memcmp(state->startChar, word->word, length) == 0)
+        return word->type;
 
     // else, it's an identifier
     return TOKEN_IDENTIFIER;
@@ -173,6 +319,10 @@ CTokenType identifierType(CLexState *state) {
 
 void skipWhitespace(CLexState *state) {
     while (true) {
+        // skip runs of plain whitespace
+        while (isClass(*state->currentChar, CHAR_SPACE))
+            state->currentChar++;
+
         char c = peek(state);
         switch (c) {
             case '\n': // mark new line
@@ -191,8 +341,16 @@ void skipWhitespace(CLexState *state) {
                     // keep consuming whitespace
                     break;
                 } else if (peekNext(state) == '*') { // multiline comments
-                    while (!isEnd(state) && !(peek(state) == '*' && peekNext(state) == '/')) // if it's the end of the comment or the end of the source
+                    while (!(peek(state) == '*' && peekNext(state) == '/')) { // if it's the end of the comment or the end of the source
+                        if (isEnd(state)) {
+                            if (!fillWindow(state))
+                                break;
+
+                            continue; // the new window could start with the '*/'
+                        }
+
                         next(state);
+                    }
 
                     // consume the '*/'
                     next(state);
@@ -202,6 +360,11 @@ void skipWhitespace(CLexState *state) {
                     break;
                 }
                 return; // it's a TOKEN_SLASH, let the main body handle that
+            case '\0': // end of the window, streamed source might have more
+                if (fillWindow(state))
+                    break;
+
+                return;
             default: // it's no longer whitespace, return!
                 return;
         }
@@ -209,7 +372,26 @@ void skipWhitespace(CLexState *state) {
 }
 
 CToken parseString(CLexState *state) {
+    char *start = state->currentChar;
+
+    // most literals don't have any escapes, so the token can just point into the source
+    while (peek(state) != '"' && peek(state) != '\\') {
+        if (peek(state) == '\n' || isEnd(state)) // strings can't stretch across lines
+            return makeError(state, "Unterminated string!");
+        next(state);
+    }
+
+    if (peek(state) == '"') {
+        state->startChar = start; // skip the opening quote
+        CToken token = makeToken(state, TOKEN_STRING);
+        next(state); // consume closing quote
+        return token;
+    }
+
+    // it has escapes, decode it into a scratch buffer starting with what we've already scanned
     makeBuffer(state); // buffer mode
+    appendRange(state, start, state->currentChar - start);
+
     while (peek(state) != '"' && !isEnd(state)) {
         switch (peek(state)) {
             case '\n': // strings can't stretch across lines
@@ -343,9 +525,9 @@ CToken parseNumber(CLexState *state) {
 }
 
 CToken parseIdentifier(CLexState *state) {
-    // read literal
-    while ((isAlpha(peek(state)) || isNumerical(peek(state))) && !isEnd(state)) 
-        next(state);
+    // read literal ('\0' has no class, so this stops at the end of the source)
+    while (isClass(*state->currentChar, CHAR_ALPHA | CHAR_DIGIT))
+        state->currentChar++;
     
     return makeToken(state, identifierType(state)); // is it a reserved word?
 }
@@ -358,17 +540,68 @@ CLexState *cosmoL_newLexState(CState *cstate, const char *source) {
     state->lastLine = 0;
     state->lastType = TOKEN_ERROR;
     state->cstate = cstate;
+    state->bufSlot = 0;
+    state->nextScratch = 0;
+
+    state->reader = NULL;
+    state->ud = NULL;
+    state->pending = NULL;
+    state->pendingSize = 0;
+    state->window = NULL;
+    state->windowEnd = NULL;
+    state->windowCap = 0;
+    state->partial = 0;
+    state->hidden = '\0';
+    state->readerDone = true;
+
+    for (int i = 0; i < LEX_SCRATCH_COUNT; i++) {
+        state->scratch[i] = NULL;
+        state->scratchCap[i] = 0;
+    }
 
     resetBuffer(state);
 
     return state;
 }
 
+void cosmoL_setReader(CState *cstate, CLexState *state, CosmoReader reader, void *ud) {
+    char *window = cosmoM_xmalloc(cstate, sizeof(char) * LEX_WINDOW_SIZE);
+    window[0] = '\0';
+
+    // the window starts empty, so the first token will fill it
+    state->startChar = window;
+    state->currentChar = window;
+    state->reader = reader;
+    state->ud = ud;
+    state->window = window;
+    state->windowEnd = window;
+    state->windowCap = LEX_WINDOW_SIZE;
+    state->readerDone = false;
+}
+
+CLexState *cosmoL_newStreamLexState(CState *cstate, CosmoReader reader, void *ud) {
+    CLexState *state = cosmoL_newLexState(cstate, "");
+    cosmoL_setReader(cstate, state, reader, ud);
+    return state;
+}
+
 void cosmoL_freeLexState(CState *state, CLexState *lstate) {
+    // if we were unwound mid-token the buffer might've been grown out from under its scratch slot
+    if (isBuffer(lstate))
+        releaseBuffer(lstate);
+
+    if (lstate->window != NULL) {
+        cosmoM_freearray(state, char, lstate->window, lstate->windowCap);
+    }
+
+    for (int i = 0; i < LEX_SCRATCH_COUNT; i++) {
+        cosmoM_freearray(state, char, lstate->scratch[i], lstate->scratchCap[i]);
+    }
+
     cosmoM_free(state, CLexState, lstate);
 }
 
-CToken cosmoL_scanToken(CLexState *state) {
+static CToken scanToken(CLexState *state) {
     skipWhitespace(state);
 
     state->startChar = state->currentChar;
@@ -420,3 +653,13 @@ CToken cosmoL_scanToken(CLexState *state) {
 
     return makeError(state, "Unknown symbol!");
 }
+
+CToken cosmoL_scanToken(CLexState *state) {
+    // kept separate so the plain source path stays a straight tail call
+    if (state->reader == NULL)
+        return scanToken(state);
+
+    CToken token = scanToken(state);
+    copyToken(state, &token);
+    return token;
+}
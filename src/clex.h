@@ -39,7 +39,7 @@ typedef enum {
 
     // literals
     TOKEN_IDENTIFIER,
-    TOKEN_STRING, // token.start is heap allocated and separate from the source string!
+    TOKEN_STRING, // token.start is either a view into the source or a lexer scratch buffer (if it had escapes), copy it before the next few tokens are scanned!
     TOKEN_NUMBER,
     TOKEN_HEXNUMBER,
     TOKEN_BINNUMBER,
@@ -85,12 +85,33 @@ typedef struct {
     int line;
 } CToken;
 
+// escaped strings (and streamed tokens) are copied into a small ring of scratch buffers, so the parser's previous & current tokens can both live there
+#define LEX_SCRATCH_COUNT 2
+
+// default size of the source window when lexing from a CosmoReader, it only grows if a single line doesn't fit in half of it
+#define LEX_WINDOW_SIZE 8192
+
 typedef struct {
     char *currentChar;
     char *startChar;
     char *buffer; // if non-NULL & bufCount > 0, token->start & token->length will be set to buffer & bufCount respectively
     size_t bufCount;
-    size_t bufCap; 
+    size_t bufCap;
+    char *scratch[LEX_SCRATCH_COUNT]; // reused between tokens, only grows
+    size_t scratchCap[LEX_SCRATCH_COUNT];
+    int bufSlot; // scratch slot buffer belongs to
+    int nextScratch;
+    // streamed source, if reader is NULL the whole source was passed to cosmoL_newLexState & these are unused
+    CosmoReader reader;
+    void *ud;
+    const char *pending; // what's left of the last block the reader returned
+    size_t pendingSize;
+    char *window; // only ever holds whole lines (besides the last one), so tokens never get cut off by the end of the window
+    char *windowEnd; // always points to a '\0', the start of the next partial line is saved in hidden
+    size_t windowCap;
+    size_t partial; // length of the partial line after windowEnd, it's shown once the rest of it has been read
+    char hidden;
+    bool readerDone;
     int line; // current line
     int lastLine; // line of the previous consumed token
     bool isEnd;
@@ -99,6 +120,11 @@ typedef struct {
 } CLexState;
 
 CLexState *cosmoL_newLexState(CState *state, const char *source);
+// pulls the source from reader as it's needed, token text is copied out of the window (identifiers are interned) so it stays valid while parsing
+CLexState *cosmoL_newStreamLexState(CState *state, CosmoReader reader, void *ud);
+// same as cosmoL_newStreamLexState, but for a lex state that was made with an empty source. the lex state is made first so it
+// can still be freed if the window can't be allocated
+void cosmoL_setReader(CState *state, CLexState *lstate, CosmoReader reader, void *ud);
 void cosmoL_freeLexState(CState *state, CLexState *lstate);
 
 CToken cosmoL_scanToken(CLexState *state);
@@ -0,0 +1,1218 @@
+#define _GNU_SOURCE // accept4 & pipe2
+
+#include "cloop.h"
+#include "cstate.h"
+#include "cvm.h"
+#include "cmem.h"
+#include "cobj.h"
+#include "cbaselib.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef enum {
+    WAIT_NONE,
+    WAIT_READ, // reader side
+    WAIT_ACCEPT,
+    WAIT_WRITE, // writer side
+    WAIT_CONNECT
+} CWaitKind;
+
+// something that can't yield & is running the loop until its operation is done (see block)
+typedef struct CBlocked {
+    struct CBlocked *next;
+    CValue result;
+    int err;
+    bool done;
+} CBlocked;
+
+typedef struct CWaiter {
+    CWaitKind kind; // WAIT_NONE if nobody is waiting
+    CObjCoroutine *co; // the suspended coroutine, NULL if blocked is set instead
+    CBlocked *blocked;
+    size_t size; // WAIT_READ: the most bytes to read, WAIT_WRITE: bytes written so far
+    CObjString *data; // WAIT_WRITE: what's being written
+} CWaiter;
+
+typedef struct CLoopFd {
+    CWaiter reader;
+    CWaiter writer;
+    bool open; // the loop owns the fd & closes it when it's freed
+    bool registered; // in the epoll set. it's registered oneshot, so it's only armed while someone is waiting
+} CLoopFd;
+
+typedef struct CTimer {
+    double when;
+    uint64_t seq; // timers due at the same time fire in the order they were made
+    CObjCoroutine *co;
+    CBlocked *blocked;
+} CTimer;
+
+// a coroutine whose operation finished, it's resumed with val
+typedef struct CReady {
+    CObjCoroutine *co;
+    CValue val;
+    int err;
+} CReady;
+
+struct CLoop {
+    int epfd;
+    CLoopFd *fds; // indexed by fd
+    int fdCapacity;
+    CTimer *timers; // min-heap on when
+    int timerCount;
+    int timerCapacity;
+    uint64_t timerSeq;
+    CReady *ready; // the coroutines in [readyHead, readyCount) are waiting to be resumed
+    int readyHead;
+    int readyCount;
+    int readyCapacity;
+    int draining; // # of drains running, the queue isn't moved until they're done
+    CBlocked *blocked; // innermost first
+    int waiting; // operations & timers in flight
+    int error; // errno of the last operation that was handed back
+    CObjObject *handleProto; // NULL until the io library is loaded
+};
+
+COSMO_API double cosmoE_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+COSMO_API CLoop *cosmoE_getLoop(CState *state) {
+    if (state->loop != NULL)
+        return state->loop;
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        cosmoV_error(state, "Couldn't make the event loop: %s", strerror(errno));
+        return NULL;
+    }
+
+    CLoop *loop = cosmoM_xmalloc(state, sizeof(CLoop));
+    loop->epfd = epfd;
+    loop->fds = NULL;
+    loop->fdCapacity = 0;
+    loop->timers = NULL;
+    loop->timerCount = 0;
+    loop->timerCapacity = ARRAY_START;
+    loop->timerSeq = 0;
+    loop->ready = NULL;
+    loop->readyHead = 0;
+    loop->readyCount = 0;
+    loop->readyCapacity = ARRAY_START;
+    loop->draining = 0;
+    loop->blocked = NULL;
+    loop->waiting = 0;
+    loop->error = 0;
+    loop->handleProto = NULL;
+    state->loop = loop;
+
+    // a write to a closed pipe or socket should fail, not kill the process
+    struct sigaction action;
+    if (sigaction(SIGPIPE, NULL, &action) == 0 && action.sa_handler == SIG_DFL)
+        signal(SIGPIPE, SIG_IGN);
+
+    return loop;
+}
+
+void cosmoE_freeLoop(CState *state) {
+    CLoop *loop = state->loop;
+    if (loop == NULL)
+        return;
+
+    for (int fd = 0; fd < loop->fdCapacity; fd++) {
+        if (loop->fds[fd].open)
+            close(fd);
+    }
+
+    close(loop->epfd);
+    if (loop->fds != NULL)
+        cosmoM_freearray(state, CLoopFd, loop->fds, loop->fdCapacity);
+    if (loop->timers != NULL)
+        cosmoM_freearray(state, CTimer, loop->timers, loop->timerCapacity);
+    if (loop->ready != NULL)
+        cosmoM_freearray(state, CReady, loop->ready, loop->readyCapacity);
+    cosmoM_free(state, CLoop, loop);
+    state->loop = NULL;
+}
+
+void cosmoE_visitLoop(CState *state, CosmoLoopVisitor visit, void *ud) {
+    CLoop *loop = state->loop;
+
+    for (int fd = 0; fd < loop->fdCapacity; fd++) {
+        CLoopFd *f = &loop->fds[fd];
+
+        if (f->reader.co != NULL)
+            visit(state, cosmoV_newRef(f->reader.co), ud);
+        if (f->writer.co != NULL)
+            visit(state, cosmoV_newRef(f->writer.co), ud);
+        if (f->writer.data != NULL)
+            visit(state, cosmoV_newRef(f->writer.data), ud);
+    }
+
+    for (int i = 0; i < loop->timerCount; i++) {
+        if (loop->timers[i].co != NULL)
+            visit(state, cosmoV_newRef(loop->timers[i].co), ud);
+    }
+
+    for (int i = loop->readyHead; i < loop->readyCount; i++) {
+        visit(state, cosmoV_newRef(loop->ready[i].co), ud);
+        visit(state, loop->ready[i].val, ud);
+    }
+
+    for (CBlocked *blocked = loop->blocked; blocked != NULL; blocked = blocked->next) {
+        if (blocked->done)
+            visit(state, blocked->result, ud);
+    }
+
+    if (loop->handleProto != NULL)
+        visit(state, cosmoV_newRef(loop->handleProto), ud);
+}
+
+// grows the fd table to fit fd
+static CLoopFd *getFd(CState *state, CLoop *loop, int fd) {
+    if (fd >= loop->fdCapacity) {
+        int newCap = loop->fdCapacity == 0 ? ARRAY_START : loop->fdCapacity;
+        while (newCap <= fd)
+            newCap *= GROW_FACTOR;
+
+        loop->fds = cosmoM_reallocate(state, loop->fds, sizeof(CLoopFd) * loop->fdCapacity, sizeof(CLoopFd) * newCap);
+        memset(&loop->fds[loop->fdCapacity], 0, sizeof(CLoopFd) * (newCap - loop->fdCapacity));
+        loop->fdCapacity = newCap;
+    }
+
+    return &loop->fds[fd];
+}
+
+// arms fd for whatever its waiters are waiting on, returns the errno if epoll wouldn't take it
+static int arm(CLoop *loop, int fd) {
+    CLoopFd *f = &loop->fds[fd];
+    struct epoll_event event;
+
+    // once an event fires the fd is disarmed, so with nobody waiting there's nothing to do
+    event.events = EPOLLONESHOT;
+    event.data.fd = fd;
+    if (f->reader.kind != WAIT_NONE)
+        event.events |= EPOLLIN;
+    if (f->writer.kind != WAIT_NONE)
+        event.events |= EPOLLOUT;
+
+    if (event.events == EPOLLONESHOT)
+        return 0;
+
+    // the fd might've been closed & reused behind our back, so fall back to the other op
+    if (f->registered && epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &event) == 0)
+        return 0;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &event) == 0 || (errno == EEXIST && epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &event) == 0)) {
+        f->registered = true;
+        return 0;
+    }
+
+    return errno;
+}
+
+// hands val to whoever was waiting, coroutines are resumed by the next drain
+static void complete(CState *state, CLoop *loop, CObjCoroutine *co, CBlocked *blocked, CValue val, int err) {
+    if (blocked != NULL) {
+        blocked->result = val;
+        blocked->err = err;
+        blocked->done = true;
+        return;
+    }
+
+    cosmoM_growarray(state, CReady, loop->ready, loop->readyCount, loop->readyCapacity);
+    loop->ready[loop->readyCount++] = (CReady){co, val, err};
+}
+
+// takes the waiter off of its fd, returns who was waiting
+static CWaiter detach(CLoop *loop, CWaiter *w) {
+    CWaiter old = *w;
+
+    *w = (CWaiter){WAIT_NONE, NULL, NULL, 0, NULL};
+    loop->waiting--;
+    return old;
+}
+
+// clears the waiter, whoever was waiting gets val
+static void finishWaiter(CState *state, CLoop *loop, CWaiter *w, CValue val, int err) {
+    CWaiter old = detach(loop, w);
+    complete(state, loop, old.co, old.blocked, val, err);
+}
+
+// ================================================================ [OPERATIONS] ================================================================
+
+// each of these returns false if the operation would block, otherwise it's done & *val, *err are its result
+
+static bool tryRead(CState *state, int fd, size_t max, CValue *val, int *err) {
+    char stackBuf[LOOP_READ_SIZE];
+    char *buf = max > LOOP_READ_SIZE ? cosmoM_xmalloc(state, max) : stackBuf;
+    ssize_t n;
+
+    do {
+        n = read(fd, buf, max);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        if (buf != stackBuf)
+            cosmoM_freearray(state, char, buf, max);
+        return false;
+    }
+
+    *err = n == -1 ? errno : 0;
+    *val = n > 0 ? cosmoV_newRef(cosmoO_copyString(state, buf, n)) : cosmoV_newNil(); // nil at the end of the file too
+
+    if (buf != stackBuf)
+        cosmoM_freearray(state, char, buf, max);
+    return true;
+}
+
+static bool tryWrite(CState *state, int fd, CObjString *str, size_t *written, CValue *val, int *err) {
+    while (*written < str->length) {
+        ssize_t n = write(fd, str->str + *written, str->length - *written);
+
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return false;
+
+            *val = cosmoV_newNil();
+            *err = errno;
+            return true;
+        }
+
+        *written += n;
+    }
+
+    *val = cosmoV_newBoolean(true);
+    *err = 0;
+    return true;
+}
+
+typedef struct {
+    int *fds;
+    int count;
+} OwnCall;
+
+static bool ownFds(CState *state, void *ud) {
+    OwnCall *call = (OwnCall*)ud;
+
+    for (int i = 0; i < call->count; i++) {
+        if (!cosmoE_addFd(state, call->fds[i]))
+            return false;
+    }
+
+    return true;
+}
+
+// hands fds the loop hasn't seen yet to it. if the fd table can't grow they're closed before the out of memory error is passed on
+static void own(CState *state, int *fds, int count) {
+    OwnCall call = {fds, count};
+    if (cosmoV_runProtected(state, state->top, ownFds, &call))
+        return;
+
+    for (int i = 0; i < count; i++) {
+        if (fds[i] >= state->loop->fdCapacity || !state->loop->fds[fds[i]].open)
+            close(fds[i]);
+    }
+
+    if (state->error == state->memError)
+        cosmoV_throwMemory(state);
+}
+
+// the new fd is handed to the loop before the handle is made, so it's closed with the loop if the handle can't be made
+static CValue newHandle(CState *state, int fd) {
+    own(state, &fd, 1);
+    cosmoE_pushHandle(state, fd);
+    return *cosmoV_pop(state);
+}
+
+static bool tryAccept(CState *state, int fd, CValue *val, int *err) {
+    int conn;
+
+    do {
+        conn = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    } while (conn == -1 && (errno == EINTR || errno == ECONNABORTED));
+
+    if (conn == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return false;
+
+    *err = conn == -1 ? errno : 0;
+    *val = conn == -1 ? cosmoV_newNil() : newHandle(state, conn);
+    return true;
+}
+
+// the connection attempt is already done once fd is writable
+static void finishConnect(CState *state, int fd, CValue *val, int *err) {
+    int soErr = 0;
+    socklen_t len = sizeof(soErr);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &soErr, &len) == -1)
+        soErr = errno;
+
+    if (soErr != 0) {
+        cosmoE_closeFd(state, fd);
+        *val = cosmoV_newNil();
+    } else {
+        *val = newHandle(state, fd);
+    }
+
+    *err = soErr;
+}
+
+// tries the operation fd's reader (or writer) is waiting on again, if it's done the waiter is finished
+static void retry(CState *state, CLoop *loop, int fd, bool reader) {
+    CWaiter *w = reader ? &loop->fds[fd].reader : &loop->fds[fd].writer;
+    CValue val;
+    int err;
+
+    switch (w->kind) {
+        case WAIT_READ:
+            if (!tryRead(state, fd, w->size, &val, &err))
+                return;
+            break;
+        case WAIT_ACCEPT:
+            if (!tryAccept(state, fd, &val, &err))
+                return;
+            break;
+        case WAIT_WRITE:
+            if (!tryWrite(state, fd, w->data, &w->size, &val, &err))
+                return;
+            break;
+        case WAIT_CONNECT: {
+            // fd is handed over to the new handle (or closed), so the waiter has to come off of it first
+            CWaiter old = detach(loop, w);
+            finishConnect(state, fd, &val, &err);
+            complete(state, loop, old.co, old.blocked, val, err);
+            return;
+        }
+        default:
+            return;
+    }
+
+    // accepting might've grown the fd table
+    w = reader ? &loop->fds[fd].reader : &loop->fds[fd].writer;
+    finishWaiter(state, loop, w, val, err);
+}
+
+// everyone waiting on fd gets nil & err
+static void failFd(CState *state, CLoop *loop, int fd, int err) {
+    if (loop->fds[fd].reader.kind != WAIT_NONE)
+        finishWaiter(state, loop, &loop->fds[fd].reader, cosmoV_newNil(), err);
+    if (loop->fds[fd].writer.kind != WAIT_NONE)
+        finishWaiter(state, loop, &loop->fds[fd].writer, cosmoV_newNil(), err);
+}
+
+static void pollFd(CState *state, CLoop *loop, int fd, uint32_t events) {
+    if (fd >= loop->fdCapacity)
+        return;
+
+    // errors & hangups wake everyone up, the operation itself reports what happened
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        retry(state, loop, fd, true);
+    if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+        retry(state, loop, fd, false);
+
+    // whoever is still waiting has to be re-armed
+    int err = arm(loop, fd);
+    if (err != 0)
+        failFd(state, loop, fd, err);
+}
+
+// ================================================================ [TIMERS] ================================================================
+
+static bool timerBefore(CTimer *a, CTimer *b) {
+    return a->when < b->when || (a->when == b->when && a->seq < b->seq);
+}
+
+static void addTimer(CState *state, CLoop *loop, double when, CObjCoroutine *co, CBlocked *blocked) {
+    cosmoM_growarray(state, CTimer, loop->timers, loop->timerCount, loop->timerCapacity);
+
+    // sift up
+    CTimer timer = {when, loop->timerSeq++, co, blocked};
+    int i = loop->timerCount++;
+    while (i > 0 && timerBefore(&timer, &loop->timers[(i - 1) / 2])) {
+        loop->timers[i] = loop->timers[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+
+    loop->timers[i] = timer;
+    loop->waiting++;
+}
+
+static void removeTimer(CLoop *loop, int indx) {
+    CTimer last = loop->timers[--loop->timerCount];
+    int i = indx;
+    loop->waiting--;
+
+    if (i == loop->timerCount)
+        return;
+
+    // the last timer takes its place, it might have to go either way
+    while (i > 0 && timerBefore(&last, &loop->timers[(i - 1) / 2])) {
+        loop->timers[i] = loop->timers[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= loop->timerCount)
+            break;
+        if (child + 1 < loop->timerCount && timerBefore(&loop->timers[child + 1], &loop->timers[child]))
+            child++;
+        if (!timerBefore(&loop->timers[child], &last))
+            break;
+
+        loop->timers[i] = loop->timers[child];
+        i = child;
+    }
+
+    loop->timers[i] = last;
+}
+
+static void cancelTimer(CLoop *loop, CObjCoroutine *co, CBlocked *blocked) {
+    for (int i = 0; i < loop->timerCount; i++) {
+        if (loop->timers[i].co == co && loop->timers[i].blocked == blocked) {
+            removeTimer(loop, i);
+            return;
+        }
+    }
+}
+
+// fires every timer that's due, timers made after seqLimit wait for the next run so sleep(0) can't spin us forever
+static void fireTimers(CState *state, CLoop *loop, uint64_t seqLimit) {
+    double now = cosmoE_now();
+
+    while (loop->timerCount > 0 && loop->timers[0].when <= now && loop->timers[0].seq < seqLimit) {
+        CTimer timer = loop->timers[0];
+        removeTimer(loop, 0);
+        complete(state, loop, timer.co, timer.blocked, cosmoV_newNil(), 0);
+    }
+}
+
+// ================================================================ [LOOP] ================================================================
+
+// moves what's left of the ready queue to the front, once nothing is draining it
+static void compact(CLoop *loop) {
+    if (loop->draining > 0 || loop->readyHead == 0)
+        return;
+
+    memmove(loop->ready, &loop->ready[loop->readyHead], sizeof(CReady) * (loop->readyCount - loop->readyHead));
+    loop->readyCount -= loop->readyHead;
+    loop->readyHead = 0;
+}
+
+// resumes the coroutines that were ready when we started, anything that gets ready while they're running waits for the next run
+static bool drain(CState *state, CLoop *loop) {
+    int limit = loop->readyCount;
+    bool ok = true;
+
+    // a coroutine can end up running the loop itself (see block), so the queue is popped as we go
+    loop->draining++;
+    while (loop->readyHead < limit) {
+        CReady ready = loop->ready[loop->readyHead++];
+
+        loop->error = ready.err;
+        cosmoV_pushValue(state, ready.val);
+        int nres = cosmoV_resume(state, ready.co, 1);
+
+        if (nres == -1) {
+            ok = false;
+            break;
+        }
+
+        cosmoV_setTop(state, nres); // whatever it yielded or returned is thrown away
+    }
+    loop->draining--;
+
+    compact(loop);
+    return ok;
+}
+
+typedef struct {
+    CLoop *loop;
+    double timeout;
+} RunCall;
+
+static bool runOnce(CState *state, void *ud) {
+    RunCall *call = (RunCall*)ud;
+    CLoop *loop = call->loop;
+    double timeout = call->timeout;
+    uint64_t seqLimit = loop->timerSeq;
+    struct epoll_event events[LOOP_EVENTS];
+
+    // don't sleep past the next timer, or at all if there's nothing that could wake us up
+    double next = cosmoE_nextTimeout(state);
+    if (next >= 0 && (timeout < 0 || next < timeout))
+        timeout = next;
+    if (loop->waiting == 0)
+        timeout = 0;
+
+    int ms = timeout < 0 ? -1 : (timeout * 1000 >= INT_MAX ? INT_MAX : (int)ceil(timeout * 1000));
+    int n = epoll_wait(loop->epfd, events, LOOP_EVENTS, ms);
+    if (n == -1 && errno != EINTR) {
+        cosmoV_error(state, "epoll_wait() failed: %s", strerror(errno));
+        return false;
+    }
+
+    // the results are only held by locals until they're queued
+    cosmoM_freezeGC(state);
+    for (int i = 0; i < n; i++)
+        pollFd(state, loop, events[i].data.fd, events[i].events);
+
+    fireTimers(state, loop, seqLimit);
+    cosmoM_unfreezeGC(state);
+
+    return drain(state, loop);
+}
+
+COSMO_API bool cosmoE_runOnce(CState *state, double timeout) {
+    if (state->loop == NULL)
+        return true;
+
+    // running out of memory in here can't be allowed to unwind past a blocked operation
+    RunCall call = {state->loop, timeout};
+    int draining = state->loop->draining;
+    bool ok = cosmoV_runProtected(state, state->top, runOnce, &call);
+
+    state->loop->draining = draining;
+    compact(state->loop);
+    return ok;
+}
+
+COSMO_API bool cosmoE_run(CState *state) {
+    while (cosmoE_pending(state) > 0) {
+        if (!cosmoE_runOnce(state, -1))
+            return false;
+    }
+
+    return true;
+}
+
+COSMO_API int cosmoE_pending(CState *state) {
+    CLoop *loop = state->loop;
+    return loop != NULL ? loop->waiting + loop->readyCount - loop->readyHead : 0;
+}
+
+COSMO_API int cosmoE_getFd(CState *state) {
+    CLoop *loop = cosmoE_getLoop(state);
+    return loop != NULL ? loop->epfd : -1;
+}
+
+COSMO_API double cosmoE_nextTimeout(CState *state) {
+    CLoop *loop = state->loop;
+
+    if (loop == NULL)
+        return -1;
+    if (loop->readyCount > loop->readyHead)
+        return 0;
+    if (loop->timerCount == 0)
+        return -1;
+
+    double left = loop->timers[0].when - cosmoE_now();
+    return left > 0 ? left : 0;
+}
+
+COSMO_API int cosmoE_error(CState *state) {
+    return state->loop != NULL ? state->loop->error : 0;
+}
+
+COSMO_API bool cosmoE_addFd(CState *state, int fd) {
+    CLoop *loop = cosmoE_getLoop(state);
+    if (loop == NULL)
+        return false;
+
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        cosmoV_error(state, "Couldn't make fd %d non-blocking: %s", fd, strerror(errno));
+        return false;
+    }
+
+    getFd(state, loop, fd)->open = true;
+    return true;
+}
+
+COSMO_API void cosmoE_closeFd(CState *state, int fd) {
+    CLoop *loop = state->loop;
+
+    if (loop != NULL && fd >= 0 && fd < loop->fdCapacity) {
+        failFd(state, loop, fd, ECANCELED);
+
+        if (loop->fds[fd].registered)
+            epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+        loop->fds[fd].registered = false;
+        loop->fds[fd].open = false;
+    }
+
+    close(fd);
+}
+
+// ================================================================ [WAITING] ================================================================
+
+// pushes the result of an operation that's done
+static int finish(CState *state, CLoop *loop, CValue val, int err) {
+    loop->error = err;
+    cosmoV_pushValue(state, val);
+    return 1;
+}
+
+// true if the running coroutine can be suspended right here (see cosmoV_yield)
+static bool canYield(CState *state) {
+    return state->coroutine != NULL && state->coroutine->cDepth == state->cDepth;
+}
+
+// runs the loop until blocked is done. we're in a C function, so the GC is unfrozen while coroutines run (same as pcall())
+static bool block(CState *state, CLoop *loop, CBlocked *blocked) {
+    blocked->next = loop->blocked;
+    loop->blocked = blocked;
+
+    bool ok = true;
+    cosmoM_unfreezeGC(state);
+    while (ok && !blocked->done)
+        ok = cosmoE_runOnce(state, -1);
+    cosmoM_freezeGC(state);
+
+    loop->blocked = blocked->next;
+    return ok;
+}
+
+// parks whoever is running on fd until the operation in w can be finished, returns what the C function should return
+static int waitFd(CState *state, CLoop *loop, int fd, bool reader, CWaiter w) {
+    CLoopFd *f = getFd(state, loop, fd);
+    CWaiter *slot = reader ? &f->reader : &f->writer;
+    CBlocked blocked = {NULL, cosmoV_newNil(), 0, false};
+    bool yield = canYield(state);
+
+    if (slot->kind != WAIT_NONE) // only 1 reader & 1 writer at a time
+        return finish(state, loop, cosmoV_newNil(), EBUSY);
+
+    if (yield)
+        w.co = state->coroutine;
+    else
+        w.blocked = &blocked;
+
+    *slot = w;
+    int err = arm(loop, fd);
+    if (err != 0) {
+        *slot = (CWaiter){WAIT_NONE, NULL, NULL, 0, NULL};
+        return finish(state, loop, cosmoV_newNil(), err);
+    }
+
+    loop->waiting++;
+    if (yield) {
+        int nres = cosmoV_yield(state, 0); // the loop resumes us with the result
+        if (!state->yielding)
+            detach(loop, reader ? &loop->fds[fd].reader : &loop->fds[fd].writer);
+        return nres;
+    }
+
+    if (!block(state, loop, &blocked)) {
+        // we're unwinding, take ourselves off of fd if nobody else has already
+        slot = reader ? &loop->fds[fd].reader : &loop->fds[fd].writer;
+        if (slot->blocked == &blocked)
+            detach(loop, slot);
+        return 0;
+    }
+
+    return finish(state, loop, blocked.result, blocked.err);
+}
+
+// nil & EBADF for closed handles, there's no fd to wait on
+#define CHECKFD(state, loop, fd) \
+    if (fd < 0) \
+        return finish(state, loop, cosmoV_newNil(), EBADF)
+
+COSMO_API int cosmoE_read(CState *state, int fd, size_t max) {
+    CLoop *loop = cosmoE_getLoop(state);
+    CValue val;
+    int err;
+
+    if (loop == NULL)
+        return 0;
+    CHECKFD(state, loop, fd);
+
+    if (tryRead(state, fd, max, &val, &err))
+        return finish(state, loop, val, err);
+
+    return waitFd(state, loop, fd, true, (CWaiter){WAIT_READ, NULL, NULL, max, NULL});
+}
+
+COSMO_API int cosmoE_write(CState *state, int fd, CObjString *str) {
+    CLoop *loop = cosmoE_getLoop(state);
+    size_t written = 0;
+    CValue val;
+    int err;
+
+    if (loop == NULL)
+        return 0;
+    CHECKFD(state, loop, fd);
+
+    if (tryWrite(state, fd, str, &written, &val, &err))
+        return finish(state, loop, val, err);
+
+    return waitFd(state, loop, fd, false, (CWaiter){WAIT_WRITE, NULL, NULL, written, str});
+}
+
+COSMO_API int cosmoE_accept(CState *state, int fd) {
+    CLoop *loop = cosmoE_getLoop(state);
+    CValue val;
+    int err;
+
+    if (loop == NULL)
+        return 0;
+    CHECKFD(state, loop, fd);
+
+    if (tryAccept(state, fd, &val, &err))
+        return finish(state, loop, val, err);
+
+    return waitFd(state, loop, fd, true, (CWaiter){WAIT_ACCEPT, NULL, NULL, 0, NULL});
+}
+
+COSMO_API int cosmoE_connect(CState *state, const char *host, const char *port) {
+    CLoop *loop = cosmoE_getLoop(state);
+    struct addrinfo hints, *addrs;
+    int fd, err;
+
+    if (loop == NULL)
+        return 0;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+
+    if ((err = getaddrinfo(host, port, &hints, &addrs)) != 0) {
+        cosmoV_error(state, "Couldn't resolve \"%s\": %s", host, gai_strerror(err));
+        return 0;
+    }
+
+    fd = socket(addrs->ai_family, addrs->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, addrs->ai_protocol);
+    if (fd == -1) {
+        freeaddrinfo(addrs);
+        return finish(state, loop, cosmoV_newNil(), errno);
+    }
+
+    int res = connect(fd, addrs->ai_addr, addrs->ai_addrlen);
+    err = errno;
+    freeaddrinfo(addrs);
+
+    if (res == 0) {
+        return finish(state, loop, newHandle(state, fd), 0);
+    } else if (err != EINPROGRESS) {
+        close(fd);
+        return finish(state, loop, cosmoV_newNil(), err);
+    }
+
+    // the fd belongs to the loop while we wait, so it's closed if the state goes away first
+    own(state, &fd, 1);
+    return waitFd(state, loop, fd, false, (CWaiter){WAIT_CONNECT, NULL, NULL, 0, NULL});
+}
+
+COSMO_API int cosmoE_sleep(CState *state, double seconds) {
+    CLoop *loop = cosmoE_getLoop(state);
+    CBlocked blocked = {NULL, cosmoV_newNil(), 0, false};
+
+    if (loop == NULL)
+        return 0;
+
+    double when = cosmoE_now() + (seconds > 0 ? seconds : 0);
+    if (canYield(state)) {
+        addTimer(state, loop, when, state->coroutine, NULL);
+
+        int nres = cosmoV_yield(state, 0);
+        if (!state->yielding)
+            cancelTimer(loop, state->coroutine, NULL);
+        return nres;
+    }
+
+    addTimer(state, loop, when, NULL, &blocked);
+    if (!block(state, loop, &blocked)) {
+        cancelTimer(loop, NULL, &blocked);
+        return 0;
+    }
+
+    return finish(state, loop, cosmoV_newNil(), 0);
+}
+
+// ================================================================ [IO.*] ================================================================
+
+COSMO_API void cosmoE_pushHandle(CState *state, int fd) {
+    CLoop *loop = cosmoE_getLoop(state);
+    CObjObject *obj = cosmoO_newObject(state);
+
+    cosmoV_pushRef(state, (CObj*)obj);
+    if (loop != NULL && loop->handleProto != NULL)
+        obj->_obj.proto = loop->handleProto;
+
+    cosmoO_setUserI(obj, fd);
+    cosmoO_setUserT(obj, LOOP_HANDLE);
+}
+
+COSMO_API int cosmoE_readHandle(CState *state, const char *name, CValue val) {
+    if (!IS_OBJECT(val) || cosmoO_getUserT(cosmoV_readObject(val)) != LOOP_HANDLE) {
+        cosmoV_error(state, "%s expected (<handle>), got (%s)!", name, cosmoV_typeStr(val));
+        return -2;
+    }
+
+    return cosmoO_getUserI(cosmoV_readObject(val));
+}
+
+// grabs the fd of the handle the method was called on, or returns from the method
+#define HANDLEARG(name, minArgs) \
+    if (nargs < minArgs) { \
+        cosmoV_error(state, name " expected at least %d argument(s), got %d!", minArgs, nargs); \
+        return 0; \
+    } \
+    int fd = cosmoE_readHandle(state, name, args[0]); \
+    if (fd == -2) \
+        return 0
+
+// <handle>:read(max)
+int cosmoB_hRead(CState *state, int nargs, CValue *args) {
+    HANDLEARG("<handle>:read()", 1);
+    size_t max = LOOP_READ_SIZE;
+
+    if (nargs > 1) {
+        if (!IS_NUMBER(args[1]) || cosmoV_readNumber(args[1]) < 1) {
+            cosmoV_typeError(state, "<handle>:read()", "<handle>, <number>", "%s, %s", cosmoV_typeStr(args[0]), cosmoV_typeStr(args[1]));
+            return 0;
+        }
+
+        max = (size_t)cosmoV_readNumber(args[1]);
+    }
+
+    return cosmoE_read(state, fd, max);
+}
+
+// <handle>:write(str)
+int cosmoB_hWrite(CState *state, int nargs, CValue *args) {
+    HANDLEARG("<handle>:write()", 2);
+
+    if (!IS_STRING(args[1])) {
+        cosmoV_typeError(state, "<handle>:write()", "<handle>, <string>", "%s, %s", cosmoV_typeStr(args[0]), cosmoV_typeStr(args[1]));
+        return 0;
+    }
+
+    return cosmoE_write(state, fd, cosmoV_readString(args[1]));
+}
+
+// <handle>:accept()
+int cosmoB_hAccept(CState *state, int nargs, CValue *args) {
+    HANDLEARG("<handle>:accept()", 1);
+    return cosmoE_accept(state, fd);
+}
+
+// <handle>:close()
+int cosmoB_hClose(CState *state, int nargs, CValue *args) {
+    HANDLEARG("<handle>:close()", 1);
+
+    if (fd >= 0) {
+        cosmoE_closeFd(state, fd);
+        cosmoO_setUserI(cosmoV_readObject(args[0]), -1);
+    }
+
+    return 0;
+}
+
+// <handle>:fd(), -1 once it's closed
+int cosmoB_hFd(CState *state, int nargs, CValue *args) {
+    HANDLEARG("<handle>:fd()", 1);
+    cosmoV_pushNumber(state, fd);
+    return 1;
+}
+
+// <handle>:port(), the local port of a socket. nil if it isn't one
+int cosmoB_hPort(CState *state, int nargs, CValue *args) {
+    HANDLEARG("<handle>:port()", 1);
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+
+    if (fd < 0 || getsockname(fd, (struct sockaddr*)&addr, &len) == -1)
+        return 0;
+
+    if (addr.ss_family == AF_INET)
+        cosmoV_pushNumber(state, ntohs(((struct sockaddr_in*)&addr)->sin_port));
+    else if (addr.ss_family == AF_INET6)
+        cosmoV_pushNumber(state, ntohs(((struct sockaddr_in6*)&addr)->sin6_port));
+    else
+        return 0;
+
+    return 1;
+}
+
+// io.open(path, mode), mode is "r" (default), "w", "a", "r+", "w+" or "a+" like fopen()
+int cosmoB_ioOpen(CState *state, int nargs, CValue *args) {
+    const char *modes[] = {"r", "w", "a", "r+", "w+", "a+"};
+    int flags[] = {
+        O_RDONLY,
+        O_WRONLY | O_CREAT | O_TRUNC,
+        O_WRONLY | O_CREAT | O_APPEND,
+        O_RDWR,
+        O_RDWR | O_CREAT | O_TRUNC,
+        O_RDWR | O_CREAT | O_APPEND
+    };
+    CLoop *loop = cosmoE_getLoop(state);
+    int mode = 0;
+
+    if (loop == NULL)
+        return 0;
+
+    if (nargs < 1 || nargs > 2) {
+        cosmoV_error(state, "io.open() expected 1 or 2 arguments, got %d!", nargs);
+        return 0;
+    }
+
+    if (!IS_STRING(args[0]) || (nargs == 2 && !IS_STRING(args[1]))) {
+        cosmoV_typeError(state, "io.open()", "<string>, <string>", "%s, %s", cosmoV_typeStr(args[0]), nargs == 2 ? cosmoV_typeStr(args[1]) : "<nil>");
+        return 0;
+    }
+
+    if (nargs == 2) {
+        const char *str = cosmoV_readCString(args[1]);
+
+        for (mode = 0; mode < sizeof(modes)/sizeof(modes[0]); mode++) {
+            if (strcmp(str, modes[mode]) == 0)
+                break;
+        }
+
+        if (mode == sizeof(modes)/sizeof(modes[0])) {
+            cosmoV_error(state, "io.open() unknown mode \"%s\"!", str);
+            return 0;
+        }
+    }
+
+    int fd = open(cosmoV_readCString(args[0]), flags[mode] | O_CLOEXEC | O_NONBLOCK, 0666);
+    if (fd == -1)
+        return finish(state, loop, cosmoV_newNil(), errno);
+
+    return finish(state, loop, newHandle(state, fd), 0);
+}
+
+// io.pipe(), returns the read end & the write end
+int cosmoB_ioPipe(CState *state, int nargs, CValue *args) {
+    CLoop *loop = cosmoE_getLoop(state);
+    int fds[2];
+
+    if (loop == NULL)
+        return 0;
+
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) == -1) {
+        cosmoV_error(state, "io.pipe() failed: %s", strerror(errno));
+        return 0;
+    }
+
+    own(state, fds, 2);
+    cosmoE_pushHandle(state, fds[0]);
+    cosmoE_pushHandle(state, fds[1]);
+    loop->error = 0;
+    return 2;
+}
+
+// reads the host & port args, port is written into buf
+static bool readAddress(CState *state, const char *name, int nargs, CValue *args, char *buf, size_t size) {
+    if (nargs != 2) {
+        cosmoV_error(state, "%s expected 2 arguments, got %d!", name, nargs);
+        return false;
+    }
+
+    if (!IS_STRING(args[0]) || !IS_NUMBER(args[1])) {
+        cosmoV_error(state, "%s expected (<string>, <number>), got (%s, %s)!", name, cosmoV_typeStr(args[0]), cosmoV_typeStr(args[1]));
+        return false;
+    }
+
+    snprintf(buf, size, "%d", (int)cosmoV_readNumber(args[1]));
+    return true;
+}
+
+// io.connect(host, port)
+int cosmoB_ioConnect(CState *state, int nargs, CValue *args) {
+    char port[16];
+
+    if (!readAddress(state, "io.connect()", nargs, args, port, sizeof(port)))
+        return 0;
+
+    return cosmoE_connect(state, cosmoV_readCString(args[0]), port);
+}
+
+// io.listen(host, port), a port of 0 picks any free port (see <handle>:port())
+int cosmoB_ioListen(CState *state, int nargs, CValue *args) {
+    CLoop *loop = cosmoE_getLoop(state);
+    struct addrinfo hints, *addrs;
+    char port[16];
+    int err, one = 1;
+
+    if (loop == NULL || !readAddress(state, "io.listen()", nargs, args, port, sizeof(port)))
+        return 0;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV | AI_PASSIVE;
+
+    if ((err = getaddrinfo(cosmoV_readCString(args[0]), port, &hints, &addrs)) != 0) {
+        cosmoV_error(state, "Couldn't resolve \"%s\": %s", cosmoV_readCString(args[0]), gai_strerror(err));
+        return 0;
+    }
+
+    int fd = socket(addrs->ai_family, addrs->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, addrs->ai_protocol);
+    if (fd == -1 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1 ||
+            bind(fd, addrs->ai_addr, addrs->ai_addrlen) == -1 || listen(fd, SOMAXCONN) == -1) {
+        err = errno;
+        if (fd != -1)
+            close(fd);
+        freeaddrinfo(addrs);
+        return finish(state, loop, cosmoV_newNil(), err);
+    }
+
+    freeaddrinfo(addrs);
+    return finish(state, loop, newHandle(state, fd), 0);
+}
+
+// io.error(), the error message of the last operation, nil if it succeeded
+int cosmoB_ioError(CState *state, int nargs, CValue *args) {
+    int err = cosmoE_error(state);
+    if (err == 0)
+        return 0;
+
+    cosmoV_pushString(state, strerror(err));
+    return 1;
+}
+
+// ================================================================ [LOOP.*] ================================================================
+
+// loop.spawn(<closure>, ...), returns the coroutine it runs in
+int cosmoB_lSpawn(CState *state, int nargs, CValue *args) {
+    if (nargs < 1 || !IS_CLOSURE(args[0])) {
+        cosmoV_typeError(state, "loop.spawn()", "<closure>, ...", "%s", nargs > 0 ? cosmoV_typeStr(args[0]) : "<nil>");
+        return 0;
+    }
+
+    CObjCoroutine *co = cosmoO_newCoroutine(state, cosmoV_readClosure(args[0]));
+    cosmoV_pushRef(state, (CObj*)co);
+
+    // the args have to be on top for the resume, the coroutine stays below them
+    for (int i = 1; i < nargs; i++)
+        cosmoV_pushValue(state, args[i]);
+
+    cosmoM_unfreezeGC(state);
+    int nres = cosmoV_resume(state, co, nargs - 1);
+    cosmoM_freezeGC(state);
+
+    if (nres == -1)
+        return 0;
+
+    cosmoV_setTop(state, nres);
+    return 1;
+}
+
+// loop.run()
+int cosmoB_lRun(CState *state, int nargs, CValue *args) {
+    cosmoM_unfreezeGC(state);
+    cosmoE_run(state);
+    cosmoM_freezeGC(state);
+    return 0;
+}
+
+// loop.sleep(seconds)
+int cosmoB_lSleep(CState *state, int nargs, CValue *args) {
+    if (nargs != 1 || !IS_NUMBER(args[0])) {
+        cosmoV_typeError(state, "loop.sleep()", "<number>", "%s", nargs > 0 ? cosmoV_typeStr(args[0]) : "<nil>");
+        return 0;
+    }
+
+    return cosmoE_sleep(state, cosmoV_readNumber(args[0]));
+}
+
+// loop.now(), seconds on a clock that only goes forward
+int cosmoB_lNow(CState *state, int nargs, CValue *args) {
+    cosmoV_pushNumber(state, cosmoE_now());
+    return 1;
+}
+
+// loop.pending()
+int cosmoB_lPending(CState *state, int nargs, CValue *args) {
+    cosmoV_pushNumber(state, cosmoE_pending(state));
+    return 1;
+}
+
+COSMO_API void cosmoB_loadIOLib(CState *state) {
+    const char *handleIdentifiers[] = {
+        "read",
+        "write",
+        "accept",
+        "close",
+        "fd",
+        "port"
+    };
+
+    CosmoCFunction handleLib[] = {
+        cosmoB_hRead,
+        cosmoB_hWrite,
+        cosmoB_hAccept,
+        cosmoB_hClose,
+        cosmoB_hFd,
+        cosmoB_hPort
+    };
+
+    const char *ioIdentifiers[] = {
+        "open",
+        "pipe",
+        "connect",
+        "listen",
+        "error"
+    };
+
+    CosmoCFunction ioLib[] = {
+        cosmoB_ioOpen,
+        cosmoB_ioPipe,
+        cosmoB_ioConnect,
+        cosmoB_ioListen,
+        cosmoB_ioError
+    };
+
+    const char *loopIdentifiers[] = {
+        "spawn",
+        "run",
+        "sleep",
+        "now",
+        "pending"
+    };
+
+    CosmoCFunction loopLib[] = {
+        cosmoB_lSpawn,
+        cosmoB_lRun,
+        cosmoB_lSleep,
+        cosmoB_lNow,
+        cosmoB_lPending
+    };
+
+    CLoop *loop = cosmoE_getLoop(state);
+    if (loop == NULL)
+        return;
+
+    // the proto for every handle, the loop holds onto it
+    CObjObject *proto = cosmoB_makeLib(state, handleIdentifiers, handleLib, sizeof(handleIdentifiers)/sizeof(handleIdentifiers[0]));
+    cosmoO_lock(proto);
+    loop->handleProto = proto;
+    cosmoV_pop(state);
+
+    cosmoV_pushString(state, "io");
+    cosmoB_makeLib(state, ioIdentifiers, ioLib, sizeof(ioIdentifiers)/sizeof(ioIdentifiers[0]));
+    cosmoV_pushString(state, "loop");
+    cosmoB_makeLib(state, loopIdentifiers, loopLib, sizeof(loopIdentifiers)/sizeof(loopIdentifiers[0]));
+
+    // register "io" & "loop" to the global table
+    cosmoV_register(state, 2);
+}
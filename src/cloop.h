@@ -0,0 +1,106 @@
+#ifndef CLOOP_H
+#define CLOOP_H
+
+#include "cosmo.h"
+
+/*
+    event loop & non-blocking I/O (linux only, it's built on epoll). every state gets at most one loop, it's made the first
+    time it's needed & freed (along with every fd it still owns) by cosmoV_freeState.
+
+    I/O operations are meant to be returned from C functions, the same way cosmoV_yield is:
+        return cosmoE_read(state, fd, 4096);
+    if the operation can be finished right away it is, otherwise the running coroutine is parked on the fd & suspended. once
+    the fd is ready the loop finishes the operation & resumes the coroutine with the result, so the C function's result is
+    the operation's result either way. this is what lets script code look synchronous while the loop multiplexes however many
+    operations are in flight. if there's nothing to yield (the state's own stack is running, or there's C code in the way like
+    pcall()) the loop is run right there until the operation is done. other coroutines keep going in the meantime, but
+    whatever is below it on the C stack (like whoever spawned or resumed the coroutine) doesn't until it's done.
+
+    every operation has exactly 1 result, nil if it failed. cosmoE_error gives the errno of the last operation the caller did,
+    since coroutines only switch when they wait on something it can be checked right after the operation returns.
+
+    the loop resumes coroutines with cosmoV_resume, so if one throws an error cosmoE_runOnce returns false with the error set
+    (just like cosmoV_resume). coroutines that are waiting on the loop shouldn't be resumed by anything else.
+
+    regular files can't be polled (epoll won't take them) but they never block either, so operations on them don't yield.
+    SIGPIPE is ignored once a loop is made (unless someone else already handles it), writes to closed pipes & sockets fail
+    with EPIPE instead
+*/
+
+#define LOOP_EVENTS     64 // most epoll events handled per cosmoE_runOnce
+#define LOOP_READ_SIZE  4096 // reads bigger than this go through a heap buffer
+#define LOOP_HANDLE     0x696f // userT of io handles ("io")
+
+// returns the state's loop, making it if it doesn't have one. throws an error & returns NULL if epoll couldn't be set up
+COSMO_API CLoop *cosmoE_getLoop(CState *state);
+
+// closes every fd the loop owns & frees it, called by cosmoV_freeState
+void cosmoE_freeLoop(CState *state);
+
+/*
+    waits at most timeout seconds (-1 waits until something happens) for I/O & timers, then resumes every coroutine whose
+    operation finished. it doesn't wait at all if nothing's pending. returns false if a coroutine threw an error, the error is
+    at state->error
+*/
+COSMO_API bool cosmoE_runOnce(CState *state, double timeout);
+
+// runs the loop until nothing's pending, returns false if a coroutine threw an error (see cosmoE_runOnce)
+COSMO_API bool cosmoE_run(CState *state);
+
+// # of operations & timers in flight, plus coroutines waiting to be resumed
+COSMO_API int cosmoE_pending(CState *state);
+
+/*
+    for hosts with their own loop: the epoll fd becomes readable when there's I/O for cosmoE_runOnce to handle, and
+    cosmoE_nextTimeout is how long until a timer is due (0 if coroutines are waiting to be resumed, -1 if there's nothing)
+*/
+COSMO_API int cosmoE_getFd(CState *state);
+COSMO_API double cosmoE_nextTimeout(CState *state);
+
+// CLOCK_MONOTONIC seconds, what timers, time limits (cosmoV_setTimeLimit) & GC pauses are measured against
+COSMO_API double cosmoE_now();
+
+// the errno of the caller's last operation, 0 if it succeeded
+COSMO_API int cosmoE_error(CState *state);
+
+// makes fd non-blocking & hands it to the loop, it's closed when the loop is freed (unless cosmoE_closeFd closes it first)
+COSMO_API bool cosmoE_addFd(CState *state, int fd);
+
+// closes fd, anyone waiting on it gets nil (ECANCELED)
+COSMO_API void cosmoE_closeFd(CState *state, int fd);
+
+// pushes an io handle for fd, see cosmoB_loadIOLib for its methods
+COSMO_API void cosmoE_pushHandle(CState *state, int fd);
+
+// returns the fd of an io handle, -1 if the handle was closed. throws an error & returns -2 if val isn't a handle
+COSMO_API int cosmoE_readHandle(CState *state, const char *name, CValue val);
+
+/*
+    the operations, each one pushes its result & returns 1, unless it's suspending the running coroutine (see above):
+        cosmoE_read: a string of at most max bytes, nil at the end of the file
+        cosmoE_write: writes all of str, true
+        cosmoE_accept: a handle for the new connection
+        cosmoE_connect: a handle for the connection. host & port are resolved before connecting, which blocks
+        cosmoE_sleep: nil, once seconds have passed
+*/
+COSMO_API int cosmoE_read(CState *state, int fd, size_t max);
+COSMO_API int cosmoE_write(CState *state, int fd, CObjString *str);
+COSMO_API int cosmoE_accept(CState *state, int fd);
+COSMO_API int cosmoE_connect(CState *state, const char *host, const char *port);
+COSMO_API int cosmoE_sleep(CState *state, double seconds);
+
+// calls visit on every value the loop is holding onto, for the GC & heap snapshots
+typedef void (*CosmoLoopVisitor)(CState *state, CValue val, void *ud);
+void cosmoE_visitLoop(CState *state, CosmoLoopVisitor visit, void *ud);
+
+/* loads the io & loop libraries, including:
+    - io.open(path, mode), io.pipe(), io.connect(host, port) & io.listen(host, port)
+    - io.error(), the error message of the last operation (nil if it succeeded)
+    - <handle>:read(max), <handle>:write(str), <handle>:accept(), <handle>:close(), <handle>:fd() & <handle>:port()
+    - loop.spawn(closure, ...), runs closure in a new coroutine until it first waits on something
+    - loop.run(), runs the loop until nothing's pending
+    - loop.sleep(seconds), loop.now() & loop.pending()
+*/
+COSMO_API void cosmoB_loadIOLib(CState *state);
+
+#endif
@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "cmem.h"
 #include "cstate.h"
 #include "cvalue.h"
@@ -5,16 +7,59 @@
 #include "cparse.h"
 #include "cobj.h"
 #include "cbaselib.h"
+#include "cheap.h"
+#include "cvm.h"
+#include "cloop.h"
 
-// realloc wrapper
-void *cosmoM_reallocate(CState* state, void *buf, size_t oldSize, size_t newSize) {
-    state->allocatedBytes += newSize - oldSize;
+#include <string.h>
 
-    if (newSize == 0) { // it needs to be freed
+COSMO_API void *cosmoM_defaultAlloc(void *ud, void *buf, size_t oldSize, size_t newSize) {
+    if (newSize == 0) {
         free(buf);
         return NULL;
     }
 
+    // if NULL is passed, realloc() acts like malloc()
+    return realloc(buf, newSize);
+}
+
+// calls the state's allocator, unless allocations are being made to fail (see cosmoM_failAllocations)
+static inline void *rawRealloc(CState *state, void *buf, size_t oldSize, size_t newSize) {
+    if (state->allocFaults >= 0) {
+        if (state->allocFaults == 0)
+            return NULL;
+
+        state->allocFaults--;
+    }
+
+    return state->alloc(state->allocUd, buf, oldSize, newSize);
+}
+
+// realloc failed, try to make some room. returns the new buffer or NULL if it still failed
+static void *allocFailed(CState *state, void *buf, size_t oldSize, size_t newSize) {
+    // the old buffer is still good if we were shrinking it
+    if (newSize < oldSize)
+        return buf;
+
+    if (!(cosmoM_isFrozen(state))) {
+        cosmoM_collectGarbage(state);
+
+        void *newBuf = rawRealloc(state, buf, oldSize, newSize);
+        if (newBuf != NULL)
+            return newBuf;
+    }
+
+    // the allocation never happened
+    state->allocatedBytes -= newSize - oldSize;
+    return NULL;
+}
+
+void *cosmoM_tryReallocate(CState* state, void *buf, size_t oldSize, size_t newSize) {
+    state->allocatedBytes += newSize - oldSize;
+
+    if (newSize == 0) // it needs to be freed
+        return state->alloc(state->allocUd, buf, oldSize, 0);
+
 #ifdef GC_STRESS
     if (!(cosmoM_isFrozen(state)) && newSize > oldSize) {
         cosmoM_collectGarbage(state);
@@ -28,13 +73,31 @@ void *cosmoM_reallocate(CState* state, void *buf, size_t oldSize, size_t newSize
     cosmoM_checkGarbage(state, 0);
 #endif
 
-    // if NULL is passed, realloc() acts like malloc()
-    void *newBuf = realloc(buf, newSize);
+    /*
+        the cap is soft, throwing from here would unwind like running out of memory does & fail allocations that only need a
+        collection. we're usually called with the GC frozen (every C function is) so the garbage that pushed us over can't be
+        collected yet, the next safepoint collects first & only throws if the state is still over
+    */
+    if (state->memoryLimit != 0 && newSize > oldSize && state->allocatedBytes > state->memoryLimit)
+        cosmoV_interruptLimits(state);
 
-    if (newBuf == NULL) {
-        CERROR("failed to allocate memory!");
-        exit(1);
-    }
+    void *newBuf = rawRealloc(state, buf, oldSize, newSize);
+
+    if (newBuf == NULL && (newBuf = allocFailed(state, buf, oldSize, newSize)) == NULL)
+        return NULL;
+
+    if (state->heapTracker != NULL && newSize > oldSize)
+        cosmoM_trackBytes(state, newSize - oldSize);
+
+    return newBuf;
+}
+
+// realloc wrapper
+void *cosmoM_reallocate(CState* state, void *buf, size_t oldSize, size_t newSize) {
+    void *newBuf = cosmoM_tryReallocate(state, buf, oldSize, newSize);
+
+    if (newBuf == NULL && newSize != 0)
+        cosmoV_throwMemory(state);
 
     return newBuf;
 }
@@ -50,6 +113,7 @@ COSMO_API bool cosmoM_checkGarbage(CState *state, size_t needed) {
 
 void markObject(CState *state, CObj *obj);
 void markValue(CState *state, CValue val);
+void markContext(CState *state, CContext *ctx);
 
 void markTable(CState *state, CTable *tbl) {
     if (tbl->table == NULL) // table is still being initialized
@@ -106,7 +170,12 @@ void blackenObject(CState *state, CObj *obj) {
             break;
         }
         case COBJ_UPVALUE: {
-            markValue(state, ((CObjUpval*)obj)->closed);
+            CObjUpval *upval = (CObjUpval*)obj;
+            markValue(state, upval->closed);
+
+            // an open upvalue points into its coroutine's stack, which has to stay around until it's closed
+            if (upval->val != &upval->closed)
+                markObject(state, (CObj*)upval->owner);
             break;
         }
         case COBJ_FUNCTION: {
@@ -144,6 +213,16 @@ void blackenObject(CState *state, CObj *obj) {
 
             break;
         }
+        case COBJ_COROUTINE: {
+            CObjCoroutine *co = (CObjCoroutine*)obj;
+
+            // while it's running its stack is the state's, which is marked with the rest of the roots
+            if (co->status != COROUTINE_RUNNING)
+                markContext(state, &co->ctx);
+
+            markObject(state, (CObj*)co->resumer);
+            break;
+        }
         default:
 #ifdef GC_DEBUG
             printf("Unknown type in blackenObject with %p, type %d\n", (void*)obj, obj->type);
@@ -188,10 +267,19 @@ void traceGrays(CState *state) {
 }
 
 void sweep(CState *state) {
+    CGCStats *stats = &state->gcStats;
     CObj *prev = NULL;
     CObj *object = state->objects;
+
+    // we're already walking every object, so take a census of whatever survives
+    memset(stats->liveObjects, 0, sizeof(stats->liveObjects));
+    memset(stats->liveBytes, 0, sizeof(stats->liveBytes));
+
     while (object != NULL) {
         if (object->isMarked) { // skip over it
+            stats->liveObjects[object->type]++;
+            stats->liveBytes[object->type] += cosmoO_sizeOf(object);
+
             object->isMarked = false; // rest to white
             prev = object;
             object = object->next;
@@ -220,23 +308,42 @@ void markUserRoots(CState *state) {
     }
 }
 
-void markRoots(CState *state) {
+void markContext(CState *state, CContext *ctx) {
     // mark all values on the stack
-    for (StkPtr value = state->stack; value < state->top; value++) {
+    for (StkPtr value = ctx->stack; value < ctx->top; value++) {
         markValue(state, *value);
     }
 
     // mark all active callframe closures
-    for (int i = 0; i < state->frameCount; i++) {
-        markObject(state, (CObj*)state->callFrame[i].closure);
+    for (int i = 0; i < ctx->frameCount; i++) {
+        markObject(state, (CObj*)ctx->callFrame[i].closure);
     }
 
     // mark all open upvalues
-    for (CObjUpval *upvalue = state->openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+    for (CObjUpval *upvalue = ctx->openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
         markObject(state, (CObj*)upvalue);
     }
+}
 
-    markObject(state, (CObj*)state->globals);
+static void markLoopValue(CState *state, CValue val, void *ud) {
+    markValue(state, val);
+}
+
+void markRoots(CState *state) {
+    CContext current;
+    cosmoV_saveContext(state, &current);
+    markContext(state, &current);
+
+    // if a coroutine is running, the state's own stack is saved off to the side (the coroutine marks whoever resumed it)
+    if (state->coroutine != NULL) {
+        markContext(state, &state->mainContext);
+        markObject(state, (CObj*)state->coroutine);
+    }
+
+    // mark all globals
+    for (int i = 0; i < state->globals.count; i++)
+        markValue(state, *cosmoV_getGlobalSlot(state, i));
+    markTable(state, &state->globalIndex);
 
     // mark all internal strings
     for (int i = 0; i < ISTRING_MAX; i++)
@@ -245,8 +352,13 @@ void markRoots(CState *state) {
     // mark the user defined roots
     markUserRoots(state);
 
+    // coroutines waiting on the event loop might not be referenced by anything else
+    if (state->loop != NULL)
+        cosmoE_visitLoop(state, markLoopValue, NULL);
+
     // mark other misc. internally reserved objects
     markObject(state, (CObj*)state->error);
+    markObject(state, (CObj*)state->memError);
 
     for (int i = 0; i < COBJ_MAX; i++)
         markObject(state, (CObj*)state->protoObjects[i]);
@@ -257,8 +369,11 @@ void markRoots(CState *state) {
 COSMO_API void cosmoM_collectGarbage(CState *state) {
 #ifdef GC_DEBUG
     printf("-- GC start\n");
-    size_t start = state->allocatedBytes;
 #endif
+    CGCStats *stats = &state->gcStats;
+    size_t start = state->allocatedBytes;
+    double startTime = cosmoE_now();
+
     cosmoM_freezeGC(state); // we don't want a recursive garbage collection event!
 
     markRoots(state);
@@ -270,6 +385,21 @@ COSMO_API void cosmoM_collectGarbage(CState *state) {
     // set our next GC event
     cosmoM_updateThreshhold(state);
 
+    double pause = cosmoE_now() - startTime;
+    stats->cycles++;
+    stats->lastPause = pause;
+    stats->totalPause += pause;
+    if (pause > stats->maxPause)
+        stats->maxPause = pause;
+
+    // the gray stack can grow while marking, so a cycle could technically end with more than it started with
+    stats->lastReclaimed = start > state->allocatedBytes ? start - state->allocatedBytes : 0;
+    stats->totalReclaimed += stats->lastReclaimed;
+
+    // the callback runs while we're still frozen, so it can't trigger a cycle of its own
+    if (state->gcCallback != NULL)
+        state->gcCallback(state, state->gcCallbackUd);
+
     state->freezeGC--; // we don't want to use cosmoM_unfreezeGC because that might trigger a GC event (if GC_STRESS is defined)
 #ifdef GC_DEBUG
     printf("-- GC end, reclaimed %ld bytes (started at %ld, ended at %ld), next garbage collection scheduled at %ld bytes\n",
@@ -280,6 +410,47 @@ COSMO_API void cosmoM_collectGarbage(CState *state) {
 
 COSMO_API void cosmoM_updateThreshhold(CState *state) {
     state->nextGC = state->allocatedBytes * HEAP_GROW_FACTOR;
+
+    // make sure we collect before the memory limit is hit, not after
+    if (state->memoryLimit != 0 && state->nextGC > state->memoryLimit && state->allocatedBytes < state->memoryLimit)
+        state->nextGC = state->memoryLimit;
+}
+
+COSMO_API void cosmoM_setMemoryLimit(CState *state, size_t bytes) {
+    state->memoryLimit = bytes;
+    cosmoM_updateThreshhold(state);
+}
+
+COSMO_API bool cosmoM_checkLimit(CState *state, size_t needed) {
+    if (state->memoryLimit == 0 || state->allocatedBytes + needed <= state->memoryLimit)
+        return true;
+
+    cosmoV_error(state, "Memory limit exceeded!");
+    return false;
+}
+
+COSMO_API void cosmoM_failAllocations(CState *state, int after) {
+    state->allocFaults = after;
+}
+
+void cosmoM_resetMarks(CState *state) {
+    state->grayStack.count = 0;
+
+    for (CObj *obj = state->objects; obj != NULL; obj = obj->next)
+        obj->isMarked = false;
+}
+
+COSMO_API void cosmoM_getGCStats(CState *state, CGCStats *stats) {
+    *stats = state->gcStats;
+    stats->heapBytes = state->allocatedBytes;
+    stats->nextGC = state->nextGC;
+    stats->strings = state->strings.count;
+    stats->stringCapacity = state->strings.capacityMask + 1;
+}
+
+COSMO_API void cosmoM_setGCCallback(CState *state, CosmoGCCallback callback, void *ud) {
+    state->gcCallback = callback;
+    state->gcCallbackUd = ud;
 }
 
 COSMO_API void cosmoM_addRoot(CState *state, CObj *newRoot) {
@@ -12,26 +12,33 @@
 #define HEAP_GROW_FACTOR 2
 #define ARRAY_START 8
 
+// the debug versions are wrapped up as a single statement, so they're still safe under an unbraced if or for
 #ifdef GC_DEBUG
 #define cosmoM_freearray(state, type, buf, capacity) \
-    printf("freeing array %p [size %lu] at %s:%d\n", buf, sizeof(type) * capacity, __FILE__, __LINE__); \
-    cosmoM_reallocate(state, buf, sizeof(type) * capacity, 0)
+    do { \
+        printf("freeing array %p [size %lu] at %s:%d\n", buf, sizeof(type) * capacity, __FILE__, __LINE__); \
+        cosmoM_reallocate(state, buf, sizeof(type) * capacity, 0); \
+    } while (0)
 #else
 #define cosmoM_freearray(state, type, buf, capacity) \
     cosmoM_reallocate(state, buf, sizeof(type) * capacity, 0)
 #endif
 
+// capacity is only updated once the allocation succeeded, a failed allocation unwinds out of here (see cosmoM_reallocate)
 #define cosmoM_growarray(state, type, buf, count, capacity) \
     if (count >= capacity || buf == NULL) { \
         int old = capacity; \
-        capacity = old * GROW_FACTOR; \
-        buf = (type*)cosmoM_reallocate(state, buf, sizeof(type)  *old, sizeof(type)  *capacity); \
+        int newCap = old * GROW_FACTOR; \
+        buf = (type*)cosmoM_reallocate(state, buf, buf == NULL ? 0 : sizeof(type) * old, sizeof(type) * newCap); \
+        capacity = newCap; \
     }
 
 #ifdef GC_DEBUG
 #define cosmoM_free(state, type, x) \
-    printf("freeing %p [size %lu] at %s:%d\n", x, sizeof(type), __FILE__, __LINE__); \
-    cosmoM_reallocate(state, x, sizeof(type), 0)
+    do { \
+        printf("freeing %p [size %lu] at %s:%d\n", x, sizeof(type), __FILE__, __LINE__); \
+        cosmoM_reallocate(state, x, sizeof(type), 0); \
+    } while (0)
 #else
 #define cosmoM_free(state, type, x) \
     cosmoM_reallocate(state, x, sizeof(type), 0)
@@ -63,11 +70,47 @@
 
 #endif 
 
+// the CosmoAlloc cosmoV_newState uses, it's just realloc & free
+COSMO_API void *cosmoM_defaultAlloc(void *ud, void *buf, size_t oldSize, size_t newSize);
+
+/*
+    when the allocator fails, a garbage collection is run (unless the GC is frozen) and the allocation is tried again. if that fails too,
+    the state's preallocated "Out of memory!" error is thrown by unwinding (longjmp) straight back to the innermost protected call,
+    that's cosmoV_pcall or the outermost cosmoV_call. the C code in between never sees the allocation fail, so anything it was in
+    the middle of building is leaked. if there's no protected call to unwind to the process exits
+*/
 COSMO_API void *cosmoM_reallocate(CState *state, void *buf, size_t oldSize, size_t newSize);
+/*
+    same as cosmoM_reallocate but NULL is returned instead of throwing, for when the caller has something to clean up first. a
+    collection can still throw (marking grows the gray stack) so freeze the GC around it if nothing can be allowed to
+*/
+COSMO_API void *cosmoM_tryReallocate(CState *state, void *buf, size_t oldSize, size_t newSize);
 COSMO_API bool cosmoM_checkGarbage(CState *state, size_t needed); // returns true if GC event was triggered
 COSMO_API void cosmoM_collectGarbage(CState *state);
 COSMO_API void cosmoM_updateThreshhold(CState *state);
 
+/*
+    caps the bytes the state can use, 0 removes the cap. crossing it doesn't fail the allocation, instead the next VM safepoint
+    collects garbage & throws an error if the state is still over (see cosmoV_setStepLimit). it's soft because the allocator is
+    usually running with the GC frozen, so being over might only be garbage that can't be collected yet. a single large
+    allocation could still go far past it, that's what cosmoM_checkLimit is for
+*/
+COSMO_API void cosmoM_setMemoryLimit(CState *state, size_t bytes);
+
+// for C code that's about to make a large allocation, throws an error & returns false if needed more bytes would go over the cap
+COSMO_API bool cosmoM_checkLimit(CState *state, size_t needed);
+
+// for testing the out of memory paths: the next after allocations succeed, every one after them fails. pass -1 to stop
+COSMO_API void cosmoM_failAllocations(CState *state, int after);
+
+// clears the marks left behind by a collection that was unwound out of
+void cosmoM_resetMarks(CState *state);
+
+// copies the GC telemetry into stats, the per-type counts are as of the end of the last cycle
+COSMO_API void cosmoM_getGCStats(CState *state, CGCStats *stats);
+// callback is fired after every cycle (pass NULL to remove it)
+COSMO_API void cosmoM_setGCCallback(CState *state, CosmoGCCallback callback, void *ud);
+
 // lets the VM know you are holding a reference to a CObj and to not free it
 COSMO_API void cosmoM_addRoot(CState *state, CObj *newRoot);
 
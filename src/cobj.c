@@ -4,6 +4,7 @@
 #include "cmem.h"
 #include "cvm.h"
 #include "clex.h"
+#include "cheap.h"
 
 #include <string.h>
 #include <stdarg.h>
@@ -19,8 +20,8 @@ uint32_t hashString(const char *str, size_t sz) {
     return hash;
 }
 
-CObj *cosmoO_allocateBase(CState *state, size_t sz, CObjType type) {
-    CObj* obj = (CObj*)cosmoM_xmalloc(state, sz);
+// sets up the header of a freshly allocated object & links it into the state's object list
+static CObj *initBase(CState *state, CObj *obj, CObjType type) {
     obj->type = type;
     obj->isMarked = false;
     obj->proto = state->protoObjects[type];
@@ -29,18 +30,28 @@ CObj *cosmoO_allocateBase(CState *state, size_t sz, CObjType type) {
     state->objects = obj;
 
     obj->nextRoot = NULL;
+
+    if (state->heapTracker != NULL)
+        cosmoM_trackObject(state, obj);
 #ifdef GC_DEBUG
     printf("allocated %p with OBJ_TYPE %d\n", obj, type);
 #endif
     return obj;
 }
 
+CObj *cosmoO_allocateBase(CState *state, size_t sz, CObjType type) {
+    return initBase(state, (CObj*)cosmoM_xmalloc(state, sz), type);
+}
+
 void cosmoO_free(CState *state, CObj *obj) {
 #ifdef GC_DEBUG
     printf("freeing %p [", obj);
     printObject(obj);
     printf("]\n");
 #endif
+    if (state->heapTracker != NULL)
+        cosmoM_untrackObject(state, obj);
+
     switch(obj->type) {
         case COBJ_STRING: {
             CObjString *objStr = (CObjString*)obj;
@@ -90,11 +101,46 @@ void cosmoO_free(CState *state, CObj *obj) {
             cosmoM_free(state, CObjClosure, closure);
             break;
         }
+        case COBJ_COROUTINE: {
+            CObjCoroutine *co = (CObjCoroutine*)obj;
+            cosmoM_freearray(state, CValue, co->ctx.stack, co->ctx.stackSize);
+            cosmoM_freearray(state, CCallFrame, co->ctx.callFrame, co->ctx.frameSize);
+            cosmoM_free(state, CObjCoroutine, co);
+            break;
+        }
         case COBJ_MAX:
         default: { /* stubbed, should never happen */ }
     }
 }
 
+// mirrors what cosmoO_free gives back
+static size_t tableSize(CTable *tbl) {
+    return tbl->table != NULL ? sizeof(CTableEntry) * (tbl->capacityMask + 1) : 0;
+}
+
+size_t cosmoO_sizeOf(CObj *obj) {
+    switch (obj->type) {
+        case COBJ_STRING: return sizeof(CObjString) + ((CObjString*)obj)->length + 1;
+        case COBJ_OBJECT: return sizeof(CObjObject) + tableSize(&((CObjObject*)obj)->tbl);
+        case COBJ_TABLE: return sizeof(CObjTable) + tableSize(&((CObjTable*)obj)->tbl);
+        case COBJ_UPVALUE: return sizeof(CObjUpval);
+        case COBJ_FUNCTION: {
+            CChunk *chunk = &((CObjFunction*)obj)->chunk;
+            return sizeof(CObjFunction) + sizeof(INSTRUCTION) * chunk->capacity + sizeof(CLineRun) * chunk->lineCapacity +
+                sizeof(CValue) * chunk->constants.capacity + sizeof(CValue*) * chunk->globalCacheCount;
+        }
+        case COBJ_CFUNCTION: return sizeof(CObjCFunction);
+        case COBJ_METHOD: return sizeof(CObjMethod);
+        case COBJ_ERROR: return sizeof(CObjError) + sizeof(CCallFrame) * ((CObjError*)obj)->frameCount;
+        case COBJ_CLOSURE: return sizeof(CObjClosure) + sizeof(CObjUpval*) * ((CObjClosure*)obj)->upvalueCount;
+        case COBJ_COROUTINE: {
+            CContext *ctx = &((CObjCoroutine*)obj)->ctx;
+            return sizeof(CObjCoroutine) + sizeof(CValue) * ctx->stackSize + sizeof(CCallFrame) * ctx->frameSize;
+        }
+        default: return 0;
+    }
+}
+
 bool cosmoO_equal(CState *state, CObj *obj1, CObj *obj2) {
     CObjObject *proto1, *proto2;
     CValue eq1, eq2;
@@ -199,6 +245,10 @@ CObjFunction *cosmoO_newFunction(CState *state) {
     func->variadic = false;
     func->name = NULL;
     func->module = NULL;
+#ifdef VM_STATS
+    func->execCount = 0;
+    func->callCount = 0;
+#endif
 
     initChunk(state, &func->chunk, ARRAY_START);
     return func;
@@ -207,17 +257,30 @@ CObjFunction *cosmoO_newFunction(CState *state) {
 CObjCFunction *cosmoO_newCFunction(CState *state, CosmoCFunction func) {
     CObjCFunction *cfunc = (CObjCFunction*)cosmoO_allocateBase(state, sizeof(CObjCFunction), COBJ_CFUNCTION);
     cfunc->cfunc = func;
+    cfunc->arity = -1;
+    return cfunc;
+}
+
+CObjCFunction *cosmoO_newLeafCFunction(CState *state, CosmoCFunction func, int arity) {
+    CObjCFunction *cfunc = cosmoO_newCFunction(state, func);
+    cfunc->arity = arity;
     return cfunc;
 }
 
 CObjError *cosmoO_newError(CState *state, CValue err) {
+    // nothing references the error until it's returned, so allocating the callframes can't be allowed to collect it
+    cosmoM_freezeGC(state);
+
     CObjError *cerror = (CObjError*)cosmoO_allocateBase(state, sizeof(CObjError), COBJ_ERROR);
     cerror->err = err;
-    cerror->frameCount = state->frameCount;
+    cerror->frames = NULL;
+    cerror->frameCount = 0;
     cerror->parserError = false;
 
     // allocate the callframe
-    cerror->frames = cosmoM_xmalloc(state, sizeof(CCallFrame) * cerror->frameCount);
+    cerror->frames = cosmoM_xmalloc(state, sizeof(CCallFrame) * state->frameCount);
+    cerror->frameCount = state->frameCount;
+    state->freezeGC--; // cosmoM_unfreezeGC could collect it before the caller gets a chance to root it
 
     // clone the call frame
     for (int i = 0; i < state->frameCount; i++)
@@ -234,15 +297,21 @@ CObjMethod *cosmoO_newMethod(CState *state, CValue func, CObj *obj) {
 }
 
 CObjClosure *cosmoO_newClosure(CState *state, CObjFunction *func) {
+    // the closure is made first so the upvalue array always has an owner, even if allocating it throws
+    CObjClosure *closure = (CObjClosure*)cosmoO_allocateBase(state, sizeof(CObjClosure), COBJ_CLOSURE);
+    closure->function = func;
+    closure->upvalues = NULL;
+    closure->upvalueCount = 0;
+
     // initialize array of pointers
+    cosmoV_pushRef(state, (CObj*)closure); // so our GC can keep track of it
     CObjUpval **upvalues = cosmoM_xmalloc(state, sizeof(CObjUpval*) * func->upvals);
+    cosmoV_pop(state);
 
     for (int i = 0; i < func->upvals; i++) {
         upvalues[i] = NULL;
     }
 
-    CObjClosure *closure = (CObjClosure*)cosmoO_allocateBase(state, sizeof(CObjClosure), COBJ_CLOSURE);
-    closure->function = func;
     closure->upvalues = upvalues;
     closure->upvalueCount = func->upvals;
 
@@ -254,10 +323,50 @@ CObjUpval *cosmoO_newUpvalue(CState *state, CValue *val) {
     upval->val = val;
     upval->closed = cosmoV_newNil();
     upval->next = NULL;
+    upval->owner = state->coroutine;
 
     return upval;
 }
 
+CObjCoroutine *cosmoO_newCoroutine(CState *state, CObjClosure *closure) {
+    // nothing references the coroutine until it's returned, so allocating the stacks can't be allowed to collect it
+    cosmoM_freezeGC(state);
+
+    CObjCoroutine *co = (CObjCoroutine*)cosmoO_allocateBase(state, sizeof(CObjCoroutine), COBJ_COROUTINE);
+    co->ctx.stack = NULL;
+    co->ctx.top = NULL;
+    co->ctx.callFrame = NULL;
+    co->ctx.openUpvalues = NULL;
+    co->ctx.frameCount = 0;
+    co->ctx.stackSize = 0;
+    co->ctx.frameSize = 0;
+    co->resumer = NULL;
+    co->status = COROUTINE_SUSPENDED;
+    co->cDepth = 0;
+    co->wanted = 0;
+    co->yielded = 0;
+
+    co->ctx.stack = cosmoM_xmalloc(state, sizeof(CValue) * CO_STACK_MAX);
+    co->ctx.stackSize = CO_STACK_MAX;
+    co->ctx.callFrame = cosmoM_xmalloc(state, sizeof(CCallFrame) * FRAME_MAX);
+    co->ctx.frameSize = FRAME_MAX;
+    state->freezeGC--; // cosmoM_unfreezeGC could collect it before the caller gets a chance to root it
+
+    // the closure sits at the bottom of the stack until the first resume calls it
+    co->ctx.stack[0] = cosmoV_newRef(closure);
+    co->ctx.top = co->ctx.stack + 1;
+    return co;
+}
+
+const char *cosmoO_coroutineStatus(CObjCoroutine *co) {
+    switch (co->status) {
+        case COROUTINE_SUSPENDED:   return "suspended";
+        case COROUTINE_RUNNING:     return "running";
+        case COROUTINE_NORMAL:      return "normal";
+        default:                    return "dead";
+    }
+}
+
 CObjString *cosmoO_copyString(CState *state, const char *str, size_t length) {
     uint32_t hash = hashString(str, length);
     CObjString *lookup = cosmoT_lookupString(&state->strings, str, length, hash);
@@ -289,7 +398,17 @@ CObjString *cosmoO_takeString(CState *state, char *str, size_t length) {
 }
 
 CObjString *cosmoO_allocateString(CState *state, const char *str, size_t sz, uint32_t hash) {
-    CObjString *strObj = (CObjString*)cosmoO_allocateBase(state, sizeof(CObjString), COBJ_STRING);
+    // str is ours now, nothing can be thrown until the string owns it (or it's been freed)
+    cosmoM_freezeGC(state);
+    CObj *obj = cosmoM_tryReallocate(state, NULL, 0, sizeof(CObjString));
+    state->freezeGC--; // cosmoM_unfreezeGC could collect it before it's rooted
+
+    if (obj == NULL) {
+        cosmoM_freearray(state, char, (char*)str, sz + 1);
+        cosmoV_throwMemory(state);
+    }
+
+    CObjString *strObj = (CObjString*)initBase(state, obj, COBJ_STRING);
     strObj->isIString = false;
     strObj->str = (char*)str;
     strObj->length = sz;
@@ -562,6 +681,11 @@ CObjString *cosmoO_toString(CState *state, CObj *obj) {
             int sz = sprintf(buf, "<tbl> %p", (void*)obj) + 1; // +1 for the null character
             return cosmoO_copyString(state, buf, sz);
         }
+        case COBJ_COROUTINE: {
+            char buf[64];
+            int sz = sprintf(buf, "<coroutine> %p", (void*)obj) + 1; // +1 for the null character
+            return cosmoO_copyString(state, buf, sz);
+        }
         default: {
             char buf[64];
             int sz = sprintf(buf, "<unkn obj> %p", (void*)obj) + 1; // +1 for the null character
@@ -690,21 +814,32 @@ void printObject(CObj *o) {
             printValue(*upval->val);
             break;
         }
+        case COBJ_COROUTINE: {
+            CObjCoroutine *co = (CObjCoroutine*)o;
+            printf("<coroutine> %p [%s]", (void*)co, cosmoO_coroutineStatus(co));
+            break;
+        }
         default:
             printf("<unkn obj %p>", (void*)o);
     }
 }
 
 const char *cosmoO_typeStr(CObj* obj) {
-    switch (obj->type) {
+    return cosmoO_typeName(obj->type);
+}
+
+const char *cosmoO_typeName(CObjType type) {
+    switch (type) {
         case COBJ_STRING:       return "<string>";
         case COBJ_OBJECT:       return "<object>";
         case COBJ_TABLE:        return "<table>";
         case COBJ_FUNCTION:     return "<function>";
         case COBJ_CFUNCTION:    return "<c function>";
+        case COBJ_ERROR:        return "<error>";
         case COBJ_METHOD:       return "<method>";
         case COBJ_CLOSURE:      return "<closure>";
         case COBJ_UPVALUE:      return "<upvalue>";
+        case COBJ_COROUTINE:    return "<coroutine>";
 
         default:
             return "<unkn obj>"; // TODO: maybe panic? could be a malformed object :eyes:
@@ -14,6 +14,7 @@ typedef enum CObjType {
     COBJ_METHOD,
     COBJ_CLOSURE,
     COBJ_UPVALUE,
+    COBJ_COROUTINE,
     COBJ_MAX
 } CObjType;
 
@@ -78,11 +79,16 @@ struct CObjFunction {
     int args;
     int upvals;
     bool variadic;
+#ifdef VM_STATS
+    uint64_t execCount; // # of instructions ran in this function
+    uint64_t callCount;
+#endif
 };
 
 struct CObjCFunction {
     CommonHeader; // "is a" CObj
     CosmoCFunction cfunc;
+    int arity; // >= 0 for leaf functions, when called with exactly this many args the GC bookkeeping is skipped
 };
 
 struct CObjClosure {
@@ -103,6 +109,24 @@ struct CObjUpval {
     CValue closed;
     CValue *val;
     struct CObjUpval *next;
+    CObjCoroutine *owner; // coroutine whose stack val points into while it's open, NULL for the state's own stack
+};
+
+typedef enum {
+    COROUTINE_SUSPENDED, // hasn't started yet, or yielded
+    COROUTINE_RUNNING,
+    COROUTINE_NORMAL, // resumed another coroutine & is waiting for it to yield or return
+    COROUTINE_DEAD // returned or threw an error
+} CoroutineStatus;
+
+struct CObjCoroutine {
+    CommonHeader; // "is a" CObj
+    CContext ctx; // saved while the coroutine isn't running, the stacks are free'd once it's dead
+    CObjCoroutine *resumer; // coroutine that resumed us, NULL if it was the state's own stack (only set while we're running)
+    CoroutineStatus status;
+    int cDepth; // state->cDepth our dispatch loop runs at, a yield from any deeper is refused
+    int wanted; // # of results the call we yielded from expects, the values we're resumed with become those results
+    int yielded; // # of values the last yield pushed onto the resumer's stack
 };
 
 #undef CommonHeader
@@ -114,6 +138,7 @@ struct CObjUpval {
 #define IS_CFUNCTION(x) isObjType(x, COBJ_CFUNCTION)
 #define IS_METHOD(x)    isObjType(x, COBJ_METHOD)
 #define IS_CLOSURE(x)   isObjType(x, COBJ_CLOSURE)
+#define IS_COROUTINE(x) isObjType(x, COBJ_COROUTINE)
 
 #define cosmoV_readString(x)    ((CObjString*)cosmoV_readRef(x))
 #define cosmoV_readCString(x)   (((CObjString*)cosmoV_readRef(x))->str)
@@ -123,6 +148,7 @@ struct CObjUpval {
 #define cosmoV_readCFunction(x) (((CObjCFunction*)cosmoV_readRef(x))->cfunc)
 #define cosmoV_readMethod(x)    ((CObjMethod*)cosmoV_readRef(x))
 #define cosmoV_readClosure(x)   ((CObjClosure*)cosmoV_readRef(x))
+#define cosmoV_readCoroutine(x) ((CObjCoroutine*)cosmoV_readRef(x))
 
 #define cosmoO_readCString(x)    ((CObjString*)x)->str
 
@@ -136,6 +162,7 @@ static inline bool IS_CALLABLE(CValue val) {
 }  
 
 void cosmoO_free(CState *state, CObj* obj);
+size_t cosmoO_sizeOf(CObj *obj); // # of bytes obj (and the buffers it owns) are using
 bool cosmoO_equal(CState *state, CObj* obj1, CObj* obj2);
 
 // walks the protos of obj and checks for proto
@@ -145,11 +172,23 @@ CObjObject *cosmoO_newObject(CState *state);
 CObjTable *cosmoO_newTable(CState *state);
 CObjFunction *cosmoO_newFunction(CState *state);
 CObjCFunction *cosmoO_newCFunction(CState *state, CosmoCFunction func);
+
+/*
+    leaf functions are called directly by the VM (no GC freeze/unfreeze) when they're passed exactly arity arguments, otherwise
+    they're called like any other c function. because of this, leaf functions must never call back into the VM & must not hold
+    a CObj* that isn't on the stack across an allocation (pushing a freshly made result, like a string, is fine)
+*/
+CObjCFunction *cosmoO_newLeafCFunction(CState *state, CosmoCFunction func, int arity);
 CObjError *cosmoO_newError(CState *state, CValue err);
 CObjMethod *cosmoO_newMethod(CState *state, CValue func, CObj *obj);
 CObjClosure *cosmoO_newClosure(CState *state, CObjFunction *func);
 CObjUpval *cosmoO_newUpvalue(CState *state, CValue *val);
 
+// makes a suspended coroutine that runs closure when it's first resumed (see cosmoV_resume)
+CObjCoroutine *cosmoO_newCoroutine(CState *state, CObjClosure *closure);
+// "suspended", "running", "normal" or "dead"
+const char *cosmoO_coroutineStatus(CObjCoroutine *co);
+
 // grabs the base proto of the CObj* (if CObj is a CObjObject, that is returned)
 static inline CObjObject *cosmoO_grabProto(CObj *obj) {
     return obj->type == COBJ_OBJECT ? (CObjObject*)obj : obj->proto;
@@ -180,13 +219,17 @@ void cosmoO_unlock(CObjObject *object);
 // internal string
 bool cosmoO_getIString(CState *state, CObjObject *object, int flag, CValue *val);
 
+// hashes str for the string table, only samples ~32 of the characters for long strings
+uint32_t hashString(const char *str, size_t sz);
+
 // copies the *str buffer to the heap and returns a CObjString struct which is also on the heap (length should not include the null terminator)
 CObjString *cosmoO_copyString(CState *state, const char *str, size_t length);
 
 // length shouldn't include the null terminator! str should be a null terminated string! (char array should also have been allocated using cosmoM_xmalloc!)
+// str is owned by the string from here on, it's even freed if running out of memory throws
 CObjString *cosmoO_takeString(CState *state, char *str, size_t length);
 
-// allocates a CObjStruct pointing directly to *str
+// allocates a CObjStruct pointing directly to *str, which it takes ownership of (like cosmoO_takeString)
 CObjString *cosmoO_allocateString(CState *state, const char *str, size_t length, uint32_t hash);
 
 /*
@@ -201,6 +244,7 @@ CObjString *cosmoO_pushVFString(CState *state, const char *format, va_list args)
 
 COSMO_API void printObject(CObj *o);
 const char *cosmoO_typeStr(CObj* obj);
+const char *cosmoO_typeName(CObjType type);
 
 CObjString *cosmoO_toString(CState *state, CObj *obj);
 cosmo_Number cosmoO_toNumber(CState *state, CObj *obj);
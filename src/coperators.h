@@ -20,6 +20,7 @@ typedef enum {
     OP_JMPBACK, // jumps -uint16_t
     OP_POP, // - pops[uint8_t] from stack
     OP_CALL, // calls top[-uint8_t] expecting uint8_t results
+    OP_TAILCALL, // same as OP_CALL, but closures reuse the current callframe (always followed by OP_RETURN)
     OP_CLOSURE, 
     OP_CLOSE,
     OP_NEWTABLE,
@@ -31,8 +32,17 @@ typedef enum {
     OP_GETOBJECT,
     OP_GETMETHOD,
     OP_INVOKE,
+    OP_TAILINVOKE, // same as OP_INVOKE, but closures reuse the current callframe (always followed by OP_RETURN)
     OP_ITER,
     OP_NEXT,
+    OP_VARARGS, // pushes the variadic table, making it from the args left in the stack window if it hasn't been made yet
+    OP_VARINDEX, // pops key, pushes varargs[key]
+    OP_VARNEWINDEX, // pops key & value, sets varargs[key]
+    OP_VARINCINDEX, // pops key, pushes old value, adds (uint8_t-128) to varargs[key]
+    OP_VARCOUNT, // pushes the # of variadic args
+    OP_VARITER, // same as OP_ITER, but iterates over the variadic args
+    OP_VARCALL, // calls top[-uint8_t] with the variadic args appended, expecting uint8_t results
+    OP_TAILVARCALL, // same as OP_VARCALL, but closures reuse the current callframe (always followed by OP_RETURN)
 
     // ARITHMETIC
     OP_ADD,
@@ -63,7 +73,9 @@ typedef enum {
     OP_FALSE,
     OP_NIL,
 
-    OP_RETURN
+    OP_RETURN,
+
+    OP_MAX // # of opcodes, not an instruction
 } COPCODE; // there can be a max of 256 instructions
 
 #endif
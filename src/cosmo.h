@@ -17,6 +17,19 @@
 #define SAFE_STACK
 //#define NAN_BOXXED
 
+/*
+    VM_STATS:
+        if defined, every instruction the VM dispatches is counted per opcode & per function (see cstats.h). the stats are
+    available through cosmoV_printStats & vm.stats(), and are printed when the state is free'd. VM_STATS_TIMING also times each
+    opcode, which slows the VM down a lot more. when neither is defined the VM doesn't pay anything for them
+*/
+//#define VM_STATS
+//#define VM_STATS_TIMING
+
+#if defined(VM_STATS_TIMING) && !defined(VM_STATS)
+#define VM_STATS
+#endif
+
 // forward declare *most* stuff so our headers are cleaner
 typedef struct CState CState;
 typedef struct CChunk CChunk;
@@ -42,12 +55,66 @@ typedef struct CObjError CObjError;
 typedef struct CObjObject CObjObject;
 typedef struct CObjTable CObjTable;
 typedef struct CObjClosure CObjClosure;
+typedef struct CObjCoroutine CObjCoroutine;
+
+// compiled functions that aren't tied to a state (see cproto.h)
+typedef struct CProto CProto;
+
+// sampling profiler state (see cprofile.h)
+typedef struct CProfiler CProfiler;
+
+// allocation tracker state (see cheap.h)
+typedef struct CHeapTracker CHeapTracker;
+
+// bump allocator for short lived states (see carena.h)
+typedef struct CArena CArena;
+
+// event loop state (see cloop.h)
+typedef struct CLoop CLoop;
+
+// a pool of worker states on their own threads (see cworker.h)
+typedef struct CWorkerPool CWorkerPool;
 
 typedef uint8_t INSTRUCTION;
 
+/*
+    a state's allocator (see cosmoV_newStateEx), it works like realloc: buf is NULL when a new buffer is wanted & newSize is 0
+    when buf should be freed (buf can be NULL then too). oldSize is the size buf was allocated or last resized with. returns
+    NULL if the allocation failed (or when freeing)
+*/
+typedef void *(*CosmoAlloc)(void *ud, void *buf, size_t oldSize, size_t newSize);
+
+/*
+    source reader for streamed compilation (see cosmoV_load), called whenever the lexer needs more source. returns the next block
+    of source & sets *size to its length, returning NULL or setting *size to 0 signals the end of the source. the returned
+    block only has to stay valid until the reader is called again
+*/
+typedef const char *(*CosmoReader)(CState *state, void *ud, size_t *size);
+
+// called after every garbage collection cycle (see cosmoM_setGCCallback), the GC is still frozen while it runs
+typedef void (*CosmoGCCallback)(CState *state, void *ud);
+
+// execution hooks (see cosmoV_setHook)
+typedef enum {
+    COSMO_HOOK_CALL,
+    COSMO_HOOK_RETURN,
+    COSMO_HOOK_LINE,
+    COSMO_HOOK_COUNT
+} CosmoHookEvent;
+
+#define COSMO_MASK_CALL     (1 << COSMO_HOOK_CALL)
+#define COSMO_MASK_RETURN   (1 << COSMO_HOOK_RETURN)
+#define COSMO_MASK_LINE     (1 << COSMO_HOOK_LINE)
+#define COSMO_MASK_COUNT    (1 << COSMO_HOOK_COUNT)
+
+// line is the line the function on top of the call stack is at, the GC is frozen while the hook runs
+typedef void (*CosmoHook)(CState *state, CosmoHookEvent event, int line, void *ud);
+
 #define COSMOMAX_UPVALS 80
 #define FRAME_MAX       64
 #define STACK_MAX       (256 * FRAME_MAX)
+#define CO_STACK_MAX    (STACK_MAX / 16) // coroutines get a smaller stack than the state's own
+#define CDEPTH_MAX      200 // how deep resumes can nest, each one runs the coroutine on top of the C stack
 
 #define COSMO_API       extern
 #define UNNAMEDCHUNK    "_main"
@@ -23,11 +23,9 @@ typedef struct {
 } Upvalue;
 
 typedef struct {
-    int *breaks; // this array is dynamically allocated
     int scope; // if -1, there is no loop
     int startBytecode; // start index in the chunk of the loop
-    int breakCount; // # of breaks to patch
-    int breakCapacity;
+    int breakBase; // the loop's breaks are everything above this in the parser's break stack
 } LoopState;
 
 typedef enum {
@@ -37,8 +35,12 @@ typedef enum {
 } FunctionType;
 
 typedef struct CCompilerState {
-    Local locals[256];
-    Upvalue upvalues[256];
+    // these are borrowed from the parser's buffers for this function depth (see CCompilerBuffers)
+    Local *locals;
+    Upvalue *upvalues;
+    int localCapacity;
+    int upvalueCapacity;
+    int depth; // how many functions this one is nested in
     LoopState loop;
 
     CObjFunction *function;
@@ -47,12 +49,33 @@ typedef struct CCompilerState {
     int scopeDepth;
     int pushedValues;
     int expectedValues; 
+    int varargs; // local slot of the variadic table, -1 if the function isn't variadic
+    int lastCall; // chunk offset of the last OP_CALL, OP_VARCALL or OP_INVOKE, used to spot 'return f()' tail calls
     struct CCompilerState* enclosing;
 } CCompilerState;
 
+/*
+    locals & upvalues for every function compiled at a depth, reused so nested functions don't each need their own. the compiler
+    states live on the C stack, so everything they allocate is kept in here where it can still be freed if compiling is unwound
+    by an allocation failure
+*/
+typedef struct {
+    Local *locals;
+    Upvalue *upvalues;
+    int localCapacity;
+    int upvalueCapacity;
+    CTable constIndex; // constant -> index in the constant pool, so makeConstant doesn't have to scan the whole pool
+} CCompilerBuffers;
+
 typedef struct {
     CLexState *lex;
     CCompilerState *compiler;
+    CCompilerBuffers *buffers; // indexed by CCompilerState.depth
+    int bufferCount;
+    int bufferCapacity;
+    int *breaks; // jumps to patch for every loop being compiled, each loop owns the ones above its breakBase
+    int breakCount;
+    int breakCapacity;
     CObjString *module; // name of the module
     CState *state;
     CToken current;
@@ -95,6 +118,7 @@ static void declaration(CParseState *pstate);
 static void function(CParseState *pstate, FunctionType type);
 static void expressionStatement(CParseState *pstate);
 static ParseRule* getRule(CTokenType type);
+static Local *pushLocal(CParseState *pstate);
 static CObjFunction *endCompiler(CParseState *pstate);
 
 // ================================================================ [FRONT END/TALK TO LEXER] ================================================================
@@ -102,17 +126,46 @@ static CObjFunction *endCompiler(CParseState *pstate);
 static void initCompilerState(CParseState* pstate, CCompilerState *ccstate, FunctionType type, CCompilerState *enclosing) {
     pstate->compiler = ccstate;
 
+    // borrow the buffers for this depth, they're handed back in endCompiler
+    ccstate->depth = enclosing == NULL ? 0 : enclosing->depth + 1;
+    if (ccstate->depth == pstate->bufferCount) {
+        cosmoM_growarray(pstate->state, CCompilerBuffers, pstate->buffers, pstate->bufferCount, pstate->bufferCapacity);
+
+        // it's counted before anything is allocated for it, so freeParseState sees whatever did get allocated
+        CCompilerBuffers *buffers = &pstate->buffers[pstate->bufferCount++];
+        buffers->locals = NULL;
+        buffers->upvalues = NULL;
+        buffers->localCapacity = 0;
+        buffers->upvalueCapacity = 0;
+        buffers->constIndex.table = NULL;
+        buffers->constIndex.capacityMask = -1;
+
+        buffers->locals = cosmoM_xmalloc(pstate->state, sizeof(Local) * ARRAY_START);
+        buffers->localCapacity = ARRAY_START;
+        buffers->upvalues = cosmoM_xmalloc(pstate->state, sizeof(Upvalue) * ARRAY_START);
+        buffers->upvalueCapacity = ARRAY_START;
+    }
+
+    CCompilerBuffers *buffers = &pstate->buffers[ccstate->depth];
+    ccstate->locals = buffers->locals;
+    ccstate->upvalues = buffers->upvalues;
+    ccstate->localCapacity = buffers->localCapacity;
+    ccstate->upvalueCapacity = buffers->upvalueCapacity;
+
     ccstate->enclosing = enclosing;
     ccstate->function = NULL;
     ccstate->localCount = 0;
     ccstate->scopeDepth = 0;
     ccstate->pushedValues = 0;
     ccstate->expectedValues = 0;
+    ccstate->varargs = -1;
+    ccstate->lastCall = -1;
     ccstate->type = type;
     ccstate->function = cosmoO_newFunction(pstate->state);
     ccstate->function->module = pstate->module;
 
     ccstate->loop.scope = -1; // there is no loop yet
+    cosmoT_initTable(pstate->state, &pstate->buffers[ccstate->depth].constIndex, ARRAY_START);
 
     if (type != FTYPE_SCRIPT) 
         ccstate->function->name = cosmoO_copyString(pstate->state, pstate->previous.start, pstate->previous.length);
@@ -120,27 +173,45 @@ static void initCompilerState(CParseState* pstate, CCompilerState *ccstate, Func
         ccstate->function->name = cosmoO_copyString(pstate->state, UNNAMEDCHUNK, strlen(UNNAMEDCHUNK));
 
     // mark first local slot as used (this will hold the CObjFunction of the current function, or if it's a method it'll hold the currently bounded object)
-    Local *local = &ccstate->locals[ccstate->localCount++];
+    Local *local = pushLocal(pstate);
     local->depth = 0;
     local->isCaptured = false;
     local->name.start = "";
     local->name.length = 0;
 }
 
-static void initParseState(CParseState *pstate, CCompilerState *ccstate, CState *s, const char *source, const char *module) {
-    pstate->lex = cosmoL_newLexState(s, source);
+// everything is NULL'd out before anything is allocated, so freeParseState can clean up after an allocation failure at any point
+static void initParseState(CParseState *pstate, CState *s) {
+    pstate->lex = NULL;
+    pstate->buffers = NULL;
+    pstate->bufferCount = 0;
+    pstate->bufferCapacity = 0;
+    pstate->breaks = NULL;
+    pstate->breakCount = 0;
+    pstate->breakCapacity = 0;
 
     pstate->state = s;
     pstate->hadError = false;
     pstate->panic = false;
-    pstate->compiler = ccstate;
-    pstate->module = cosmoO_copyString(s, module, strlen(module));
-    
-    initCompilerState(pstate, ccstate, FTYPE_SCRIPT, NULL); // enclosing starts as NULL
+    pstate->compiler = NULL;
+    pstate->module = NULL;
 }
 
 static void freeParseState(CParseState *pstate) {
-    cosmoL_freeLexState(pstate->state, pstate->lex);
+    if (pstate->lex != NULL)
+        cosmoL_freeLexState(pstate->state, pstate->lex);
+
+    for (int i = 0; i < pstate->bufferCount; i++) {
+        cosmoM_freearray(pstate->state, Local, pstate->buffers[i].locals, pstate->buffers[i].localCapacity);
+        cosmoM_freearray(pstate->state, Upvalue, pstate->buffers[i].upvalues, pstate->buffers[i].upvalueCapacity);
+
+        // only set if we were unwound in the middle of a function
+        if (pstate->buffers[i].constIndex.table != NULL)
+            cosmoT_clearTable(pstate->state, &pstate->buffers[i].constIndex);
+    }
+
+    cosmoM_freearray(pstate->state, CCompilerBuffers, pstate->buffers, pstate->bufferCapacity);
+    cosmoM_freearray(pstate->state, int, pstate->breaks, pstate->breakCapacity);
 }
 
 static void errorAt(CParseState *pstate, CToken *token, const char *format, va_list args) {
@@ -241,9 +312,16 @@ CChunk* getChunk(CParseState *pstate) {
     return &pstate->compiler->function->chunk;
 }
 
-// safely adds constant to chunk, checking for overflow
+// safely adds constant to chunk, checking for overflow. constants that are already in the chunk are reused
 uint16_t makeConstant(CParseState *pstate, CValue val) {
+    CValue *entry = cosmoT_insert(pstate->state, &pstate->buffers[pstate->compiler->depth].constIndex, val);
+
+    if (IS_NUMBER(*entry)) // we already have a matching constant!
+        return (uint16_t)cosmoV_readNumber(*entry);
+
     int indx = addConstant(pstate->state, getChunk(pstate), val);
+    *entry = cosmoV_newNumber(indx);
+
     if (indx > UINT16_MAX) {
         error(pstate, "UInt overflow! Too many constants in one chunk!");
         return 0;
@@ -303,13 +381,32 @@ static uint16_t identifierConstant(CParseState *pstate, CToken *name) {
   return makeConstant(pstate, cosmoV_newRef((CObj*)cosmoO_copyString(pstate->state, name->start, name->length)));
 }
 
+// hands ccstate's (possibly grown) locals & upvalues back to the buffers for its depth
+static void syncBuffers(CParseState *pstate, CCompilerState *ccstate) {
+    CCompilerBuffers *buffers = &pstate->buffers[ccstate->depth];
+    buffers->locals = ccstate->locals;
+    buffers->upvalues = ccstate->upvalues;
+    buffers->localCapacity = ccstate->localCapacity;
+    buffers->upvalueCapacity = ccstate->upvalueCapacity;
+}
+
+// grows the locals as needed, the returned pointer is only valid until the next local is pushed
+static Local *pushLocal(CParseState *pstate) {
+    CCompilerState *ccstate = pstate->compiler;
+    cosmoM_growarray(pstate->state, Local, ccstate->locals, ccstate->localCount, ccstate->localCapacity);
+    syncBuffers(pstate, ccstate);
+
+    return &ccstate->locals[ccstate->localCount++];
+}
+
 static void addLocal(CParseState *pstate, CToken name) {
+    // locals are addressed with a u8 operand
     if (pstate->compiler->localCount > UINT8_MAX) {
         error(pstate, "UInt overflow! Too many locals in scope!");
         return;
     }
 
-    Local *local = &pstate->compiler->locals[pstate->compiler->localCount++];
+    Local *local = pushLocal(pstate);
     local->name = name;
     local->depth = -1;
     local->isCaptured = false;
@@ -330,6 +427,8 @@ static int addUpvalue(CParseState *pstate, CCompilerState *ccstate, uint8_t indx
             return i;
     }
 
+    cosmoM_growarray(pstate->state, Upvalue, ccstate->upvalues, upvals, ccstate->upvalueCapacity);
+    syncBuffers(pstate, ccstate);
     ccstate->upvalues[upvals].index = indx;
     ccstate->upvalues[upvals].isLocal = isLocal;
     return ccstate->function->upvals++;
@@ -368,12 +467,22 @@ static void markInitialized(CParseState *pstate, int local) {
     pstate->compiler->locals[local].depth = pstate->compiler->scopeDepth;
 }
 
-static int parseArguments(CParseState *pstate) {
+// expand is set to true if the variadic args are expanded into the call using '...' (this has to be the last argument)
+static int parseArguments(CParseState *pstate, bool *expand) {
     int args = 0;
+    *expand = false;
 
     // there are args to parse!
     if (!check(pstate, TOKEN_RIGHT_PAREN)) {
         do {
+            if (match(pstate, TOKEN_DOT_DOT_DOT)) {
+                if (pstate->compiler->varargs == -1)
+                    error(pstate, "'...' used outside of a variadic function!");
+
+                *expand = true;
+                break;
+            }
+
             expression(pstate, 1, true);
             args++;
         } while(match(pstate, TOKEN_COMMA));
@@ -422,7 +531,7 @@ static void binnumber(CParseState *pstate, bool canAssign, Precedence prec) {
 }
 
 static void string(CParseState *pstate, bool canAssign, Precedence prec) {
-    CObjString *strObj = cosmoO_takeString(pstate->state, pstate->previous.start, pstate->previous.length);
+    CObjString *strObj = cosmoO_copyString(pstate->state, pstate->previous.start, pstate->previous.length);
     writeConstant(pstate, cosmoV_newRef((CObj*)strObj));
 }
 
@@ -438,14 +547,28 @@ static void literal(CParseState *pstate, bool canAssign, Precedence prec) {
     valuePushed(pstate, 1);
 }
 
+// checks if the code emitted since start is just the variadic table being pushed (a lone OP_VARARGS)
+static bool isVarargs(CParseState *pstate, int start) {
+    CChunk *chunk = getChunk(pstate);
+    return chunk->count == start + 1 && chunk->buf[start] == OP_VARARGS;
+}
+
 // parses prefix operators
 static void unary(CParseState *pstate, bool canAssign, Precedence prec) {
     CTokenType type = pstate->previous.type;
     int cachedLine = pstate->previous.line; // eval'ing the next expression might change the line number
 
+    int start = getChunk(pstate)->count;
+
     // only eval the next *value*
     expressionPrecedence(pstate, 1, PREC_UNARY, true);
 
+    // #args doesn't need the variadic table to be made, so just count the variadic args
+    if (type == TOKEN_POUND && isVarargs(pstate, start)) {
+        getChunk(pstate)->buf[start] = OP_VARCOUNT;
+        return;
+    }
+
     switch(type) {
         case TOKEN_MINUS:   writeu8Chunk(pstate->state, getChunk(pstate), OP_NEGATE, cachedLine); break;
         case TOKEN_BANG:    writeu8Chunk(pstate->state, getChunk(pstate), OP_NOT, cachedLine); break;
@@ -497,6 +620,26 @@ static void _etterOP(CParseState *pstate, uint8_t op, int arg) {
         writeu8(pstate, arg);
 }
 
+static void varargIndex(CParseState *pstate, bool canAssign) {
+    // enter having already consumed the '['
+    expression(pstate, 1, true);
+    consume(pstate, TOKEN_RIGHT_BRACKET, "Expected ']' to end index.");
+
+    if (canAssign && match(pstate, TOKEN_EQUAL)) {
+        expression(pstate, 1, true);
+        writeu8(pstate, OP_VARNEWINDEX);
+        valuePopped(pstate, 2); // pops key & value
+    } else if (match(pstate, TOKEN_PLUS_PLUS)) {
+        writeu8(pstate, OP_VARINCINDEX);
+        writeu8(pstate, 128 + 1);
+    } else if (match(pstate, TOKEN_MINUS_MINUS)) {
+        writeu8(pstate, OP_VARINCINDEX);
+        writeu8(pstate, 128 - 1);
+    } else {
+        writeu8(pstate, OP_VARINDEX);
+    }
+}
+
 static void namedVariable(CParseState *pstate, CToken name, bool canAssign, bool canIncrement, int expectedValues) {
     uint8_t opGet, opSet, inc;
     int arg = getLocal(pstate->compiler, &name);
@@ -518,6 +661,12 @@ static void namedVariable(CParseState *pstate, CToken name, bool canAssign, bool
         inc = OP_INCGLOBAL;
     }
 
+    // indexing the variadic table reads straight from the variadic args, so the table doesn't need to be made
+    if (opGet == OP_GETLOCAL && arg == pstate->compiler->varargs && match(pstate, TOKEN_LEFT_BRACKET)) {
+        varargIndex(pstate, canAssign);
+        return;
+    }
+
     if (canAssign && match(pstate, TOKEN_COMMA)) {
         expectedValues++;
 
@@ -569,7 +718,10 @@ static void namedVariable(CParseState *pstate, CToken name, bool canAssign, bool
         valuePushed(pstate, 1);
     } else { 
         // getter
-        _etterOP(pstate, opGet, arg);
+        if (opGet == OP_GETLOCAL && arg == pstate->compiler->varargs)
+            writeu8(pstate, OP_VARARGS); // the variadic table is being used as a value, so it needs to be made
+        else
+            _etterOP(pstate, opGet, arg);
         valuePushed(pstate, 1);
     }
 }
@@ -625,9 +777,11 @@ static void call_(CParseState *pstate, bool canAssign, Precedence prec) {
     int returnNum = pstate->compiler->expectedValues;
 
     // grab our arguments
-    uint8_t argCount = parseArguments(pstate);
+    bool expand;
+    uint8_t argCount = parseArguments(pstate, &expand);
     valuePopped(pstate, argCount + 1); // all of these values will be popped off the stack when returned (+1 for the function)
-    writeu8(pstate, OP_CALL);
+    pstate->compiler->lastCall = getChunk(pstate)->count;
+    writeu8(pstate, expand ? OP_VARCALL : OP_CALL);
     writeu8(pstate, argCount);
 
     // if we're not the last token in this expression or we're expecting multiple values, we should return only 1 value!!
@@ -771,12 +925,17 @@ static void invoke(CParseState *pstate, bool canAssign, Precedence prec) {
 
     if (match(pstate, TOKEN_LEFT_PAREN)) { // invoke
         int returnNum = pstate->compiler->expectedValues;
-        uint8_t args = parseArguments(pstate);
+        bool expand;
+        uint8_t args = parseArguments(pstate, &expand);
+
+        if (expand)
+            error(pstate, "'...' can't be expanded into a method invoke!");
 
         // if we're not the last token in this expression or we're expecting multiple values, we should return only 1 value!!
         if (!isLast(pstate, prec) || (returnNum > 1 && check(pstate, TOKEN_COMMA)))
             returnNum = 1;
         
+        pstate->compiler->lastCall = getChunk(pstate)->count;
         writeu8(pstate, OP_INVOKE);
         writeu8(pstate, args);
         writeu8(pstate, returnNum); 
@@ -1220,19 +1379,15 @@ static void ifStatement(CParseState *pstate) {
 static void startLoop(CParseState *pstate) {
     LoopState *lstate = &pstate->compiler->loop;
     lstate->scope = pstate->compiler->scopeDepth;
-    lstate->breaks = cosmoM_xmalloc(pstate->state, sizeof(int) * ARRAY_START);
-    lstate->breakCount = 0;
-    lstate->breakCapacity = ARRAY_START;
+    lstate->breakBase = pstate->breakCount;
     lstate->startBytecode = getChunk(pstate)->count;
 }
 
 // this patches all the breaks 
 static void endLoop(CParseState *pstate) {
-    while (pstate->compiler->loop.breakCount > 0) {
-        patchJmp(pstate, pstate->compiler->loop.breaks[--pstate->compiler->loop.breakCount]);
+    while (pstate->breakCount > pstate->compiler->loop.breakBase) {
+        patchJmp(pstate, pstate->breaks[--pstate->breakCount]);
     }
-
-    cosmoM_freearray(pstate->state, int, pstate->compiler->loop.breaks,  pstate->compiler->loop.breakCapacity);
 }
 
 static void whileStatement(CParseState *pstate) {
@@ -1292,6 +1447,7 @@ static void function(CParseState *pstate, FunctionType type) {
         defineVariable(pstate, vari, true);
         valuePushed(pstate, 1);
         compiler.function->variadic = true;
+        compiler.varargs = compiler.localCount - 1;
     }
 
     consume(pstate, TOKEN_RIGHT_PAREN, "Expected ')' after parameters.");
@@ -1303,6 +1459,17 @@ static void function(CParseState *pstate, FunctionType type) {
 
     CObjFunction *objFunc = endCompiler(pstate);
 
+    // compiler.upvalues was handed back to the parser by endCompiler, but it's only reused by the next function at this depth
+
+    // the variadic table is only made when it's needed, so make sure it exists before it's captured
+    for (int i = 0; i < objFunc->upvals; i++) {
+        if (compiler.upvalues[i].isLocal && compiler.upvalues[i].index == pstate->compiler->varargs) {
+            writeu8(pstate, OP_VARARGS);
+            writePop(pstate, 1);
+            break;
+        }
+    }
+
     // push closure
     writeu8(pstate, OP_CLOSURE);
     writeu16(pstate, makeConstant(pstate, cosmoV_newRef(objFunc)));
@@ -1346,6 +1513,20 @@ static void returnStatement(CParseState *pstate) {
         rvalues++;
     } while (match(pstate, TOKEN_COMMA));
 
+    // if the value we're returning was the last thing evaluated & it's a call, make it a tail call (the tail versions share operands)
+    CChunk *chunk = getChunk(pstate);
+    int lastCall = pstate->compiler->lastCall;
+    if (rvalues == 1 && lastCall != -1) {
+        INSTRUCTION *op = &chunk->buf[lastCall];
+
+        if (*op == OP_INVOKE && lastCall == chunk->count - 5)
+            *op = OP_TAILINVOKE;
+        else if (*op == OP_VARCALL && lastCall == chunk->count - 3)
+            *op = OP_TAILVARCALL;
+        else if (*op == OP_CALL && lastCall == chunk->count - 3)
+            *op = OP_TAILCALL;
+    }
+
     writeu8(pstate, OP_RETURN);
     writeu8(pstate, rvalues);
     valuePopped(pstate, rvalues);
@@ -1364,7 +1545,7 @@ static void forEachLoop(CParseState *pstate) {
     beginScope(pstate);
 
     // mark a slot on the stack as reserved, we do this by declaring a local with no identifer
-    Local *local = &pstate->compiler->locals[pstate->compiler->localCount++];
+    Local *local = pushLocal(pstate);
     local->depth = pstate->compiler->scopeDepth;
     local->isCaptured = false;
     local->name.start = "";
@@ -1386,11 +1567,15 @@ static void forEachLoop(CParseState *pstate) {
 
     // after we consume the values, get the table/object/whatever on the stack
     consume(pstate, TOKEN_IN, "Expected 'in' before iterator!");
+    int start = getChunk(pstate)->count;
     expression(pstate, 1, true);
 
     consume(pstate, TOKEN_DO, "Expected 'do' before loop block!");
 
-    writeu8(pstate, OP_ITER); // checks if stack[top] is iterable and pushes the __next metamethod onto the stack for OP_NEXT to call
+    if (isVarargs(pstate, start)) // iterating over the variadic table, walk the variadic args instead of making the table
+        getChunk(pstate)->buf[start] = OP_VARITER;
+    else
+        writeu8(pstate, OP_ITER); // checks if stack[top] is iterable and pushes the __next metamethod onto the stack for OP_NEXT to call
 
     // start loop scope
     LoopState cachedLoop = pstate->compiler->loop;
@@ -1508,8 +1693,9 @@ static void breakStatement(CParseState *pstate) {
     pstate->compiler->localCount = savedLocals;
 
     // add break to loop
-    cosmoM_growarray(pstate->state, int, pstate->compiler->loop.breaks, pstate->compiler->loop.breakCount, pstate->compiler->loop.breakCapacity);
-    pstate->compiler->loop.breaks[pstate->compiler->loop.breakCount++] = writeJmp(pstate, OP_JMP);
+    int jump = writeJmp(pstate, OP_JMP);
+    cosmoM_growarray(pstate->state, int, pstate->breaks, pstate->breakCount, pstate->breakCapacity);
+    pstate->breaks[pstate->breakCount++] = jump;
 }
 
 static void continueStatement(CParseState *pstate) {
@@ -1636,44 +1822,94 @@ static CObjFunction *endCompiler(CParseState *pstate) {
     CCompilerState *cachedCCState = pstate->compiler;
     pstate->compiler = cachedCCState->enclosing;
 
+    // the buffers stay untouched until another function at this depth is compiled
+    CCompilerBuffers *buffers = &pstate->buffers[cachedCCState->depth];
+    cosmoT_clearTable(pstate->state, &buffers->constIndex);
+    buffers->constIndex.table = NULL;
+    buffers->constIndex.capacityMask = -1;
+
     return cachedCCState->function;
 }
 
 // ================================================================ [API] ================================================================
 
-CObjFunction* cosmoP_compileString(CState *state, const char *source, const char *module) {
+typedef struct {
     CParseState parser;
+    const char *source; // used if reader is NULL
+    CosmoReader reader;
+    void *ud;
+    const char *module;
+    CObjFunction *func;
+} CCompileCall;
+
+// run under a panic point, everything it allocates is reachable from call->parser so it can be freed if it's unwound
+static bool protectedCompile(CState *state, void *ud) {
+    CCompileCall *call = (CCompileCall*)ud;
+    CParseState *parser = &call->parser;
     CCompilerState compiler;
-    cosmoM_freezeGC(state); // ignore all GC events while compiling
-    initParseState(&parser, &compiler, state, source, module);
 
-    advance(&parser);
+    parser->lex = cosmoL_newLexState(state, call->reader == NULL ? call->source : "");
+    if (call->reader != NULL)
+        cosmoL_setReader(state, parser->lex, call->reader, call->ud);
+
+    parser->buffers = cosmoM_xmalloc(state, sizeof(CCompilerBuffers) * ARRAY_START);
+    parser->bufferCapacity = ARRAY_START;
+    parser->breaks = cosmoM_xmalloc(state, sizeof(int) * ARRAY_START);
+    parser->breakCapacity = ARRAY_START;
+    parser->module = cosmoO_copyString(state, call->module, strlen(call->module));
+
+    initCompilerState(parser, &compiler, FTYPE_SCRIPT, NULL); // enclosing starts as NULL
+
+    advance(parser);
 
-    while (!match(&parser, TOKEN_EOF)) {
-        declaration(&parser);
+    while (!match(parser, TOKEN_EOF)) {
+        declaration(parser);
     }
 
-    consume(&parser, TOKEN_EOF, "End of file expected!");
+    consume(parser, TOKEN_EOF, "End of file expected!");
 
-    popLocals(&parser, 0);
+    popLocals(parser, 0);
 
-    if (parser.hadError) { // we don't free the function, the state already has a reference to it in it's linked list of objects!
-        endCompiler(&parser);
-        freeParseState(&parser);
+    // we don't free the function if there was an error, the state already has a reference to it in it's linked list of objects!
+    call->func = parser->hadError ? NULL : compiler.function;
+    endCompiler(parser);
+    return true;
+}
 
+/*
+    compiling is done under a panic point so running out of memory halfway through doesn't take the whole process down with it,
+    the parse state is freed either way & NULL is returned with the error left in state->error (like a parser error)
+*/
+static CObjFunction *compile(CState *state, const char *source, CosmoReader reader, void *ud, const char *module) {
+    CCompileCall call;
+    initParseState(&call.parser, state);
+    call.source = source;
+    call.reader = reader;
+    call.ud = ud;
+    call.module = module;
+    call.func = NULL;
+
+    // ignore all GC events while compiling (the lexer also relies on this to keep interned identifiers alive)
+    cosmoM_freezeGC(state);
+    bool ok = cosmoV_runProtected(state, state->top, protectedCompile, &call);
+    freeParseState(&call.parser);
+
+    if (!ok || call.func == NULL) {
         cosmoM_unfreezeGC(state);
         return NULL;
     }
 
-    CObjFunction* resFunc = compiler.function;
-
-    // finally free out parser states
-    endCompiler(&parser);
-    freeParseState(&parser);
-
     // push the funciton onto the stack so if we cause an GC event, it won't be free'd
-    cosmoV_pushRef(state, (CObj*)resFunc);
+    cosmoV_pushRef(state, (CObj*)call.func);
     cosmoM_unfreezeGC(state);
     cosmoV_pop(state);
-    return resFunc;
+    return call.func;
+}
+
+CObjFunction* cosmoP_compileString(CState *state, const char *source, const char *module) {
+    return compile(state, source, NULL, NULL, module);
+}
+
+CObjFunction* cosmoP_compileReader(CState *state, CosmoReader reader, void *ud, const char *module) {
+    return compile(state, NULL, reader, ud, module);
 }
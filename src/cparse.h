@@ -7,4 +7,7 @@
 // compiles source into CChunk, if NULL is returned, a syntaxical error has occurred and pushed onto the stack
 CObjFunction* cosmoP_compileString(CState *state, const char *source, const char *module);
 
+// same as cosmoP_compileString, but the source is pulled from reader in blocks as the lexer needs it
+CObjFunction* cosmoP_compileReader(CState *state, CosmoReader reader, void *ud, const char *module);
+
 #endif
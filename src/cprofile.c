@@ -0,0 +1,151 @@
+#define _GNU_SOURCE // SIGEV_THREAD_ID
+
+#include "cprofile.h"
+#include "cstate.h"
+#include "cobj.h"
+#include "csite.h"
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// older glibcs don't name it
+#ifndef sigev_notify_thread_id
+#   define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// samples are taken in the middle of the VM, so we stay away from the GC & use C's allocator
+struct CProfiler {
+    CSiteTable stacks; // every folded stack we've seen, each one's data is the # of ticks it was sampled for (a long)
+};
+
+_Thread_local volatile sig_atomic_t cosmoV_profileTicks = 0;
+
+static CState *profiledState = NULL;
+static struct sigaction oldAction;
+static timer_t timer;
+
+static void onTick(int sig) {
+    cosmoV_profileTicks++;
+}
+
+COSMO_API bool cosmoV_startProfiler(CState *state, int intervalUs) {
+    if (profiledState != NULL)
+        return false;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onTick;
+    action.sa_flags = SA_RESTART; // so we don't break the script's IO
+    sigemptyset(&action.sa_mask);
+
+    if (state->profiler == NULL) {
+        CProfiler *profiler = malloc(sizeof(CProfiler));
+        if (profiler == NULL)
+            return false;
+
+        cosmoS_initSites(&profiler->stacks, sizeof(long));
+        state->profiler = profiler;
+    }
+
+    if (sigaction(SIGPROF, &action, &oldAction) != 0)
+        return false;
+
+    // the timer only counts the CPU time of the thread we're on & only ticks on it, so worker threads don't skew the samples
+    struct sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_notify_thread_id = syscall(SYS_gettid);
+
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer) != 0) {
+        sigaction(SIGPROF, &oldAction, NULL);
+        return false;
+    }
+
+    struct itimerspec interval;
+    interval.it_interval.tv_sec = intervalUs / 1000000;
+    interval.it_interval.tv_nsec = (intervalUs % 1000000) * 1000;
+    interval.it_value = interval.it_interval;
+
+    if (timer_settime(timer, 0, &interval, NULL) != 0) {
+        timer_delete(timer);
+        sigaction(SIGPROF, &oldAction, NULL);
+        return false;
+    }
+
+    cosmoV_profileTicks = 0;
+    profiledState = state;
+    return true;
+}
+
+COSMO_API void cosmoV_stopProfiler(CState *state) {
+    if (profiledState != state)
+        return;
+
+    timer_delete(timer);
+    sigaction(SIGPROF, &oldAction, NULL);
+
+    cosmoV_profileTicks = 0;
+    profiledState = NULL;
+}
+
+COSMO_API void cosmoV_writeProfile(CState *state, FILE *out) {
+    CProfiler *profiler = state->profiler;
+    if (profiler == NULL)
+        return;
+
+    CSiteTable *stacks = &profiler->stacks;
+    for (int i = 0; i < stacks->count; i++)
+        fprintf(out, "%.*s %ld\n", (int)stacks->sites[i].length, stacks->sites[i].name, *(long*)cosmoS_siteData(stacks, i));
+}
+
+void cosmoV_freeProfile(CState *state) {
+    CProfiler *profiler = state->profiler;
+    if (profiler == NULL)
+        return;
+
+    cosmoV_stopProfiler(state);
+
+    cosmoS_freeSites(&profiler->stacks);
+    free(profiler);
+    state->profiler = NULL;
+}
+
+// ================================================================ [SAMPLING] ================================================================
+
+// folds the call stack into the scratch buffer, root first
+static bool foldStack(CState *state, CSiteTable *stacks) {
+    cosmoS_resetName(stacks);
+
+    for (int i = 0; i < state->frameCount; i++) {
+        if (i > 0 && !cosmoS_append(stacks, ";", 1))
+            return false;
+
+        if (!cosmoS_appendFrame(stacks, &state->callFrame[i]))
+            return false;
+    }
+
+    return true;
+}
+
+void cosmoV_sampleProfile(CState *state) {
+    // another state is being profiled, the tick is theirs
+    if (state != profiledState)
+        return;
+
+    // ticks that land between safepoints are all charged to this sample
+    long ticks = cosmoV_profileTicks;
+    cosmoV_profileTicks = 0;
+
+    if (state->frameCount == 0)
+        return;
+
+    // if we're out of memory the sample is dropped, the script shouldn't die because it's being profiled
+    CSiteTable *stacks = &state->profiler->stacks;
+    int stack = foldStack(state, stacks) ? cosmoS_findSite(stacks) : -1;
+
+    if (stack != -1)
+        *(long*)cosmoS_siteData(stacks, stack) += ticks;
+}
@@ -0,0 +1,36 @@
+#ifndef CPROFILE_H
+#define CPROFILE_H
+
+#include "cosmo.h"
+
+#include <signal.h>
+
+/*
+    sampling profiler. a SIGPROF timer bumps cosmoV_profileTicks, and the VM records the whole call stack the next time it hits
+    a safepoint (calls, returns & loop back-jumps). when the profiler is off the VM only pays for checking cosmoV_profileTicks at
+    those safepoints.
+
+    the timer runs on the CPU time of the thread that started it & the tick is per thread, so states running on other threads
+    (eg. a worker pool's) never see it. only one state can be profiled at a time
+*/
+
+// bumped by the timer, reset by the VM once it's taken the sample
+extern _Thread_local volatile sig_atomic_t cosmoV_profileTicks;
+
+// starts sampling state every intervalUs microseconds of the calling thread's CPU time, the state has to be ran on this thread.
+// returns false if another state is being profiled (or the timer couldn't be set up). samples from earlier runs on this state
+// are kept
+COSMO_API bool cosmoV_startProfiler(CState *state, int intervalUs);
+COSMO_API void cosmoV_stopProfiler(CState *state);
+
+// writes the samples as folded stacks ("frame;frame;frame count" per line), which flamegraph.pl & friends read directly. each
+// frame is "module:function:line"
+COSMO_API void cosmoV_writeProfile(CState *state, FILE *out);
+
+// called by the VM at safepoints when cosmoV_profileTicks is non-zero
+void cosmoV_sampleProfile(CState *state);
+
+// frees the samples, called by cosmoV_freeState
+void cosmoV_freeProfile(CState *state);
+
+#endif
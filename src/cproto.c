@@ -0,0 +1,576 @@
+#include "cproto.h"
+#include "cstate.h"
+#include "cparse.h"
+#include "cmem.h"
+#include "cobj.h"
+#include "cvm.h"
+#include "csite.h"
+
+#include <string.h>
+
+// protos live outside of any state, so they use C's malloc (there's no state to account them to). nothing here can throw, so
+// running out of memory is reported by returning NULL (or false) & the half built proto is free'd
+
+static void *copyBuffer(const void *src, size_t size) {
+    void *buf = malloc(size > 0 ? size : 1);
+    if (buf != NULL)
+        memcpy(buf, src, size);
+
+    return buf;
+}
+
+static char *copyStr(const char *str, int length) {
+    char *buf = malloc(length + 1);
+    if (buf == NULL)
+        return NULL;
+
+    memcpy(buf, str, length);
+    buf[length] = '\0';
+    return buf;
+}
+
+static CProto *newProto() {
+    CProto *proto = malloc(sizeof(CProto));
+    if (proto != NULL)
+        memset(proto, 0, sizeof(CProto));
+
+    return proto;
+}
+
+// zeroed, so every constant starts as CPROTO_NIL & the proto can be free'd before they're all filled in
+static CProtoConst *newConstants(int count) {
+    size_t size = sizeof(CProtoConst) * (count > 0 ? count : 1);
+    CProtoConst *constants = malloc(size);
+    if (constants != NULL)
+        memset(constants, 0, size);
+
+    return constants;
+}
+
+// ================================================================ [STATE -> PROTO] ================================================================
+
+// proto is always left safe to pass to cosmoP_freeProto, even if this fails
+static bool fillProto(CProto *proto, CObjFunction *func) {
+    CChunk *chunk = &func->chunk;
+
+    if ((proto->code = copyBuffer(chunk->buf, sizeof(INSTRUCTION) * chunk->count)) == NULL)
+        return false;
+    proto->codeCount = chunk->count;
+
+    if ((proto->lines = copyBuffer(chunk->lineInfo, sizeof(CLineRun) * chunk->lineCount)) == NULL)
+        return false;
+    proto->lineCount = chunk->lineCount;
+
+    // the parser only makes these kinds of constants
+    if ((proto->constants = newConstants(chunk->constants.count)) == NULL)
+        return false;
+    proto->constCount = chunk->constants.count;
+
+    for (int i = 0; i < proto->constCount; i++) {
+        CValue val = chunk->constants.values[i];
+        CProtoConst *constant = &proto->constants[i];
+
+        // the type is only set once the constant owns its memory
+        if (IS_NUMBER(val)) {
+            constant->type = CPROTO_NUMBER;
+            constant->num = cosmoV_readNumber(val);
+        } else if (IS_BOOLEAN(val)) {
+            constant->type = CPROTO_BOOLEAN;
+            constant->b = cosmoV_readBoolean(val);
+        } else if (IS_STRING(val)) {
+            CObjString *str = cosmoV_readString(val);
+            if ((constant->s.str = copyStr(str->str, str->length)) == NULL)
+                return false;
+
+            constant->type = CPROTO_STRING;
+            constant->s.length = str->length;
+        } else if (IS_FUNCTION(val)) {
+            if ((constant->proto = newProto()) == NULL)
+                return false;
+
+            constant->type = CPROTO_FUNCTION;
+            if (!fillProto(constant->proto, cosmoV_readFunction(val)))
+                return false;
+        }
+    }
+
+    if (func->name != NULL) {
+        if ((proto->name = copyStr(func->name->str, func->name->length)) == NULL)
+            return false;
+        proto->nameLength = func->name->length;
+    }
+
+    if (func->module != NULL) {
+        if ((proto->module = copyStr(func->module->str, func->module->length)) == NULL)
+            return false;
+        proto->moduleLength = func->module->length;
+    }
+
+    proto->args = func->args;
+    proto->upvals = func->upvals;
+    proto->variadic = func->variadic;
+    return true;
+}
+
+// turns the result of cosmoP_compileString/cosmoP_compileReader into a proto, func is NULL if it failed
+static CProto *makeProto(CState *state, CObjFunction *func) {
+    // running out of memory isn't a parser error, so it's not kept around to be thrown later
+    if (func == NULL && state->error == state->memError)
+        return NULL;
+
+    CProto *proto = newProto();
+    if (proto == NULL)
+        return NULL;
+
+    if (func != NULL) {
+        if (!fillProto(proto, func)) {
+            cosmoP_freeProto(proto);
+            return NULL;
+        }
+
+        return proto;
+    }
+
+    // keep the parser error around so it can be thrown on the state the proto is loaded into
+    CObjString *err = cosmoV_toString(state, state->error->err);
+    if ((proto->error = copyStr(err->str, err->length)) == NULL) {
+        cosmoP_freeProto(proto);
+        return NULL;
+    }
+
+    proto->errorLength = err->length;
+    proto->errorLine = state->error->line;
+    return proto;
+}
+
+typedef struct {
+    const char *source; // NULL if we're reading from reader
+    CosmoReader reader;
+    void *ud;
+    const char *module;
+    CProto *proto;
+} CProtoCall;
+
+static bool protectedCompileProto(CState *state, void *ud) {
+    CProtoCall *call = (CProtoCall*)ud;
+    CObjFunction *func = call->source != NULL ? cosmoP_compileString(state, call->source, call->module)
+                                              : cosmoP_compileReader(state, call->reader, call->ud, call->module);
+
+    call->proto = makeProto(state, func);
+    return true;
+}
+
+// each proto is compiled on a private state, it's thrown away once the proto is made. the compiler unfreezes the GC once it's
+// done, so the collection that kicks off has to run protected too or running out of memory there would exit
+static CProto *compileProto(const char *source, CosmoReader reader, void *ud, const char *module) {
+    CState *state = cosmoV_newState();
+    if (state == NULL)
+        return NULL;
+
+    CProtoCall call = {source, reader, ud, module, NULL};
+    cosmoV_runProtected(state, state->top, protectedCompileProto, &call);
+
+    cosmoV_freeState(state);
+    return call.proto;
+}
+
+CProto *cosmoP_compileProto(const char *source, const char *module) {
+    return compileProto(source, NULL, NULL, module);
+}
+
+CProto *cosmoP_compileProtoReader(CosmoReader reader, void *ud, const char *module) {
+    return compileProto(NULL, reader, ud, module);
+}
+
+void cosmoP_freeProto(CProto *proto) {
+    for (int i = 0; i < proto->constCount; i++) {
+        CProtoConst *constant = &proto->constants[i];
+
+        if (constant->type == CPROTO_STRING)
+            free(constant->s.str);
+        else if (constant->type == CPROTO_FUNCTION)
+            cosmoP_freeProto(constant->proto);
+    }
+
+    free(proto->code);
+    free(proto->lines);
+    free(proto->constants);
+    free(proto->name);
+    free(proto->module);
+    free(proto->error);
+    free(proto);
+}
+
+// ================================================================ [DUMP/UNDUMP] ================================================================
+
+#define CPROTO_MAGIC "\x1b" "Csm"
+
+typedef struct {
+    char *buf;
+    size_t count;
+    size_t capacity;
+    bool failed; // ran out of memory, everything dumped after that is dropped
+} DumpState;
+
+typedef struct {
+    const char *buf;
+    size_t left;
+} UndumpState;
+
+uint64_t cosmoP_hashSource(const char *source, size_t size, const char *module) {
+    uint64_t hash = cosmoS_hash(FNV_OFFSET, source, size);
+
+    // hashing the 0 keeps "ab" + "c" from hashing the same as "a" + "bc"
+    return cosmoS_hash(hash, module, strlen(module) + 1);
+}
+
+static void initDump(DumpState *dump, size_t capacity) {
+    dump->buf = malloc(capacity);
+    dump->count = 0;
+    dump->capacity = capacity;
+    dump->failed = dump->buf == NULL;
+}
+
+static void dumpBlock(DumpState *dump, const void *data, size_t size) {
+    if (dump->failed)
+        return;
+
+    if (dump->count + size > dump->capacity) {
+        size_t capacity = dump->capacity * 2;
+        while (capacity < dump->count + size)
+            capacity *= 2;
+
+        char *buf = realloc(dump->buf, capacity);
+        if (buf == NULL) {
+            dump->failed = true;
+            return;
+        }
+
+        dump->buf = buf;
+        dump->capacity = capacity;
+    }
+
+    memcpy(dump->buf + dump->count, data, size);
+    dump->count += size;
+}
+
+static void dumpByte(DumpState *dump, uint8_t b) {
+    dumpBlock(dump, &b, sizeof(uint8_t));
+}
+
+static void dumpInt(DumpState *dump, int i) {
+    dumpBlock(dump, &i, sizeof(int));
+}
+
+// NULL strings are dumped with a length of -1
+static void dumpStr(DumpState *dump, const char *str, int length) {
+    if (str == NULL) {
+        dumpInt(dump, -1);
+        return;
+    }
+
+    dumpInt(dump, length);
+    dumpBlock(dump, str, length);
+}
+
+static void dumpFunction(DumpState *dump, CProto *proto) {
+    dumpInt(dump, proto->codeCount);
+    dumpBlock(dump, proto->code, sizeof(INSTRUCTION) * proto->codeCount);
+
+    dumpInt(dump, proto->lineCount);
+    for (int i = 0; i < proto->lineCount; i++) {
+        dumpInt(dump, proto->lines[i].pc);
+        dumpInt(dump, proto->lines[i].line);
+    }
+
+    dumpInt(dump, proto->constCount);
+    for (int i = 0; i < proto->constCount; i++) {
+        CProtoConst *constant = &proto->constants[i];
+        dumpByte(dump, constant->type);
+
+        switch (constant->type) {
+            case CPROTO_BOOLEAN: dumpByte(dump, constant->b); break;
+            case CPROTO_NUMBER: dumpBlock(dump, &constant->num, sizeof(cosmo_Number)); break;
+            case CPROTO_STRING: dumpStr(dump, constant->s.str, constant->s.length); break;
+            case CPROTO_FUNCTION: dumpFunction(dump, constant->proto); break;
+            default: break;
+        }
+    }
+
+    dumpStr(dump, proto->name, proto->nameLength);
+    dumpStr(dump, proto->module, proto->moduleLength);
+    dumpInt(dump, proto->args);
+    dumpInt(dump, proto->upvals);
+    dumpByte(dump, proto->variadic);
+}
+
+// the header rejects dumps from other format versions, opcode sets & machines with different type sizes
+static void dumpHeader(DumpState *dump, uint64_t key) {
+    dumpBlock(dump, CPROTO_MAGIC, 4);
+    dumpByte(dump, CPROTO_FORMAT_VERSION);
+    dumpByte(dump, OP_MAX);
+    dumpByte(dump, sizeof(INSTRUCTION));
+    dumpByte(dump, sizeof(int));
+    dumpByte(dump, sizeof(cosmo_Number));
+    dumpBlock(dump, &key, sizeof(uint64_t));
+}
+
+char *cosmoP_dumpProto(CProto *proto, uint64_t key, size_t *size) {
+    DumpState dump;
+    initDump(&dump, 256);
+    dumpHeader(&dump, key);
+
+    // the bytecode isn't verified when it's loaded, so the body is checksummed to catch dumps that were damaged on disk
+    size_t checksumOffset = dump.count;
+    uint64_t checksum = 0;
+    dumpBlock(&dump, &checksum, sizeof(uint64_t));
+
+    size_t bodyOffset = dump.count;
+    dumpFunction(&dump, proto);
+
+    if (dump.failed) {
+        free(dump.buf);
+        return NULL;
+    }
+
+    checksum = cosmoS_hash(FNV_OFFSET, dump.buf + bodyOffset, dump.count - bodyOffset);
+    memcpy(dump.buf + checksumOffset, &checksum, sizeof(uint64_t));
+
+    *size = dump.count;
+    return dump.buf;
+}
+
+static bool undumpBlock(UndumpState *undump, void *data, size_t size) {
+    if (size > undump->left)
+        return false;
+
+    memcpy(data, undump->buf, size);
+    undump->buf += size;
+    undump->left -= size;
+    return true;
+}
+
+static bool undumpByte(UndumpState *undump, uint8_t *b) {
+    return undumpBlock(undump, b, sizeof(uint8_t));
+}
+
+// counts are checked against what's left so a corrupt dump can't make us allocate something huge
+static bool undumpCount(UndumpState *undump, int *count, size_t elemSize) {
+    return undumpBlock(undump, count, sizeof(int)) && *count >= 0 && (size_t)*count <= undump->left / (elemSize > 0 ? elemSize : 1);
+}
+
+static bool undumpStr(UndumpState *undump, char **str, int *length) {
+    if (!undumpBlock(undump, length, sizeof(int)))
+        return false;
+
+    if (*length == -1) // NULL string
+        return true;
+
+    if (*length < 0 || (size_t)*length > undump->left)
+        return false;
+
+    if ((*str = copyStr(undump->buf, *length)) == NULL)
+        return false;
+
+    undump->buf += *length;
+    undump->left -= *length;
+    return true;
+}
+
+// proto is always left safe to pass to cosmoP_freeProto, even if this fails
+static bool undumpFunction(UndumpState *undump, CProto *proto) {
+    int count;
+
+    if (!undumpCount(undump, &count, sizeof(INSTRUCTION)))
+        return false;
+    if ((proto->code = malloc(sizeof(INSTRUCTION) * (count > 0 ? count : 1))) == NULL)
+        return false;
+    proto->codeCount = count;
+    undumpBlock(undump, proto->code, sizeof(INSTRUCTION) * count);
+
+    if (!undumpCount(undump, &count, sizeof(int) * 2))
+        return false;
+    if ((proto->lines = malloc(sizeof(CLineRun) * (count > 0 ? count : 1))) == NULL)
+        return false;
+    proto->lineCount = count;
+    for (int i = 0; i < count; i++) {
+        undumpBlock(undump, &proto->lines[i].pc, sizeof(int));
+        undumpBlock(undump, &proto->lines[i].line, sizeof(int));
+    }
+
+    // each constant is at least it's type byte
+    if (!undumpCount(undump, &count, sizeof(uint8_t)))
+        return false;
+    if ((proto->constants = newConstants(count)) == NULL)
+        return false;
+    for (int i = 0; i < count; i++) {
+        CProtoConst *constant = &proto->constants[i];
+        uint8_t type, b;
+
+        if (!undumpByte(undump, &type))
+            return false;
+
+        constant->type = type;
+        switch (type) {
+            case CPROTO_NIL: break;
+            case CPROTO_BOOLEAN:
+                if (!undumpByte(undump, &b))
+                    return false;
+                constant->b = b;
+                break;
+            case CPROTO_NUMBER:
+                if (!undumpBlock(undump, &constant->num, sizeof(cosmo_Number)))
+                    return false;
+                break;
+            case CPROTO_STRING:
+                constant->s.str = NULL;
+                if (!undumpStr(undump, &constant->s.str, &constant->s.length) || constant->s.str == NULL)
+                    return false;
+                break;
+            case CPROTO_FUNCTION:
+                if ((constant->proto = newProto()) == NULL)
+                    return false;
+
+                proto->constCount = i + 1; // so the nested proto is free'd if it fails
+                if (!undumpFunction(undump, constant->proto))
+                    return false;
+                break;
+            default:
+                return false;
+        }
+
+        proto->constCount = i + 1;
+    }
+
+    uint8_t variadic;
+    if (!undumpStr(undump, &proto->name, &proto->nameLength) || !undumpStr(undump, &proto->module, &proto->moduleLength) ||
+        !undumpBlock(undump, &proto->args, sizeof(int)) || !undumpBlock(undump, &proto->upvals, sizeof(int)) ||
+        !undumpByte(undump, &variadic))
+        return false;
+
+    proto->variadic = variadic;
+    return true;
+}
+
+CProto *cosmoP_undumpProto(const char *buf, size_t size, uint64_t key) {
+    // the header is compared byte for byte against what we would've dumped
+    DumpState header;
+    initDump(&header, 32);
+    dumpHeader(&header, key);
+
+    if (header.failed) {
+        free(header.buf);
+        return NULL;
+    }
+
+    bool match = size >= header.count && memcmp(buf, header.buf, header.count) == 0;
+    size_t headerSize = header.count;
+    free(header.buf);
+
+    if (!match)
+        return NULL;
+
+    UndumpState undump;
+    undump.buf = buf + headerSize;
+    undump.left = size - headerSize;
+
+    uint64_t checksum;
+    if (!undumpBlock(&undump, &checksum, sizeof(uint64_t)) || checksum != cosmoS_hash(FNV_OFFSET, undump.buf, undump.left))
+        return NULL;
+
+    CProto *proto = newProto();
+    if (proto == NULL)
+        return NULL;
+
+    if (!undumpFunction(&undump, proto) || undump.left != 0) {
+        cosmoP_freeProto(proto);
+        return NULL;
+    }
+
+    return proto;
+}
+
+// ================================================================ [PROTO -> STATE] ================================================================
+
+// the GC should be frozen
+static CObjFunction *toFunction(CState *state, CProto *proto) {
+    CObjFunction *func = cosmoO_newFunction(state);
+    CChunk *chunk = &func->chunk;
+
+    chunk->buf = cosmoM_xmalloc(state, sizeof(INSTRUCTION) * proto->codeCount);
+    chunk->capacity = proto->codeCount;
+    chunk->count = proto->codeCount;
+    memcpy(chunk->buf, proto->code, sizeof(INSTRUCTION) * proto->codeCount);
+
+    chunk->lineInfo = cosmoM_xmalloc(state, sizeof(CLineRun) * proto->lineCount);
+    chunk->lineCapacity = proto->lineCount;
+    chunk->lineCount = proto->lineCount;
+    memcpy(chunk->lineInfo, proto->lines, sizeof(CLineRun) * proto->lineCount);
+
+    for (int i = 0; i < proto->constCount; i++) {
+        CProtoConst *constant = &proto->constants[i];
+        CValue val;
+
+        switch (constant->type) {
+            case CPROTO_BOOLEAN: val = cosmoV_newBoolean(constant->b); break;
+            case CPROTO_NUMBER: val = cosmoV_newNumber(constant->num); break;
+            case CPROTO_STRING: val = cosmoV_newRef(cosmoO_copyString(state, constant->s.str, constant->s.length)); break;
+            case CPROTO_FUNCTION: val = cosmoV_newRef(toFunction(state, constant->proto)); break;
+            default: val = cosmoV_newNil(); break;
+        }
+
+        addConstant(state, chunk, val);
+    }
+
+    if (proto->name != NULL)
+        func->name = cosmoO_copyString(state, proto->name, proto->nameLength);
+
+    if (proto->module != NULL)
+        func->module = cosmoO_copyString(state, proto->module, proto->moduleLength);
+
+    func->args = proto->args;
+    func->upvals = proto->upvals;
+    func->variadic = proto->variadic;
+    return func;
+}
+
+typedef struct {
+    CProto *proto;
+    CObjFunction *func;
+} CLoadCall;
+
+static bool protectedLoad(CState *state, void *ud) {
+    CLoadCall *call = (CLoadCall*)ud;
+    CProto *proto = call->proto;
+
+    if (proto->error != NULL) {
+        // rethrow the parser error like cosmoP_compileString would have
+        cosmoV_pushRef(state, (CObj*)cosmoO_copyString(state, proto->error, proto->errorLength));
+        CObjError *err = cosmoV_throw(state);
+        err->line = proto->errorLine;
+        err->parserError = true;
+        return false;
+    }
+
+    call->func = toFunction(state, proto);
+    return true;
+}
+
+// like compiling, running out of memory halfway through leaves the error in state->error & returns NULL
+CObjFunction *cosmoP_loadProto(CState *state, CProto *proto) {
+    CLoadCall call;
+    call.proto = proto;
+    call.func = NULL;
+
+    cosmoM_freezeGC(state);
+    if (!cosmoV_runProtected(state, state->top, protectedLoad, &call)) {
+        cosmoM_unfreezeGC(state);
+        return NULL;
+    }
+
+    // push the function onto the stack so if we cause an GC event, it won't be free'd
+    cosmoV_pushRef(state, (CObj*)call.func);
+    cosmoM_unfreezeGC(state);
+    cosmoV_pop(state);
+    return call.func;
+}
@@ -0,0 +1,75 @@
+#ifndef CPROTO_H
+#define CPROTO_H
+
+#include "cosmo.h"
+
+#include "cchunk.h"
+
+// bump this whenever the dumped layout or the meaning of any instruction changes, old dumps will be rejected by cosmoP_undumpProto
+#define CPROTO_FORMAT_VERSION 2
+
+/*
+    a compiled function that doesn't belong to any state. everything is plain malloc'd memory (nothing is interned or tracked by
+    a GC), so protos can be compiled on any thread & handed to a state later with cosmoV_loadProto
+*/
+
+typedef enum {
+    CPROTO_NIL,
+    CPROTO_BOOLEAN,
+    CPROTO_NUMBER,
+    CPROTO_STRING,
+    CPROTO_FUNCTION
+} CProtoConstType;
+
+typedef struct CProtoConst {
+    CProtoConstType type;
+    union {
+        bool b;
+        cosmo_Number num;
+        struct {
+            char *str; // NULL terminated
+            int length;
+        } s;
+        CProto *proto; // nested function
+    };
+} CProtoConst;
+
+struct CProto {
+    INSTRUCTION *code;
+    CLineRun *lines;
+    CProtoConst *constants;
+    char *name;
+    char *module;
+    char *error; // if non-NULL, compiling failed & this is the error message (only errorLine is set besides it)
+    int codeCount;
+    int lineCount;
+    int constCount;
+    int nameLength;
+    int moduleLength;
+    int errorLength;
+    int errorLine;
+    int args;
+    int upvals;
+    bool variadic;
+};
+
+// compiles source on a private state, so it's safe to call from any thread. check proto->error to see if it failed, returns
+// NULL if we ran out of memory
+COSMO_API CProto *cosmoP_compileProto(const char *source, const char *module);
+// same as cosmoP_compileProto, but the source is pulled from reader (the reader is passed the private state)
+COSMO_API CProto *cosmoP_compileProtoReader(CosmoReader reader, void *ud, const char *module);
+COSMO_API void cosmoP_freeProto(CProto *proto);
+
+// hashes source (& the module name, since it's baked into the protos) for the key passed to cosmoP_dumpProto/cosmoP_undumpProto
+COSMO_API uint64_t cosmoP_hashSource(const char *source, size_t size, const char *module);
+// serializes proto into a malloc'd buffer (free it with free()), the format is native-endian so dumps aren't portable between
+// machines. returns NULL if we ran out of memory
+COSMO_API char *cosmoP_dumpProto(CProto *proto, uint64_t key, size_t *size);
+// returns NULL if buf is malformed, was dumped by a different VM/format version, wasn't dumped with key or we ran out of memory.
+// the bytecode itself isn't verified, so only undump what you (or a cache you own) dumped
+COSMO_API CProto *cosmoP_undumpProto(const char *buf, size_t size, uint64_t key);
+
+// makes the CObjFunction for proto on state, if proto failed to compile its error is thrown on state & NULL is returned
+CObjFunction *cosmoP_loadProto(CState *state, CProto *proto);
+
+#endif
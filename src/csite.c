@@ -0,0 +1,170 @@
+#include "csite.h"
+#include "cchunk.h"
+#include "cobj.h"
+
+#include <stdio.h>
+#include <string.h>
+
+uint64_t cosmoS_hash(uint64_t hash, const char *data, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ (uint8_t)data[i]) * FNV_PRIME;
+
+    return hash;
+}
+
+void cosmoS_initSites(CSiteTable *tbl, size_t dataSize) {
+    tbl->sites = NULL;
+    tbl->data = NULL;
+    tbl->dataSize = dataSize;
+    tbl->count = 0;
+    tbl->capacity = 0;
+    tbl->index = NULL;
+    tbl->indexCapacity = 0;
+    tbl->buf = NULL;
+    tbl->bufCount = 0;
+    tbl->bufCapacity = 0;
+}
+
+void cosmoS_freeSites(CSiteTable *tbl) {
+    for (int i = 0; i < tbl->count; i++)
+        free(tbl->sites[i].name);
+
+    free(tbl->sites);
+    free(tbl->data);
+    free(tbl->index);
+    free(tbl->buf);
+    cosmoS_initSites(tbl, tbl->dataSize);
+}
+
+// ================================================================ [NAMES] ================================================================
+
+void cosmoS_resetName(CSiteTable *tbl) {
+    tbl->bufCount = 0;
+}
+
+bool cosmoS_append(CSiteTable *tbl, const char *str, size_t length) {
+    if (tbl->bufCount + length > tbl->bufCapacity) {
+        size_t capacity = (tbl->bufCount + length) * 2;
+        char *buf = realloc(tbl->buf, capacity);
+        if (buf == NULL)
+            return false;
+
+        tbl->buf = buf;
+        tbl->bufCapacity = capacity;
+    }
+
+    memcpy(tbl->buf + tbl->bufCount, str, length);
+    tbl->bufCount += length;
+    return true;
+}
+
+bool cosmoS_appendFrame(CSiteTable *tbl, CCallFrame *frame) {
+    CObjFunction *function = frame->closure->function;
+    CChunk *chunk = &function->chunk;
+    char line[16];
+
+    if (function->module != NULL && !cosmoS_append(tbl, function->module->str, function->module->length))
+        return false;
+
+    if (!cosmoS_append(tbl, ":", 1))
+        return false;
+
+    if (function->name != NULL) {
+        if (!cosmoS_append(tbl, function->name->str, function->name->length))
+            return false;
+    } else if (!cosmoS_append(tbl, UNNAMEDCHUNK, strlen(UNNAMEDCHUNK))) {
+        return false;
+    }
+
+    // pc is already past the instruction that's running
+    return cosmoS_append(tbl, line, sprintf(line, ":%d", getLineChunk(chunk, frame->pc - chunk->buf - 1)));
+}
+
+// ================================================================ [SITES] ================================================================
+
+// capacity is always a power of 2
+static int *findSlot(CSiteTable *tbl, int *index, int capacity, const char *name, size_t length, uint64_t hash) {
+    int indx = hash & (capacity - 1);
+
+    while (true) {
+        int *slot = &index[indx];
+
+        if (*slot == -1)
+            return slot;
+
+        CSite *site = &tbl->sites[*slot];
+        if (site->hash == hash && site->length == length && memcmp(site->name, name, length) == 0)
+            return slot;
+
+        indx = (indx + 1) & (capacity - 1);
+    }
+}
+
+static bool growIndex(CSiteTable *tbl) {
+    int capacity = tbl->indexCapacity == 0 ? 64 : tbl->indexCapacity * 2;
+    int *index = malloc(sizeof(int) * capacity);
+    if (index == NULL)
+        return false;
+
+    for (int i = 0; i < capacity; i++)
+        index[i] = -1;
+
+    for (int i = 0; i < tbl->count; i++) {
+        CSite *site = &tbl->sites[i];
+        *findSlot(tbl, index, capacity, site->name, site->length, site->hash) = i;
+    }
+
+    free(tbl->index);
+    tbl->index = index;
+    tbl->indexCapacity = capacity;
+    return true;
+}
+
+static bool growSites(CSiteTable *tbl) {
+    int capacity = tbl->capacity == 0 ? 64 : tbl->capacity * 2;
+
+    CSite *sites = realloc(tbl->sites, sizeof(CSite) * capacity);
+    if (sites == NULL)
+        return false;
+    tbl->sites = sites;
+
+    // sites can stay bigger than capacity says if this fails, it's grown again next time anyways
+    char *data = realloc(tbl->data, tbl->dataSize * capacity);
+    if (data == NULL)
+        return false;
+    tbl->data = data;
+
+    tbl->capacity = capacity;
+    return true;
+}
+
+int cosmoS_findSite(CSiteTable *tbl) {
+    // keep the load factor under 3/4
+    if ((tbl->count + 1) * 4 > tbl->indexCapacity * 3 && !growIndex(tbl))
+        return -1;
+
+    uint64_t hash = cosmoS_hash(FNV_OFFSET, tbl->buf, tbl->bufCount);
+    int *slot = findSlot(tbl, tbl->index, tbl->indexCapacity, tbl->buf, tbl->bufCount, hash);
+
+    if (*slot != -1)
+        return *slot;
+
+    if (tbl->count == tbl->capacity && !growSites(tbl))
+        return -1;
+
+    // malloc(0) is allowed to return NULL
+    char *name = malloc(tbl->bufCount > 0 ? tbl->bufCount : 1);
+    if (name == NULL)
+        return -1;
+
+    memcpy(name, tbl->buf, tbl->bufCount);
+
+    CSite *site = &tbl->sites[tbl->count];
+    site->name = name;
+    site->length = tbl->bufCount;
+    site->hash = hash;
+    memset(cosmoS_siteData(tbl, tbl->count), 0, tbl->dataSize);
+
+    *slot = tbl->count++;
+    return *slot;
+}
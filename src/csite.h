@@ -0,0 +1,56 @@
+#ifndef CSITE_H
+#define CSITE_H
+
+#include "cosmo.h"
+#include "cstate.h"
+
+/*
+    shared by the allocation tracker (cheap.c) & the profiler (cprofile.c). both run in the middle of the VM (allocations &
+    safepoints), so they stay away from the GC & use C's allocator. running out of memory isn't fatal, everything that
+    allocates returns false (or -1) instead & leaves the table as it was, it's up to the caller to give up gracefully.
+
+    a site table interns names (usually "module:function:line", see cosmoS_appendFrame) & gives each one an index, in the
+    order they were first seen. every site also gets dataSize bytes of zeroed data for the caller to keep its counts in.
+    names are built in the table's scratch buffer with cosmoS_append* & then looked up with cosmoS_findSite.
+*/
+
+#define FNV_OFFSET  14695981039346656037ULL
+#define FNV_PRIME   1099511628211ULL
+
+typedef struct CSite {
+    char *name;
+    size_t length;
+    uint64_t hash;
+} CSite;
+
+typedef struct CSiteTable {
+    CSite *sites;
+    char *data; // dataSize bytes per site, same order as sites
+    size_t dataSize;
+    int count;
+    int capacity;
+    int *index; // open addressed, maps a name to its index in sites (-1 if the slot is empty)
+    int indexCapacity;
+    char *buf; // scratch buffer the name being looked up is built in
+    size_t bufCount;
+    size_t bufCapacity;
+} CSiteTable;
+
+// FNV-1a, start with FNV_OFFSET (or the hash of whatever came before data)
+uint64_t cosmoS_hash(uint64_t hash, const char *data, size_t size);
+
+void cosmoS_initSites(CSiteTable *tbl, size_t dataSize);
+void cosmoS_freeSites(CSiteTable *tbl);
+
+// clears the scratch buffer, the appends return false if it couldn't be grown
+void cosmoS_resetName(CSiteTable *tbl);
+bool cosmoS_append(CSiteTable *tbl, const char *str, size_t length);
+// appends "module:function:line" for the instruction frame is executing
+bool cosmoS_appendFrame(CSiteTable *tbl, CCallFrame *frame);
+
+// returns the index of the site named by the scratch buffer (adding it if it's new), or -1 if we're out of memory
+int cosmoS_findSite(CSiteTable *tbl);
+
+#define cosmoS_siteData(tbl, i) ((void*)((tbl)->data + (size_t)(i) * (tbl)->dataSize))
+
+#endif
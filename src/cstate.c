@@ -3,20 +3,66 @@
 #include "cobj.h"
 #include "cvm.h"
 #include "cmem.h"
+#include "cprofile.h"
+#include "cheap.h"
+#include "carena.h"
+#include "cloop.h"
+#include "cworker.h"
 
 #include <string.h>
+#include <limits.h>
+
+// makes everything the state needs up front, this runs protected so cosmoV_newState can back out if it runs out of memory
+static bool initState(CState *state, void *ud) {
+    cosmoT_initTable(state, &state->strings, 16); // init string table
+    cosmoT_initTable(state, &state->globalIndex, 16); // init global index
+
+    // setup all strings used by the VM
+    state->iStrings[ISTRING_INIT] = cosmoO_copyString(state, "__init", 6);
+    state->iStrings[ISTRING_TOSTRING] = cosmoO_copyString(state, "__tostring", 10);
+    state->iStrings[ISTRING_TONUMBER] = cosmoO_copyString(state, "__tonumber", 10);
+    state->iStrings[ISTRING_INDEX] = cosmoO_copyString(state, "__index", 7);
+    state->iStrings[ISTRING_EQUAL] = cosmoO_copyString(state, "__equal", 7);
+    state->iStrings[ISTRING_NEWINDEX] = cosmoO_copyString(state, "__newindex", 10);
+    state->iStrings[ISTRING_COUNT] = cosmoO_copyString(state, "__count", 7);
+
+    // getters/setters
+    state->iStrings[ISTRING_GETTER] = cosmoO_copyString(state, "__getter", 8);
+    state->iStrings[ISTRING_SETTER] = cosmoO_copyString(state, "__setter", 8);
+
+    // for iterators
+    state->iStrings[ISTRING_ITER] = cosmoO_copyString(state, "__iter", 6);
+    state->iStrings[ISTRING_NEXT] = cosmoO_copyString(state, "__next", 6);
+
+    // for reserved members for objects
+    state->iStrings[ISTRING_RESERVED] = cosmoO_copyString(state, "__reserved", 10);
+
+    // set the IString flags
+    for (int i = 0; i < ISTRING_MAX; i++)
+        state->iStrings[i]->isIString = true;
+
+    // there are no callframes yet, so the error doesn't get a stack trace
+    state->memError = cosmoO_newError(state, cosmoV_newRef(cosmoO_copyString(state, "Out of memory!", 14)));
+    return true;
+}
 
 CState *cosmoV_newState() {
-    // we use C's malloc because we don't want to trigger a GC with an invalid state
-    CState *state = malloc(sizeof(CState));
+    return cosmoV_newStateEx(cosmoM_defaultAlloc, NULL);
+}
 
-    if (state == NULL) {
-        CERROR("failed to allocate memory!");
-        exit(1);
-    }
+CState *cosmoV_newStateEx(CosmoAlloc alloc, void *ud) {
+    // we call the allocator directly because we don't want to trigger a GC with an invalid state
+    CState *state = alloc(ud, NULL, 0, sizeof(CState));
+
+    if (state == NULL)
+        return NULL;
 
+    state->alloc = alloc;
+    state->allocUd = ud;
+    state->arena = NULL;
     state->panic = false;
     state->freezeGC = 1; // we start frozen
+    state->heapTracker = NULL;
 
     // GC
     state->objects = NULL;
@@ -24,15 +70,51 @@ CState *cosmoV_newState() {
     state->grayStack.count = 0;
     state->grayStack.capacity = 2;
     state->grayStack.array = NULL;
+    state->globals.blocks = NULL;
+    state->globals.count = 0;
+    state->globals.blockCapacity = 0;
     state->allocatedBytes = sizeof(CState);
     state->nextGC = 1024 * 8; // threshhold starts at 8kb
+    memset(&state->gcStats, 0, sizeof(CGCStats));
+    state->gcCallback = NULL;
+    state->gcCallbackUd = NULL;
+
+    state->hook = NULL;
+    state->hookUd = NULL;
+    state->hookMask = 0;
+    state->hookCount = 0;
+    state->hookCounter = 0;
+    state->inHook = false;
+
+    state->limitCountdown = INT_MAX;
+    state->limitBatch = INT_MAX;
+    state->steps = 0;
+    state->stepLimit = 0;
+    state->deadline = 0;
+    state->memoryLimit = 0;
 
     // init stack
+    state->stack = state->mainStack;
+    state->callFrame = state->mainFrames;
+    state->stackSize = STACK_MAX;
+    state->frameSize = FRAME_MAX;
     state->top = state->stack;
     state->frameCount = 0;
     state->openUpvalues = NULL;
+    state->coroutine = NULL;
+    state->cDepth = 0;
+    state->yielding = false;
 
     state->error = NULL;
+    state->memError = NULL;
+    state->panicPoint = NULL;
+    state->allocFaults = -1;
+    state->profiler = NULL;
+    state->loop = NULL;
+    state->pools = NULL;
+#ifdef VM_STATS
+    cosmoV_resetStats(state);
+#endif
     
     // set default proto objects
     for (int i = 0; i < COBJ_MAX; i++)
@@ -41,35 +123,34 @@ CState *cosmoV_newState() {
     for (int i = 0; i < ISTRING_MAX; i++)
         state->iStrings[i] = NULL;
 
-    cosmoT_initTable(state, &state->strings, 16); // init string table
-
-    state->globals = cosmoO_newTable(state); // init global table
-
-    // setup all strings used by the VM
-    state->iStrings[ISTRING_INIT] = cosmoO_copyString(state, "__init", 6);
-    state->iStrings[ISTRING_TOSTRING] = cosmoO_copyString(state, "__tostring", 10);
-    state->iStrings[ISTRING_TONUMBER] = cosmoO_copyString(state, "__tonumber", 10);
-    state->iStrings[ISTRING_INDEX] = cosmoO_copyString(state, "__index", 7);
-    state->iStrings[ISTRING_EQUAL] = cosmoO_copyString(state, "__equal", 7);
-    state->iStrings[ISTRING_NEWINDEX] = cosmoO_copyString(state, "__newindex", 10);
-    state->iStrings[ISTRING_COUNT] = cosmoO_copyString(state, "__count", 7);
+    // so cosmoV_freeState can clean up after initState if it doesn't finish
+    state->strings.table = NULL;
+    state->strings.capacityMask = -1;
+    state->globalIndex.table = NULL;
+    state->globalIndex.capacityMask = -1;
 
-    // getters/setters
-    state->iStrings[ISTRING_GETTER] = cosmoO_copyString(state, "__getter", 8);
-    state->iStrings[ISTRING_SETTER] = cosmoO_copyString(state, "__setter", 8);
+    if (!cosmoV_runProtected(state, state->top, initState, NULL)) {
+        cosmoV_freeState(state);
+        return NULL;
+    }
 
-    // for iterators
-    state->iStrings[ISTRING_ITER] = cosmoO_copyString(state, "__iter", 6);
-    state->iStrings[ISTRING_NEXT] = cosmoO_copyString(state, "__next", 6);
+    state->freezeGC = 0; // unfreeze the state
+    return state;
+}
 
-    // for reserved members for objects
-    state->iStrings[ISTRING_RESERVED] = cosmoO_copyString(state, "__reserved", 10);
+CState *cosmoV_newArenaState(size_t blockSize, size_t limit) {
+    CArena *arena = cosmoM_newArena(blockSize, limit);
+    if (arena == NULL)
+        return NULL;
 
-    // set the IString flags
-    for (int i = 0; i < ISTRING_MAX; i++)
-        state->iStrings[i]->isIString = true;
+    CState *state = cosmoV_newStateEx(cosmoM_arenaAlloc, arena);
+    if (state == NULL) {
+        cosmoM_freeArena(arena);
+        return NULL;
+    }
 
-    state->freezeGC = 0; // unfreeze the state
+    state->arena = arena;
+    cosmoM_freezeGC(state); // collecting wouldn't give anything back to the arena
     return state;
 }
 
@@ -79,6 +160,22 @@ void cosmoV_freeState(CState *state) {
 #endif
     cosmoM_freezeGC(state);
 
+    // stops the profiler too, if it's running
+    cosmoV_freeProfile(state);
+    cosmoM_stopTracking(state);
+    cosmoE_freeLoop(state); // closes the fds it owns, even if the arena is about to take the memory
+    cosmoW_freePools(state); // joins the worker threads
+
+#ifdef VM_STATS
+    cosmoV_printStats(state, stderr);
+#endif
+
+    // everything, the state included, lives in the arena
+    if (state->arena != NULL) {
+        cosmoM_freeArena(state->arena);
+        return;
+    }
+
     // frees all the objects
     CObj *objs = state->objects;
     while (objs != NULL) {
@@ -93,6 +190,14 @@ void cosmoV_freeState(CState *state) {
 
     // free our string table (the string table includes the internal VM strings)
     cosmoT_clearTable(state, &state->strings);
+
+    // free the global cells
+    int blocks = (state->globals.count + GLOBAL_BLOCK_SIZE - 1) / GLOBAL_BLOCK_SIZE;
+    for (int i = 0; i < blocks; i++) {
+        cosmoM_freearray(state, CValue, state->globals.blocks[i], GLOBAL_BLOCK_SIZE);
+    }
+    cosmoM_freearray(state, CValue*, state->globals.blocks, state->globals.blockCapacity);
+    cosmoT_clearTable(state, &state->globalIndex);
     
     // free our gray stack & finally free the state structure
     cosmoM_freearray(state, CObj*, state->grayStack.array, state->grayStack.capacity);
@@ -104,7 +209,7 @@ void cosmoV_freeState(CState *state) {
         exit(0);
     }
 #endif*/
-    free(state);
+    state->alloc(state->allocUd, state, sizeof(CState), 0);
 }
 
 // expects 2*pairs values on the stack, each pair should consist of 1 key and 1 value
@@ -113,13 +218,44 @@ void cosmoV_register(CState *state, int pairs) {
         StkPtr key = cosmoV_getTop(state, 1);
         StkPtr val = cosmoV_getTop(state, 0);
 
-        CValue *oldVal = cosmoT_insert(state, &state->globals->tbl, *key);
-        *oldVal = *val;
+        CValue *cell = cosmoV_getGlobalCell(state, *key);
+        *cell = *val;
         
         cosmoV_setTop(state, 2); // pops the 2 values off the stack
     }
 }
 
+CValue *cosmoV_getGlobalCell(CState *state, CValue key) {
+    CGlobalCells *globals = &state->globals;
+    CValue slot;
+
+    if (cosmoT_get(state, &state->globalIndex, key, &slot))
+        return cosmoV_getGlobalSlot(state, (int)cosmoV_readNumber(slot));
+
+    // new global, grab a new block if the last one is full
+    int indx = globals->count;
+    if (indx % GLOBAL_BLOCK_SIZE == 0) {
+        int block = indx / GLOBAL_BLOCK_SIZE;
+
+        // blocks are only freed up to count, so the list is grown first. otherwise the new block would leak if growing it threw
+        if (block >= globals->blockCapacity) {
+            int newCap = globals->blockCapacity == 0 ? ARRAY_START : globals->blockCapacity * GROW_FACTOR;
+            globals->blocks = cosmoM_reallocate(state, globals->blocks, sizeof(CValue*) * globals->blockCapacity, sizeof(CValue*) * newCap);
+            globals->blockCapacity = newCap;
+        }
+
+        CValue *cells = cosmoM_xmalloc(state, sizeof(CValue) * GLOBAL_BLOCK_SIZE);
+        for (int i = 0; i < GLOBAL_BLOCK_SIZE; i++)
+            cells[i] = cosmoV_newNil();
+
+        globals->blocks[block] = cells;
+    }
+
+    globals->count++;
+    *cosmoT_insert(state, &state->globalIndex, key) = cosmoV_newNumber(indx);
+    return cosmoV_getGlobalSlot(state, indx);
+}
+
 void cosmoV_printStack(CState *state) {
     printf("==== [[ stack dump ]] ====\n");
     for (CValue *top = state->top - 1; top >= state->stack; top--) {
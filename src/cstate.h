@@ -2,14 +2,35 @@
 #define CSTATE_H
 
 #include "cosmo.h"
+
+// a value stack & callframe stack for the VM to run on, the state has its own & so does every coroutine. this is defined before
+// the includes below since cobj.h needs it too
+typedef struct CContext {
+    CValue *stack;
+    CValue *top;
+    CCallFrame *callFrame;
+    CObjUpval *openUpvalues;
+    int frameCount;
+    int stackSize;
+    int frameSize;
+} CContext;
+
 #include "cobj.h"
 #include "cvalue.h"
 #include "ctable.h"
+#include "cstats.h"
+
+#include <setjmp.h>
 
 struct CCallFrame {
     CObjClosure *closure;
     INSTRUCTION *pc;
     CValue* base;
+    int varargs; // # of variadic args, they're left in the caller's window right below the moved function & params
+    int maxResults; // returns are capped to this, lowered by tail calls since the callee's results go straight to our caller
+    int nresults; // for frames the VM called inline, the # of results the caller expects
+    int offset; // for frames the VM called inline, where the results go (relative to where we were called from)
+    int nextJump; // for '__next' frames OP_NEXT called inline, how far our caller jumps if we return nil (-1 if we aren't one)
 };
 
 typedef enum IStringEnum {
@@ -34,33 +55,147 @@ typedef struct ArrayCObj {
     int capacity;
 } ArrayCObj;
 
+#define GLOBAL_BLOCK_SIZE 64
+
+// global variables live in cells, cells are allocated in blocks that never move so pointers to them stay valid for the life of the state
+typedef struct CGlobalCells {
+    CValue **blocks; // each block holds GLOBAL_BLOCK_SIZE cells
+    int count; // # of cells in use
+    int blockCapacity;
+} CGlobalCells;
+
+// GC telemetry, grab a copy with cosmoM_getGCStats
+typedef struct CGCStats {
+    uint64_t cycles;
+    double totalPause; // seconds spent collecting garbage
+    double maxPause;
+    double lastPause;
+    size_t lastReclaimed; // bytes reclaimed by the last cycle
+    size_t totalReclaimed;
+    size_t liveObjects[COBJ_MAX]; // # of objects of each type that survived the last cycle
+    size_t liveBytes[COBJ_MAX]; // bytes used by those objects (including the buffers they own)
+    size_t heapBytes; // every byte the state is using right now
+    size_t nextGC; // heapBytes at which the next cycle is triggered
+    int strings; // # of interned strings
+    int stringCapacity;
+} CGCStats;
+
+// where a failed allocation unwinds to, pushed by protected calls (see cosmoV_pcall)
+typedef struct CPanicPoint {
+    jmp_buf buf;
+    struct CPanicPoint *prev;
+    StkPtr base; // the stack is cut back to here
+    int frameCount;
+    int freezeGC;
+    int cDepth;
+    bool inHook;
+} CPanicPoint;
+
 struct CState {
     bool panic;
     int freezeGC; // when > 0, GC events will be ignored (for internal use)
     int frameCount;
 
+    CosmoAlloc alloc; // every buffer & object the state owns goes through this (see cosmoM_reallocate)
+    void *allocUd;
+    CArena *arena; // NULL unless the state owns its arena (see cosmoV_newArenaState)
+
     CObjError *error; // NULL, unless panic is true
+    CObjError *memError; // thrown when an allocation fails, it's made up front since there might not be memory for it later
+    CPanicPoint *panicPoint; // innermost protected call, NULL if there isn't one
+    int allocFaults; // allocations left until they all start failing, -1 if they don't (see cosmoM_failAllocations)
+    CProfiler *profiler; // NULL until cosmoV_startProfiler is called on this state
+    CHeapTracker *heapTracker; // NULL unless cosmoM_startTracking was called on this state
+    CLoop *loop; // NULL until the io library is loaded or cosmoE_getLoop is called on this state
+    CWorkerPool *pools; // pools made by this state that haven't been closed yet
     CObj *objects; // tracks all of our allocated objects
     CObj *userRoots; // user definable roots, this holds CObjs that should be considered "roots", lets the VM know you are holding a reference to a CObj in your code
     ArrayCObj grayStack; // keeps track of which objects *haven't yet* been traversed in our GC, but *have been* found
     size_t allocatedBytes;
     size_t nextGC; // when allocatedBytes reaches this threshhold, trigger a GC event
+    CGCStats gcStats; // heapBytes, nextGC & the string table fields are only filled in by cosmoM_getGCStats
+    CosmoGCCallback gcCallback;
+    void *gcCallbackUd;
+
+    CosmoHook hook;
+    void *hookUd;
+    int hookMask; // 0 when no hook is set, the VM runs its uninstrumented loop
+    int hookCount; // instructions between COSMO_HOOK_COUNT events
+    int hookCounter; // instructions left until the next COSMO_HOOK_COUNT event
+    bool inHook; // hooks don't fire while one is already running
+
+    // limits for untrusted scripts (see cosmoV_setStepLimit & friends)
+    int limitCountdown; // safepoints left until cosmoV_checkLimits runs
+    int limitBatch; // what limitCountdown was last reset to
+    uint64_t steps; // safepoints passed since the step limit was set (not counting the current batch)
+    uint64_t stepLimit; // 0 if there's no limit
+    double deadline; // CLOCK_MONOTONIC seconds, 0 if there's no limit
+    size_t memoryLimit; // 0 if there's no limit
 
     CObjUpval *openUpvalues; // tracks all of our still open (meaning still on the stack) upvalues
     CTable strings;
-    CObjTable *globals;
+    CTable globalIndex; // maps global identifiers to their slot in globals
+    CGlobalCells globals;
 
+#ifdef VM_STATS
+    CVMStats stats;
+#endif
+
+    // the stack & callframes the VM is running on, these point to the state's own (below) unless a coroutine is running
     CValue *top; // top of the stack
+    CValue *stack;
+    CCallFrame *callFrame;
+    int stackSize; // # of values stack can hold
+    int frameSize; // # of callframes callFrame can hold
+
+    CObjCoroutine *coroutine; // the running coroutine, NULL if the state's own stack is being used
+    CContext mainContext; // the state's own stack is saved here while a coroutine is running
+    int cDepth; // # of times the VM has been entered from C, a coroutine can't yield across them (see cosmoV_yield)
+    bool yielding; // set along with panic by cosmoV_yield, the yield unwinds back to cosmoV_resume like an error would
+
     CObjObject *protoObjects[COBJ_MAX]; // proto object for each COBJ type [NULL = no default proto]
     CObjString *iStrings[ISTRING_MAX]; // strings used internally by the VM, eg. __init, __index & friends
-    CCallFrame callFrame[FRAME_MAX]; // call frames
-    CValue stack[STACK_MAX]; // stack
+    CCallFrame mainFrames[FRAME_MAX]; // call frames
+    CValue mainStack[STACK_MAX]; // stack
 };
 
+static inline void cosmoV_saveContext(CState *state, CContext *ctx) {
+    ctx->stack = state->stack;
+    ctx->top = state->top;
+    ctx->callFrame = state->callFrame;
+    ctx->openUpvalues = state->openUpvalues;
+    ctx->frameCount = state->frameCount;
+    ctx->stackSize = state->stackSize;
+    ctx->frameSize = state->frameSize;
+}
+
+static inline void cosmoV_loadContext(CState *state, CContext *ctx) {
+    state->stack = ctx->stack;
+    state->top = ctx->top;
+    state->callFrame = ctx->callFrame;
+    state->openUpvalues = ctx->openUpvalues;
+    state->frameCount = ctx->frameCount;
+    state->stackSize = ctx->stackSize;
+    state->frameSize = ctx->frameSize;
+}
+
+// returns NULL if there wasn't enough memory to make the state
 COSMO_API CState *cosmoV_newState();
+// same as cosmoV_newState, but everything the state allocates (itself included) goes through alloc
+COSMO_API CState *cosmoV_newStateEx(CosmoAlloc alloc, void *ud);
+// makes a state that lives in its own arena, it's all freed at once by cosmoV_freeState (see carena.h for blockSize & limit)
+COSMO_API CState *cosmoV_newArenaState(size_t blockSize, size_t limit);
 // expects 2*pairs values on the stack, each pair should consist of 1 key and 1 value
 COSMO_API void cosmoV_register(CState *state, int pairs); 
 COSMO_API void cosmoV_freeState(CState *state);
 COSMO_API void cosmoV_printStack(CState *state);
 
+// returns the cell for the global named key, if it doesn't exist yet a new cell (set to nil) is made. the cell stays valid until the state is freed
+COSMO_API CValue *cosmoV_getGlobalCell(CState *state, CValue key);
+
+// returns the cell for the global in slot indx
+static inline CValue *cosmoV_getGlobalSlot(CState *state, int indx) {
+    return &state->globals.blocks[indx / GLOBAL_BLOCK_SIZE][indx % GLOBAL_BLOCK_SIZE];
+}
+
 #endif
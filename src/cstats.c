@@ -0,0 +1,249 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cstats.h"
+#include "cstate.h"
+#include "cobj.h"
+#include "cdebug.h"
+#include "cvm.h"
+#include "cmem.h"
+
+#include <string.h>
+#include <time.h>
+
+#if defined(VM_STATS_TIMING) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+#ifdef VM_STATS
+
+#define STATS_TOP_FUNCTIONS 20
+
+#ifdef VM_STATS_TIMING
+static uint64_t readTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+void cosmoV_timeOp(CState *state, int op) {
+    CVMStats *stats = &state->stats;
+    uint64_t now = readTicks();
+
+    if (stats->lastOp != -1) {
+        uint64_t ticks = now - stats->lastTick;
+        int bucket = 0;
+
+        while ((ticks >> (bucket + 1)) != 0 && bucket < STATS_BUCKETS - 1)
+            bucket++;
+
+        stats->opTime[stats->lastOp] += ticks;
+        stats->opHist[stats->lastOp][bucket]++;
+    }
+
+    stats->lastOp = op;
+    stats->lastTick = now;
+}
+#endif
+
+COSMO_API void cosmoV_resetStats(CState *state) {
+    memset(&state->stats, 0, sizeof(CVMStats));
+#ifdef VM_STATS_TIMING
+    state->stats.lastOp = -1;
+#endif
+
+    for (CObj *obj = state->objects; obj != NULL; obj = obj->next) {
+        if (obj->type == COBJ_FUNCTION) {
+            ((CObjFunction*)obj)->execCount = 0;
+            ((CObjFunction*)obj)->callCount = 0;
+        }
+    }
+}
+
+// qsort doesn't pass any userdata, so the counts being sorted by are stashed here
+static const uint64_t *sortCounts;
+
+// sorts opcodes by how many times they ran, most first
+static int compareOps(const void *a, const void *b) {
+    uint64_t countA = sortCounts[*(const int*)a], countB = sortCounts[*(const int*)b];
+    return countA < countB ? 1 : (countA > countB ? -1 : 0);
+}
+
+static int compareFunctions(const void *a, const void *b) {
+    uint64_t countA = (*(CObjFunction* const*)a)->execCount, countB = (*(CObjFunction* const*)b)->execCount;
+    return countA < countB ? 1 : (countA > countB ? -1 : 0);
+}
+
+static void printFunction(FILE *out, CObjFunction *func) {
+    if (func->module != NULL)
+        fprintf(out, "%.*s:", func->module->length, func->module->str);
+
+    if (func->name != NULL)
+        fprintf(out, "%.*s\n", func->name->length, func->name->str);
+    else
+        fprintf(out, "%s\n", UNNAMEDCHUNK);
+}
+
+COSMO_API void cosmoV_printStats(CState *state, FILE *out) {
+    CVMStats *stats = &state->stats;
+    uint64_t total = 0;
+    int ops[OP_MAX];
+
+    for (int i = 0; i < OP_MAX; i++) {
+        total += stats->opCount[i];
+        ops[i] = i;
+    }
+
+    // states that never ran anything (eg. the ones cosmoP_compileProto makes) have nothing to say
+    if (total == 0)
+        return;
+
+    sortCounts = stats->opCount;
+    qsort(ops, OP_MAX, sizeof(int), compareOps);
+
+    fprintf(out, "==== [[ vm stats ]] ====\n");
+#ifdef VM_STATS_TIMING
+    fprintf(out, "%-18s %14s %7s %16s %10s\n", "opcode", "count", "%", "ticks", "ticks/op");
+#else
+    fprintf(out, "%-18s %14s %7s\n", "opcode", "count", "%");
+#endif
+
+    for (int i = 0; i < OP_MAX && stats->opCount[ops[i]] > 0; i++) {
+        int op = ops[i];
+
+#ifdef VM_STATS_TIMING
+        fprintf(out, "%-18s %14llu %6.2f%% %16llu %10.1f\n", opcodeName(op), (unsigned long long)stats->opCount[op],
+            100.0 * stats->opCount[op] / total, (unsigned long long)stats->opTime[op], (double)stats->opTime[op] / stats->opCount[op]);
+#else
+        fprintf(out, "%-18s %14llu %6.2f%%\n", opcodeName(op), (unsigned long long)stats->opCount[op], 100.0 * stats->opCount[op] / total);
+#endif
+    }
+
+    fprintf(out, "%-18s %14llu\n", "total", (unsigned long long)total);
+
+#ifdef VM_STATS_TIMING
+    // each bucket is printed as <log2 of the ticks>:<count>
+    fprintf(out, "==== [[ opcode timing histograms ]] ====\n");
+    for (int i = 0; i < OP_MAX && stats->opCount[ops[i]] > 0; i++) {
+        fprintf(out, "%-18s", opcodeName(ops[i]));
+
+        for (int bucket = 0; bucket < STATS_BUCKETS; bucket++) {
+            if (stats->opHist[ops[i]][bucket] > 0)
+                fprintf(out, " %d:%llu", bucket, (unsigned long long)stats->opHist[ops[i]][bucket]);
+        }
+
+        fprintf(out, "\n");
+    }
+#endif
+
+    // find the functions that ran the most instructions
+    int count = 0, capacity = 16;
+    CObjFunction **funcs = malloc(sizeof(CObjFunction*) * capacity);
+
+    for (CObj *obj = state->objects; obj != NULL; obj = obj->next) {
+        if (obj->type != COBJ_FUNCTION || ((CObjFunction*)obj)->execCount == 0)
+            continue;
+
+        if (count == capacity) {
+            capacity *= 2;
+            funcs = realloc(funcs, sizeof(CObjFunction*) * capacity);
+        }
+
+        funcs[count++] = (CObjFunction*)obj;
+    }
+
+    qsort(funcs, count, sizeof(CObjFunction*), compareFunctions);
+
+    fprintf(out, "==== [[ hottest functions ]] ====\n");
+    fprintf(out, "%14s %7s %10s  %s\n", "instructions", "%", "calls", "function");
+    for (int i = 0; i < count && i < STATS_TOP_FUNCTIONS; i++) {
+        fprintf(out, "%14llu %6.2f%% %10llu  ", (unsigned long long)funcs[i]->execCount, 100.0 * funcs[i]->execCount / total,
+            (unsigned long long)funcs[i]->callCount);
+        printFunction(out, funcs[i]);
+    }
+
+    free(funcs);
+}
+
+// table[key] = num
+static void setNumber(CState *state, CObjTable *tbl, const char *key, uint64_t num) {
+    CValue keyVal = cosmoV_newRef(cosmoO_copyString(state, key, strlen(key)));
+    *cosmoT_insert(state, &tbl->tbl, keyVal) = cosmoV_newNumber((cosmo_Number)num);
+}
+
+// table[key] = (a new table), the GC should be frozen
+static CObjTable *newSubTable(CState *state, CObjTable *tbl, const char *key) {
+    CObjTable *sub = cosmoO_newTable(state);
+    CValue keyVal = cosmoV_newRef(cosmoO_copyString(state, key, strlen(key)));
+    *cosmoT_insert(state, &tbl->tbl, keyVal) = cosmoV_newRef(sub);
+    return sub;
+}
+
+/*
+    [
+        "ops" = ["OP_ADD" = <count>, ...],
+        "time" = ["OP_ADD" = <ticks>, ...], (only with VM_STATS_TIMING)
+        "functions" = ["<module>:<name>" = ["instructions" = <count>, "calls" = <count>], ...]
+    ]
+*/
+COSMO_API bool cosmoV_pushStats(CState *state) {
+    cosmoM_freezeGC(state);
+    CObjTable *tbl = cosmoO_newTable(state);
+    CVMStats *stats = &state->stats;
+
+    CObjTable *ops = newSubTable(state, tbl, "ops");
+    for (int i = 0; i < OP_MAX; i++) {
+        if (stats->opCount[i] > 0)
+            setNumber(state, ops, opcodeName(i), stats->opCount[i]);
+    }
+
+#ifdef VM_STATS_TIMING
+    CObjTable *time = newSubTable(state, tbl, "time");
+    for (int i = 0; i < OP_MAX; i++) {
+        if (stats->opCount[i] > 0)
+            setNumber(state, time, opcodeName(i), stats->opTime[i]);
+    }
+#endif
+
+    CObjTable *funcs = newSubTable(state, tbl, "functions");
+    for (CObj *obj = state->objects; obj != NULL; obj = obj->next) {
+        CObjFunction *func = (CObjFunction*)obj;
+        if (obj->type != COBJ_FUNCTION || func->execCount == 0)
+            continue;
+
+        // functions with the same name share an entry
+        cosmoV_pushFString(state, "%s:%s", func->module != NULL ? func->module->str : "", func->name != NULL ? func->name->str : UNNAMEDCHUNK);
+        CObjString *name = cosmoV_readString(*cosmoV_pop(state));
+
+        CValue *entry = cosmoT_insert(state, &funcs->tbl, cosmoV_newRef(name));
+        if (!IS_TABLE(*entry))
+            *entry = cosmoV_newRef(cosmoO_newTable(state));
+
+        CObjTable *funcTbl = (CObjTable*)cosmoV_readRef(*entry);
+        CValue *instrs = cosmoT_insert(state, &funcTbl->tbl, cosmoV_newRef(cosmoO_copyString(state, "instructions", 12)));
+        CValue *calls;
+
+        *instrs = cosmoV_newNumber((IS_NUMBER(*instrs) ? cosmoV_readNumber(*instrs) : 0) + func->execCount);
+        calls = cosmoT_insert(state, &funcTbl->tbl, cosmoV_newRef(cosmoO_copyString(state, "calls", 5)));
+        *calls = cosmoV_newNumber((IS_NUMBER(*calls) ? cosmoV_readNumber(*calls) : 0) + func->callCount);
+    }
+
+    cosmoV_pushRef(state, (CObj*)tbl);
+    cosmoM_unfreezeGC(state);
+    return true;
+}
+
+#else
+
+COSMO_API void cosmoV_resetStats(CState *state) {}
+COSMO_API void cosmoV_printStats(CState *state, FILE *out) {}
+
+COSMO_API bool cosmoV_pushStats(CState *state) {
+    cosmoV_error(state, "VM stats weren't compiled in! (build with VM_STATS defined)");
+    return false;
+}
+
+#endif
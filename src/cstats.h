@@ -0,0 +1,40 @@
+#ifndef CSTATS_H
+#define CSTATS_H
+
+#include "cosmo.h"
+
+#include "coperators.h"
+
+/*
+    VM instrumentation, only compiled in with VM_STATS (see cosmo.h). every dispatched instruction is counted per opcode & per
+    CObjFunction, and with VM_STATS_TIMING each opcode is also timed (in cycles on x86, nanoseconds everywhere else). an
+    instruction's time runs until the next instruction is dispatched, so calls into C functions are charged to the instruction
+    that made them
+*/
+
+#define STATS_BUCKETS 32
+
+typedef struct CVMStats {
+    uint64_t opCount[OP_MAX];
+#ifdef VM_STATS_TIMING
+    uint64_t opTime[OP_MAX]; // total ticks
+    uint64_t opHist[OP_MAX][STATS_BUCKETS]; // opHist[op][i] is the # of times op took [2^i, 2^(i+1)) ticks
+    uint64_t lastTick;
+    int lastOp; // the instruction being timed, -1 if there isn't one
+#endif
+} CVMStats;
+
+#ifdef VM_STATS_TIMING
+// charges the time since the last instruction was dispatched to it & starts timing op (-1 just stops the current timing)
+void cosmoV_timeOp(CState *state, int op);
+#endif
+
+COSMO_API void cosmoV_resetStats(CState *state);
+
+// prints the per-opcode counts (& timings) along with the functions that ran the most instructions
+COSMO_API void cosmoV_printStats(CState *state, FILE *out);
+
+// pushes a <table> of the stats, used by vm.stats(). if VM_STATS wasn't compiled in an error is thrown & false is returned
+COSMO_API bool cosmoV_pushStats(CState *state);
+
+#endif
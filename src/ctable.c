@@ -26,11 +26,12 @@ unsigned int nextPow2(unsigned int x) {
 void cosmoT_initTable(CState *state, CTable *tbl, int startCap) {
     startCap = startCap != 0 ? startCap : ARRAY_START; // sanity check :P
 
-    tbl->capacityMask = startCap - 1;
+    tbl->capacityMask = -1; // so the table can still be cleared if the allocation fails
     tbl->count = 0;
     tbl->tombstones = 0;
     tbl->table = NULL; // to let out GC know we're initalizing
     tbl->table = cosmoM_xmalloc(state, sizeof(CTableEntry) * startCap);
+    tbl->capacityMask = startCap - 1;
 
     // init everything to NIL
     for (int i = 0; i < startCap; i++) {
@@ -1,11 +1,19 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "cvm.h"
 #include "cstate.h"
 #include "cdebug.h"
 #include "cmem.h"
 #include "cparse.h"
+#include "cproto.h"
+#include "cprofile.h"
+#include "cstats.h"
+#include "cloop.h"
 
 #include <stdarg.h>
+#include <setjmp.h>
 #include <string.h>
+#include <limits.h>
 
 #include <math.h>
 
@@ -28,18 +36,23 @@ COSMO_API void cosmo_insert(CState *state, int indx, CValue val) {
     state->top++;
 }
 
-COSMO_API bool cosmoV_compileString(CState *state, const char *src, const char *name) {
-    CObjFunction *func;
+static bool protectedClosure(CState *state, void *ud) {
+    CObjFunction *func = (CObjFunction*)ud;
+
+    // push function onto the stack so it doesn't it cleaned up by the GC, at the same stack location put our closure
+    cosmoV_pushRef(state, (CObj*)func);
+    *(cosmoV_getTop(state, 0)) = cosmoV_newRef(cosmoO_newClosure(state, func));
+    return true;
+}
 
-    if ((func = cosmoP_compileString(state, src, name)) != NULL) {
-        // success
+// pushes the <closure> for func, or the <error> if compiling failed (func is NULL) or the closure couldn't be allocated
+static bool pushCompiled(CState *state, CObjFunction *func) {
+    if (func != NULL) {
 #ifdef VM_DEBUG
         disasmChunk(&func->chunk, func->module->str, 0);
 #endif
-        // push function onto the stack so it doesn't it cleaned up by the GC, at the same stack location put our closure
-        cosmoV_pushRef(state, (CObj*)func);
-        *(cosmoV_getTop(state, 0)) = cosmoV_newRef(cosmoO_newClosure(state, func));
-        return true;
+        if (cosmoV_runProtected(state, state->top, protectedClosure, func))
+            return true; // success
     }
 
     // fail
@@ -48,6 +61,18 @@ COSMO_API bool cosmoV_compileString(CState *state, const char *src, const char *
     return false;
 }
 
+COSMO_API bool cosmoV_compileString(CState *state, const char *src, const char *name) {
+    return pushCompiled(state, cosmoP_compileString(state, src, name));
+}
+
+COSMO_API bool cosmoV_load(CState *state, CosmoReader reader, void *ud, const char *name) {
+    return pushCompiled(state, cosmoP_compileReader(state, reader, ud, name));
+}
+
+COSMO_API bool cosmoV_loadProto(CState *state, CProto *proto) {
+    return pushCompiled(state, cosmoP_loadProto(state, proto));
+}
+
 COSMO_API void cosmoV_printError(CState *state, CObjError *err) {
     // print stack trace
     for (int i = 0; i < err->frameCount; i++) {
@@ -55,7 +80,7 @@ COSMO_API void cosmoV_printError(CState *state, CObjError *err) {
         CObjFunction *function = frame->closure->function;
         CChunk *chunk = &function->chunk;
 
-        int line = chunk->lineInfo[frame->pc - chunk->buf - 1];
+        int line = getLineChunk(chunk, frame->pc - chunk->buf - 1);
 
         if (i == err->frameCount - 1 && !err->parserError) // it's the last call frame (and not a parser error), prepare for the objection to be printed
             fprintf(stderr, "Objection in %.*s on [line %d] in ", function->module->length, function->module->str, line);
@@ -74,7 +99,7 @@ COSMO_API void cosmoV_printError(CState *state, CObjError *err) {
 
     // finally, print the error message
     CObjString *errString = cosmoV_toString(state, err->err);
-    printf("\t%.*s\n", errString->length, errString->str);
+    fprintf(stderr, "\t%.*s\n", errString->length, errString->str);
 }
 
 /*
@@ -147,7 +172,7 @@ void closeUpvalues(CState *state, CValue *local) {
 
 void pushCallFrame(CState *state, CObjClosure *closure, int args) {
 #ifdef SAFE_STACK
-    if (state->frameCount >= FRAME_MAX) {
+    if (state->frameCount >= state->frameSize) {
         cosmoV_error(state, "Callframe overflow!");
         return;
     }
@@ -157,13 +182,32 @@ void pushCallFrame(CState *state, CObjClosure *closure, int args) {
     frame->base = state->top - args - 1; // - 1 for the function
     frame->pc = closure->function->chunk.buf;
     frame->closure = closure;
+    frame->varargs = 0;
+    frame->maxResults = UINT8_MAX;
+    frame->nresults = 0;
+    frame->offset = 0;
+    frame->nextJump = -1;
+
+#ifdef VM_STATS
+    closure->function->callCount++;
+#endif
+}
+
+// returns where the function was called from (if the function & params were moved above the variadic args, this is below frame->base)
+static inline StkPtr frameStart(CCallFrame *frame) {
+    if (frame->varargs > 0)
+        return frame->base - (frame->varargs + frame->closure->function->args + 1);
+
+    return frame->base;
 }
 
 // offset is the offset of the callframe base we set the state->top back too (useful for passing values in the stack as arguments, like methods)
 void popCallFrame(CState *state, int offset) {
-    closeUpvalues(state, state->callFrame[state->frameCount - 1].base); // close any upvalue still open
+    StkPtr base = frameStart(&state->callFrame[state->frameCount - 1]);
+
+    closeUpvalues(state, base); // close any upvalue still open
 
-    state->top = state->callFrame[state->frameCount - 1].base + offset; // resets the stack
+    state->top = base + offset; // resets the stack
     state->frameCount--;
 }
 
@@ -179,6 +223,9 @@ void cosmoV_concat(CState *state, int vals) {
 
         // concat the two strings together
         size_t sz = result->length + otherStr->length;
+        if (!cosmoM_checkLimit(state, sz + 1))
+            return;
+
         char *buf = cosmoM_xmalloc(state, sz + 1); // +1 for null terminator
         
         memcpy(buf, result->str, result->length);
@@ -222,8 +269,11 @@ static bool callCFunction(CState *state, CosmoCFunction cfunc, int args, int nre
     state->top = savedBase + offset; // set stack
 
     // if the state paniced during the c function, return false
-    if (state->panic)
+    if (state->panic) {
+        if (state->yielding) // the values the coroutine is resumed with become our results (see cosmoV_resume)
+            state->coroutine->wanted = nresults;
         return false;
+    }
     
     // push the return value back onto the stack
     memmove(state->top, results, sizeof(CValue) * nres); // copies the return values to the top of the stack
@@ -237,39 +287,113 @@ static bool callCFunction(CState *state, CosmoCFunction cfunc, int args, int nre
 }
 
 /*
-    calls a raw closure object with # args on the stack, nresults are pushed onto the stack upon return.
-    
+    calls a leaf C Function, same as callCFunction but the GC isn't frozen and the results are moved without a memmove, since
+    leaf functions almost always return just 1 value
+*/
+static inline bool callLeafCFunction(CState *state, CosmoCFunction cfunc, int args, int nresults, int offset) {
+    StkPtr savedBase = cosmoV_getTop(state, args);
+    int nres = cfunc(state, args, savedBase + 1);
+
+    if (state->panic) {
+        state->top = savedBase + offset;
+        return false;
+    }
+
+    // caller function wasn't expecting this many return values, cap it
+    if (nres > nresults)
+        nres = nresults;
+
+    // move the return values down to base + offset
+    StkPtr results = state->top - nres;
+    state->top = savedBase + offset;
+    for (int i = 0; i < nres; i++)
+        *(state->top++) = results[i];
+
+    // now, if the caller function expected more return values, push nils onto the stack
+    for (int i = nres; i < nresults; i++)
+        cosmoV_pushValue(state, cosmoV_newNil());
+
+    return true;
+}
+
+// checks that the closure can be called with # args, throws an error if it can't
+static bool checkArity(CState *state, CObjClosure *closure, int args) {
+    CObjFunction *func = closure->function;
+
+    if (args == func->args || (func->variadic && args > func->args))
+        return true;
+
+    cosmoV_error(state, "Expected %d arguments for %s, got %d!", func->args, func->name == NULL ? UNNAMEDCHUNK : func->name->str, args);
+    return false;
+}
+
+/*
+    the variadic table local holds this until the table is made. it's a nil with a payload, which nothing else makes (every other nil
+    is cosmoV_newNil), so a script setting the local to nil is never mistaken for a table that hasn't been made yet. if it's ever
+    read as a value it's just nil
+*/
+#ifdef NAN_BOXXED
+#   define LAZY_VARARGS         ((CValue){.data = NIL_SIG | 1})
+#   define IS_LAZY_VARARGS(x)   ((x).data == (NIL_SIG | 1))
+#else
+#   define LAZY_VARARGS         ((CValue){COSMO_TNIL, {.num = 1}})
+#   define IS_LAZY_VARARGS(x)   (IS_NIL(x) && (x).val.num == 1)
+#endif
+
+/*
+    pushes a new callframe for the closure with # args on the stack (the arg count should've already been checked with checkArity)
+
     returns:
-        false: state paniced, error is at state->error
-        true: stack->top is moved to base + offset + nresults, with nresults pushed onto the stack from base + offset
+        false: state paniced (stack or callframe overflow), error is at state->error & no callframe was pushed
+        true: the callframe was pushed, ready for cosmoV_execute
 */
-static bool rawCall(CState *state, CObjClosure *closure, int args, int nresults, int offset) {
+static bool enterClosure(CState *state, CObjClosure *closure, int args) {
     CObjFunction *func = closure->function;
 
-    // if the function is variadic and theres more args than parameters, push the args into a table
+    /*
+        if the function is variadic and theres more args than parameters, the extra args are left where they are and the function & params
+        are copied above them. this way the variadic args stay in the caller's stack window, and the variadic table local starts as
+        LAZY_VARARGS until something actually needs the table (see getVarargs)
+    */
     if (func->variadic && args >= func->args) {
         int extraArgs = args - func->args;
-        StkPtr variStart = cosmoV_getTop(state, extraArgs-1);
 
-        // push key & value pairs
-        for (int i = 0; i < extraArgs; i++) {
-            cosmoV_pushNumber(state, i);
-            cosmoV_pushValue(state, *(variStart + i));
+        if (extraArgs > 0) {
+            StkPtr callee = cosmoV_getTop(state, args);
+
+            // copy the function & params above the variadic args
+            for (int i = 0; i <= func->args; i++)
+                cosmoV_pushValue(state, callee[i]);
         }
 
-        cosmoV_makeTable(state, extraArgs);
-        *variStart = *cosmoV_getTop(state, 0); // move table on the stack to the vari local
-        state->top -= extraArgs;
+        cosmoV_pushValue(state, LAZY_VARARGS); // variadic table local
+        if (state->panic) // stack overflow
+            return false;
 
         pushCallFrame(state, closure, func->args + 1);
-    } else if (args != func->args) { // mismatched args
-        cosmoV_error(state, "Expected %d arguments for %s, got %d!", closure->function->args, closure->function->name == NULL ? UNNAMEDCHUNK : closure->function->name->str, args);
-        return false;
+        if (state->panic) // callframe overflow
+            return false;
+
+        state->callFrame[state->frameCount - 1].varargs = extraArgs;
     } else {
         // load function into callframe
         pushCallFrame(state, closure, func->args);
     }
 
+    return !state->panic;
+}
+
+/*
+    calls a raw closure object with # args on the stack, nresults are pushed onto the stack upon return.
+    
+    returns:
+        false: state paniced, error is at state->error
+        true: stack->top is moved to base + offset + nresults, with nresults pushed onto the stack from base + offset
+*/
+static bool rawCall(CState *state, CObjClosure *closure, int args, int nresults, int offset) {
+    if (!checkArity(state, closure, args) || !enterClosure(state, closure, args))
+        return false;
+
     // execute
     int nres = cosmoV_execute(state);
 
@@ -314,8 +438,15 @@ bool callCValue(CState *state, CValue func, int args, int nresults, int offset)
     switch (cosmoV_readRef(func)->type) {
         case COBJ_CLOSURE: 
             return rawCall(state, cosmoV_readClosure(func), args, nresults, offset);
-        case COBJ_CFUNCTION:
-            return callCFunction(state, cosmoV_readCFunction(func), args, nresults, offset);
+        case COBJ_CFUNCTION: {
+            CObjCFunction *cfunc = (CObjCFunction*)cosmoV_readRef(func);
+
+            // leaf functions skip the GC bookkeeping, but only if they got the args they declared
+            if (cfunc->arity == args)
+                return callLeafCFunction(state, cfunc->cfunc, args, nresults, offset);
+
+            return callCFunction(state, cfunc->cfunc, args, nresults, offset);
+        }
         case COBJ_METHOD: {
             CObjMethod *method = (CObjMethod*)cosmoV_readRef(func);
             return invokeMethod(state, method->obj, method->func, args, nresults, offset + 1);
@@ -331,7 +462,12 @@ bool callCValue(CState *state, CValue func, int args, int nresults, int offset)
 
             // check if they defined an initializer (we accept 0 return values)
             if (cosmoO_getIString(state, protoObj, ISTRING_INIT, &ret)) {
-                if (!invokeMethod(state, (CObj*)newObj, ret, args, 0, offset + 1))
+                // we still have to push the object once __init returns, so it can't yield out from under us
+                state->cDepth++;
+                bool ok = invokeMethod(state, (CObj*)newObj, ret, args, 0, offset + 1);
+                state->cDepth--;
+
+                if (!ok)
                     return false;
             } else {
                 // no default initializer
@@ -365,11 +501,104 @@ bool invokeMethod(CState* state, CObj *obj, CValue func, int args, int nresults,
     return callCValue(state, func, args+1, nresults, offset);
 }
 
+/*
+    calls func with # args on the stack for the dispatch loop. closures (& methods bound to them) just get a callframe pushed, the loop
+    carries on in the callee instead of recursing into cosmoV_execute. anything else is called with callCValue
+
+    returns:
+        -1: state paniced, error is at state->error
+        0: the call is done, same as callCValue
+        1: a callframe was pushed, its results are moved to base + offset once it returns
+*/
+static int beginCall(CState *state, CValue func, int args, int nresults, int offset) {
+    if (IS_CLOSURE(func)) {
+        CObjClosure *closure = cosmoV_readClosure(func);
+
+        if (!checkArity(state, closure, args) || !enterClosure(state, closure, args))
+            return -1;
+
+        CCallFrame *frame = &state->callFrame[state->frameCount - 1];
+        frame->nresults = nresults;
+        frame->offset = offset;
+        return 1;
+    }
+
+    // same as invokeMethod
+    if (IS_METHOD(func)) {
+        CObjMethod *method = cosmoV_readMethod(func);
+        *cosmoV_getTop(state, args) = cosmoV_newRef(method->obj);
+        return beginCall(state, method->func, args + 1, nresults, offset + 1);
+    }
+
+    return callCValue(state, func, args, nresults, offset) ? 0 : -1;
+}
+
+// ================================================================ [PANIC POINTS] ================================================================
+
+bool cosmoV_runProtected(CState *state, StkPtr base, CosmoProtectedFn fn, void *ud) {
+    CPanicPoint point;
+    bool res;
+
+    point.prev = state->panicPoint;
+    point.base = base;
+    point.frameCount = state->frameCount;
+    point.freezeGC = state->freezeGC;
+    point.cDepth = state->cDepth;
+    point.inHook = state->inHook;
+    state->panicPoint = &point;
+
+    if (setjmp(point.buf) == 0) {
+        res = fn(state, ud);
+    } else {
+        // we were unwound here by cosmoV_throwMemory, the error is already set
+        closeUpvalues(state, point.base);
+        state->top = point.base;
+        state->frameCount = point.frameCount;
+        state->freezeGC = point.freezeGC;
+        state->cDepth = point.cDepth;
+        state->inHook = point.inHook;
+
+        // the allocation could've failed mid-collection
+        cosmoM_resetMarks(state);
+        res = false;
+    }
+
+    state->panicPoint = point.prev;
+    return res;
+}
+
+void cosmoV_throwMemory(CState *state) {
+    if (state->panicPoint == NULL) {
+        CERROR("failed to allocate memory!");
+        exit(1);
+    }
+
+    state->error = state->memError;
+    state->panic = true;
+    longjmp(state->panicPoint->buf, 1);
+}
+
+typedef struct {
+    StkPtr base;
+    int args;
+    int nresults;
+} ProtectedCall;
+
+static bool protectedCall(CState *state, void *ud) {
+    ProtectedCall *call = (ProtectedCall*)ud;
+    return callCValue(state, *call->base, call->args, call->nresults, 0);
+}
+
 // wraps cosmoV_call in a protected state, CObjError will be pushed onto the stack if function call failed, else return values are passed
 COSMOVMRESULT cosmoV_pcall(CState *state, int args, int nresults) {
     StkPtr base = cosmoV_getTop(state, args);
+    ProtectedCall call = {base, args, nresults};
+
+    state->cDepth++;
+    bool ok = cosmoV_runProtected(state, base, protectedCall, &call);
+    state->cDepth--;
 
-    if (!callCValue(state, *base, args, nresults, 0)) {
+    if (!ok) {
         // restore panic state
         state->panic = false;
 
@@ -396,8 +625,20 @@ COSMOVMRESULT cosmoV_pcall(CState *state, int args, int nresults) {
 */
 COSMOVMRESULT cosmoV_call(CState *state, int args, int nresults) {
     StkPtr val = cosmoV_getTop(state, args); // function will always be right above the args
+    bool ok;
+
+    state->cDepth++;
+
+    // the outermost call gets a panic point, so running out of memory is reported like any other error instead of exiting
+    if (state->panicPoint == NULL) {
+        ProtectedCall call = {val, args, nresults};
+        ok = cosmoV_runProtected(state, val, protectedCall, &call);
+    } else {
+        ok = callCValue(state, *val, args, nresults, 0);
+    }
 
-    return callCValue(state, *val, args, nresults, 0) ? COSMOVM_OK : COSMOVM_RUNTIME_ERR;
+    state->cDepth--;
+    return ok ? COSMOVM_OK : COSMOVM_RUNTIME_ERR;
 }
 
 static inline bool isFalsey(StkPtr val) {
@@ -591,220 +832,722 @@ int _tbl__next(CState *state, int nargs, CValue *args) {
     }
 }
 
-#define NUMBEROP(typeConst, op)  \
-    StkPtr valA = cosmoV_getTop(state, 1); \
-    StkPtr valB = cosmoV_getTop(state, 0); \
-    if (IS_NUMBER(*valA) && IS_NUMBER(*valB)) { \
-        cosmoV_setTop(state, 2); /* pop the 2 values */ \
-        cosmoV_pushValue(state, typeConst(cosmoV_readNumber(*valA) op cosmoV_readNumber(*valB))); \
-    } else { \
-        cosmoV_error(state, "Expected numbers, got %s and %s!", cosmoV_typeStr(*valA), cosmoV_typeStr(*valB)); \
-        return -1; \
-    } \
+// __next for coroutines, resumes the coroutine & returns whatever it yielded. the loop ends once it's dead, anything it returned is dropped
+int _co__next(CState *state, int nargs, CValue *args) {
+    CObjCoroutine *co = cosmoV_readCoroutine(args[0]);
 
-// returns -1 if panic
-int cosmoV_execute(CState *state) {
-    CCallFrame* frame = &state->callFrame[state->frameCount - 1]; // grabs the current frame
-    CValue *constants = frame->closure->function->chunk.constants.values; // cache the pointer :)
+    if (co->status == COROUTINE_DEAD)
+        return 0;
 
-#define READBYTE() *frame->pc++
-#define READUINT() (frame->pc += 2, *(uint16_t*)(&frame->pc[-2]))
+    // the coroutine's code runs with the GC on, same as cosmoB_pcall
+    cosmoM_unfreezeGC(state);
+    int nres = cosmoV_resume(state, co, 0);
+    cosmoM_freezeGC(state);
 
-    while (!state->panic) {
-#ifdef VM_DEBUG
-        cosmoV_printStack(state);
-        disasmInstr(&frame->closure->function->chunk, frame->pc - frame->closure->function->chunk.buf, state->frameCount - 1);
-        printf("\n");
-#endif
-        switch (READBYTE()) {
-            case OP_LOADCONST: { // push const[uint] to stack
-                uint16_t indx = READUINT();
-                cosmoV_pushValue(state, constants[indx]);
-                continue;
-            }
-            case OP_SETGLOBAL: {
-                uint16_t indx = READUINT();
-                CValue ident = constants[indx]; // grabs identifier
-                CValue *val = cosmoT_insert(state, &state->globals->tbl, ident);
-                *val = *cosmoV_pop(state); // sets the value in the hash table
-                continue;
-            }
-            case OP_GETGLOBAL: {
-                uint16_t indx = READUINT();
-                CValue ident = constants[indx]; // grabs identifier
-                CValue val; // to hold our value
-                cosmoT_get(state, &state->globals->tbl, ident, &val);
-                cosmoV_pushValue(state, val); // pushes the value to the stack
-                continue;
-            }
-            case OP_SETLOCAL: {
-                uint8_t indx = READBYTE();
-                // set base to top of stack & pop
-                frame->base[indx] = *cosmoV_pop(state);
-                continue;
-            }
-            case OP_GETLOCAL: {
-                uint8_t indx = READBYTE();
-                cosmoV_pushValue(state, frame->base[indx]);
-                continue;
-            }
-            case OP_GETUPVAL: {
-                uint8_t indx = READBYTE();
-                cosmoV_pushValue(state, *frame->closure->upvalues[indx]->val);
-                continue;
-            }
-            case OP_SETUPVAL: {
-                uint8_t indx = READBYTE();
-                *frame->closure->upvalues[indx]->val = *cosmoV_pop(state);
-                continue;
-            }
-            case OP_PEJMP: { // pop equality jump
-                uint16_t offset = READUINT();
+    if (nres == -1 || co->status == COROUTINE_DEAD)
+        return 0;
 
-                if (isFalsey(cosmoV_pop(state))) { // pop, if the condition is false, jump!
-                    frame->pc += offset;
-                }
-                continue;
-            }
-            case OP_EJMP: { // equality jump
-                uint16_t offset = READUINT();
+    return nres;
+}
 
-                if (isFalsey(cosmoV_getTop(state, 0))) { // if the condition is false, jump!
-                    frame->pc += offset;
-                }
-                continue;
-            }
-            case OP_JMP: { // jump
-                uint16_t offset = READUINT();
-                frame->pc += offset;
-                continue;
-            }
-            case OP_JMPBACK: {
-                uint16_t offset = READUINT();
-                frame->pc -= offset;
-                continue;
-            }
-            case OP_POP: { // pops value off the stack
-                cosmoV_setTop(state, READBYTE());
-                continue;
-            }
-            case OP_CALL: {
-                uint8_t args = READBYTE();
-                uint8_t nres = READBYTE();
-                if (cosmoV_call(state, args, nres) != COSMOVM_OK) {
-                    return -1;
-                }
-                continue;
-            }
-            case OP_CLOSURE: {
-                uint16_t index = READUINT();
-                CObjFunction *func = cosmoV_readFunction(constants[index]);
-                CObjClosure *closure = cosmoO_newClosure(state, func);
-                cosmoV_pushRef(state, (CObj*)closure);
+// resolves the global cell for constants[indx] & caches it in the chunk, so the next lookup is just a load
+static CValue *resolveGlobal(CState *state, CChunk *chunk, uint16_t indx) {
+    if (chunk->globalCache == NULL) {
+        size_t count = chunk->constants.count;
+        CValue **cache = cosmoM_xmalloc(state, sizeof(CValue*) * count);
 
-                for (int i = 0; i < closure->upvalueCount; i++) {
-                    uint8_t encoding = READBYTE();
-                    uint8_t index = READBYTE();
-                    if (encoding == OP_GETUPVAL) {
-                        // capture upvalue from current frame's closure
-                        closure->upvalues[i] = frame->closure->upvalues[index];
-                    } else {
-                        // capture local
-                        closure->upvalues[i] = captureUpvalue(state, frame->base + index);
-                    }
-                }
-                
-                continue;
-            }
-            case OP_CLOSE: {
-                closeUpvalues(state, state->top - 1); 
-                cosmoV_pop(state);
-                continue;
-            }
-            case OP_NEWTABLE: {
-                uint16_t pairs = READUINT();
-                cosmoV_makeTable(state, pairs);
-                continue;
-            }
-            case OP_NEWARRAY: {
-                uint16_t pairs = READUINT();
-                StkPtr val;
-                CObjTable *newObj = cosmoO_newTable(state);
-                cosmoV_pushRef(state, (CObj*)newObj); // so our GC doesn't free our new table
+        for (size_t i = 0; i < count; i++)
+            cache[i] = NULL;
 
-                for (int i = 0; i < pairs; i++) {
-                    val = cosmoV_getTop(state, i + 1);
+        chunk->globalCache = cache;
+        chunk->globalCacheCount = count;
+    }
 
-                    // set key/value pair
-                    CValue *newVal = cosmoT_insert(state, &newObj->tbl, cosmoV_newNumber(pairs - i - 1));
-                    *newVal = *val;
-                }
+    return chunk->globalCache[indx] = cosmoV_getGlobalCell(state, chunk->constants.values[indx]);
+}
 
-                // once done, pop everything off the stack + push new table
-                cosmoV_setTop(state, pairs + 1); // + 1 for our table
-                cosmoV_pushRef(state, (CObj*)newObj);
-                continue;
+static inline CValue *getGlobal(CState *state, CChunk *chunk, uint16_t indx) {
+    CValue *cell;
+
+    if (chunk->globalCache != NULL && (cell = chunk->globalCache[indx]) != NULL)
+        return cell;
+
+    return resolveGlobal(state, chunk, indx);
+}
+
+// expects the object & key on the stack, same as OP_INDEX. returns false if an error was thrown
+static bool getIndex(CState *state) {
+    StkPtr key = cosmoV_getTop(state, 0); // key should be the top of the stack
+    StkPtr temp = cosmoV_getTop(state, 1); // after that should be the table
+
+    // sanity check
+    if (!IS_REF(*temp)) {
+        cosmoV_error(state, "Couldn't index type %s!", cosmoV_typeStr(*temp));
+        return false;
+    }
+
+    CObj *obj = cosmoV_readRef(*temp);
+    CObjObject *proto = cosmoO_grabProto(obj);
+    CValue val; // to hold our value
+
+    if (proto != NULL) {
+        // check for __index metamethod
+        if (!cosmoO_indexObject(state, proto, *key, &val)) // if returns false, cosmoV_error was called
+            return false;
+    } else if (obj->type == COBJ_TABLE) {
+        CObjTable *tbl = (CObjTable*)obj;
+
+        cosmoT_get(state, &tbl->tbl, *key, &val);
+    } else {
+        cosmoV_error(state, "No proto defined! Couldn't __index from type %s", cosmoV_typeStr(*temp));
+        return false;
+    }
+
+    cosmoV_setTop(state, 2); // pops the table & the key
+    cosmoV_pushValue(state, val); // pushes the field result
+
+    return true;
+}
+
+// expects the object, key & value on the stack, same as OP_NEWINDEX. returns false if an error was thrown
+static bool setIndex(CState *state) {
+    StkPtr value = cosmoV_getTop(state, 0); // value is at the top of the stack
+    StkPtr key = cosmoV_getTop(state, 1);
+    StkPtr temp = cosmoV_getTop(state, 2); // table is after the key
+
+    // sanity check
+    if (!IS_REF(*temp)) {
+        cosmoV_error(state, "Couldn't set index with type %s!", cosmoV_typeStr(*temp));
+        return false;
+    }
+
+    CObj *obj = cosmoV_readRef(*temp);
+    CObjObject *proto = cosmoO_grabProto(obj);
+
+    if (proto != NULL) {
+        if (!cosmoO_newIndexObject(state, proto, *key, *value)) // if it returns false, cosmoV_error was called
+            return false;
+    } else if (obj->type == COBJ_TABLE) {
+        CObjTable *tbl = (CObjTable*)obj;
+        CValue *newVal = cosmoT_insert(state, &tbl->tbl, *key);
+
+        *newVal = *value; // set the index
+    } else {
+        cosmoV_error(state, "No proto defined! Couldn't __newindex from type %s", cosmoV_typeStr(*temp));
+        return false;
+    }
+
+    // pop everything off the stack
+    cosmoV_setTop(state, 3);
+
+    return true;
+}
+
+// expects the object & key on the stack, same as OP_INCINDEX. returns false if an error was thrown
+static bool incIndex(CState *state, int8_t inc) {
+    StkPtr temp = cosmoV_getTop(state, 1); // object should be above the key
+    StkPtr key = cosmoV_getTop(state, 0); // grabs key
+
+    if (!IS_REF(*temp)) {
+        cosmoV_error(state, "Couldn't index non-indexable type %s!", cosmoV_typeStr(*temp));
+        return false;
+    }
+
+    CObj *obj = cosmoV_readRef(*temp);
+    CObjObject *proto = cosmoO_grabProto(obj);
+    CValue val;
+
+    // call __index if the proto was found
+    if (proto != NULL) {
+        if (cosmoO_indexObject(state, proto, *key, &val)) {
+            if (!IS_NUMBER(val)) { 
+                cosmoV_error(state, "Expected number, got %s!", cosmoV_typeStr(val));
+                return false;
             }
-            case OP_INDEX: {
-                StkPtr key = cosmoV_getTop(state, 0); // key should be the top of the stack
-                StkPtr temp = cosmoV_getTop(state, 1); // after that should be the table
 
-                // sanity check
-                if (!IS_REF(*temp)) {
-                    cosmoV_error(state, "Couldn't index type %s!", cosmoV_typeStr(*temp));
+            cosmoV_pushValue(state, val); // pushes old value onto the stack :)
+
+            // call __newindex
+            if (!cosmoO_newIndexObject(state, proto, *key, cosmoV_newNumber(cosmoV_readNumber(val) + inc)))
+                return false;
+        } else
+            return false; // cosmoO_indexObject failed and threw an error
+    } else if (obj->type == COBJ_TABLE) {
+        CObjTable *tbl = (CObjTable*)obj;
+        CValue *val = cosmoT_insert(state, &tbl->tbl, *key);
+
+        if (!IS_NUMBER(*val)) { 
+            cosmoV_error(state, "Expected number, got %s!", cosmoV_typeStr(*val));
+            return false;
+        }
+
+        // pops tbl & key from stack
+        cosmoV_setTop(state, 2);
+        cosmoV_pushValue(state, *val); // pushes old value onto the stack :)
+        *val = cosmoV_newNumber(cosmoV_readNumber(*val) + inc); // sets table index
+    } else {
+        cosmoV_error(state, "No proto defined! Couldn't __index from type %s", cosmoV_typeStr(*temp));
+        return false;
+    }
+
+    return true;
+}
+
+// replaces the coroutine on the top of the stack with the method OP_NEXT resumes it with
+static void iterCoroutine(CState *state, CObj *co) {
+    CObjCFunction *co_next = cosmoO_newCFunction(state, _co__next);
+    cosmoV_pushRef(state, (CObj*)co_next); // so our GC can find it
+
+    CObjMethod *method = cosmoO_newMethod(state, cosmoV_newRef(co_next), co);
+    cosmoV_setTop(state, 2); // pops the cfunction & the coroutine
+    cosmoV_pushRef(state, (CObj*)method); // pushes the method for OP_NEXT
+}
+
+// replaces the object on the top of the stack with it's '__next' method, same as OP_ITER. returns false if an error was thrown
+static bool iterValue(CState *state) {
+    StkPtr temp = cosmoV_getTop(state, 0); // should be the object/table
+
+    if (!IS_REF(*temp)) {
+        cosmoV_error(state, "Couldn't iterate over non-iterator type %s!", cosmoV_typeStr(*temp));
+        return false;
+    }
+
+    CObj *obj = cosmoV_readRef(*temp);
+    CObjObject *proto = cosmoO_grabProto(obj);
+    CValue val;
+
+    // coroutines are iterated by resuming them, they have a proto for their methods so this is checked first
+    if (obj->type == COBJ_COROUTINE) {
+        iterCoroutine(state, obj);
+        return true;
+    }
+
+    if (proto != NULL) {
+        // grab __iter & call it
+        if (cosmoO_getIString(state, proto, ISTRING_ITER, &val)) {
+            cosmoV_pop(state); // pop the object from the stack
+            cosmoV_pushValue(state, val);
+            cosmoV_pushRef(state, (CObj*)obj);
+            if (cosmoV_call(state, 1, 1) != COSMOVM_OK) // we expect 1 return value on the stack, the iterable object
+                return false;
+
+            StkPtr iObj = cosmoV_getTop(state, 0);
+
+            // __iter can hand back a generator instead, that's iterated like any other coroutine
+            if (IS_COROUTINE(*iObj)) {
+                iterCoroutine(state, cosmoV_readRef(*iObj));
+                return true;
+            }
+
+            if (!IS_OBJECT(*iObj)) {
+                cosmoV_error(state, "Expected iterable object! '__iter' returned %s, expected <object>!", cosmoV_typeStr(*iObj));
+                return false;
+            }
+
+            // get __next method and place it at the top of the stack
+            cosmoV_getMethod(state, cosmoV_readRef(*iObj), cosmoV_newRef(state->iStrings[ISTRING_NEXT]), iObj);
+        } else {
+            cosmoV_error(state, "Expected iterable object! '__iter' not defined!");
+            return false;
+        }
+    } else if (obj->type == COBJ_TABLE) {
+        CObjTable *tbl = (CObjTable*)obj;
+
+        cosmoV_pushRef(state, (CObj*)state->iStrings[ISTRING_RESERVED]); // key
+        cosmoV_pushRef(state, (CObj*)tbl); // value
+
+        cosmoV_pushString(state, "__next"); // key
+        CObjCFunction *tbl_next = cosmoO_newCFunction(state, _tbl__next);
+        cosmoV_pushRef(state, (CObj*)tbl_next); // value
+
+        CObjObject *obj = cosmoV_makeObject(state, 2); // pushes the new object to the stack
+        cosmoO_setUserI(obj, 0); // increment for iterator
+
+        // make our CObjMethod for OP_NEXT to call
+        CObjMethod *method = cosmoO_newMethod(state, cosmoV_newRef(tbl_next), (CObj*)obj);
+
+        cosmoV_setTop(state, 2); // pops the object & the tbl
+        cosmoV_pushRef(state, (CObj*)method); // pushes the method for OP_NEXT
+    } else {
+        cosmoV_error(state, "No proto defined! Couldn't get from type %s", cosmoO_typeStr(obj));
+        return false;
+    }
+
+    return true;
+}
+
+// grabs the variadic table local of the frame, it's right after the params
+static inline CValue *varargLocal(CCallFrame *frame) {
+    return &frame->base[frame->closure->function->args + 1];
+}
+
+// returns the variadic table local, making the table from the variadic args in the stack window if it hasn't been made yet
+static CValue *getVarargs(CState *state, CCallFrame *frame) {
+    CValue *local = varargLocal(frame);
+
+    if (IS_LAZY_VARARGS(*local)) {
+        StkPtr window = frame->base - frame->varargs;
+        CObjTable *tbl = cosmoO_newTable(state);
+        *local = cosmoV_newRef(tbl); // the local is on the stack, so the GC can find our new table
+
+        for (int i = 0; i < frame->varargs; i++)
+            *cosmoT_insert(state, &tbl->tbl, cosmoV_newNumber(i)) = window[i];
+    }
+
+    return local;
+}
+
+// ================================================================ [HOOKS] ================================================================
+
+COSMO_API void cosmoV_setHook(CState *state, CosmoHook hook, int mask, int count, void *ud) {
+    if (count <= 0)
+        mask &= ~COSMO_MASK_COUNT;
+
+    if (hook == NULL || mask == 0) {
+        hook = NULL;
+        mask = 0;
+    }
+
+    state->hook = hook;
+    state->hookUd = ud;
+    state->hookMask = mask;
+    state->hookCount = count;
+    state->hookCounter = count;
+
+    // if the VM is running, this gets it to switch loops at the next safepoint
+    cosmoV_interruptLimits(state);
+}
+
+COSMO_API int cosmoV_getHookMask(CState *state) {
+    return state->hookMask;
+}
+
+static void callHook(CState *state, CosmoHookEvent event, int line) {
+    // the hook could've removed itself, or be calling back into the VM
+    if (state->inHook || state->hook == NULL)
+        return;
+
+    // the hook is run in the middle of an instruction, so a coroutine can't yield from it
+    state->inHook = true;
+    state->cDepth++;
+    cosmoM_freezeGC(state);
+    state->hook(state, event, line, state->hookUd);
+    cosmoM_unfreezeGC(state);
+    state->cDepth--;
+    state->inHook = false;
+}
+
+// line of the instruction at pc in frame
+static int frameLine(CCallFrame *frame, INSTRUCTION *pc) {
+    CChunk *chunk = &frame->closure->function->chunk;
+    return getLineChunk(chunk, pc - chunk->buf);
+}
+
+/*
+    same as beginCall, but if func is a closure it takes over frame instead of pushing a new one. the args are the args values
+    above callee (callee itself is never read, for invokes it's a slot owned by our caller). anything else is called normally &
+    the OP_RETURN that always follows a tail call returns its results
+*/
+static inline int tailCall(CState *state, CCallFrame *frame, CValue func, StkPtr callee, int args, int nres, int offset, bool hooked) {
+    if (!IS_CLOSURE(func))
+        return beginCall(state, func, args, nres, offset);
+
+    CObjClosure *closure = cosmoV_readClosure(func);
+    if (!checkArity(state, closure, args))
+        return -1;
+
+    // we're being replaced, so as far as the hooks are concerned we've returned
+    if (hooked && (state->hookMask & COSMO_MASK_RETURN)) {
+        callHook(state, COSMO_HOOK_RETURN, frameLine(frame, frame->pc - 1));
+        if (state->panic)
+            return -1;
+    }
+
+    /*
+        close our upvalues & move the args down to where we were called from. base[0] is left alone, since it isn't read by the
+        callee (and for invoked methods it's a slot owned by our caller)
+    */
+    StkPtr start = frameStart(frame);
+    int nresults = frame->nresults;
+    int frameOffset = frame->offset;
+    int nextJump = frame->nextJump;
+    int maxResults = nres < frame->maxResults ? nres : frame->maxResults;
+
+    closeUpvalues(state, start + 1);
+    memmove(start + 1, callee + 1, sizeof(CValue) * args);
+    state->top = start + args + 1;
+
+    // reuse our callframe for the callee, our caller still gets the results
+    state->frameCount--;
+    if (!enterClosure(state, closure, args)) {
+        state->frameCount++; // put it back, the callframes are cleaned up with the error (see execute)
+        return -1;
+    }
+
+    frame->nresults = nresults;
+    frame->offset = frameOffset;
+    frame->nextJump = nextJump;
+    frame->maxResults = maxResults;
+    return 1;
+}
+
+// runs the line & count hooks before the instruction at frame->pc is dispatched, returns false if a hook threw an error
+static bool runHooks(CState *state, CCallFrame *frame, int *lastLine, INSTRUCTION **lastPc) {
+    int mask = state->hookMask;
+
+    if (state->inHook)
+        return true;
+
+    if ((mask & COSMO_MASK_COUNT) && --state->hookCounter <= 0) {
+        state->hookCounter = state->hookCount;
+        callHook(state, COSMO_HOOK_COUNT, frameLine(frame, frame->pc));
+
+        if (state->panic)
+            return false;
+    }
+
+    if (mask & COSMO_MASK_LINE) {
+        int line = frameLine(frame, frame->pc);
+        bool newLine = line != *lastLine || frame->pc <= *lastPc;
+
+        *lastLine = line;
+        *lastPc = frame->pc;
+
+        if (newLine) {
+            callHook(state, COSMO_HOOK_LINE, line);
+
+            if (state->panic)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+// ================================================================ [LIMITS] ================================================================
+
+#define LIMIT_CHECK_INTERVAL 1024
+
+// folds the safepoints passed in the current batch into state->steps
+static void chargeSteps(CState *state) {
+    state->steps += state->limitBatch - state->limitCountdown;
+    state->limitBatch = state->limitCountdown;
+}
+
+static void resetCountdown(CState *state) {
+    int batch = INT_MAX;
+
+    if (state->deadline != 0)
+        batch = LIMIT_CHECK_INTERVAL;
+
+    if (state->stepLimit != 0) {
+        uint64_t left = state->steps < state->stepLimit ? state->stepLimit - state->steps : 1;
+
+        if (left < (uint64_t)batch)
+            batch = (int)left;
+    }
+
+    state->limitCountdown = batch;
+    state->limitBatch = batch;
+}
+
+COSMO_API void cosmoV_setStepLimit(CState *state, uint64_t steps) {
+    state->steps = 0;
+    state->stepLimit = steps;
+    resetCountdown(state);
+}
+
+COSMO_API void cosmoV_setTimeLimit(CState *state, double seconds) {
+    chargeSteps(state);
+    state->deadline = seconds > 0 ? cosmoE_now() + seconds : 0;
+    resetCountdown(state);
+}
+
+COSMO_API uint64_t cosmoV_getSteps(CState *state) {
+    return state->steps + (state->limitBatch - state->limitCountdown);
+}
+
+void cosmoV_interruptLimits(CState *state) {
+    chargeSteps(state);
+    state->limitCountdown = 0;
+    state->limitBatch = 0;
+}
+
+bool cosmoV_checkLimits(CState *state) {
+    chargeSteps(state);
+    resetCountdown(state);
+
+    if (state->stepLimit != 0 && state->steps >= state->stepLimit) {
+        cosmoV_error(state, "Step limit exceeded!");
+        return false;
+    }
+
+    if (state->deadline != 0 && cosmoE_now() >= state->deadline) {
+        // keep checking every step, so the error is thrown again at the next safepoint
+        state->limitCountdown = state->limitBatch = 1;
+        cosmoV_error(state, "Time limit exceeded!");
+        return false;
+    }
+
+    if (state->memoryLimit != 0 && state->allocatedBytes > state->memoryLimit) {
+        // the heap might just be full of garbage
+        if (!cosmoM_isFrozen(state))
+            cosmoM_collectGarbage(state);
+
+        if (state->allocatedBytes > state->memoryLimit) {
+            state->limitCountdown = state->limitBatch = 1;
+            cosmoV_error(state, "Memory limit exceeded!");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// ================================================================ [EXECUTE] ================================================================
+
+#if defined(__GNUC__) || defined(__clang__)
+#  define FORCEINLINE static inline __attribute__((always_inline))
+#else
+#  define FORCEINLINE static inline
+#endif
+
+// returned by executeLoop when a hook was set or removed, cosmoV_execute picks the matching loop & carries on
+#define EXECUTE_SWITCH -2
+
+#define NUMBEROP(typeConst, op)  \
+    StkPtr valA = cosmoV_getTop(state, 1); \
+    StkPtr valB = cosmoV_getTop(state, 0); \
+    if (IS_NUMBER(*valA) && IS_NUMBER(*valB)) { \
+        cosmoV_setTop(state, 2); /* pop the 2 values */ \
+        cosmoV_pushValue(state, typeConst(cosmoV_readNumber(*valA) op cosmoV_readNumber(*valB))); \
+    } else { \
+        cosmoV_error(state, "Expected numbers, got %s and %s!", cosmoV_typeStr(*valA), cosmoV_typeStr(*valB)); \
+        return -1; \
+    } \
+
+/*
+    the dispatch loop, compiled twice: once with hooked set to false (which the compiler strips every hook check out of) and once
+    with it set to true. runs until the callframe at entry returns, closures it calls along the way are run inline (see beginCall)
+    so they don't nest the C stack. returns entry's # of results, -1 if panic, or EXECUTE_SWITCH if the other loop should take over
+*/
+FORCEINLINE int executeLoop(CState *state, int entry, const bool hooked) {
+    CCallFrame* frame = &state->callFrame[state->frameCount - 1]; // grabs the current frame
+    CChunk *chunk = &frame->closure->function->chunk;
+    CValue *constants = chunk->constants.values; // cache the pointer :)
+    int hookLine = -1; // last line the line hook fired for
+    INSTRUCTION *hookPc = NULL;
+
+#define READBYTE() *frame->pc++
+#define READUINT() (frame->pc += 2, *(uint16_t*)(&frame->pc[-2]))
+
+/*
+    calls, returns & back-jumps are where the profiler takes its samples (see cprofile.h) and where the limits are checked. setting
+    or removing a hook runs the countdown out too, so that's also where we switch loops. the instruction is un-read so the other
+    loop dispatches it again
+*/
+#define SAFEPOINT() do { \
+        if (cosmoV_profileTicks) \
+            cosmoV_sampleProfile(state); \
+        if (--state->limitCountdown <= 0) { \
+            if (!cosmoV_checkLimits(state)) \
+                return -1; \
+            if ((state->hookMask != 0) != hooked) { \
+                frame->pc--; \
+                return EXECUTE_SWITCH; \
+            } \
+        } \
+    } while (0)
+
+// picks up the callframe on top of the call stack after a call or a return
+#define LOADFRAME() do { \
+        frame = &state->callFrame[state->frameCount - 1]; \
+        chunk = &frame->closure->function->chunk; \
+        constants = chunk->constants.values; \
+    } while (0)
+
+// after beginCall pushed a callframe, it's a new function so the next line is always new
+#define ENTERFRAME() do { \
+        LOADFRAME(); \
+        if (hooked) { \
+            hookLine = -1; \
+            hookPc = NULL; \
+            if (state->hookMask & COSMO_MASK_CALL) { \
+                callHook(state, COSMO_HOOK_CALL, frameLine(frame, frame->pc)); \
+                if (state->panic) \
+                    return -1; \
+            } \
+        } \
+    } while (0)
+
+    while (!state->panic) {
+        if (hooked && !runHooks(state, frame, &hookLine, &hookPc))
+            return -1;
+
+#ifdef VM_DEBUG
+        cosmoV_printStack(state);
+        disasmInstr(&frame->closure->function->chunk, frame->pc - frame->closure->function->chunk.buf, state->frameCount - 1);
+        printf("\n");
+#endif
+#ifdef VM_STATS
+        state->stats.opCount[*frame->pc]++;
+        frame->closure->function->execCount++;
+#  ifdef VM_STATS_TIMING
+        cosmoV_timeOp(state, *frame->pc);
+#  endif
+#endif
+        switch (READBYTE()) {
+            case OP_LOADCONST: { // push const[uint] to stack
+                uint16_t indx = READUINT();
+                cosmoV_pushValue(state, constants[indx]);
+                continue;
+            }
+            case OP_SETGLOBAL: {
+                uint16_t indx = READUINT();
+                CValue *cell = getGlobal(state, chunk, indx);
+                *cell = *cosmoV_pop(state); // sets the value in the global cell
+                continue;
+            }
+            case OP_GETGLOBAL: {
+                uint16_t indx = READUINT();
+                CValue *cell = getGlobal(state, chunk, indx);
+                cosmoV_pushValue(state, *cell); // pushes the value to the stack
+                continue;
+            }
+            case OP_SETLOCAL: {
+                uint8_t indx = READBYTE();
+                // set base to top of stack & pop
+                frame->base[indx] = *cosmoV_pop(state);
+                continue;
+            }
+            case OP_GETLOCAL: {
+                uint8_t indx = READBYTE();
+                cosmoV_pushValue(state, frame->base[indx]);
+                continue;
+            }
+            case OP_GETUPVAL: {
+                uint8_t indx = READBYTE();
+                cosmoV_pushValue(state, *frame->closure->upvalues[indx]->val);
+                continue;
+            }
+            case OP_SETUPVAL: {
+                uint8_t indx = READBYTE();
+                *frame->closure->upvalues[indx]->val = *cosmoV_pop(state);
+                continue;
+            }
+            case OP_PEJMP: { // pop equality jump
+                uint16_t offset = READUINT();
+
+                if (isFalsey(cosmoV_pop(state))) { // pop, if the condition is false, jump!
+                    frame->pc += offset;
+                }
+                continue;
+            }
+            case OP_EJMP: { // equality jump
+                uint16_t offset = READUINT();
+
+                if (isFalsey(cosmoV_getTop(state, 0))) { // if the condition is false, jump!
+                    frame->pc += offset;
+                }
+                continue;
+            }
+            case OP_JMP: { // jump
+                uint16_t offset = READUINT();
+                frame->pc += offset;
+                continue;
+            }
+            case OP_JMPBACK: {
+                SAFEPOINT();
+                uint16_t offset = READUINT();
+                frame->pc -= offset;
+                continue;
+            }
+            case OP_POP: { // pops value off the stack
+                cosmoV_setTop(state, READBYTE());
+                continue;
+            }
+            case OP_CALL: {
+                SAFEPOINT();
+                uint8_t args = READBYTE();
+                uint8_t nres = READBYTE();
+                int called = beginCall(state, *cosmoV_getTop(state, args), args, nres, 0);
+
+                if (called == -1)
                     return -1;
-                }
-
-                CObj *obj = cosmoV_readRef(*temp);
-                CObjObject *proto = cosmoO_grabProto(obj);
-                CValue val; // to hold our value
-
-                if (proto != NULL) {
-                    // check for __index metamethod
-                    if (!cosmoO_indexObject(state, proto, *key, &val)) // if returns false, cosmoV_error was called
-                        return -1;
-                } else if (obj->type == COBJ_TABLE) {
-                    CObjTable *tbl = (CObjTable*)obj;
+                if (called)
+                    ENTERFRAME();
+                continue;
+            }
+            case OP_TAILCALL: {
+                SAFEPOINT();
+                uint8_t args = READBYTE();
+                uint8_t nres = READBYTE();
+                StkPtr callee = cosmoV_getTop(state, args);
+                int called = tailCall(state, frame, *callee, callee, args, nres, 0, hooked);
 
-                    cosmoT_get(state, &tbl->tbl, *key, &val);
-                } else {
-                    cosmoV_error(state, "No proto defined! Couldn't __index from type %s", cosmoV_typeStr(*temp));
+                if (called == -1)
                     return -1;
-                }
-
-                cosmoV_setTop(state, 2); // pops the table & the key
-                cosmoV_pushValue(state, val); // pushes the field result
+                if (called)
+                    ENTERFRAME();
                 continue;
             }
-            case OP_NEWINDEX: {
-                StkPtr value = cosmoV_getTop(state, 0); // value is at the top of the stack
-                StkPtr key = cosmoV_getTop(state, 1);
-                StkPtr temp = cosmoV_getTop(state, 2); // table is after the key
+            case OP_CLOSURE: {
+                uint16_t index = READUINT();
+                CObjFunction *func = cosmoV_readFunction(constants[index]);
+                CObjClosure *closure = cosmoO_newClosure(state, func);
+                cosmoV_pushRef(state, (CObj*)closure);
 
-                // sanity check
-                if (!IS_REF(*temp)) {
-                    cosmoV_error(state, "Couldn't set index with type %s!", cosmoV_typeStr(*temp));
-                    return -1;
+                for (int i = 0; i < closure->upvalueCount; i++) {
+                    uint8_t encoding = READBYTE();
+                    uint8_t index = READBYTE();
+                    if (encoding == OP_GETUPVAL) {
+                        // capture upvalue from current frame's closure
+                        closure->upvalues[i] = frame->closure->upvalues[index];
+                    } else {
+                        // capture local
+                        closure->upvalues[i] = captureUpvalue(state, frame->base + index);
+                    }
                 }
+                
+                continue;
+            }
+            case OP_CLOSE: {
+                closeUpvalues(state, state->top - 1); 
+                cosmoV_pop(state);
+                continue;
+            }
+            case OP_NEWTABLE: {
+                uint16_t pairs = READUINT();
+                cosmoV_makeTable(state, pairs);
+                continue;
+            }
+            case OP_NEWARRAY: {
+                uint16_t pairs = READUINT();
+                StkPtr val;
+                CObjTable *newObj = cosmoO_newTable(state);
+                cosmoV_pushRef(state, (CObj*)newObj); // so our GC doesn't free our new table
 
-                CObj *obj = cosmoV_readRef(*temp);
-                CObjObject *proto = cosmoO_grabProto(obj);
-
-                if (proto != NULL) {
-                    if (!cosmoO_newIndexObject(state, proto, *key, *value)) // if it returns false, cosmoV_error was called
-                        return -1;
-                } else if (obj->type == COBJ_TABLE) {
-                    CObjTable *tbl = (CObjTable*)obj;
-                    CValue *newVal = cosmoT_insert(state, &tbl->tbl, *key);
+                for (int i = 0; i < pairs; i++) {
+                    val = cosmoV_getTop(state, i + 1);
 
-                    *newVal = *value; // set the index
-                } else {
-                    cosmoV_error(state, "No proto defined! Couldn't __newindex from type %s", cosmoV_typeStr(*temp));
-                    return -1;
+                    // set key/value pair
+                    CValue *newVal = cosmoT_insert(state, &newObj->tbl, cosmoV_newNumber(pairs - i - 1));
+                    *newVal = *val;
                 }
 
-                // pop everything off the stack
-                cosmoV_setTop(state, 3);
+                // once done, pop everything off the stack + push new table
+                cosmoV_setTop(state, pairs + 1); // + 1 for our table
+                cosmoV_pushRef(state, (CObj*)newObj);
+                continue;
+            }
+            case OP_INDEX: {
+                if (!getIndex(state))
+                    return -1;
+                continue;
+            }
+            case OP_NEWINDEX: {
+                if (!setIndex(state))
+                    return -1;
                 continue;
             }
             case OP_NEWOBJECT: {
@@ -869,7 +1612,10 @@ int cosmoV_execute(CState *state) {
                 cosmoV_pushValue(state, val); // pushes the field result
                 continue;
             }
-            case OP_INVOKE: {
+            case OP_INVOKE:
+            case OP_TAILINVOKE: {
+                bool tail = frame->pc[-1] == OP_TAILINVOKE;
+                SAFEPOINT();
                 uint8_t args = READBYTE();
                 uint8_t nres = READBYTE();
                 uint16_t ident = READUINT();
@@ -877,97 +1623,185 @@ int cosmoV_execute(CState *state) {
                 CValue val; // to hold our value
 
                 // sanity check
-                if (IS_REF(*temp)) {
-                    // get the field from the object
-                    if (!cosmoV_rawget(state, cosmoV_readRef(*temp), constants[ident], &val))
-                        return -1;
-                    
-                    // now invoke the method!
-                    invokeMethod(state, cosmoV_readRef(*temp), val, args, nres, 1);
-                } else {
+                if (!IS_REF(*temp)) {
                     cosmoV_error(state, "Couldn't get from type %s!", cosmoV_typeStr(*temp));
                     return -1;
                 }
 
+                // get the field from the object
+                if (!cosmoV_rawget(state, cosmoV_readRef(*temp), constants[ident], &val))
+                    return -1;
+
+                // now invoke the method! the object is already in the function's slot, same as invokeMethod
+                int called = tail ? tailCall(state, frame, val, temp - 1, args + 1, nres, 1, hooked)
+                                  : beginCall(state, val, args + 1, nres, 1);
+
+                if (called == -1)
+                    return -1;
+                if (called)
+                    ENTERFRAME();
                 continue;
             }
             case OP_ITER: {
-                StkPtr temp = cosmoV_getTop(state, 0); // should be the object/table
+                if (!iterValue(state))
+                    return -1;
+                continue;
+            }
+            case OP_NEXT: {
+                uint8_t nresults = READBYTE();
+                uint16_t jump = READUINT();
+                StkPtr temp = cosmoV_getTop(state, 0); // we don't actually pop this off the stack
 
-                if (!IS_REF(*temp)) {
-                    cosmoV_error(state, "Couldn't iterate over non-iterator type %s!", cosmoV_typeStr(*temp));
+                if (IS_NUMBER(*temp)) { // walking the variadic args in the stack window (see OP_VARITER)
+                    int i = (int)cosmoV_readNumber(*temp);
+
+                    if (i >= frame->varargs) { // no more args, exit the loop
+                        frame->pc += jump;
+                        continue;
+                    }
+
+                    *temp = cosmoV_newNumber(i + 1);
+
+                    // push the same key & value pair a table iterator would
+                    if (nresults > 1)
+                        cosmoV_pushNumber(state, i);
+                    if (nresults > 0)
+                        cosmoV_pushValue(state, frame->base[i - frame->varargs]);
+                    for (int j = 2; j < nresults; j++)
+                        cosmoV_pushValue(state, cosmoV_newNil());
+
+                    continue;
+                }
+
+                if (!IS_METHOD(*temp)) {
+                    cosmoV_error(state, "Expected '__next' to be a method, got type %s!", cosmoV_typeStr(*temp));
                     return -1;
                 }
 
-                CObj *obj = cosmoV_readRef(*temp);
-                CObjObject *proto = cosmoO_grabProto(obj);
-                CValue val;
+                // closures are called inline so they can yield, the nil check is done once they return (see OP_RETURN)
+                cosmoV_pushValue(state, *temp);
+                int called = beginCall(state, *temp, 0, nresults, 0);
 
-                if (proto != NULL) {
-                    // grab __iter & call it
-                    if (cosmoO_getIString(state, proto, ISTRING_ITER, &val)) {
-                        cosmoV_pop(state); // pop the object from the stack
-                        cosmoV_pushValue(state, val);
-                        cosmoV_pushRef(state, (CObj*)obj);
-                        if (cosmoV_call(state, 1, 1) != COSMOVM_OK) // we expect 1 return value on the stack, the iterable object
-                            return -1;
+                if (called == -1)
+                    return -1;
+                if (called) {
+                    state->callFrame[state->frameCount - 1].nextJump = jump;
+                    ENTERFRAME();
+                    continue;
+                }
+
+                if (IS_NIL(*(cosmoV_getTop(state, 0)))) { // __next returned a nil, which means to exit the loop
+                    cosmoV_setTop(state, nresults); // pop the return values
+                    frame->pc += jump;
+                }
+                continue;
+            }
+            case OP_VARARGS: {
+                cosmoV_pushValue(state, *getVarargs(state, frame));
+                continue;
+            }
+            case OP_VARINDEX: {
+                StkPtr key = cosmoV_getTop(state, 0);
+                CValue *local = varargLocal(frame);
 
-                        StkPtr iObj = cosmoV_getTop(state, 0);
+                if (IS_LAZY_VARARGS(*local)) { // the table hasn't been made, so just read from the stack window
+                    CValue val = cosmoV_newNil();
 
-                        if (!IS_OBJECT(*iObj)) {
-                            cosmoV_error(state, "Expected iterable object! '__iter' returned %s, expected <object>!", cosmoV_typeStr(*iObj));
-                            return -1;
-                        }
+                    if (IS_NUMBER(*key)) {
+                        cosmo_Number num = cosmoV_readNumber(*key);
 
-                        // get __next method and place it at the top of the stack
-                        cosmoV_getMethod(state, cosmoV_readRef(*iObj), cosmoV_newRef(state->iStrings[ISTRING_NEXT]), iObj);
-                    } else {
-                        cosmoV_error(state, "Expected iterable object! '__iter' not defined!");
-                        return -1;
+                        if (num >= 0 && num < frame->varargs && (int)num == num)
+                            val = frame->base[(int)num - frame->varargs];
                     }
-                } else if (obj->type == COBJ_TABLE) {
-                    CObjTable *tbl = (CObjTable*)obj;
 
-                    cosmoV_pushRef(state, (CObj*)state->iStrings[ISTRING_RESERVED]); // key
-                    cosmoV_pushRef(state, (CObj*)tbl); // value
+                    *key = val; // replace the key with the value
+                } else {
+                    cosmo_insert(state, 0, *local); // insert the table below the key
+                    if (!getIndex(state))
+                        return -1;
+                }
+                continue;
+            }
+            case OP_VARNEWINDEX: {
+                cosmo_insert(state, 1, *getVarargs(state, frame)); // insert the table below the key & value
+                if (!setIndex(state))
+                    return -1;
+                continue;
+            }
+            case OP_VARINCINDEX: {
+                int8_t inc = READBYTE() - 128; // amount we're incrementing by
+                cosmo_insert(state, 0, *getVarargs(state, frame)); // insert the table below the key
+                if (!incIndex(state, inc))
+                    return -1;
+                continue;
+            }
+            case OP_VARCOUNT: {
+                CValue *local = varargLocal(frame);
 
-                    cosmoV_pushString(state, "__next"); // key
-                    CObjCFunction *tbl_next = cosmoO_newCFunction(state, _tbl__next);
-                    cosmoV_pushRef(state, (CObj*)tbl_next); // value
+                if (IS_LAZY_VARARGS(*local)) {
+                    cosmoV_pushNumber(state, frame->varargs);
+                    continue;
+                }
 
-                    CObjObject *obj = cosmoV_makeObject(state, 2); // pushes the new object to the stack
-                    cosmoO_setUserI(obj, 0); // increment for iterator
+                if (!IS_REF(*local)) {
+                    cosmoV_error(state, "Expected non-primitive, got %s!", cosmoV_typeStr(*local));
+                    return -1;
+                }
 
-                    // make our CObjMethod for OP_NEXT to call
-                    CObjMethod *method = cosmoO_newMethod(state, cosmoV_newRef(tbl_next), (CObj*)obj);
+                cosmoV_pushNumber(state, cosmoO_count(state, cosmoV_readRef(*local)));
+                continue;
+            }
+            case OP_VARITER: {
+                CValue *local = varargLocal(frame);
 
-                    cosmoV_setTop(state, 2); // pops the object & the tbl
-                    cosmoV_pushRef(state, (CObj*)method); // pushes the method for OP_NEXT
+                if (IS_LAZY_VARARGS(*local)) {
+                    cosmoV_pushNumber(state, 0); // OP_NEXT walks the stack window, using this as the index
                 } else {
-                    cosmoV_error(state, "No proto defined! Couldn't get from type %s", cosmoO_typeStr(obj));
-                    return -1;
+                    cosmoV_pushValue(state, *local);
+                    if (!iterValue(state))
+                        return -1;
                 }
-
                 continue;
             }
-            case OP_NEXT: {
-                uint8_t nresults = READBYTE();
-                uint16_t jump = READUINT();
-                StkPtr temp = cosmoV_getTop(state, 0); // we don't actually pop this off the stack
+            case OP_VARCALL:
+            case OP_TAILVARCALL: {
+                bool tail = frame->pc[-1] == OP_TAILVARCALL;
+                SAFEPOINT();
+                uint8_t args = READBYTE();
+                uint8_t nres = READBYTE();
+                CValue *local = varargLocal(frame);
+                int extraArgs;
 
-                if (!IS_METHOD(*temp)) {
-                    cosmoV_error(state, "Expected '__next' to be a method, got type %s!", cosmoV_typeStr(*temp));
+                if (IS_LAZY_VARARGS(*local)) { // push the variadic args straight from the stack window
+                    extraArgs = frame->varargs;
+
+                    for (int i = 0; i < extraArgs; i++)
+                        cosmoV_pushValue(state, frame->base[i - extraArgs]);
+                } else if (IS_TABLE(*local)) { // the table was made (& maybe changed), so expand that instead
+                    CObjTable *tbl = cosmoV_readTable(*local);
+                    CValue val;
+                    extraArgs = cosmoT_count(&tbl->tbl);
+
+                    for (int i = 0; i < extraArgs; i++) {
+                        cosmoT_get(state, &tbl->tbl, cosmoV_newNumber(i), &val);
+                        cosmoV_pushValue(state, val);
+                    }
+                } else {
+                    cosmoV_error(state, "Couldn't expand '...' from type %s!", cosmoV_typeStr(*local));
                     return -1;
                 }
 
-                cosmoV_pushValue(state, *temp);
-                if (cosmoV_call(state, 0, nresults) != COSMOVM_OK)
+                if (state->panic)
                     return -1;
 
-                if (IS_NIL(*(cosmoV_getTop(state, 0)))) { // __next returned a nil, which means to exit the loop
-                    cosmoV_setTop(state, nresults); // pop the return values
-                    frame->pc += jump;
-                }
+                StkPtr callee = cosmoV_getTop(state, args + extraArgs);
+                int called = tail ? tailCall(state, frame, *callee, callee, args + extraArgs, nres, 0, hooked)
+                                  : beginCall(state, *callee, args + extraArgs, nres, 0);
+
+                if (called == -1)
+                    return -1;
+                if (called)
+                    ENTERFRAME();
                 continue;
             }
             case OP_ADD: { // pop 2 values off the stack & try to add them together
@@ -1064,8 +1898,7 @@ int cosmoV_execute(CState *state) {
             case OP_INCGLOBAL: {
                 int8_t inc = READBYTE() - 128; // amount we're incrementing by
                 uint16_t indx = READUINT();
-                CValue ident = constants[indx]; // grabs identifier
-                CValue *val = cosmoT_insert(state, &state->globals->tbl, ident);
+                CValue *val = getGlobal(state, chunk, indx);
 
                 // check that it's a number value
                if (IS_NUMBER(*val)) { 
@@ -1096,51 +1929,8 @@ int cosmoV_execute(CState *state) {
             }
             case OP_INCINDEX: {
                 int8_t inc = READBYTE() - 128; // amount we're incrementing by
-                StkPtr temp = cosmoV_getTop(state, 1); // object should be above the key
-                StkPtr key = cosmoV_getTop(state, 0); // grabs key
-
-                if (!IS_REF(*temp)) {
-                    cosmoV_error(state, "Couldn't index non-indexable type %s!", cosmoV_typeStr(*temp));
-                    return -1;
-                }
-
-                CObj *obj = cosmoV_readRef(*temp);
-                CObjObject *proto = cosmoO_grabProto(obj);
-                CValue val;
-
-                // call __index if the proto was found
-                if (proto != NULL) {
-                    if (cosmoO_indexObject(state, proto, *key, &val)) {
-                        if (!IS_NUMBER(val)) { 
-                            cosmoV_error(state, "Expected number, got %s!", cosmoV_typeStr(val));
-                            return -1;
-                        }
-
-                        cosmoV_pushValue(state, val); // pushes old value onto the stack :)
-
-                        // call __newindex
-                        if (!cosmoO_newIndexObject(state, proto, *key, cosmoV_newNumber(cosmoV_readNumber(val) + inc)))
-                            return -1;   
-                    } else
-                        return -1; // cosmoO_indexObject failed and threw an error
-                } else if (obj->type == COBJ_TABLE) {
-                    CObjTable *tbl = (CObjTable*)obj;
-                    CValue *val = cosmoT_insert(state, &tbl->tbl, *key);
-
-                    if (!IS_NUMBER(*val)) { 
-                        cosmoV_error(state, "Expected number, got %s!", cosmoV_typeStr(*val));
-                        return -1;
-                    }
-
-                    // pops tbl & key from stack
-                    cosmoV_setTop(state, 2);
-                    cosmoV_pushValue(state, *val); // pushes old value onto the stack :)
-                    *val = cosmoV_newNumber(cosmoV_readNumber(*val) + inc); // sets table index
-                } else {
-                    cosmoV_error(state, "No proto defined! Couldn't __index from type %s", cosmoV_typeStr(*temp));
+                if (!incIndex(state, inc))
                     return -1;
-                }
-
                 continue;
             }
             case OP_INCOBJECT: {
@@ -1205,8 +1995,51 @@ int cosmoV_execute(CState *state) {
             case OP_FALSE:  cosmoV_pushBoolean(state, false); continue;
             case OP_NIL:    cosmoV_pushValue(state, cosmoV_newNil()); continue;
             case OP_RETURN: {
-                uint8_t res = READBYTE();
-                return res;
+                SAFEPOINT();
+                if (hooked && (state->hookMask & COSMO_MASK_RETURN)) {
+                    callHook(state, COSMO_HOOK_RETURN, frameLine(frame, frame->pc - 1));
+                    if (state->panic)
+                        return -1;
+                }
+#ifdef VM_STATS_TIMING
+                cosmoV_timeOp(state, -1); // whatever our caller does next isn't part of our last instruction
+#endif
+                int res = READBYTE();
+                if (res > frame->maxResults)
+                    res = frame->maxResults;
+
+                if (state->frameCount - 1 == entry)
+                    return res;
+
+                // we were called inline, so hand the results to our caller ourselves (same as rawCall)
+                int nresults = frame->nresults;
+                int nextJump = frame->nextJump;
+                if (res > nresults)
+                    res = nresults;
+
+                StkPtr results = cosmoV_getTop(state, res - 1);
+                popCallFrame(state, frame->offset);
+
+                for (int i = 0; i < res; i++)
+                    state->top[i] = results[i];
+                state->top += res;
+
+                for (int i = res; i < nresults; i++)
+                    cosmoV_pushValue(state, cosmoV_newNil());
+
+                LOADFRAME();
+
+                // finish off the OP_NEXT that called us, a nil means to exit the loop
+                if (nextJump != -1 && IS_NIL(*(cosmoV_getTop(state, 0)))) {
+                    cosmoV_setTop(state, nresults);
+                    frame->pc += nextJump;
+                }
+
+                if (hooked) { // carry on like the caller's call instruction was the last one the line hook saw
+                    hookLine = frameLine(frame, frame->pc - 1);
+                    hookPc = frame->pc - 1;
+                }
+                continue;
             }
             default:
                 CERROR("unknown opcode!");
@@ -1216,9 +2049,211 @@ int cosmoV_execute(CState *state) {
 
 #undef READBYTE
 #undef READUINT
+#undef SAFEPOINT
+#undef LOADFRAME
+#undef ENTERFRAME
 
     // we'll only reach this is state->panic is true
     return -1;
 }
 
+static int executePlain(CState *state, int entry) {
+    return executeLoop(state, entry, false);
+}
+
+static int executeHooked(CState *state, int entry) {
+    return executeLoop(state, entry, true);
+}
+
+// runs the VM until the callframe at entry returns, returns -1 if panic
+static int execute(CState *state, int entry) {
+    int res;
+
+    state->cDepth++;
+    do {
+        res = state->hookMask != 0 ? executeHooked(state, entry) : executePlain(state, entry);
+    } while (res == EXECUTE_SWITCH);
+    state->cDepth--;
+
+    // an error leaves behind the callframes that were called inline, a yield keeps them around for the next resume
+    if (res == -1 && !state->yielding)
+        state->frameCount = entry + 1;
+
+    return res;
+}
+
+// runs the callframe on top of the call stack, returns -1 if panic
+int cosmoV_execute(CState *state) {
+    if (state->hookMask & COSMO_MASK_CALL) {
+        CCallFrame *frame = &state->callFrame[state->frameCount - 1];
+        callHook(state, COSMO_HOOK_CALL, frameLine(frame, frame->pc));
+
+        if (state->panic)
+            return -1;
+    }
+
+    return execute(state, state->frameCount - 1);
+}
+
 #undef NUMBEROP
+#undef EXECUTE_SWITCH
+#undef FORCEINLINE
+
+// ================================================================ [COROUTINES] ================================================================
+
+typedef struct {
+    CObjCoroutine *co;
+    int args;
+    int nres;
+} ResumeCall;
+
+// runs the coroutine until it yields, returns or throws an error. the state is already running on the coroutine's stack
+static bool runCoroutine(CState *state, void *ud) {
+    ResumeCall *call = (ResumeCall*)ud;
+    CObjCoroutine *co = call->co;
+
+    if (state->frameCount == 0) {
+        // first resume, the closure is at the bottom of the stack with the args right above it
+        CObjClosure *closure = cosmoV_readClosure(state->stack[0]);
+
+        if (!checkArity(state, closure, call->args) || !enterClosure(state, closure, call->args))
+            return false;
+
+        call->nres = cosmoV_execute(state);
+    } else {
+        // the values we were resumed with become the results of the call we yielded from
+        if (call->args > co->wanted)
+            cosmoV_setTop(state, call->args - co->wanted);
+
+        for (int i = call->args; i < co->wanted; i++)
+            cosmoV_pushValue(state, cosmoV_newNil());
+
+        call->nres = execute(state, 0);
+    }
+
+    return call->nres != -1;
+}
+
+// frees the stacks of a dead coroutine, it won't be running on them again
+static void freeStacks(CState *state, CObjCoroutine *co) {
+    cosmoM_freearray(state, CValue, co->ctx.stack, co->ctx.stackSize);
+    cosmoM_freearray(state, CCallFrame, co->ctx.callFrame, co->ctx.frameSize);
+    co->ctx.stack = co->ctx.top = NULL;
+    co->ctx.callFrame = NULL;
+    co->ctx.openUpvalues = NULL;
+    co->ctx.frameCount = 0;
+    co->ctx.stackSize = 0;
+    co->ctx.frameSize = 0;
+}
+
+COSMO_API int cosmoV_resume(CState *state, CObjCoroutine *co, int args) {
+    CObjCoroutine *resumer = state->coroutine;
+    CContext *saved = resumer != NULL ? &resumer->ctx : &state->mainContext;
+    StkPtr argv = state->top - args;
+
+    if (co->status != COROUTINE_SUSPENDED) {
+        cosmoV_error(state, "Cannot resume %s coroutine!", cosmoO_coroutineStatus(co));
+        return -1;
+    }
+
+    // every resume runs the coroutine on top of the C stack
+    if (state->cDepth >= CDEPTH_MAX) {
+        cosmoV_error(state, "Too many nested resumes!");
+        return -1;
+    }
+
+    // leave room for the slots cosmoV_pushValue reserves
+    if ((co->ctx.top - co->ctx.stack) + args >= co->ctx.stackSize - 8) {
+        cosmoV_error(state, "Stack overflow!");
+        return -1;
+    }
+
+    // pop the args & switch over to the coroutine's stack, nothing allocates until the args are copied over
+    state->top = argv;
+    cosmoV_saveContext(state, saved);
+    cosmoV_loadContext(state, &co->ctx);
+    state->coroutine = co;
+
+    if (resumer != NULL)
+        resumer->status = COROUTINE_NORMAL;
+    co->resumer = resumer;
+    co->status = COROUTINE_RUNNING;
+    co->cDepth = state->cDepth + 1; // the dispatch loop enters the VM once more (see execute)
+
+    for (int i = 0; i < args; i++)
+        *(state->top++) = argv[i];
+
+    // running out of memory in the coroutine unwinds to here, we have to switch back either way
+    ResumeCall call = {co, args, 0};
+    bool ok = cosmoV_runProtected(state, state->stack, runCoroutine, &call);
+    StkPtr results = state->top - call.nres;
+    int nres;
+
+    if (state->yielding) {
+        // the values were already pushed onto our stack by cosmoV_yield
+        state->yielding = false;
+        state->panic = false;
+        co->status = COROUTINE_SUSPENDED;
+        nres = co->yielded;
+    } else {
+        // returned or threw an error, either way it's done for
+        co->status = COROUTINE_DEAD;
+        closeUpvalues(state, state->stack);
+        nres = ok ? call.nres : -1;
+    }
+
+    // switch back to whoever resumed us
+    cosmoV_saveContext(state, &co->ctx);
+    cosmoV_loadContext(state, saved);
+    state->coroutine = resumer;
+
+    if (resumer != NULL)
+        resumer->status = COROUTINE_RUNNING;
+    co->resumer = NULL;
+
+    if (co->status == COROUTINE_DEAD) {
+        // the results are still on the coroutine's stack
+        for (int i = 0; i < nres; i++)
+            cosmoV_pushValue(state, results[i]);
+
+        freeStacks(state, co);
+
+        if (state->panic)
+            return -1;
+    }
+
+    return nres;
+}
+
+COSMO_API int cosmoV_yield(CState *state, int nvalues) {
+    CObjCoroutine *co = state->coroutine;
+
+    if (co == NULL) {
+        cosmoV_error(state, "Cannot yield from outside of a coroutine!");
+        return 0;
+    }
+
+    // anything between us & the coroutine's dispatch loop is C code that can't be picked back up later
+    if (state->cDepth != co->cDepth) {
+        cosmoV_error(state, "Cannot yield across a C call boundary!");
+        return 0;
+    }
+
+    CContext *ctx = co->resumer != NULL ? &co->resumer->ctx : &state->mainContext;
+    if ((ctx->top - ctx->stack) + nvalues >= ctx->stackSize - 8) {
+        cosmoV_error(state, "Stack overflow!");
+        return 0;
+    }
+
+    // hand the values straight to whoever resumed us
+    StkPtr values = state->top - nvalues;
+    for (int i = 0; i < nvalues; i++)
+        *(ctx->top++) = values[i];
+    state->top = values;
+
+    // unwind back to cosmoV_resume like an error would, the callframes are left as they are
+    co->yielded = nvalues;
+    state->yielding = true;
+    state->panic = true;
+    return 0;
+}
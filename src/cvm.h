@@ -18,6 +18,38 @@ typedef enum {
 COSMO_API COSMOVMRESULT cosmoV_call(CState *state, int args, int nresults);
 COSMO_API COSMOVMRESULT cosmoV_pcall(CState *state, int args, int nresults);
 
+typedef bool (*CosmoProtectedFn)(CState *state, void *ud);
+
+/*
+    runs fn with a panic point set, if an allocation fails inside of it the stack is cut back to base, the callframes, GC freeze
+    & hook state are put back the way they were and false is returned with state->error set to the out of memory error.
+    otherwise returns whatever fn returned
+*/
+bool cosmoV_runProtected(CState *state, StkPtr base, CosmoProtectedFn fn, void *ud);
+
+// unwinds to the innermost panic point with the out of memory error, exits if there isn't one. doesn't return
+void cosmoV_throwMemory(CState *state);
+
+/*
+    resumes co with # args on the stack (they're popped), the first resume calls the coroutine's closure with them & every
+    resume after that returns them from the cosmoV_yield the coroutine is suspended in. the coroutine runs until it yields or
+    returns, closures it calls are run inline by the VM so it can yield from any depth.
+
+    returns the # of values that were yielded or returned, they're pushed onto the stack. returns -1 if the coroutine threw an
+    error or couldn't be resumed (it isn't suspended), the error is at state->error. a coroutine is dead once it returns or
+    throws an error
+*/
+COSMO_API int cosmoV_resume(CState *state, CObjCoroutine *co, int args);
+
+/*
+    suspends the running coroutine, passing the top # values to whoever resumed it. it's meant to be returned from a C function:
+        return cosmoV_yield(state, nargs);
+    the values the coroutine is later resumed with become that C function's results. yielding throws an error if there's no
+    coroutine running, or if there's C code between the C function & the coroutine's dispatch loop (eg. pcall(), __init, hooks
+    or a cosmoV_call from another C function)
+*/
+COSMO_API int cosmoV_yield(CState *state, int nvalues);
+
 // pushes new object onto the stack & returns a pointer to the new object
 COSMO_API CObjObject* cosmoV_makeObject(CState *state, int pairs);
 COSMO_API void cosmoV_makeTable(CState *state, int pairs);
@@ -36,6 +68,40 @@ COSMO_API void cosmo_insert(CState *state, int indx, CValue val);
 */
 COSMO_API bool cosmoV_registerProtoObject(CState *state, CObjType objType, CObjObject *obj);
 
+/*
+    sets the execution hook, mask is a combination of the COSMO_MASK_* flags:
+        COSMO_MASK_CALL   : fired when a closure is entered, before its first instruction
+        COSMO_MASK_RETURN : fired when a closure is about to return, or is about to be replaced by a tail call
+        COSMO_MASK_LINE   : fired before an instruction on a new line runs, or after a jump back (even to the same line)
+        COSMO_MASK_COUNT  : fired every count instructions
+
+    C functions don't fire call/return events. the hook can throw errors with cosmoV_error, which unwind like any other error.
+    passing a NULL hook or a 0 mask removes the hook. the VM has a separate instrumented loop it switches to while a hook is
+    set, so states without a hook don't pay for them. a hook set while the VM is running takes effect at the next call, return
+    or loop iteration
+*/
+COSMO_API void cosmoV_setHook(CState *state, CosmoHook hook, int mask, int count, void *ud);
+COSMO_API int cosmoV_getHookMask(CState *state);
+
+/*
+    limits for running untrusted scripts, passing 0 removes the limit. they're checked at the VM's safepoints (calls, returns &
+    loop back-jumps), so a script can't spin without hitting one. a step is one of those safepoints, straight-line code between
+    them is bounded by the size of the function so this caps runtime like an instruction count would without having to count
+    every instruction (use a COSMO_MASK_COUNT hook for exact counts). the deadline is checked every LIMIT_CHECK_INTERVAL steps.
+
+    going over a limit throws a catchable error, however it's thrown again at every safepoint until the limit is raised or
+    removed, so a script can't catch its way past one. time spent inside a single C function isn't interrupted
+*/
+COSMO_API void cosmoV_setStepLimit(CState *state, uint64_t steps); // also resets the steps taken
+COSMO_API void cosmoV_setTimeLimit(CState *state, double seconds); // from now
+COSMO_API uint64_t cosmoV_getSteps(CState *state); // steps taken since the step limit was last set
+
+// called by the VM when limitCountdown runs out, returns false if a limit was hit (the error is thrown)
+bool cosmoV_checkLimits(CState *state);
+
+// makes the next safepoint check the limits (used by the allocator when the memory limit is crossed)
+void cosmoV_interruptLimits(CState *state);
+
 /*
     compiles string into a <closure>, if successful, <closure> will be pushed onto the stack otherwise the <error> will be pushed.
 
@@ -45,6 +111,26 @@ COSMO_API bool cosmoV_registerProtoObject(CState *state, CObjType objType, CObjO
 */
 COSMO_API bool cosmoV_compileString(CState *state, const char *src, const char *name);
 
+/*
+    same as cosmoV_compileString, but the source is pulled from reader in blocks while it's being compiled (see CosmoReader),
+    so it never has to be in memory all at once.
+
+    returns:
+        false : <error> is at the top of the stack
+        true  : <closure> is at the top of the stack
+*/
+COSMO_API bool cosmoV_load(CState *state, CosmoReader reader, void *ud, const char *name);
+
+/*
+    makes a <closure> for a proto compiled by cosmoP_compileProto (which can be done on another thread), the proto isn't
+    consumed so it can be loaded into any number of states. if the proto failed to compile, its error is pushed instead.
+
+    returns:
+        false : <error> is at the top of the stack
+        true  : <closure> is at the top of the stack
+*/
+COSMO_API bool cosmoV_loadProto(CState *state, CProto *proto);
+
 /*
     expects object to be pushed, then the key. 
     
@@ -74,9 +160,9 @@ static inline void cosmoV_pushValue(CState *state, CValue val) {
     ptrdiff_t stackSize = state->top - state->stack;
 
     // we reserve 8 slots for the error string and whatever c api we might be in
-    if (stackSize >= STACK_MAX - 8) {
+    if (stackSize >= state->stackSize - 8) {
         if (state->panic) { // we're in a panic state, let the 8 reserved slots be filled
-            if (stackSize < STACK_MAX)
+            if (stackSize < state->stackSize)
                 *(state->top++) = val;
             
             return;
@@ -125,6 +211,11 @@ static inline void cosmoV_pushCFunction(CState *state, CosmoCFunction func) {
     cosmoV_pushRef(state, (CObj*)cosmoO_newCFunction(state, func));
 }
 
+// pushes a leaf C Function to the stack (see cosmoO_newLeafCFunction)
+static inline void cosmoV_pushLeafCFunction(CState *state, CosmoCFunction func, int arity) {
+    cosmoV_pushRef(state, (CObj*)cosmoO_newLeafCFunction(state, func, arity));
+}
+
 // len is the length of the string without the NULL terminator
 static inline void cosmoV_pushLString(CState *state, const char *str, size_t len) {
     cosmoV_pushRef(state, (CObj*)cosmoO_copyString(state, str, len));
@@ -0,0 +1,1024 @@
+#define _GNU_SOURCE // sysconf(_SC_NPROCESSORS_ONLN)
+
+#include "cworker.h"
+#include "cstate.h"
+#include "cvm.h"
+#include "cmem.h"
+#include "cobj.h"
+#include "cproto.h"
+#include "cbaselib.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+// a job or a result, they're plain malloc'd so they can be handed between threads
+typedef struct CMessage {
+    struct CMessage *next; // results are queued in a linked list
+    char *buf; // the serialized value, or the error message if ok is false
+    size_t size;
+    uint64_t id;
+    bool ok;
+} CMessage;
+
+typedef struct CWorker {
+    CWorkerPool *pool;
+    CMessage **jobs; // ring buffer of queued jobs, guarded by lock
+    int head;
+    int count;
+    int capacity;
+    int id;
+    CValue *work; // the work() global's cell, only touched by the worker's thread
+    pthread_mutex_t lock;
+    pthread_t thread;
+} CWorker;
+
+struct CWorkerPool {
+    CWorkerPool *next; // the rest of the state's pools
+    CWorker *workers;
+    int count;
+    int started; // threads that were actually started
+
+    // only touched by the thread running the state that owns the pool
+    int pending;
+    int nextWorker; // round robin
+    uint64_t nextId;
+
+    // the workers only read these, & only while they're starting
+    CProto *proto;
+    CosmoWorkerInit init;
+    void *ud;
+
+    // guards everything below
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // idle workers wait on this for jobs
+    pthread_cond_t done; // the owner waits on this for results (& for the workers to start)
+    CMessage *results;
+    CMessage *resultsTail;
+    char *error; // the first worker that couldn't start's error
+    int errorWorker;
+    int ready; // workers done starting, successfully or not
+    int idle; // workers waiting on wake
+    bool closing;
+};
+
+// ================================================================ [MESSAGES] ================================================================
+
+typedef enum {
+    MSG_NIL,
+    MSG_FALSE,
+    MSG_TRUE,
+    MSG_NUMBER,
+    MSG_STRING, // u32 length, then the bytes
+    MSG_TABLE // u32 # of pairs, then each key & value
+} CMessageTag;
+
+typedef enum {
+    WRITE_OK,
+    WRITE_TYPE, // bad is a value that can't be sent
+    WRITE_DEPTH,
+    WRITE_MEMORY
+} CWriteError;
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t capacity;
+    CWriteError error;
+    CValue bad;
+} CWriter;
+
+typedef struct {
+    const char *buf;
+    size_t size;
+    size_t pos;
+} CReader;
+
+static bool writeBytes(CWriter *w, const void *data, size_t size) {
+    if (w->size + size > w->capacity) {
+        size_t capacity = w->capacity == 0 ? 64 : w->capacity;
+        while (capacity < w->size + size)
+            capacity *= 2;
+
+        char *buf = realloc(w->buf, capacity);
+        if (buf == NULL) {
+            w->error = WRITE_MEMORY;
+            return false;
+        }
+
+        w->buf = buf;
+        w->capacity = capacity;
+    }
+
+    memcpy(w->buf + w->size, data, size);
+    w->size += size;
+    return true;
+}
+
+static bool writeTag(CWriter *w, CMessageTag tag) {
+    uint8_t byte = tag;
+    return writeBytes(w, &byte, sizeof(byte));
+}
+
+static bool writeValue(CWriter *w, CValue val, int depth) {
+    if (IS_NIL(val))
+        return writeTag(w, MSG_NIL);
+
+    if (IS_BOOLEAN(val))
+        return writeTag(w, cosmoV_readBoolean(val) ? MSG_TRUE : MSG_FALSE);
+
+    if (IS_NUMBER(val)) {
+        cosmo_Number num = cosmoV_readNumber(val);
+        return writeTag(w, MSG_NUMBER) && writeBytes(w, &num, sizeof(num));
+    }
+
+    if (IS_STRING(val)) {
+        CObjString *str = cosmoV_readString(val);
+        uint32_t length = str->length;
+        return writeTag(w, MSG_STRING) && writeBytes(w, &length, sizeof(length)) && writeBytes(w, str->str, length);
+    }
+
+    if (IS_TABLE(val)) {
+        CTable *tbl = &cosmoV_readTable(val)->tbl;
+        uint32_t count = 0;
+
+        // tables that contain themselves would go on forever
+        if (depth >= WORKER_DEPTH) {
+            w->error = WRITE_DEPTH;
+            return false;
+        }
+
+        if (!writeTag(w, MSG_TABLE))
+            return false;
+
+        // the count is patched in once we know how many entries are actually in use
+        size_t countPos = w->size;
+        if (!writeBytes(w, &count, sizeof(count)))
+            return false;
+
+        for (int i = 0; i <= tbl->capacityMask; i++) {
+            CTableEntry *entry = &tbl->table[i];
+            if (IS_NIL(entry->key)) // empty or a tombstone
+                continue;
+
+            if (!writeValue(w, entry->key, depth + 1) || !writeValue(w, entry->val, depth + 1))
+                return false;
+
+            count++;
+        }
+
+        memcpy(w->buf + countPos, &count, sizeof(count));
+        return true;
+    }
+
+    w->error = WRITE_TYPE;
+    w->bad = val;
+    return false;
+}
+
+static bool readBytes(CReader *r, void *out, size_t size) {
+    if (r->size - r->pos < size)
+        return false;
+
+    memcpy(out, r->buf + r->pos, size);
+    r->pos += size;
+    return true;
+}
+
+// pushes the next value, returns false if the message is malformed (there might be leftovers on the stack then)
+static bool readValue(CState *state, CReader *r) {
+    uint8_t tag;
+
+    if (!readBytes(r, &tag, sizeof(tag)))
+        return false;
+
+    switch (tag) {
+        case MSG_NIL:
+            cosmoV_pushNil(state);
+            return true;
+        case MSG_FALSE:
+        case MSG_TRUE:
+            cosmoV_pushBoolean(state, tag == MSG_TRUE);
+            return true;
+        case MSG_NUMBER: {
+            cosmo_Number num;
+            if (!readBytes(r, &num, sizeof(num)))
+                return false;
+
+            cosmoV_pushNumber(state, num);
+            return true;
+        }
+        case MSG_STRING: {
+            uint32_t length;
+            if (!readBytes(r, &length, sizeof(length)) || r->size - r->pos < length)
+                return false;
+
+            cosmoV_pushLString(state, r->buf + r->pos, length);
+            r->pos += length;
+            return true;
+        }
+        case MSG_TABLE: {
+            uint32_t count;
+            if (!readBytes(r, &count, sizeof(count)))
+                return false;
+
+            CObjTable *tbl = cosmoO_newTable(state);
+            cosmoV_pushRef(state, (CObj*)tbl);
+
+            for (uint32_t i = 0; i < count; i++) {
+                // the key & value stay on the stack until they're in the table, inserting can trigger a GC
+                if (!readValue(state, r) || !readValue(state, r))
+                    return false;
+
+                // the stack overflowed
+                if (state->panic)
+                    return false;
+
+                CValue key = *cosmoV_getTop(state, 1);
+                CValue val = *cosmoV_getTop(state, 0);
+                if (IS_NIL(key))
+                    return false;
+
+                *cosmoT_insert(state, &tbl->tbl, key) = val;
+                cosmoV_setTop(state, 2);
+            }
+
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+COSMO_API char *cosmoW_serialize(CState *state, CValue val, size_t *size) {
+    CWriter w = {NULL, 0, 0, WRITE_OK};
+
+    if (writeValue(&w, val, 0)) {
+        *size = w.size;
+        return w.buf;
+    }
+
+    free(w.buf);
+    switch (w.error) {
+        case WRITE_TYPE:
+            cosmoV_error(state, "%s can't be sent to a worker, only nil, booleans, numbers, strings & tables can!", cosmoV_typeStr(w.bad));
+            break;
+        case WRITE_DEPTH:
+            cosmoV_error(state, "table is nested too deeply to be sent to a worker (more than %d levels, or it contains itself)!", WORKER_DEPTH);
+            break;
+        default:
+            cosmoV_throwMemory(state);
+            break;
+    }
+
+    return NULL;
+}
+
+COSMO_API bool cosmoW_deserialize(CState *state, const char *buf, size_t size) {
+    CReader r = {buf, size, 0};
+    StkPtr base = state->top;
+
+    if (!readValue(state, &r) || r.pos != size) {
+        state->top = base;
+        if (!state->panic)
+            cosmoV_error(state, "malformed worker message!");
+        return false;
+    }
+
+    return true;
+}
+
+// reported in place of an error we couldn't allocate the message for, it's never freed (see freeString)
+static char outOfMemory[] = "failed to allocate memory!";
+
+// returns NULL if it couldn't be allocated
+static char *copyString(const char *str, size_t length) {
+    char *buf = malloc(length + 1);
+    if (buf == NULL)
+        return NULL;
+
+    memcpy(buf, str, length);
+    buf[length] = '\0';
+    return buf;
+}
+
+// frees an error message, which might be outOfMemory
+static void freeString(char *str) {
+    if (str != outOfMemory)
+        free(str);
+}
+
+static void freeMessage(CMessage *msg) {
+    freeString(msg->buf);
+    free(msg);
+}
+
+// ================================================================ [WORKERS] ================================================================
+
+static bool pushJob(CWorker *worker, CMessage *msg) {
+    pthread_mutex_lock(&worker->lock);
+
+    if (worker->count == worker->capacity) {
+        int capacity = worker->capacity == 0 ? 16 : worker->capacity * 2;
+        CMessage **jobs = malloc(sizeof(CMessage*) * capacity);
+
+        if (jobs == NULL) {
+            pthread_mutex_unlock(&worker->lock);
+            return false;
+        }
+
+        // unwrap the ring while we're at it
+        for (int i = 0; i < worker->count; i++)
+            jobs[i] = worker->jobs[(worker->head + i) % worker->capacity];
+
+        free(worker->jobs);
+        worker->jobs = jobs;
+        worker->head = 0;
+        worker->capacity = capacity;
+    }
+
+    worker->jobs[(worker->head + worker->count++) % worker->capacity] = msg;
+    pthread_mutex_unlock(&worker->lock);
+    return true;
+}
+
+// workers take their own jobs from the front, thieves take from the back
+static CMessage *popJob(CWorker *worker, bool steal) {
+    CMessage *msg = NULL;
+    pthread_mutex_lock(&worker->lock);
+
+    if (worker->count > 0) {
+        if (steal) {
+            msg = worker->jobs[(worker->head + worker->count - 1) % worker->capacity];
+        } else {
+            msg = worker->jobs[worker->head];
+            worker->head = (worker->head + 1) % worker->capacity;
+        }
+
+        worker->count--;
+    }
+
+    pthread_mutex_unlock(&worker->lock);
+    return msg;
+}
+
+// expects pool->lock to be held
+static bool hasJobs(CWorkerPool *pool) {
+    for (int i = 0; i < pool->count; i++) {
+        CWorker *worker = &pool->workers[i];
+
+        pthread_mutex_lock(&worker->lock);
+        int count = worker->count;
+        pthread_mutex_unlock(&worker->lock);
+
+        if (count > 0)
+            return true;
+    }
+
+    return false;
+}
+
+// waits for a job, returns NULL once the pool is closing
+static CMessage *nextJob(CWorker *worker) {
+    CWorkerPool *pool = worker->pool;
+
+    while (true) {
+        CMessage *msg = popJob(worker, false);
+        for (int i = 1; msg == NULL && i < pool->count; i++)
+            msg = popJob(&pool->workers[(worker->id + i) % pool->count], true);
+
+        if (msg != NULL)
+            return msg;
+
+        // submitting only wakes us while holding the lock, so if nothing's queued while we hold it we can't miss the wake up
+        pthread_mutex_lock(&pool->lock);
+        if (pool->closing) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+
+        if (!hasJobs(pool)) {
+            pool->idle++;
+            pthread_cond_wait(&pool->wake, &pool->lock);
+            pool->idle--;
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void postResult(CWorkerPool *pool, CMessage *msg) {
+    msg->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->resultsTail != NULL)
+        pool->resultsTail->next = msg;
+    else
+        pool->results = msg;
+
+    pool->resultsTail = msg;
+    pthread_cond_signal(&pool->done);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static bool errorString(CState *state, void *ud) {
+    CObjString *str = cosmoV_toString(state, state->error->err);
+    *(char**)ud = copyString(str->str, str->length);
+    return *(char**)ud != NULL;
+}
+
+// the message of the error the worker's state just threw, free it with freeString
+static char *errorMessage(CState *state) {
+    char *msg = NULL;
+
+    state->panic = false;
+    if (state->error != state->memError) {
+        cosmoV_pushRef(state, (CObj*)state->error); // keep it around while it's stringified
+        bool ok = cosmoV_runProtected(state, state->top - 1, errorString, &msg);
+        state->panic = false;
+
+        if (ok)
+            return msg;
+    }
+
+    return outOfMemory;
+}
+
+static void loadLib(CState *state, int id, int count);
+
+// runs on the worker's state, loads the libraries & runs the program
+static bool setupWorker(CState *state, void *ud) {
+    CWorker *worker = (CWorker*)ud;
+    CWorkerPool *pool = worker->pool;
+
+    if (pool->init != NULL) {
+        pool->init(state, pool->ud);
+    } else {
+        cosmoB_loadLibrary(state);
+        cosmoB_loadOSLib(state);
+    }
+
+    loadLib(state, worker->id, pool->count);
+
+    if (!cosmoV_loadProto(state, pool->proto) || cosmoV_call(state, 0, 0) != COSMOVM_OK)
+        return false;
+
+    cosmoV_pushString(state, "work");
+    worker->work = cosmoV_getGlobalCell(state, *cosmoV_getTop(state, 0));
+    cosmoV_pop(state);
+
+    if (!IS_CALLABLE(*worker->work)) {
+        cosmoV_error(state, "the program didn't define a work() function!");
+        return false;
+    }
+
+    return true;
+}
+
+typedef struct {
+    CWorker *worker;
+    CMessage *msg;
+} CJobCall;
+
+// calls work() with the job, the job's message is replaced with the result's
+static bool runJob(CState *state, void *ud) {
+    CJobCall *call = (CJobCall*)ud;
+    CMessage *msg = call->msg;
+    size_t size;
+
+    cosmoV_pushValue(state, *call->worker->work);
+    if (!cosmoW_deserialize(state, msg->buf, msg->size) || cosmoV_call(state, 1, 1) != COSMOVM_OK)
+        return false;
+
+    char *buf = cosmoW_serialize(state, *cosmoV_getTop(state, 0), &size);
+    if (buf == NULL)
+        return false;
+
+    free(msg->buf);
+    msg->buf = buf;
+    msg->size = size;
+    return true;
+}
+
+static void *workerMain(void *ud) {
+    CWorker *worker = (CWorker*)ud;
+    CWorkerPool *pool = worker->pool;
+    CState *state = cosmoV_newState();
+    char *error = NULL;
+
+    if (state == NULL)
+        error = outOfMemory;
+    else if (!cosmoV_runProtected(state, state->top, setupWorker, worker))
+        error = errorMessage(state);
+
+    bool ok = error == NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->ready++;
+    if (error != NULL && pool->error == NULL) {
+        pool->error = error;
+        pool->errorWorker = worker->id;
+        error = NULL;
+    }
+    pthread_cond_broadcast(&pool->done);
+    pthread_mutex_unlock(&pool->lock);
+
+    // if any worker failed the pool is closed right away, so there's no need to hang around
+    if (!ok) {
+        freeString(error);
+        if (state != NULL)
+            cosmoV_freeState(state);
+        return NULL;
+    }
+
+    StkPtr base = state->top;
+    CMessage *msg;
+
+    while ((msg = nextJob(worker)) != NULL) {
+        CJobCall call = {worker, msg};
+
+        msg->ok = cosmoV_runProtected(state, base, runJob, &call);
+        if (!msg->ok) {
+            char *error = errorMessage(state);
+            free(msg->buf);
+            msg->buf = error;
+            msg->size = strlen(error);
+        }
+
+        state->top = base;
+        postResult(pool, msg);
+    }
+
+    cosmoV_freeState(state);
+    return NULL;
+}
+
+// ================================================================ [POOLS] ================================================================
+
+COSMO_API CWorkerPool *cosmoW_newPool(CState *state, CProto *proto, int workers, CosmoWorkerInit init, void *ud) {
+    if (proto->error != NULL) {
+        // rethrow the parser error, same as cosmoV_loadProto would
+        cosmoV_pushRef(state, (CObj*)cosmoO_copyString(state, proto->error, proto->errorLength));
+        CObjError *err = cosmoV_throw(state);
+        err->line = proto->errorLine;
+        err->parserError = true;
+        return NULL;
+    }
+
+    if (workers < 1)
+        workers = 1;
+    else if (workers > WORKER_MAX)
+        workers = WORKER_MAX;
+
+    CWorkerPool *pool = calloc(1, sizeof(CWorkerPool));
+    CWorker *list = calloc(workers, sizeof(CWorker));
+    if (pool == NULL || list == NULL) {
+        free(pool);
+        free(list);
+        cosmoV_throwMemory(state);
+        return NULL;
+    }
+
+    pool->workers = list;
+    pool->count = workers;
+    pool->nextId = 1;
+    pool->proto = proto;
+    pool->init = init;
+    pool->ud = ud;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (int i = 0; i < workers; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+        pthread_mutex_init(&pool->workers[i].lock, NULL);
+    }
+
+    // the workers shouldn't take signals meant for us (like the profiler's), they inherit the mask they're started with
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    while (pool->started < workers && pthread_create(&pool->workers[pool->started].thread, NULL, workerMain, &pool->workers[pool->started]) == 0)
+        pool->started++;
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->ready < pool->started)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    pool->proto = NULL;
+
+    // the state owns it from here, so it's still closed if throwing the error below runs out of memory
+    pool->next = state->pools;
+    state->pools = pool;
+
+    if (pool->error != NULL) {
+        cosmoV_error(state, "worker %d failed to start: %s", pool->errorWorker, pool->error);
+        cosmoW_closePool(state, pool);
+        return NULL;
+    }
+
+    if (pool->started < workers) {
+        cosmoV_error(state, "couldn't start worker %d's thread!", pool->started);
+        cosmoW_closePool(state, pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+COSMO_API void cosmoW_closePool(CState *state, CWorkerPool *pool) {
+    // unlink it from the state
+    for (CWorkerPool **curr = &state->pools; *curr != NULL; curr = &(*curr)->next) {
+        if (*curr == pool) {
+            *curr = pool->next;
+            break;
+        }
+    }
+
+    // drop the jobs that haven't started, then wake everyone up so they see we're closing
+    for (int i = 0; i < pool->count; i++) {
+        CMessage *msg;
+        while ((msg = popJob(&pool->workers[i], false)) != NULL)
+            freeMessage(msg);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->closing = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->started; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+
+    for (int i = 0; i < pool->count; i++) {
+        free(pool->workers[i].jobs);
+        pthread_mutex_destroy(&pool->workers[i].lock);
+    }
+
+    while (pool->results != NULL) {
+        CMessage *next = pool->results->next;
+        freeMessage(pool->results);
+        pool->results = next;
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    freeString(pool->error);
+    free(pool->workers);
+    free(pool);
+}
+
+void cosmoW_freePools(CState *state) {
+    while (state->pools != NULL)
+        cosmoW_closePool(state, state->pools);
+}
+
+COSMO_API bool cosmoW_submit(CState *state, CWorkerPool *pool, CValue job, uint64_t *id) {
+    // serializing can throw, so the message isn't allocated until there's nothing left to leak it
+    size_t size;
+    char *buf = cosmoW_serialize(state, job, &size);
+    if (buf == NULL)
+        return false;
+
+    CMessage *msg = malloc(sizeof(CMessage));
+    if (msg == NULL) {
+        free(buf);
+        cosmoV_throwMemory(state);
+        return false;
+    }
+
+    msg->buf = buf;
+    msg->size = size;
+
+    msg->id = pool->nextId++;
+    msg->ok = false;
+
+    if (!pushJob(&pool->workers[pool->nextWorker], msg)) {
+        freeMessage(msg);
+        cosmoV_throwMemory(state);
+        return false;
+    }
+
+    pool->nextWorker = (pool->nextWorker + 1) % pool->count;
+    pool->pending++;
+    *id = msg->id;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->idle > 0)
+        pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    return true;
+}
+
+static CMessage *waitResult(CWorkerPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->results == NULL)
+        pthread_cond_wait(&pool->done, &pool->lock);
+
+    CMessage *msg = pool->results;
+    pool->results = msg->next;
+    if (pool->results == NULL)
+        pool->resultsTail = NULL;
+    pthread_mutex_unlock(&pool->lock);
+
+    pool->pending--;
+    return msg;
+}
+
+static bool readResult(CState *state, void *ud) {
+    CMessage *msg = (CMessage*)ud;
+
+    if (!msg->ok) {
+        cosmoV_error(state, "%s", msg->buf);
+        return false;
+    }
+
+    return cosmoW_deserialize(state, msg->buf, msg->size);
+}
+
+COSMO_API bool cosmoW_receive(CState *state, CWorkerPool *pool, uint64_t *id) {
+    if (pool->pending == 0) {
+        cosmoV_error(state, "there are no jobs to receive!");
+        return false;
+    }
+
+    CMessage *msg = waitResult(pool);
+    *id = msg->id;
+
+    // the message is freed even if we run out of memory rebuilding it
+    bool ok = cosmoV_runProtected(state, state->top, readResult, msg);
+    freeMessage(msg);
+
+    if (!ok && state->error == state->memError)
+        cosmoV_throwMemory(state);
+
+    return ok;
+}
+
+// throws away every pending result
+static void dropResults(CWorkerPool *pool) {
+    while (pool->pending > 0)
+        freeMessage(waitResult(pool));
+}
+
+COSMO_API int cosmoW_pending(CWorkerPool *pool) {
+    return pool->pending;
+}
+
+COSMO_API int cosmoW_size(CWorkerPool *pool) {
+    return pool->count;
+}
+
+COSMO_API int cosmoW_cores() {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores < 1 ? 1 : (int)cores;
+}
+
+// ================================================================ [WORKER.*] ================================================================
+
+static CWorkerPool *readPool(CState *state, const char *name, CValue val) {
+    if (!IS_OBJECT(val) || cosmoO_getUserT(cosmoV_readObject(val)) != WORKER_POOL) {
+        cosmoV_error(state, "%s expected (<pool>), got (%s)!", name, cosmoV_typeStr(val));
+        return NULL;
+    }
+
+    CWorkerPool *pool = cosmoO_getUserP(cosmoV_readObject(val));
+    if (pool == NULL)
+        cosmoV_error(state, "%s called on a closed pool!", name);
+
+    return pool;
+}
+
+// grabs the pool the method was called on, or returns from the method
+#define POOLARG(name, minArgs) \
+    if (nargs < minArgs) { \
+        cosmoV_error(state, name " expected at least %d argument(s), got %d!", minArgs, nargs); \
+        return 0; \
+    } \
+    CWorkerPool *pool = readPool(state, name, args[0]); \
+    if (pool == NULL) \
+        return 0
+
+// <pool>:submit(job)
+int cosmoB_pSubmit(CState *state, int nargs, CValue *args) {
+    POOLARG("<pool>:submit()", 2);
+    uint64_t id;
+
+    if (!cosmoW_submit(state, pool, args[1], &id))
+        return 0;
+
+    cosmoV_pushNumber(state, id);
+    return 1;
+}
+
+// <pool>:receive()
+int cosmoB_pReceive(CState *state, int nargs, CValue *args) {
+    POOLARG("<pool>:receive()", 1);
+    uint64_t id;
+
+    cosmoV_pushNumber(state, 0);
+    if (!cosmoW_receive(state, pool, &id))
+        return 0;
+
+    // the id goes below the result
+    *cosmoV_getTop(state, 1) = cosmoV_newNumber(id);
+    return 2;
+}
+
+// <pool>:map(jobs)
+int cosmoB_pMap(CState *state, int nargs, CValue *args) {
+    POOLARG("<pool>:map()", 2);
+
+    if (!IS_TABLE(args[1])) {
+        cosmoV_typeError(state, "<pool>:map()", "<pool>, <table>", "%s, %s", cosmoV_typeStr(args[0]), cosmoV_typeStr(args[1]));
+        return 0;
+    }
+
+    // results are matched up by id, so anything submitted before would get mixed in
+    if (cosmoW_pending(pool) > 0) {
+        cosmoV_error(state, "<pool>:map() can't be used while jobs are pending!");
+        return 0;
+    }
+
+    CTable *jobs = &cosmoV_readTable(args[1])->tbl;
+    CObjTable *keys = cosmoO_newTable(state); // job id -> key
+    cosmoV_pushRef(state, (CObj*)keys);
+    CObjTable *results = cosmoO_newTable(state);
+    cosmoV_pushRef(state, (CObj*)results);
+
+    for (int i = 0; i <= jobs->capacityMask; i++) {
+        CTableEntry *entry = &jobs->table[i];
+        uint64_t id;
+
+        if (IS_NIL(entry->key))
+            continue;
+
+        if (!cosmoW_submit(state, pool, entry->val, &id)) {
+            dropResults(pool);
+            return 0;
+        }
+
+        *cosmoT_insert(state, &keys->tbl, cosmoV_newNumber(id)) = entry->key;
+    }
+
+    while (cosmoW_pending(pool) > 0) {
+        uint64_t id;
+        CValue key;
+
+        if (!cosmoW_receive(state, pool, &id)) {
+            dropResults(pool);
+            return 0;
+        }
+
+        cosmoT_get(state, &keys->tbl, cosmoV_newNumber(id), &key);
+        *cosmoT_insert(state, &results->tbl, key) = *cosmoV_getTop(state, 0);
+        cosmoV_pop(state);
+    }
+
+    return 1;
+}
+
+// <pool>:pending()
+int cosmoB_pPending(CState *state, int nargs, CValue *args) {
+    POOLARG("<pool>:pending()", 1);
+
+    cosmoV_pushNumber(state, cosmoW_pending(pool));
+    return 1;
+}
+
+// <pool>:size()
+int cosmoB_pSize(CState *state, int nargs, CValue *args) {
+    POOLARG("<pool>:size()", 1);
+
+    cosmoV_pushNumber(state, cosmoW_size(pool));
+    return 1;
+}
+
+// <pool>:close()
+int cosmoB_pClose(CState *state, int nargs, CValue *args) {
+    POOLARG("<pool>:close()", 1);
+
+    cosmoO_setUserP(cosmoV_readObject(args[0]), NULL);
+    cosmoW_closePool(state, pool);
+    return 0;
+}
+
+typedef struct {
+    CProto *proto;
+    int workers;
+    CWorkerPool *pool;
+} CPoolCall;
+
+static bool newPool(CState *state, void *ud) {
+    CPoolCall *call = (CPoolCall*)ud;
+    call->pool = cosmoW_newPool(state, call->proto, call->workers, NULL, NULL);
+    return call->pool != NULL;
+}
+
+// pushes the handle for pool, pools are few & far between so each handle gets its own methods
+static void pushPool(CState *state, CWorkerPool *pool) {
+    const char *identifiers[] = {
+        "submit",
+        "receive",
+        "map",
+        "pending",
+        "size",
+        "close"
+    };
+
+    CosmoCFunction funcs[] = {
+        cosmoB_pSubmit,
+        cosmoB_pReceive,
+        cosmoB_pMap,
+        cosmoB_pPending,
+        cosmoB_pSize,
+        cosmoB_pClose
+    };
+
+    CObjObject *obj = cosmoB_makeLib(state, identifiers, funcs, sizeof(identifiers)/sizeof(identifiers[0]));
+    cosmoO_setUserP(obj, pool);
+    cosmoO_setUserT(obj, WORKER_POOL);
+    cosmoO_lock(obj);
+}
+
+// worker.pool(src, workers)
+int cosmoB_wPool(CState *state, int nargs, CValue *args) {
+    if (nargs < 1 || !IS_STRING(args[0]) || (nargs > 1 && !IS_NUMBER(args[1]))) {
+        cosmoV_typeError(state, "worker.pool()", "<string>, <number>", "%s, %s", nargs > 0 ? cosmoV_typeStr(args[0]) : "<nil>",
+            nargs > 1 ? cosmoV_typeStr(args[1]) : "<nil>");
+        return 0;
+    }
+
+    CPoolCall call = {NULL, nargs > 1 ? (int)cosmoV_readNumber(args[1]) : cosmoW_cores(), NULL};
+    call.proto = cosmoP_compileProto(cosmoV_readCString(args[0]), "worker");
+    if (call.proto == NULL) {
+        cosmoV_throwMemory(state);
+        return 0;
+    }
+
+    // the proto is freed even if we run out of memory making the pool
+    bool ok = cosmoV_runProtected(state, state->top, newPool, &call);
+    cosmoP_freeProto(call.proto);
+
+    if (!ok) {
+        if (state->error == state->memError)
+            cosmoV_throwMemory(state);
+        return 0;
+    }
+
+    pushPool(state, call.pool);
+    return 1;
+}
+
+// worker.cores()
+int cosmoB_wCores(CState *state, int nargs, CValue *args) {
+    cosmoV_pushNumber(state, cosmoW_cores());
+    return 1;
+}
+
+// id is -1 for the state running the script, workers get their id & the size of their pool
+static void loadLib(CState *state, int id, int count) {
+    const char *identifiers[] = {
+        "pool",
+        "cores"
+    };
+
+    CosmoCFunction funcs[] = {
+        cosmoB_wPool,
+        cosmoB_wCores
+    };
+
+    int pairs = sizeof(identifiers)/sizeof(identifiers[0]);
+
+    cosmoV_pushString(state, "worker");
+
+    for (int i = 0; i < pairs; i++) {
+        cosmoV_pushString(state, identifiers[i]);
+        cosmoV_pushCFunction(state, funcs[i]);
+    }
+
+    if (id >= 0) {
+        cosmoV_pushString(state, "id");
+        cosmoV_pushNumber(state, id);
+        cosmoV_pushString(state, "count");
+        cosmoV_pushNumber(state, count);
+        pairs += 2;
+    }
+
+    cosmoV_makeObject(state, pairs);
+
+    // register "worker" to the global table
+    cosmoV_register(state, 1);
+}
+
+COSMO_API void cosmoB_loadWorkerLib(CState *state) {
+    loadLib(state, -1, 0);
+}
@@ -0,0 +1,82 @@
+#ifndef CWORKER_H
+#define CWORKER_H
+
+#include "cosmo.h"
+
+/*
+    worker pools, for spreading work over every core. a state can only be run by one thread at a time, so a pool is a set of
+    worker states, each on its own thread & each loaded with the same program. the program defines a global work(job)
+    function, jobs are handed to whichever worker is free & the results come back to the state that made the pool.
+
+    nothing is shared between states, so jobs & results are serialized into plain malloc'd messages & rebuilt on the other
+    side. only nil, booleans, numbers, strings & tables (of those) can be sent, tables are deep copied (so a cycle or nesting
+    deeper than WORKER_DEPTH is an error).
+
+    every worker has its own job queue. jobs are spread over them round robin, a worker runs the jobs in its own queue first &
+    steals from the back of the others once it's out, so a few slow jobs don't hold up the ones queued behind them. results
+    are received in the order they finish, not the order they were submitted.
+
+    receiving blocks the whole state (the event loop included) until a result is ready, pools are owned by the state that
+    made them & are closed by cosmoV_freeState if they haven't been already
+*/
+
+#define WORKER_MAX      256 // most workers in a pool
+#define WORKER_DEPTH    64 // deepest a table can be nested in a message
+#define WORKER_POOL     0x776b // userT of pool handles ("wk")
+
+// called on each worker's state before the program is run, to load whatever libraries it needs
+typedef void (*CosmoWorkerInit)(CState *state, void *ud);
+
+/*
+    starts a pool of workers (clamped to 1-WORKER_MAX) running proto. if init is NULL the base & os libraries are loaded, the
+    worker library is always loaded (with worker.id set to the worker's index). this waits for every worker to finish running
+    the program, so proto can be freed once it returns. throws an error & returns NULL if proto failed to compile, a thread
+    couldn't be started or any worker's program threw an error (or didn't define work)
+*/
+COSMO_API CWorkerPool *cosmoW_newPool(CState *state, CProto *proto, int workers, CosmoWorkerInit init, void *ud);
+
+// drops jobs that haven't started, waits for the running ones to finish & frees the pool
+COSMO_API void cosmoW_closePool(CState *state, CWorkerPool *pool);
+
+// closes every pool the state still owns, called by cosmoV_freeState
+void cosmoW_freePools(CState *state);
+
+// queues job, throws an error & returns false if it can't be sent. id is set to the job's id (ids start at 1)
+COSMO_API bool cosmoW_submit(CState *state, CWorkerPool *pool, CValue job, uint64_t *id);
+
+/*
+    waits for the next finished job, sets id & pushes its result. if the job threw an error (or its result couldn't be sent)
+    it's rethrown & false is returned, so is waiting with nothing pending
+*/
+COSMO_API bool cosmoW_receive(CState *state, CWorkerPool *pool, uint64_t *id);
+
+// # of jobs submitted that haven't been received yet
+COSMO_API int cosmoW_pending(CWorkerPool *pool);
+
+// # of workers in the pool
+COSMO_API int cosmoW_size(CWorkerPool *pool);
+
+// # of cores online
+COSMO_API int cosmoW_cores();
+
+/*
+    serializes val into a malloc'd buffer (free it with free()), it doesn't touch the state unless val can't be sent, then an
+    error is thrown & NULL is returned
+*/
+COSMO_API char *cosmoW_serialize(CState *state, CValue val, size_t *size);
+
+// pushes the value buf was serialized from, throws an error & returns false if buf is malformed
+COSMO_API bool cosmoW_deserialize(CState *state, const char *buf, size_t size);
+
+/* loads the worker library, including:
+    - worker.pool(src, workers), compiles src & starts a pool running it (workers defaults to the # of cores)
+    - worker.cores()
+    - <pool>:submit(job), returns the job's id
+    - <pool>:receive(), returns the id & result of the next job to finish
+    - <pool>:map(jobs), runs every value in the table jobs & returns a table of the results under the same keys
+    - <pool>:pending(), <pool>:size() & <pool>:close()
+    - worker.id & worker.count, only set on the states inside a pool
+*/
+COSMO_API void cosmoB_loadWorkerLib(CState *state);
+
+#endif
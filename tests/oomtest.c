@@ -0,0 +1,352 @@
+/*
+    fault injection for the out of memory paths. every phase is ran over and over, failing the nth allocation (n counting up
+    from 0) until it gets through without hitting one. after every failure the state has to be back the way it was before the
+    failing call & still be able to run scripts, and once it's freed every byte it got from the allocator has to be given back.
+
+    usage: oomtest [phase ...]
+        runs every phase whose name contains one of the arguments (or all of them)
+*/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cosmo.h"
+#include "cstate.h"
+#include "cvm.h"
+#include "cmem.h"
+#include "cobj.h"
+#include "cproto.h"
+#include "carena.h"
+#include "cbaselib.h"
+
+// sweeps stop here, if a phase still hasn't gotten through by then something is allocating forever
+#define MAX_FAULTS 100000
+
+static const char *script =
+    "local function join(sep, ...parts)\n"
+    "    var out = \"\"\n"
+    "    for (var i = 0; i < #parts; i++) do\n"
+    "        if i > 0 then out = out .. sep end\n"
+    "        out = out .. parts[i]\n"
+    "    end\n"
+    "    return out\n"
+    "end\n"
+    "proto Point\n"
+    "    function __init(self, x, y) self.x = x self.y = y end\n"
+    "    function __tostring(self) return \"(\" .. self.x .. \", \" .. self.y .. \")\" end\n"
+    "end\n"
+    "var points = []\n"
+    "for (var i = 0; i < 16; i++) do points[i] = Point(i, i * 2) end\n"
+    "var names = [\"a\" = \"first\", \"b\" = \"second\"]\n"
+    "local function counter() var n = 0 return function() n++ return n end end\n"
+    "var c = counter() c() c()\n"
+    "var steps = \"\"\n"
+    "for step in coroutine.create(function() for (var i = 0; i < 4; i++) do coroutine.yield(\"step \" .. i) end end) do\n"
+    "    steps = steps .. step\n"
+    "end\n"
+    "var s = join(\", \", tostring(points[3]), names[\"a\"], names[\"b\"], \"x\" .. c())\n";
+
+static int failed = 0;
+
+static void fail(const char *phase, int n, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "[%s] n=%d: ", phase, n);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+    failed++;
+}
+
+// ================================================================ [COUNTING ALLOCATOR] ================================================================
+
+// wraps cosmoM_defaultAlloc so leaks can be spotted without a sanitizer, & so cosmoV_newState itself can be made to fail
+typedef struct {
+    long live; // blocks that haven't been freed yet
+    int faults; // allocations left before they start failing, -1 if they never do
+} Counter;
+
+static void *countingAlloc(void *ud, void *buf, size_t oldSize, size_t newSize) {
+    Counter *counter = (Counter*)ud;
+
+    if (newSize != 0 && buf == NULL) {
+        if (counter->faults == 0)
+            return NULL;
+        else if (counter->faults > 0)
+            counter->faults--;
+    }
+
+    void *newBuf = cosmoM_defaultAlloc(NULL, buf, oldSize, newSize);
+
+    if (buf == NULL && newBuf != NULL)
+        counter->live++;
+    else if (buf != NULL && newSize == 0)
+        counter->live--;
+
+    return newBuf;
+}
+
+// ================================================================ [CHECKS] ================================================================
+
+// the state should be just as it was before the call that ran out of memory (with top results left on the stack)
+static bool checkState(const char *phase, int n, CState *state, int top) {
+    if (state->freezeGC != 0 || state->frameCount != 0 || state->panicPoint != NULL || state->cDepth != 0 ||
+        state->inHook || state->coroutine != NULL || state->yielding || state->stack != state->mainStack) {
+        fail(phase, n, "state wasn't restored (freezeGC=%d, frames=%d)", state->freezeGC, state->frameCount);
+        return false;
+    }
+
+    if (state->top - state->stack != top) {
+        fail(phase, n, "expected %d values on the stack, got %d", top, (int)(state->top - state->stack));
+        return false;
+    }
+
+    return true;
+}
+
+// a failed call should've left the out of memory error behind, anything else means the script itself is broken
+static bool checkError(const char *phase, int n, CState *state) {
+    if (state->error != state->memError) {
+        fail(phase, n, "expected the out of memory error, got:");
+        cosmoV_printError(state, state->error);
+        return false;
+    }
+
+    return true;
+}
+
+// the state should still be good for running the whole script once the allocator is back to normal
+static bool checkRecovered(const char *phase, int n, CState *state) {
+    state->panic = false;
+    state->top = state->stack;
+    cosmoM_collectGarbage(state);
+
+    if (!cosmoV_compileString(state, script, "recover") || cosmoV_pcall(state, 0, 1) != COSMOVM_OK) {
+        fail(phase, n, "state didn't recover:");
+        cosmoV_printError(state, state->error);
+        return false;
+    }
+
+    state->top = state->stack;
+    return true;
+}
+
+static bool checkFreed(const char *phase, int n, Counter *counter) {
+    if (counter->live != 0) {
+        fail(phase, n, "%ld block(s) leaked", counter->live);
+        return false;
+    }
+
+    return true;
+}
+
+// ================================================================ [PHASES] ================================================================
+
+// returns true once n was high enough for the phase to get through without a failure
+typedef bool (*PhaseFunc)(const char *phase, int n);
+
+typedef struct {
+    const char *name;
+    PhaseFunc func;
+} Phase;
+
+static CState *newState(Counter *counter) {
+    counter->live = 0;
+    counter->faults = -1;
+
+    CState *state = cosmoV_newStateEx(countingAlloc, counter);
+    cosmoB_loadLibrary(state);
+    return state;
+}
+
+static bool newStatePhase(const char *phase, int n) {
+    Counter counter = {0, n};
+
+    CState *state = cosmoV_newStateEx(countingAlloc, &counter);
+    if (state == NULL) {
+        checkFreed(phase, n, &counter);
+        return false;
+    }
+
+    counter.faults = -1;
+    cosmoB_loadLibrary(state);
+    checkState(phase, n, state, 0);
+    checkRecovered(phase, n, state);
+    cosmoV_freeState(state);
+    checkFreed(phase, n, &counter);
+    return true;
+}
+
+static bool compilePhase(const char *phase, int n) {
+    Counter counter;
+    CState *state = newState(&counter);
+
+    cosmoM_failAllocations(state, n);
+    bool ok = cosmoV_compileString(state, script, "compile");
+    cosmoM_failAllocations(state, -1);
+
+    // the closure (or the error) is left on the stack either way
+    if (checkState(phase, n, state, 1) && (ok || checkError(phase, n, state)))
+        checkRecovered(phase, n, state);
+
+    cosmoV_freeState(state);
+    checkFreed(phase, n, &counter);
+    return ok;
+}
+
+typedef struct {
+    const char *src;
+    size_t left;
+} ScriptReader;
+
+// hands the script out a few characters at a time, so the lexer's window has to be refilled (and grown) a bunch
+static const char *readScript(CState *state, void *ud, size_t *size) {
+    ScriptReader *reader = (ScriptReader*)ud;
+    size_t n = reader->left < 7 ? reader->left : 7;
+
+    *size = n;
+    reader->src += n;
+    reader->left -= n;
+    return n == 0 ? NULL : reader->src - n;
+}
+
+static bool loadPhase(const char *phase, int n) {
+    Counter counter;
+    CState *state = newState(&counter);
+    ScriptReader reader = {script, strlen(script)};
+
+    cosmoM_failAllocations(state, n);
+    bool ok = cosmoV_load(state, readScript, &reader, "load");
+    cosmoM_failAllocations(state, -1);
+
+    if (checkState(phase, n, state, 1) && (ok || checkError(phase, n, state)))
+        checkRecovered(phase, n, state);
+
+    cosmoV_freeState(state);
+    checkFreed(phase, n, &counter);
+    return ok;
+}
+
+static CProto *proto;
+
+static bool protoPhase(const char *phase, int n) {
+    Counter counter;
+    CState *state = newState(&counter);
+
+    cosmoM_failAllocations(state, n);
+    bool ok = cosmoV_loadProto(state, proto);
+    cosmoM_failAllocations(state, -1);
+
+    if (checkState(phase, n, state, 1) && (ok || checkError(phase, n, state)))
+        checkRecovered(phase, n, state);
+
+    cosmoV_freeState(state);
+    checkFreed(phase, n, &counter);
+    return ok;
+}
+
+static bool pcallPhase(const char *phase, int n) {
+    Counter counter;
+    CState *state = newState(&counter);
+
+    if (!cosmoV_compileString(state, script, "pcall")) {
+        fail(phase, n, "script didn't compile:");
+        cosmoV_printError(state, state->error);
+        cosmoV_freeState(state);
+        return true;
+    }
+
+    cosmoM_failAllocations(state, n);
+    bool ok = cosmoV_pcall(state, 0, 1) == COSMOVM_OK;
+    cosmoM_failAllocations(state, -1);
+
+    if (checkState(phase, n, state, 1) && (ok || checkError(phase, n, state)))
+        checkRecovered(phase, n, state);
+
+    cosmoV_freeState(state);
+    checkFreed(phase, n, &counter);
+    return ok;
+}
+
+// arena states never collect, so the allocations have to fail inside the arena instead of being rescued by a GC
+static bool arenaPhase(const char *phase, int n) {
+    CState *state = cosmoV_newArenaState(0, 0);
+    if (state == NULL) {
+        fail(phase, n, "couldn't make an arena state");
+        return true;
+    }
+
+    cosmoB_loadLibrary(state);
+
+    cosmoM_failAllocations(state, n);
+    bool ok = cosmoV_compileString(state, script, "arena") && cosmoV_pcall(state, 0, 1) == COSMOVM_OK;
+    cosmoM_failAllocations(state, -1);
+
+    // the arena state's GC stays frozen
+    state->freezeGC--;
+    if (checkState(phase, n, state, 1) && (ok || checkError(phase, n, state))) {
+        state->freezeGC++;
+        state->top = state->stack;
+        state->panic = false;
+
+        if (!cosmoV_compileString(state, script, "recover") || cosmoV_pcall(state, 0, 1) != COSMOVM_OK) {
+            fail(phase, n, "arena state didn't recover:");
+            cosmoV_printError(state, state->error);
+        }
+    } else {
+        state->freezeGC++;
+    }
+
+    cosmoV_freeState(state);
+    return ok;
+}
+
+static Phase phases[] = {
+    {"newstate", newStatePhase},
+    {"compile", compilePhase},
+    {"load", loadPhase},
+    {"proto", protoPhase},
+    {"pcall", pcallPhase},
+    {"arena", arenaPhase},
+};
+
+static bool wanted(const char *name, int argc, char **argv) {
+    if (argc < 2)
+        return true;
+
+    for (int i = 1; i < argc; i++) {
+        if (strstr(name, argv[i]) != NULL)
+            return true;
+    }
+
+    return false;
+}
+
+int main(int argc, char **argv) {
+    proto = cosmoP_compileProto(script, "proto");
+    if (proto == NULL) {
+        fprintf(stderr, "couldn't compile the proto\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(phases) / sizeof(Phase); i++) {
+        Phase *phase = &phases[i];
+        if (!wanted(phase->name, argc, argv))
+            continue;
+
+        int before = failed;
+        int n = 0;
+        while (n < MAX_FAULTS && !phase->func(phase->name, n))
+            n++;
+
+        if (n == MAX_FAULTS)
+            fail(phase->name, n, "never got through");
+
+        printf("%-10s %6d faults %s\n", phase->name, n, failed == before ? "ok" : "FAILED");
+    }
+
+    cosmoP_freeProto(proto);
+    return failed == 0 ? 0 : 1;
+}